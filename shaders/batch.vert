@@ -0,0 +1,24 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+
+struct sstDrawData {
+    mat4 model;
+    uint material;
+};
+
+layout(std430, binding = 0) buffer sstDraws {
+    sstDrawData draws[];
+};
+
+uniform mat4 projectionMatrix;
+
+in vec3 in_Position;
+in vec3 in_Normal;
+
+out vec3 pass_Normal;
+
+void main(void) {
+    gl_Position = projectionMatrix * draws[gl_DrawIDARB].model
+                * vec4(in_Position, 1.0);
+    pass_Normal = in_Normal;
+}
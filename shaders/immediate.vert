@@ -0,0 +1,13 @@
+#version 150 core
+
+uniform mat4 projectionMatrix;
+
+in vec3 in_Position;
+in vec4 in_Color;
+
+out vec4 pass_Color;
+
+void main(void) {
+    gl_Position = projectionMatrix * vec4(in_Position, 1.0);
+    pass_Color = in_Color;
+}
@@ -0,0 +1,14 @@
+#version 150 core
+
+uniform mat4 projectionMatrix;
+
+in vec3 in_Position;
+in vec3 in_Normal;
+in mat4 inst_modelMatrix;
+
+out vec3 pass_Normal;
+
+void main(void) {
+    gl_Position = projectionMatrix * inst_modelMatrix * vec4(in_Position, 1.0);
+    pass_Normal = in_Normal;
+}
@@ -0,0 +1,2471 @@
+/*
+ * bench.c
+ * By Steven Smith
+ *
+ * Benchmarks for SST. Run with the names of the benchmarks to run, or with no
+ * arguments to run all of them. Timings are wall-clock and include a glFinish()
+ * per frame, so they measure the whole frame rather than just the submission.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "sst.h"
+
+#define FRAMES 10
+
+static GLfloat positions[] = {  1.0f,  1.0f,  1.0f,
+                                1.0f,  1.0f, -1.0f,
+                               -1.0f,  1.0f, -1.0f,
+                               -1.0f,  1.0f,  1.0f,
+                                1.0f, -1.0f,  1.0f,
+                                1.0f, -1.0f, -1.0f,
+                               -1.0f, -1.0f, -1.0f,
+                               -1.0f, -1.0f,  1.0f };
+
+static GLfloat normals[] = {  0.577f,  0.577f,  0.577f,
+                              0.577f,  0.577f, -0.577f,
+                             -0.577f,  0.577f, -0.577f,
+                             -0.577f,  0.577f,  0.577f,
+                              0.577f, -0.577f,  0.577f,
+                              0.577f, -0.577f, -0.577f,
+                             -0.577f, -0.577f, -0.577f,
+                             -0.577f, -0.577f,  0.577f };
+
+static GLubyte triangles[] = { 3, 2, 1,
+                               1, 2, 5,
+                               2, 6, 5,
+                               4, 5, 6,
+                               7, 4, 6,
+                               2, 3, 7,
+                               7, 6, 2,
+                               1, 5, 4,
+                               4, 7, 3,
+                               4, 3, 0,
+                               0, 1, 4,
+                               3, 1, 0 };
+
+/* Helpers */
+
+/*
+ * Fills in count model matrices laying out small cubes on a square grid in
+ * front of the camera.
+ */
+static GLfloat * generateModelMatrices( int count ) {
+    GLfloat *result;
+    int i, side;
+    result = (GLfloat*)malloc(sizeof(GLfloat) * 16 * count);
+    for( side = 1; side * side < count; side++ );
+    for( i = 0; i < count; i++ ) {
+        sstTranslateMatrix_((GLfloat)(i % side - side / 2),
+                            (GLfloat)(i / side - side / 2),
+                            -(GLfloat)side, &result[i*16]);
+        sstScaleMatrixInto(0.2f, 0.2f, 0.2f, &result[i*16]);
+    }
+    return result;
+}
+
+/*
+ * Generates a unit sphere with the given number of rings and segments, with its
+ * triangles and vertices shuffled the way an unoptimized asset might have them.
+ * Fills in the positions, normals (which are the same thing for a unit sphere)
+ * and indices, and returns the number of vertices.
+ */
+static int generateShuffledSphere( int rings, int segments,
+GLfloat **positionsOut, GLuint **indicesOut, int *i_count ) {
+    GLfloat *pos, theta, phi;
+    GLuint *indices, *remap, tmp;
+    int count, r, s, i, j, k, n;
+    count = (rings + 1) * (segments + 1);
+    pos = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    for( r = 0; r <= rings; r++ ) {
+        phi = (GLfloat)M_PI * r / rings;
+        for( s = 0; s <= segments; s++ ) {
+            theta = 2.0f * (GLfloat)M_PI * s / segments;
+            i = r * (segments + 1) + s;
+            pos[i*3] = sinf(phi) * cosf(theta);
+            pos[i*3 + 1] = cosf(phi);
+            pos[i*3 + 2] = sinf(phi) * sinf(theta);
+        }
+    }
+    indices = (GLuint*)malloc(sizeof(GLuint) * 6 * rings * segments);
+    n = 0;
+    for( r = 0; r < rings; r++ ) {
+        for( s = 0; s < segments; s++ ) {
+            i = r * (segments + 1) + s;
+            indices[n++] = i;
+            indices[n++] = i + 1;
+            indices[n++] = i + segments + 1;
+            indices[n++] = i + 1;
+            indices[n++] = i + segments + 2;
+            indices[n++] = i + segments + 1;
+        }
+    }
+    /* Shuffle the triangles, then the vertices */
+    srand(1);
+    for( i = n / 3 - 1; i > 0; i-- ) {
+        j = rand() % (i + 1);
+        for( k = 0; k < 3; k++ ) {
+            tmp = indices[i*3 + k];
+            indices[i*3 + k] = indices[j*3 + k];
+            indices[j*3 + k] = tmp;
+        }
+    }
+    remap = (GLuint*)malloc(sizeof(GLuint) * count);
+    for( i = 0; i < count; i++ ) {
+        remap[i] = i;
+    }
+    for( i = count - 1; i > 0; i-- ) {
+        j = rand() % (i + 1);
+        tmp = remap[i];
+        remap[i] = remap[j];
+        remap[j] = tmp;
+    }
+    *positionsOut = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    for( i = 0; i < count; i++ ) {
+        for( k = 0; k < 3; k++ ) {
+            (*positionsOut)[remap[i]*3 + k] = pos[i*3 + k];
+        }
+    }
+    for( i = 0; i < n; i++ ) {
+        indices[i] = remap[indices[i]];
+    }
+    free(remap);
+    free(pos);
+    *indicesOut = indices;
+    *i_count = n;
+    return count;
+}
+
+/*
+ * Ends a frame, making sure the GPU has finished all of its work so that the
+ * time taken is attributed to the frame that caused it.
+ */
+static void finishFrame( GLFWwindow window ) {
+    glFinish();
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+}
+
+/* Benchmarks */
+
+/*
+ * Compares drawing many copies of a mesh by setting a uniform per copy against
+ * drawing them with a single instanced draw call.
+ */
+static int benchInstancing( GLFWwindow window ) {
+    static const char *uniformShaders[] = {"shaders/test2.vert",
+                                           "shaders/test2.frag"};
+    static const char *instancedShaders[] = {"shaders/instanced.vert",
+                                             "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000, 1000000 };
+    sstProgram *uniformProgram, *instancedProgram;
+    sstDrawableSet *uniformSet, *instancedSet;
+    sstInstanceBuffer *instances;
+    GLfloat *proj, *models;
+    double start, uniformTime, instancedTime;
+    unsigned int c;
+    int i, frame;
+    uniformProgram = sstNewProgram(uniformShaders, 2);
+    instancedProgram = sstNewProgram(instancedShaders, 2);
+    if( !uniformProgram || !instancedProgram ) {
+        printf("Failed to create programs!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(uniformProgram);
+    sstSetUniformData(uniformProgram, "projectionMatrix", proj);
+    uniformSet = sstDrawableSetElements(uniformProgram, GL_TRIANGLES, 8,
+                                        triangles, GL_UNSIGNED_BYTE, 3 * 12,
+                                        "in_Position", positions,
+                                        "in_Normal", normals);
+    sstActivateProgram(instancedProgram);
+    sstSetUniformData(instancedProgram, "projectionMatrix", proj);
+    instancedSet = sstDrawableSetElements(instancedProgram, GL_TRIANGLES, 8,
+                                          triangles, GL_UNSIGNED_BYTE, 3 * 12,
+                                          "in_Position", positions,
+                                          "in_Normal", normals);
+    printf("%10s %14s %14s %8s\n", "instances", "uniform ms", "instanced ms",
+           "speedup");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        /* One uniform update and one draw call per copy */
+        sstActivateProgram(uniformProgram);
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < counts[c]; i++ ) {
+                sstSetUniformData(uniformProgram, "modelMatrix", &models[i*16]);
+                sstDrawSet(uniformSet);
+            }
+            finishFrame(window);
+        }
+        uniformTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        /* One instance buffer upload and one draw call for every copy */
+        sstActivateProgram(instancedProgram);
+        instances = sstNewInstanceBuffer(instancedProgram, counts[c],
+                                         "inst_modelMatrix", models);
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            sstUpdateInstanceBuffer(instances, counts[c],
+                                    "inst_modelMatrix", models);
+            sstDrawSetInstanced(instancedSet, instances, counts[c]);
+            finishFrame(window);
+        }
+        instancedTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%10d %14.3f %14.3f %7.1fx\n", counts[c], uniformTime,
+               instancedTime, uniformTime / instancedTime);
+        sstFreeInstanceBuffer(instances);
+        free(models);
+    }
+    free(proj);
+    sstFreeDrawableSet(uniformSet);
+    sstFreeDrawableSet(instancedSet);
+    sstFreeProgram(uniformProgram);
+    sstFreeProgram(instancedProgram);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares drawing many copies of a mesh by setting a uniform per copy against
+ * the exact same calls made in deferred mode, where they get merged into
+ * instanced draws.
+ */
+static int benchDeferred( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models;
+    double start, immediateTime, deferredTime;
+    unsigned int c;
+    int i, frame, deferred;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    printf("%10s %14s %14s %8s\n", "draws", "immediate ms", "deferred ms",
+           "speedup");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        immediateTime = deferredTime = 0.0;
+        for( deferred = 0; deferred < 2; deferred++ ) {
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                if( deferred ) {
+                    sstBeginDeferred();
+                }
+                for( i = 0; i < counts[c]; i++ ) {
+                    sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                    sstDrawSet(set);
+                }
+                if( deferred ) {
+                    sstFlushDeferred();
+                }
+                finishFrame(window);
+            }
+            if( deferred ) {
+                deferredTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            }
+            else {
+                immediateTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            }
+        }
+        printf("%10d %14.3f %14.3f %7.1fx\n", counts[c], immediateTime,
+               deferredTime, immediateTime / deferredTime);
+        free(models);
+    }
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+#ifdef GL_SHADER_STORAGE_BUFFER
+/*
+ * Compares the CPU time spent submitting many distinct meshes one draw call at
+ * a time against submitting them as a single multi-draw-indirect batch.
+ */
+static int benchBatch( GLFWwindow window ) {
+    static const char *uniformShaders[] = {"shaders/test2.vert",
+                                           "shaders/test2.frag"};
+    static const char *batchShaders[] = {"shaders/batch.vert",
+                                         "shaders/test2.frag"};
+    static const int counts[] = { 1000, 5000, 20000 };
+    sstProgram *uniformProgram, *batchProgram;
+    sstDrawableSet **uniformSets, **batchSets;
+    sstBatch *batch;
+    GLfloat *proj, *models, scaled[3 * 8];
+    double start, cpu, uniformCpu, uniformFrame, batchCpu, batchFrame;
+    unsigned int c;
+    int i, j, frame;
+    uniformProgram = sstNewProgram(uniformShaders, 2);
+    batchProgram = sstNewProgram(batchShaders, 2);
+    if( !uniformProgram || !batchProgram ) {
+        printf("Failed to create programs!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(uniformProgram);
+    sstSetUniformData(uniformProgram, "projectionMatrix", proj);
+    sstActivateProgram(batchProgram);
+    sstSetUniformData(batchProgram, "projectionMatrix", proj);
+    printf("%8s %12s %12s %12s %12s\n", "meshes", "draw cpu ms",
+           "draw frame ms", "batch cpu ms", "batch frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        /* Every mesh gets its own buffers, as if they were all different */
+        uniformSets = (sstDrawableSet**)malloc(sizeof(sstDrawableSet*) *
+                                               counts[c]);
+        batchSets = (sstDrawableSet**)malloc(sizeof(sstDrawableSet*) *
+                                             counts[c]);
+        for( i = 0; i < counts[c]; i++ ) {
+            for( j = 0; j < 3 * 8; j++ ) {
+                scaled[j] = positions[j] * (1.0f + (i % 7) * 0.1f);
+            }
+            uniformSets[i] = sstDrawableSetElements(uniformProgram,
+                                                    GL_TRIANGLES, 8, triangles,
+                                                    GL_UNSIGNED_BYTE, 3 * 12,
+                                                    "in_Position", scaled,
+                                                    "in_Normal", normals);
+            batchSets[i] = sstDrawableSetElements(batchProgram, GL_TRIANGLES,
+                                                  8, triangles,
+                                                  GL_UNSIGNED_BYTE, 3 * 12,
+                                                  "in_Position", scaled,
+                                                  "in_Normal", normals);
+        }
+        batch = sstNewBatch(batchProgram, GL_TRIANGLES, GL_UNSIGNED_INT, 0);
+        for( i = 0; i < counts[c]; i++ ) {
+            sstBatchAdd(batch, batchSets[i], &models[i*16], 0);
+        }
+        /* One draw call per mesh */
+        sstActivateProgram(uniformProgram);
+        cpu = 0.0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            cpu -= glfwGetTime();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < counts[c]; i++ ) {
+                sstSetUniformData(uniformProgram, "modelMatrix", &models[i*16]);
+                sstDrawSet(uniformSets[i]);
+            }
+            cpu += glfwGetTime();
+            finishFrame(window);
+        }
+        uniformFrame = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        uniformCpu = cpu * 1000.0 / FRAMES;
+        /* One draw call for every mesh. The draws are touched every frame so
+         * that their upload is included. */
+        sstActivateProgram(batchProgram);
+        cpu = 0.0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            cpu -= glfwGetTime();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < counts[c]; i++ ) {
+                sstBatchSetDraw(batch, i, &models[i*16], 0);
+            }
+            sstDrawBatch(batch);
+            cpu += glfwGetTime();
+            finishFrame(window);
+        }
+        batchFrame = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        batchCpu = cpu * 1000.0 / FRAMES;
+        printf("%8d %12.3f %12.3f %12.3f %12.3f\n", counts[c], uniformCpu,
+               uniformFrame, batchCpu, batchFrame);
+        sstFreeBatch(batch);
+        for( i = 0; i < counts[c]; i++ ) {
+            sstFreeDrawableSet(uniformSets[i]);
+            sstFreeDrawableSet(batchSets[i]);
+        }
+        free(uniformSets);
+        free(batchSets);
+        free(models);
+    }
+    free(proj);
+    sstFreeProgram(uniformProgram);
+    sstFreeProgram(batchProgram);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares drawing many meshes one draw call at a time through their vertex
+ * arrays, against the same meshes drawn by a program pulling its vertices out
+ * of their buffers. Half of the meshes have compressed normals, so the pulling
+ * program also covers sets with different layouts.
+ */
+static int benchPulling( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 1000, 5000, 20000 };
+    sstProgram *vaoProgram, *pullProgram, *program;
+    sstDrawableSet **sets;
+    GLfloat *proj, *models, scaled[3 * 8];
+    double start, cpu, times[2][2];
+    unsigned int c;
+    int i, j, frame, pass;
+    vaoProgram = sstNewProgram(shaders, 2);
+    pullProgram = sstNewProgram(shaders, 2);
+    if( !vaoProgram || !pullProgram ) {
+        printf("Failed to create programs!\n");
+        return 1;
+    }
+    if( !sstPullProgram(pullProgram, 0) ) {
+        printf("Failed to build pulling program!\n");
+        return 1;
+    }
+    printf("Renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(vaoProgram);
+    sstSetUniformData(vaoProgram, "projectionMatrix", proj);
+    sstActivateProgram(pullProgram);
+    sstSetUniformData(pullProgram, "projectionMatrix", proj);
+    printf("%8s %12s %12s %12s %12s\n", "meshes", "vao cpu ms",
+           "vao frame ms", "pull cpu ms", "pull frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        /* Every mesh gets its own buffers, as if they were all different */
+        sets = (sstDrawableSet**)malloc(sizeof(sstDrawableSet*) * counts[c]);
+        for( i = 0; i < counts[c]; i++ ) {
+            if( i == counts[c] / 2 ) {
+                sstCompressInput(vaoProgram, "in_Normal", SST_NORMAL, 0.0f);
+            }
+            for( j = 0; j < 3 * 8; j++ ) {
+                scaled[j] = positions[j] * (1.0f + (i % 7) * 0.1f);
+            }
+            sets[i] = sstDrawableSetElements(vaoProgram, GL_TRIANGLES, 8,
+                                             triangles, GL_UNSIGNED_BYTE,
+                                             3 * 12, "in_Position", scaled,
+                                             "in_Normal", normals);
+        }
+        sstCompressInput(vaoProgram, "in_Normal", SST_UNCOMPRESSED, 0.0f);
+        /* The same sets, one draw call per mesh either way */
+        for( pass = 0; pass < 2; pass++ ) {
+            program = pass ? pullProgram : vaoProgram;
+            sstActivateProgram(program);
+            cpu = 0.0;
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                cpu -= glfwGetTime();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for( i = 0; i < counts[c]; i++ ) {
+                    sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                    sstDrawSet(sets[i]);
+                }
+                cpu += glfwGetTime();
+                finishFrame(window);
+            }
+            times[pass][0] = cpu * 1000.0 / FRAMES;
+            times[pass][1] = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        }
+        printf("%8d %12.3f %12.3f %12.3f %12.3f\n", counts[c], times[0][0],
+               times[0][1], times[1][0], times[1][1]);
+        for( i = 0; i < counts[c]; i++ ) {
+            sstFreeDrawableSet(sets[i]);
+        }
+        free(sets);
+        free(models);
+    }
+    free(proj);
+    sstFreeProgram(vaoProgram);
+    sstFreeProgram(pullProgram);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+#endif
+
+/*
+ * Returns the drawable of a set that feeds the named input of a program.
+ */
+static sstDrawable * findDrawable( sstProgram *program, sstDrawableSet *set,
+const char *name ) {
+    int i, j;
+    for( i = 0; i < program->in_count; i++ ) {
+        if( strcmp(program->inputs[i].name, name) != 0 ) {
+            continue;
+        }
+        for( j = 0; j < set->size; j++ ) {
+            if( set->drawables[j].location == program->inputs[i].location ) {
+                return &set->drawables[j];
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Reads the octahedral normals of a torus set back, along with its float
+ * positions, and returns the largest angle in degrees between a decoded normal
+ * and the true normal of the torus at that position.
+ */
+static double octahedralError( sstProgram *program, sstDrawableSet *set,
+GLfloat a ) {
+    sstDrawable *p, *n;
+    GLfloat *pos, *enc, e[2], d[3], c[3], t;
+    GLshort *q;
+    double length, dot, worst;
+    int i, k;
+    p = findDrawable(program, set, "in_Position");
+    n = findDrawable(program, set, "in_Normal");
+    if( !p || !n || p->type != GL_FLOAT ) {
+        return -1.0;
+    }
+    pos = (GLfloat*)malloc(sizeof(GLfloat) * 3 * set->count);
+    enc = (GLfloat*)malloc(sizeof(GLfloat) * 2 * set->count);
+    glBindBuffer(GL_COPY_READ_BUFFER, p->buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0,
+                       sizeof(GLfloat) * 3 * set->count, pos);
+    glBindBuffer(GL_COPY_READ_BUFFER, n->buffer);
+    if( n->type == GL_SHORT ) {
+        q = (GLshort*)malloc(sizeof(GLshort) * 2 * set->count);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0,
+                           sizeof(GLshort) * 2 * set->count, q);
+        for( i = 0; i < 2 * set->count; i++ ) {
+            enc[i] = q[i] < -32767 ? -1.0f : q[i] / 32767.0f;
+        }
+        free(q);
+    }
+    else {
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0,
+                           sizeof(GLfloat) * 2 * set->count, enc);
+    }
+    /* The binds above went around SST */
+    sstInvalidateState();
+    worst = 0.0;
+    for( i = 0; i < set->count; i++ ) {
+        /* Decode as SST_OCTAHEDRAL_GLSL does */
+        e[0] = enc[i*2];
+        e[1] = enc[i*2 + 1];
+        d[2] = 1.0f - fabsf(e[0]) - fabsf(e[1]);
+        t = d[2] < 0.0f ? -d[2] : 0.0f;
+        d[0] = e[0] + (e[0] >= 0.0f ? -t : t);
+        d[1] = e[1] + (e[1] >= 0.0f ? -t : t);
+        /* The true normal points away from the middle of the tube */
+        length = sqrt(pos[i*3] * pos[i*3] + pos[i*3 + 2] * pos[i*3 + 2]);
+        c[0] = pos[i*3] - (GLfloat)(a * pos[i*3] / length);
+        c[1] = pos[i*3 + 1];
+        c[2] = pos[i*3 + 2] - (GLfloat)(a * pos[i*3 + 2] / length);
+        dot = 0.0;
+        for( k = 0; k < 3; k++ ) {
+            dot += (double)d[k] * c[k];
+        }
+        dot /= sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2])
+             * sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+        dot = acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+        worst = dot > worst ? dot : worst;
+    }
+    free(pos);
+    free(enc);
+    return worst;
+}
+
+/*
+ * Uploads a torus with its inputs as floats, compressed to the formats of
+ * sstCompressInput(), and with octahedral normals, reporting the GPU memory of
+ * each. The octahedral torus also goes through the mesh passes, and its
+ * normals are read back and checked against the true normals of the torus.
+ */
+static int benchQuantize( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *octVert[] = {
+        "#version 150 core\n"
+        "uniform mat4 projectionMatrix;\n"
+        "uniform mat4 modelMatrix;\n"
+        "in vec3 in_Position;\n"
+        "in vec2 in_Normal;\n"
+        "out vec3 pass_Normal;\n",
+        SST_OCTAHEDRAL_GLSL,
+        "void main(void) {\n"
+        "    gl_Position = projectionMatrix * modelMatrix\n"
+        "                * vec4(in_Position, 1.0);\n"
+        "    pass_Normal = sstDecodeOctahedral(in_Normal);\n"
+        "}\n" };
+    static const char *octFrag[] = {
+        "#version 150 core\n"
+        "in vec3 pass_Normal;\n"
+        "out vec4 out_Color;\n"
+        "void main(void) {\n"
+        "    out_Color = vec4(pass_Normal, 1.0);\n"
+        "}\n" };
+    static const char *names[] = { "float", "compact", "octahedral" };
+    sstProgram *programs[3];
+    sstDrawableSet *set;
+    GLfloat *positions, *normals;
+    GLuint *indices;
+    GLsizeiptr bytes, floatBytes;
+    double error;
+    int count, i_count, m;
+    programs[0] = sstNewProgram(shaders, 2);
+    programs[1] = sstNewProgram(shaders, 2);
+    programs[2] = sstNewProgramS(octVert, 3, octFrag, 1);
+    if( !programs[0] || !programs[1] || !programs[2] ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    sstCompressInput(programs[1], "in_Position", SST_POSITION_BOUNDED, 0.001f);
+    sstCompressInput(programs[1], "in_Normal", SST_NORMAL, 0.002f);
+    sstCompressInput(programs[2], "in_Normal", SST_OCTAHEDRAL, 0.001f);
+    sstOptimizeMeshes(programs[2], SST_OPTIMIZE_CACHE | SST_OPTIMIZE_FETCH
+                                   | SST_OPTIMIZE_WELD);
+    sstShapeCounts(SST_TORUS, 256, 512, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_TORUS, 256, 512, 10.0f, 3.0f, positions, normals,
+                     NULL, indices, GL_UNSIGNED_INT, 0);
+    printf("%12s %12s %8s %12s\n", "inputs", "GPU bytes", "ratio",
+           "normal deg");
+    floatBytes = 0;
+    for( m = 0; m < 3; m++ ) {
+        set = sstDrawableSetElements(programs[m], GL_TRIANGLES, count, indices,
+                                     GL_UNSIGNED_INT, i_count,
+                                     "in_Position", positions,
+                                     "in_Normal", normals);
+        bytes = sstDrawableSetBytes(set);
+        floatBytes = m == 0 ? bytes : floatBytes;
+        printf("%12s %12ld %8.3f", names[m], (long)bytes,
+               (double)bytes / floatBytes);
+        if( m == 2 ) {
+            error = octahedralError(programs[m], set, 10.0f);
+            printf(" %12.4f\n", error);
+        }
+        else {
+            printf(" %12s\n", "-");
+        }
+        sstFreeDrawableSet(set);
+        sstFreeProgram(programs[m]);
+    }
+    free(positions);
+    free(normals);
+    free(indices);
+    (void)window;
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares drawing a large shuffled mesh as given against the same mesh after
+ * each of the mesh optimization passes, reporting the vertex cache behaviour
+ * along with the frame times.
+ */
+static int benchMeshOptimize( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const GLuint passes[] = { 0, SST_OPTIMIZE_CACHE,
+                                     SST_OPTIMIZE_CACHE | SST_OPTIMIZE_FETCH,
+                                     SST_OPTIMIZE_ALL };
+    static const char *names[] = { "none", "cache", "cache+fetch", "all" };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models, *sphere, acmr, atvr;
+    GLuint *indices;
+    double start, frameTime;
+    unsigned int p;
+    int i, frame, count, i_count;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    count = generateShuffledSphere(256, 512, &sphere, &indices, &i_count);
+    models = generateModelMatrices(64);
+    for( i = 0; i < 64; i++ ) {
+        sstScaleMatrixInto(4.0f, 4.0f, 4.0f, &models[i*16]);
+    }
+    printf("%12s %8s %8s %8s %10s\n", "passes", "ACMR16", "ATVR16", "ACMR32",
+           "frame ms");
+    for( p = 0; p < sizeof(passes) / sizeof(passes[0]); p++ ) {
+        sstOptimizeMeshes(program, passes[p]);
+        set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                     GL_UNSIGNED_INT, i_count,
+                                     "in_Position", sphere,
+                                     "in_Normal", sphere);
+        sstDrawableSetCacheStats(set, 16, &acmr, &atvr);
+        printf("%12s %8.3f %8.3f", names[p], acmr, atvr);
+        sstDrawableSetCacheStats(set, 32, &acmr, &atvr);
+        printf(" %8.3f", acmr);
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < 64; i++ ) {
+                sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                sstDrawSet(set);
+            }
+            finishFrame(window);
+        }
+        frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf(" %10.3f\n", frameTime);
+        sstFreeDrawableSet(set);
+    }
+    free(proj);
+    free(models);
+    free(sphere);
+    free(indices);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares a de-indexed mesh, as it might come from an importer, uploaded as is
+ * against the same mesh welded back together, reporting the vertex count and
+ * GPU memory of each along with the frame times.
+ */
+static int benchWeld( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *names[] = { "arrays", "welded" };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models, *sphere, *flat;
+    GLuint *indices;
+    double start, frameTime;
+    int i, k, w, frame, i_count;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    generateShuffledSphere(128, 256, &sphere, &indices, &i_count);
+    flat = (GLfloat*)malloc(sizeof(GLfloat) * 3 * i_count);
+    for( i = 0; i < i_count; i++ ) {
+        for( k = 0; k < 3; k++ ) {
+            flat[i*3 + k] = sphere[indices[i]*3 + k];
+        }
+    }
+    models = generateModelMatrices(64);
+    for( i = 0; i < 64; i++ ) {
+        sstScaleMatrixInto(4.0f, 4.0f, 4.0f, &models[i*16]);
+    }
+    printf("%8s %10s %8s %12s %10s\n", "mesh", "vertices", "index", "GPU bytes",
+           "frame ms");
+    for( w = 0; w < 2; w++ ) {
+        sstOptimizeMeshes(program, 0);
+        if( w ) {
+            sstWeldMeshes(program, 0.0f);
+        }
+        set = sstDrawableSetArrays(program, GL_TRIANGLES, i_count,
+                                   "in_Position", flat, "in_Normal", flat);
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < 64; i++ ) {
+                sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                sstDrawSet(set);
+            }
+            finishFrame(window);
+        }
+        frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%8s %10d %8s %12ld %10.3f\n", names[w], set->count,
+               set->i_type == GL_UNSIGNED_BYTE ? "ubyte" :
+               set->i_type == GL_UNSIGNED_SHORT ? "ushort" :
+               set->i_type == GL_UNSIGNED_INT ? "uint" : "none",
+               (long)sstDrawableSetBytes(set), frameTime);
+        sstFreeDrawableSet(set);
+    }
+    free(proj);
+    free(models);
+    free(sphere);
+    free(flat);
+    free(indices);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares drawing a field of detailed meshes stretching away from the camera
+ * at full detail against drawing each at the level of detail picked for it,
+ * reporting the triangles drawn along with the frame times.
+ */
+static int benchLOD( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *names[] = { "full", "lod" };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models, *sphere;
+    GLuint *indices;
+    double start, frameTime, triangles;
+    int i, l, frame, count, i_count, side, level;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    count = generateShuffledSphere(128, 256, &sphere, &indices, &i_count);
+    sstOptimizeMeshes(program, SST_OPTIMIZE_CACHE | SST_OPTIMIZE_FETCH);
+    sstGenerateLODs(program, 6, 0.5f);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", sphere,
+                                 "in_Normal", sphere);
+    /* A 32x32 field of spheres, from just in front of the camera out to a few
+     * hundred units away */
+    side = 32;
+    models = (GLfloat*)malloc(sizeof(GLfloat) * 16 * side * side);
+    for( i = 0; i < side * side; i++ ) {
+        sstTranslateMatrix_((GLfloat)(i % side - side / 2) * 8.0f, -4.0f,
+                            -5.0f - (GLfloat)(i / side) * 8.0f,
+                            &models[i*16]);
+    }
+    printf("%6s %14s %10s\n", "mode", "triangles", "frame ms");
+    for( l = 0; l < 2; l++ ) {
+        triangles = 0.0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < side * side; i++ ) {
+                sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                if( l ) {
+                    level = sstDrawSetLOD(set, &models[i*16], proj, 600.0f,
+                                          1.0f);
+                }
+                else {
+                    sstDrawSet(set);
+                    level = 0;
+                }
+                triangles += (level ? set->lods[level - 1].size
+                                    : set->i_size) / 3;
+            }
+            finishFrame(window);
+        }
+        frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%6s %14.0f %10.3f\n", names[l], triangles / FRAMES,
+               frameTime);
+    }
+    free(proj);
+    free(models);
+    free(sphere);
+    free(indices);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Measures frustum culling of a cull list of scattered cubes, reporting how
+ * many objects are tested per microsecond, then compares drawing every cube
+ * against drawing only the visible ones.
+ */
+static int benchCull( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 1000, 10000, 100000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    sstCullList *list;
+    GLfloat *proj, *models;
+    double start, cullTime, allTime, visibleTime;
+    unsigned int c;
+    int i, n, frame, *visible;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    printf("%8s %8s %12s %10s %10s\n", "objects", "visible", "objects/us",
+           "all ms", "culled ms");
+    srand(1);
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        /* Scatter the cubes all around the camera */
+        models = (GLfloat*)malloc(sizeof(GLfloat) * 16 * counts[c]);
+        list = sstNewCullList(counts[c]);
+        visible = (int*)malloc(sizeof(int) * counts[c]);
+        for( i = 0; i < counts[c]; i++ ) {
+            sstTranslateMatrix_((GLfloat)(rand() % 400 - 200),
+                                (GLfloat)(rand() % 400 - 200),
+                                (GLfloat)(rand() % 400 - 200), &models[i*16]);
+            sstCullListAdd(list, set, &models[i*16]);
+        }
+        /* Culling alone, repeated to get a measurable time */
+        n = 0;
+        start = glfwGetTime();
+        for( i = 0; i < 100; i++ ) {
+            n = sstCullFrustum(list, proj, visible);
+        }
+        cullTime = (glfwGetTime() - start) * 1000000.0 / 100;
+        /* Drawing everything */
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < counts[c]; i++ ) {
+                sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                sstDrawSet(set);
+            }
+            finishFrame(window);
+        }
+        allTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        /* Culling, then drawing what's left */
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            n = sstCullFrustum(list, proj, visible);
+            for( i = 0; i < n; i++ ) {
+                sstSetUniformData(program, "modelMatrix",
+                                  &models[visible[i]*16]);
+                sstDrawSet(list->sets[visible[i]]);
+            }
+            finishFrame(window);
+        }
+        visibleTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%8d %8d %12.1f %10.3f %10.3f\n", counts[c], n,
+               counts[c] / cullTime, allTime, visibleTime);
+        sstFreeCullList(list);
+        free(visible);
+        free(models);
+    }
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Measures occlusion culling of a field of cubes, half of which is hidden
+ * behind a wall, with different numbers of rasterizer threads. Reports the
+ * share of frustum visible cubes culled, the CPU cost per frame, and the time
+ * to draw with frustum culling alone against with occlusion culling too.
+ */
+static int benchOcclusion( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int threads[] = { 1, 2, 4 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    sstCullList *list;
+    sstOccluder *occluder;
+    sstOcclusion *occ;
+    GLfloat *proj, *models, wall[16];
+    double start, frustumTime, occludedTime, raster, test;
+    unsigned int t;
+    int i, n, m, frame, count, *visible;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    /* Cubes spread out in front of the camera, a wall over the left half */
+    count = 20000;
+    models = (GLfloat*)malloc(sizeof(GLfloat) * 16 * count);
+    list = sstNewCullList(count);
+    visible = (int*)malloc(sizeof(int) * count);
+    srand(1);
+    for( i = 0; i < count; i++ ) {
+        sstTranslateMatrix_((GLfloat)(rand() % 200 - 100),
+                            (GLfloat)(rand() % 200 - 100),
+                            -(GLfloat)(rand() % 200 + 30), &models[i*16]);
+        sstCullListAdd(list, set, &models[i*16]);
+    }
+    occluder = sstNewOccluder(positions, 8, triangles, GL_UNSIGNED_BYTE, 36);
+    sstTranslateMatrix_(-20.0f, 0.0f, -25.0f, wall);
+    sstScaleMatrixInto(20.0f, 40.0f, 1.0f, wall);
+    /* Frustum culling alone */
+    n = 0;
+    start = glfwGetTime();
+    for( frame = 0; frame < FRAMES; frame++ ) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        n = sstCullFrustum(list, proj, visible);
+        for( i = 0; i < n; i++ ) {
+            sstSetUniformData(program, "modelMatrix", &models[visible[i]*16]);
+            sstDrawSet(set);
+        }
+        sstSetUniformData(program, "modelMatrix", wall);
+        sstDrawSet(set);
+        finishFrame(window);
+    }
+    frustumTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+    printf("%d cubes, %d in the frustum, %.3f ms per frame\n", count, n,
+           frustumTime);
+    printf("%8s %8s %8s %10s %10s %10s\n", "threads", "drawn", "culled",
+           "raster ms", "test ms", "frame ms");
+    /* Then occlusion culling what's left */
+    for( t = 0; t < sizeof(threads) / sizeof(threads[0]); t++ ) {
+        occ = sstNewOcclusion(256, 256, threads[t]);
+        m = 0;
+        raster = test = 0.0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            n = sstCullFrustum(list, proj, visible);
+            sstOcclusionBegin(occ, proj);
+            sstOcclusionAddOccluder(occ, occluder, wall);
+            sstOcclusionRasterize(occ);
+            m = sstOcclusionCull(occ, list, visible, n);
+            raster += occ->raster_ms;
+            test += occ->test_ms;
+            for( i = 0; i < m; i++ ) {
+                sstSetUniformData(program, "modelMatrix",
+                                  &models[visible[i]*16]);
+                sstDrawSet(set);
+            }
+            sstSetUniformData(program, "modelMatrix", wall);
+            sstDrawSet(set);
+            finishFrame(window);
+        }
+        occludedTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%8d %8d %7.1f%% %10.3f %10.3f %10.3f\n", threads[t], m,
+               n ? 100.0 * (n - m) / n : 0.0, raster / FRAMES, test / FRAMES,
+               occludedTime);
+        sstFreeOcclusion(occ);
+    }
+    sstFreeOccluder(occluder);
+    sstFreeCullList(list);
+    free(visible);
+    free(models);
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Casts a screen's worth of pick rays through growing fields of detailed
+ * spheres, one ray at a time and in packets, reporting rays per second. With
+ * BVHs over each set and over the field, the cost should grow with the log of
+ * the number of triangles rather than with the number itself.
+ */
+static int benchRayCast( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int sides[] = { 1, 8, 64 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    sstRayScene *scene;
+    sstRayHit *hits;
+    GLfloat *proj, *sphere, *origins, *dirs, model[16];
+    GLuint *indices;
+    double start, built, single, packet;
+    unsigned int c;
+    int i, count, i_count, rays, side, found;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 1000.0f);
+    count = generateShuffledSphere(128, 256, &sphere, &indices, &i_count);
+    sstBuildBVHs(program, GL_TRUE);
+    start = glfwGetTime();
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", sphere,
+                                 "in_Normal", sphere);
+    built = (glfwGetTime() - start) * 1000.0;
+    printf("%d triangles, set made in %.3f ms\n", i_count / 3, built);
+    /* One ray per pixel of a 256x256 screen */
+    rays = 256 * 256;
+    origins = (GLfloat*)malloc(sizeof(GLfloat) * 3 * rays);
+    dirs = (GLfloat*)malloc(sizeof(GLfloat) * 3 * rays);
+    hits = (sstRayHit*)malloc(sizeof(sstRayHit) * rays);
+    for( i = 0; i < rays; i++ ) {
+        sstPickRay(proj, (i % 256 + 0.5f) / 128.0f - 1.0f,
+                   (i / 256 + 0.5f) / 128.0f - 1.0f, &origins[i*3],
+                   &dirs[i*3]);
+    }
+    printf("%10s %12s %8s %14s %14s\n", "instances", "triangles", "hit",
+           "single Mray/s", "packet Mray/s");
+    for( c = 0; c < sizeof(sides) / sizeof(sides[0]); c++ ) {
+        /* A square of spheres filling the view */
+        side = sides[c];
+        scene = sstNewRayScene(side * side);
+        for( i = 0; i < side * side; i++ ) {
+            sstTranslateMatrix_((i % side - (side - 1) * 0.5f) * 2.5f,
+                                (i / side - (side - 1) * 0.5f) * 2.5f,
+                                -2.5f * side - 2.0f, model);
+            sstRaySceneAdd(scene, set, model);
+        }
+        sstRayCast(scene, origins, dirs, 1.0f, hits);
+        start = glfwGetTime();
+        found = 0;
+        for( i = 0; i < rays; i++ ) {
+            found += sstRayCast(scene, &origins[i*3], &dirs[i*3], 1.0f,
+                                &hits[i]);
+        }
+        single = glfwGetTime() - start;
+        start = glfwGetTime();
+        sstRayCastPacket(scene, origins, dirs, rays, 1.0f, hits);
+        packet = glfwGetTime() - start;
+        printf("%10d %12d %8d %14.2f %14.2f\n", side * side,
+               side * side * (i_count / 3), found, rays / single / 1000000.0,
+               rays / packet / 1000000.0);
+        sstFreeRayScene(scene);
+    }
+    free(origins);
+    free(dirs);
+    free(hits);
+    free(proj);
+    free(sphere);
+    free(indices);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    (void)window;
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Measures generating normals and tangents for a large sphere with different
+ * numbers of threads, reporting millions of triangles per second. The sphere's
+ * triangles are shuffled, the worst case for the per-thread buffers.
+ */
+static int benchNormals( GLFWwindow window ) {
+    static const int threads[] = { 1, 2, 4, 8 };
+    GLfloat *sphere, *normals, *tangents, *texcoords;
+    GLuint *indices;
+    double start, normalTime, tangentTime;
+    unsigned int t;
+    int i, count, i_count;
+    count = generateShuffledSphere(512, 1024, &sphere, &indices, &i_count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    tangents = (GLfloat*)malloc(sizeof(GLfloat) * 4 * count);
+    texcoords = (GLfloat*)malloc(sizeof(GLfloat) * 2 * count);
+    /* Wrap the texture around the sphere by longitude and latitude */
+    for( i = 0; i < count; i++ ) {
+        texcoords[i*2] = atan2f(sphere[i*3 + 2], sphere[i*3]) / (2.0f * M_PI);
+        texcoords[i*2 + 1] = acosf(sphere[i*3 + 1]) / M_PI;
+    }
+    printf("%d triangles\n", i_count / 3);
+    printf("%8s %12s %12s\n", "threads", "normals Mt/s", "tangents Mt/s");
+    for( t = 0; t < sizeof(threads) / sizeof(threads[0]); t++ ) {
+        start = glfwGetTime();
+        sstGenerateNormals(sphere, count, indices, GL_UNSIGNED_INT, i_count,
+                           SST_WEIGHT_AREA | SST_WEIGHT_ANGLE, threads[t],
+                           normals);
+        normalTime = glfwGetTime() - start;
+        start = glfwGetTime();
+        sstGenerateTangents(sphere, normals, texcoords, count, indices,
+                            GL_UNSIGNED_INT, i_count, threads[t], tangents);
+        tangentTime = glfwGetTime() - start;
+        printf("%8d %12.2f %12.2f\n", threads[t],
+               i_count / 3 / normalTime / 1000000.0,
+               i_count / 3 / tangentTime / 1000000.0);
+    }
+    free(sphere);
+    free(indices);
+    free(normals);
+    free(tangents);
+    free(texcoords);
+    (void)window;
+    return 0;
+}
+
+/*
+ * Compares making a large grid set by generating it into arrays and passing
+ * them to sstDrawableSetElements(), against generating it straight into mapped
+ * buffers with sstDrawableSetShape().
+ */
+static int benchShapes( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int sides[] = { 100, 500, 1000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *positions, *normals;
+    GLuint *indices;
+    double start, copyTime, mapTime;
+    unsigned int c;
+    int count, i_count;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    printf("%10s %10s %10s %10s\n", "vertices", "triangles", "copy ms",
+           "mapped ms");
+    for( c = 0; c < sizeof(sides) / sizeof(sides[0]); c++ ) {
+        sstShapeCounts(SST_GRID, sides[c], sides[c], &count, &i_count);
+        /* Through arrays */
+        glFinish();
+        start = glfwGetTime();
+        positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+        normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+        indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+        sstGenerateShape(SST_GRID, sides[c], sides[c], 100.0f, 100.0f,
+                         positions, normals, NULL, indices, GL_UNSIGNED_INT,
+                         0);
+        set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                     GL_UNSIGNED_INT, i_count,
+                                     "in_Position", positions,
+                                     "in_Normal", normals);
+        glFinish();
+        copyTime = (glfwGetTime() - start) * 1000.0;
+        free(positions);
+        free(normals);
+        free(indices);
+        sstFreeDrawableSet(set);
+        /* Straight into mapped buffers */
+        start = glfwGetTime();
+        set = sstDrawableSetShape(program, SST_GRID, sides[c], sides[c],
+                                  100.0f, 100.0f, "in_Position", "in_Normal",
+                                  NULL);
+        glFinish();
+        mapTime = (glfwGetTime() - start) * 1000.0;
+        sstFreeDrawableSet(set);
+        printf("%10d %10d %10.3f %10.3f\n", count, i_count / 3, copyTime,
+               mapTime);
+    }
+    sstFreeProgram(program);
+    (void)window;
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Compares a grid's raw and encoded sizes, the codec's speeds and loading the
+ * grid from arrays against loading it from encoded streams.
+ */
+static int benchCodec( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *positions, *normals, *decoded;
+    GLuint *indices;
+    unsigned char *p_enc, *n_enc, *i_enc;
+    size_t p_size, n_size, i_size, raw;
+    double start, encodeTime, decodeTime, rawTime, encodedTime;
+    int count, i_count, i;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    /* Step 1: Generate and encode the grid */
+    sstShapeCounts(SST_GRID, 500, 500, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    decoded = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_GRID, 500, 500, 100.0f, 100.0f, positions, normals,
+                     NULL, indices, GL_UNSIGNED_INT, 0);
+    p_enc = (unsigned char*)malloc(sstEncodeVerticesBound(count, 12));
+    n_enc = (unsigned char*)malloc(sstEncodeVerticesBound(count, 12));
+    i_enc = (unsigned char*)malloc(sstEncodeIndicesBound(i_count));
+    start = glfwGetTime();
+    p_size = sstEncodeVertices(p_enc, sstEncodeVerticesBound(count, 12),
+                               positions, count, 12);
+    n_size = sstEncodeVertices(n_enc, sstEncodeVerticesBound(count, 12),
+                               normals, count, 12);
+    i_size = sstEncodeIndices(i_enc, sstEncodeIndicesBound(i_count),
+                              GL_TRIANGLES, indices, GL_UNSIGNED_INT, i_count);
+    encodeTime = glfwGetTime() - start;
+    raw = (size_t)count * 24 + (size_t)i_count * sizeof(GLuint);
+    /* Step 2: Decode the positions to memory */
+    start = glfwGetTime();
+    for( i = 0; i < FRAMES; i++ ) {
+        sstDecodeVertices(decoded, count, 12, p_enc, p_size);
+    }
+    decodeTime = (glfwGetTime() - start) / FRAMES;
+    /* Step 3: Load it both ways */
+    glFinish();
+    start = glfwGetTime();
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    glFinish();
+    rawTime = (glfwGetTime() - start) * 1000.0;
+    sstFreeDrawableSet(set);
+    start = glfwGetTime();
+    set = sstDrawableSetEncoded(program, GL_TRIANGLES, count, i_enc, i_size,
+                                i_count, "in_Position", p_enc, p_size,
+                                "in_Normal", n_enc, n_size);
+    glFinish();
+    encodedTime = (glfwGetTime() - start) * 1000.0;
+    if( set ) {
+        sstFreeDrawableSet(set);
+    } else {
+        printf("Failed to load encoded set!\n");
+    }
+    printf("raw %lu bytes, encoded %lu bytes (%.3f), %.2f bytes/triangle\n",
+           (unsigned long)raw, (unsigned long)(p_size + n_size + i_size),
+           (double)(p_size + n_size + i_size) / raw,
+           (double)i_size / (i_count / 3));
+    printf("encode %.1f MB/s, decode %.2f GB/s\n",
+           raw / encodeTime / 1e6, count * 12.0 / decodeTime / 1e9);
+    printf("load from arrays %.3f ms, from encoded %.3f ms\n", rawTime,
+           encodedTime);
+    free(positions);
+    free(normals);
+    free(decoded);
+    free(indices);
+    free(p_enc);
+    free(n_enc);
+    free(i_enc);
+    sstFreeProgram(program);
+    (void)window;
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Writes a grid out as an OBJ file, with one normal shared by every corner as
+ * exporters write it so that the corners need welding, and as a binary PLY
+ * file, then times importing each with more and more threads.
+ */
+static int benchImport( GLFWwindow window ) {
+    static const char *paths[] = { "bench_import.obj", "bench_import.ply" };
+    static const int threads[] = { 1, 2, 4, 8 };
+    sstImportedMesh *mesh;
+    GLfloat *positions, *texcoords;
+    GLuint *indices;
+    GLint face[3];
+    GLubyte three;
+    FILE *file;
+    long sizes[2];
+    double start, elapsed;
+    unsigned int c, t;
+    int count, i_count, i, k, failed;
+    /* Step 1: Write the files */
+    sstShapeCounts(SST_GRID, 500, 500, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    texcoords = (GLfloat*)malloc(sizeof(GLfloat) * 2 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_GRID, 500, 500, 100.0f, 100.0f, positions, NULL,
+                     texcoords, indices, GL_UNSIGNED_INT, 0);
+    file = fopen(paths[0], "w");
+    fprintf(file, "# Bench grid\nvn 0 1 0\n");
+    for( i = 0; i < count; i++ ) {
+        fprintf(file, "v %f %f %f\nvt %f %f\n", positions[i * 3],
+                positions[i * 3 + 1], positions[i * 3 + 2], texcoords[i * 2],
+                texcoords[i * 2 + 1]);
+    }
+    for( i = 0; i < i_count; i += 3 ) {
+        fprintf(file, "f %u/%u/1 %u/%u/1 %u/%u/1\n", indices[i] + 1,
+                indices[i] + 1, indices[i + 1] + 1, indices[i + 1] + 1,
+                indices[i + 2] + 1, indices[i + 2] + 1);
+    }
+    sizes[0] = ftell(file);
+    fclose(file);
+    file = fopen(paths[1], "wb");
+    fprintf(file, "ply\nformat binary_little_endian 1.0\n"
+            "element vertex %d\nproperty float x\nproperty float y\n"
+            "property float z\nelement face %d\n"
+            "property list uchar int vertex_indices\nend_header\n",
+            count, i_count / 3);
+    fwrite(positions, sizeof(GLfloat) * 3, count, file);
+    three = 3;
+    for( i = 0; i < i_count; i += 3 ) {
+        for( k = 0; k < 3; k++ ) {
+            face[k] = (GLint)indices[i + k];
+        }
+        fwrite(&three, 1, 1, file);
+        fwrite(face, sizeof(GLint), 3, file);
+    }
+    sizes[1] = ftell(file);
+    fclose(file);
+    /* Step 2: Import them */
+    failed = 0;
+    printf("%20s %8s %10s %10s\n", "file", "threads", "MB/s", "vertices");
+    for( c = 0; c < 2; c++ ) {
+        for( t = 0; t < sizeof(threads) / sizeof(threads[0]); t++ ) {
+            start = glfwGetTime();
+            mesh = sstImportMesh(paths[c], threads[t]);
+            elapsed = glfwGetTime() - start;
+            if( !mesh ) {
+                failed = 1;
+                continue;
+            }
+            printf("%20s %8d %10.1f %10d\n", paths[c], threads[t],
+                   sizes[c] / elapsed / 1e6, mesh->count);
+            sstFreeImportedMesh(mesh);
+        }
+        remove(paths[c]);
+    }
+    free(positions);
+    free(texcoords);
+    free(indices);
+    (void)window;
+    return failed;
+}
+
+/*
+ * Writes a program and a grid to an asset pack, then compares building them
+ * from shader files and arrays against making them from the mapped pack.
+ */
+static int benchPack( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *path = "bench.pack";
+    sstPackWriter *writer;
+    sstPack *pack;
+    sstProgram *program, *packed;
+    sstDrawableSet *set;
+    GLfloat *positions, *normals;
+    GLuint *indices;
+    double start, fileTime, packTime, arrayTime, mapTime;
+    int count, i_count, failed;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    /* Step 1: Write the pack */
+    sstShapeCounts(SST_GRID, 500, 500, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_GRID, 500, 500, 100.0f, 100.0f, positions, normals,
+                     NULL, indices, GL_UNSIGNED_INT, 0);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    failed = 1;
+    writer = sstNewPackWriter(path);
+    if( writer ) {
+        failed = !sstPackWriteProgram(writer, "test2", shaders, 2);
+        failed = !sstPackWriteSet(writer, "grid", program, set) || failed;
+        failed = !sstClosePackWriter(writer) || failed;
+    }
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    if( failed ) {
+        printf("Failed to write pack!\n");
+        free(positions);
+        free(normals);
+        free(indices);
+        remove(path);
+        return 1;
+    }
+    /* Step 2: Build the program and set from files and arrays */
+    glFinish();
+    start = glfwGetTime();
+    program = sstNewProgram(shaders, 2);
+    glFinish();
+    fileTime = (glfwGetTime() - start) * 1000.0;
+    start = glfwGetTime();
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    glFinish();
+    arrayTime = (glfwGetTime() - start) * 1000.0;
+    sstFreeDrawableSet(set);
+    /* Step 3: Make them from the pack */
+    start = glfwGetTime();
+    pack = sstOpenPack(path);
+    packed = pack ? sstPackProgram(pack, "test2") : NULL;
+    glFinish();
+    packTime = (glfwGetTime() - start) * 1000.0;
+    start = glfwGetTime();
+    set = packed ? sstPackDrawableSet(pack, "grid", packed) : NULL;
+    glFinish();
+    mapTime = (glfwGetTime() - start) * 1000.0;
+    failed = !set;
+    if( set ) {
+        sstFreeDrawableSet(set);
+    }
+    if( packed ) {
+        sstFreeProgram(packed);
+    }
+    if( pack ) {
+        printf("pack %lu bytes, %d entries\n", (unsigned long)pack->size,
+               pack->count);
+        sstClosePack(pack);
+    }
+    printf("program from files %.3f ms, from pack %.3f ms\n", fileTime,
+           packTime);
+    printf("set from arrays %.3f ms, from pack %.3f ms\n", arrayTime,
+           mapTime);
+    remove(path);
+    free(positions);
+    free(normals);
+    free(indices);
+    sstFreeProgram(program);
+    (void)window;
+    return failed || sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Flies past a row of grid tiles streamed from a pack holding four times as
+ * many bytes as the residency budget, with a window of them visible at once,
+ * and reports how even the frame times are.
+ */
+static int benchStream( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *path = "bench_stream.pack";
+    const int tiles = 48, visible = 8, frames_per_tile = 4;
+    sstPackWriter *writer;
+    sstPack *pack;
+    sstResidency *res;
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, model[16], *positions, *normals;
+    GLuint *indices;
+    char name[32], proxy[32];
+    double start, frameTime, total, worst;
+    int i, t, frame, count, i_count, full, proxies, loads, evictions, failed;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    /* Step 1: Pack a tile, with a proxy, under many names */
+    sstShapeCounts(SST_GRID, 150, 150, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_GRID, 150, 150, 10.0f, 10.0f, positions, normals,
+                     NULL, indices, GL_UNSIGNED_INT, 0);
+    sstGenerateLODs(program, 4, 0.25f);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, count, indices,
+                                 GL_UNSIGNED_INT, i_count,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    free(positions);
+    free(normals);
+    free(indices);
+    full = set->i_size;
+    failed = 1;
+    writer = sstNewPackWriter(path);
+    if( writer ) {
+        failed = 0;
+        for( t = 0; t < tiles; t++ ) {
+            sprintf(name, "tile%d", t);
+            sprintf(proxy, "tile%d.proxy", t);
+            failed = !sstPackWriteSet(writer, name, program, set) || failed;
+            failed = !sstPackWriteProxy(writer, proxy, program, set) || failed;
+        }
+        failed = !sstClosePackWriter(writer) || failed;
+    }
+    sstFreeDrawableSet(set);
+    pack = failed ? NULL : sstOpenPack(path);
+    if( !pack ) {
+        printf("Failed to write pack!\n");
+        sstFreeProgram(program);
+        remove(path);
+        return 1;
+    }
+    /* Step 2: Fly past the tiles */
+    res = sstNewResidency(pack, program, pack->size / 4);
+    for( t = 0; t < tiles; t++ ) {
+        sprintf(name, "tile%d", t);
+        sprintf(proxy, "tile%d.proxy", t);
+        sstResidencyAdd(res, name, proxy);
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    total = 0.0;
+    worst = 0.0;
+    proxies = 0;
+    loads = 0;
+    evictions = 0;
+    for( frame = 0; frame < tiles * frames_per_tile; frame++ ) {
+        start = glfwGetTime();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for( i = 0; i < visible; i++ ) {
+            t = (frame / frames_per_tile + i) % tiles;
+            if( !(set = sstResidencyUse(res, t)) ) {
+                continue;
+            }
+            sstTranslateMatrix_(-5.0f, -2.0f,
+                                -10.0f * i - 10.0f
+                                + (GLfloat)(frame % frames_per_tile)
+                                * 10.0f / frames_per_tile, model);
+            sstSetUniformData(program, "modelMatrix", model);
+            sstDrawSet(set);
+            proxies += set->i_size != full;
+        }
+        sstUpdateResidency(res);
+        loads += res->loads;
+        evictions += res->evictions;
+        finishFrame(window);
+        frameTime = (glfwGetTime() - start) * 1000.0;
+        total += frameTime;
+        worst = frameTime > worst ? frameTime : worst;
+    }
+    printf("pack %.1f MB, budget %.1f MB, resident %.1f MB\n",
+           pack->size / 1e6, res->budget / 1e6, res->resident / 1e6);
+    printf("frame %.3f ms, worst %.3f ms\n", total / frame, worst);
+    printf("%d loads, %d evictions, %d of %d draws were proxies\n", loads,
+           evictions, proxies, frame * visible);
+    sstFreeResidency(res);
+    sstClosePack(pack);
+    remove(path);
+    free(proj);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Loads a large grid in the middle of a run of frames, on the render thread
+ * and then through an uploader, and compares the worst frame each way.
+ */
+static int benchAsync( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const char *names[] = { "sync", "async" };
+    const int frames = 60, load = 10, most = 1000;
+    sstProgram *program;
+    sstUploader *up;
+    sstAsyncSet *async;
+    sstDrawableSet *small, *set;
+    GLfloat *proj, *positions, *normals, model[16];
+    GLuint *indices;
+    double start, frameTime, total, worst;
+    int m, frame, ready, count, i_count;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    up = sstNewUploader();
+    if( !up ) {
+        sstFreeProgram(program);
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    sstTranslateMatrix_(-50.0f, -5.0f, -60.0f, model);
+    sstSetUniformData(program, "modelMatrix", model);
+    small = sstDrawableSetShape(program, SST_GRID, 50, 50, 100.0f, 100.0f,
+                                "in_Position", "in_Normal", NULL);
+    sstShapeCounts(SST_GRID, 700, 700, &count, &i_count);
+    positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    indices = (GLuint*)malloc(sizeof(GLuint) * i_count);
+    sstGenerateShape(SST_GRID, 700, 700, 100.0f, 100.0f, positions, normals,
+                     NULL, indices, GL_UNSIGNED_INT, 0);
+    printf("%6s %10s %10s %8s\n", "mode", "frame ms", "worst ms", "ready");
+    for( m = 0; m < 2; m++ ) {
+        set = NULL;
+        async = NULL;
+        ready = -1;
+        total = 0.0;
+        worst = 0.0;
+        /* Keep going until the set is ready, so slow uploads still count */
+        for( frame = 0; frame < frames || (async && frame < most); frame++ ) {
+            start = glfwGetTime();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if( frame == load && m == 0 ) {
+                set = sstDrawableSetElements(program, GL_TRIANGLES, count,
+                                             indices, GL_UNSIGNED_INT,
+                                             i_count, "in_Position",
+                                             positions, "in_Normal",
+                                             normals);
+            }
+            else if( frame == load ) {
+                async = sstDrawableSetElementsAsync(up, program,
+                                                    GL_TRIANGLES, count,
+                                                    indices, GL_UNSIGNED_INT,
+                                                    i_count, "in_Position",
+                                                    positions, "in_Normal",
+                                                    normals);
+            }
+            if( async && (set = sstAsyncSetReady(up, async)) ) {
+                async = NULL;
+            }
+            if( set && ready < 0 ) {
+                ready = frame - load;
+            }
+            sstDrawSet(set ? set : small);
+            finishFrame(window);
+            frameTime = (glfwGetTime() - start) * 1000.0;
+            total += frameTime;
+            worst = frameTime > worst ? frameTime : worst;
+        }
+        printf("%6s %10.3f %10.3f %8d\n", names[m], total / frame, worst,
+               ready);
+        if( set ) {
+            sstFreeDrawableSet(set);
+        }
+        else if( async ) {
+            printf("Set still loading after %d frames!\n", most - load);
+        }
+    }
+    sstFreeUploader(up);
+    free(positions);
+    free(normals);
+    free(indices);
+    free(proj);
+    sstFreeDrawableSet(small);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Draws debug lines the old way, as a tiny set per line made and freed every
+ * frame, then through the immediate mode batcher, up to a million a frame.
+ */
+static int benchImmediate( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/immediate.vert",
+                                    "shaders/immediate.frag"};
+    static const int counts[] = { 10000, 100000, 1000000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *ends, colors[8];
+    double start, frameTime;
+    unsigned int c;
+    int i, frame, draws;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    ends = (GLfloat*)malloc(sizeof(GLfloat) * 6 * counts[2]);
+    srand(7);
+    for( i = 0; i < 6 * counts[2]; i++ ) {
+        ends[i] = (GLfloat)rand() / RAND_MAX * 100.0f - 50.0f;
+        ends[i] -= i % 3 == 2 ? 100.0f : 0.0f;
+    }
+    for( i = 0; i < 8; i++ ) {
+        colors[i] = i % 4 == 1 ? 0.0f : 1.0f;
+    }
+    printf("%8s %10s %8s %10s\n", "mode", "lines", "draws", "frame ms");
+    /* Step 1: A set per line */
+    start = glfwGetTime();
+    for( frame = 0; frame < FRAMES; frame++ ) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for( i = 0; i < counts[0]; i++ ) {
+            set = sstDrawableSetArrays(program, GL_LINES, 2,
+                                       "in_Position", &ends[i * 6],
+                                       "in_Color", colors);
+            sstDrawSet(set);
+            sstFreeDrawableSet(set);
+        }
+        finishFrame(window);
+    }
+    frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+    printf("%8s %10d %8d %10.3f\n", "sets", counts[0], counts[0], frameTime);
+    /* Step 2: Batched */
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        draws = 0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < counts[c]; i++ ) {
+                sstColor(1.0f, (GLfloat)(i & 1), 1.0f, 1.0f);
+                sstLine(&ends[i * 6], &ends[i * 6 + 3]);
+            }
+            draws = sstFlushImmediate();
+            finishFrame(window);
+        }
+        frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        printf("%8s %10d %8d %10.3f\n", "batched", counts[c], draws,
+               frameTime);
+    }
+    sstFreeImmediate();
+    free(ends);
+    free(proj);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+typedef struct {
+    const char *name;
+    int (*run)( GLFWwindow window );
+} benchmark;
+
+/*
+ * Draws many copies of a mesh the way a scene made of separate objects does,
+ * activating the program and drawing the set for each one, with the state
+ * cache skipping the binds that repeat against forgetting it before each copy
+ * so that every bind goes to GL.
+ */
+static int benchState( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models;
+    double start, frameTime;
+    unsigned long hits, misses;
+    unsigned int c;
+    int i, frame, cached;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    printf("%10s %8s %10s %10s %10s\n", "objects", "cache", "hits",
+           "misses", "frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        for( cached = 1; cached >= 0; cached-- ) {
+            sstStateStats(NULL, NULL, GL_TRUE);
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for( i = 0; i < counts[c]; i++ ) {
+                    if( !cached ) {
+                        sstInvalidateState();
+                    }
+                    sstEnable(GL_DEPTH_TEST);
+                    sstActivateProgram(program);
+                    sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                    sstDrawSet(set);
+                }
+                finishFrame(window);
+            }
+            frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            sstStateStats(&hits, &misses, GL_TRUE);
+            printf("%10d %8s %10lu %10lu %10.3f\n", counts[c],
+                   cached ? "on" : "off", hits / FRAMES, misses / FRAMES,
+                   frameTime);
+        }
+        free(models);
+    }
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Draws a scene of objects using two programs and eight sets in scene order,
+ * switching program and vertex array for nearly every object, against the same
+ * calls sorted by the render queue.
+ */
+static int benchQueue( GLFWwindow window ) {
+    static const char *shaders[2][2] = {
+        {"shaders/test2.vert", "shaders/test2.frag"},
+        {"shaders/test2.vert", "shaders/test1.frag"}};
+    static const int counts[] = { 10000, 100000 };
+    sstProgram *programs[2];
+    sstDrawableSet *sets[2][4];
+    GLfloat *proj, *models;
+    double start, frameTime;
+    unsigned long hits, misses;
+    unsigned int c;
+    int i, p, frame, queued, *picks;
+    for( p = 0; p < 2; p++ ) {
+        programs[p] = sstNewProgram(shaders[p], 2);
+        if( !programs[p] ) {
+            printf("Failed to create program!\n");
+            return 1;
+        }
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    for( p = 0; p < 2; p++ ) {
+        sstActivateProgram(programs[p]);
+        sstSetUniformData(programs[p], "projectionMatrix", proj);
+        for( i = 0; i < 4; i++ ) {
+            sets[p][i] = sstDrawableSetShape(programs[p], i, 8, 8, 1.0f, 0.5f,
+                                             "in_Position", "in_Normal",
+                                             NULL);
+        }
+    }
+    printf("%10s %8s %10s %10s\n", "objects", "mode", "gl binds",
+           "frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        picks = (int*)malloc(sizeof(int) * counts[c]);
+        srand(11);
+        for( i = 0; i < counts[c]; i++ ) {
+            picks[i] = rand() % 8;
+        }
+        for( queued = 0; queued < 2; queued++ ) {
+            sstStateStats(NULL, NULL, GL_TRUE);
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                if( queued ) {
+                    sstBeginQueue();
+                }
+                for( i = 0; i < counts[c]; i++ ) {
+                    p = picks[i] / 4;
+                    if( queued ) {
+                        sstQueueMaterial(0, i % 8 == 0);
+                        sstQueueDepth(-models[i * 16 + 14]);
+                    }
+                    sstActivateProgram(programs[p]);
+                    sstSetUniformData(programs[p], "modelMatrix",
+                                      &models[i * 16]);
+                    sstDrawSet(sets[p][picks[i] % 4]);
+                }
+                if( queued ) {
+                    sstFlushQueue();
+                }
+                finishFrame(window);
+            }
+            frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            sstStateStats(&hits, &misses, GL_TRUE);
+            printf("%10d %8s %10lu %10.3f\n", counts[c],
+                   queued ? "queued" : "scene", misses / FRAMES, frameTime);
+        }
+        free(picks);
+        free(models);
+    }
+    sstFreeQueue();
+    free(proj);
+    for( p = 0; p < 2; p++ ) {
+        for( i = 0; i < 4; i++ ) {
+            if( sets[p][i] ) {
+                sstFreeDrawableSet(sets[p][i]);
+            }
+        }
+        sstFreeProgram(programs[p]);
+    }
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Sets every piece of a pipeline's state one call at a time, the way code
+ * without pipelines changes materials.
+ */
+static void setStatePieces( const sstPipelineState *s ) {
+    sstActivateProgram(s->program);
+    if( s->depth_test ) {
+        sstEnable(GL_DEPTH_TEST);
+    }
+    else {
+        sstDisable(GL_DEPTH_TEST);
+    }
+    sstDepthFunc(s->depth_func);
+    sstDepthMask(s->depth_write);
+    if( s->blend ) {
+        sstEnable(GL_BLEND);
+    }
+    else {
+        sstDisable(GL_BLEND);
+    }
+    sstBlendFunc(s->blend_src, s->blend_dst);
+    sstBlendEquation(s->blend_equation);
+    if( s->cull ) {
+        sstEnable(GL_CULL_FACE);
+    }
+    else {
+        sstDisable(GL_CULL_FACE);
+    }
+    sstCullFace(s->cull_face);
+    sstFrontFace(s->front_face);
+    if( s->stencil_test ) {
+        sstEnable(GL_STENCIL_TEST);
+    }
+    else {
+        sstDisable(GL_STENCIL_TEST);
+    }
+    sstStencilFunc(s->stencil_func, s->stencil_ref, s->stencil_mask);
+    sstStencilOp(s->stencil_fail, s->stencil_depth_fail, s->stencil_pass);
+    sstStencilMask(s->stencil_write);
+    sstColorMask(s->color_write[0], s->color_write[1], s->color_write[2],
+                 s->color_write[3]);
+    sstViewport(s->viewport[0], s->viewport[1], s->viewport[2],
+                s->viewport[3]);
+}
+
+/*
+ * Draws objects cycling through eight materials, changing state on every draw,
+ * by setting each piece of state against binding prebuilt pipelines.
+ */
+static int benchPipeline( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    sstPipelineState state;
+    sstPipeline *pipes[8];
+    GLfloat *proj, *models;
+    double start, frameTime;
+    unsigned long hits, misses;
+    unsigned int c;
+    int i, frame, piped;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    /* Opaque, blended and masked materials, with and without culling */
+    for( i = 0; i < 8; i++ ) {
+        sstDefaultPipelineState(&state);
+        state.program = program;
+        state.depth_test = GL_TRUE;
+        state.viewport[2] = 600;
+        state.viewport[3] = 600;
+        state.cull = i & 1 ? GL_TRUE : GL_FALSE;
+        if( i & 2 ) {
+            state.blend = GL_TRUE;
+            state.blend_src = GL_SRC_ALPHA;
+            state.blend_dst = GL_ONE_MINUS_SRC_ALPHA;
+            state.depth_write = GL_FALSE;
+        }
+        if( i & 4 ) {
+            state.stencil_test = GL_TRUE;
+            state.stencil_func = GL_EQUAL;
+            state.stencil_ref = 1;
+        }
+        pipes[i] = sstNewPipeline(&state);
+    }
+    printf("%10s %10s %12s %10s %10s\n", "draws", "mode", "state calls",
+           "gl calls", "frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        for( piped = 0; piped < 2; piped++ ) {
+            sstBindPipeline(NULL);
+            sstStateStats(NULL, NULL, GL_TRUE);
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for( i = 0; i < counts[c]; i++ ) {
+                    if( piped ) {
+                        sstBindPipeline(pipes[i % 8]);
+                    }
+                    else {
+                        setStatePieces(sstGetPipelineState(pipes[i % 8]));
+                    }
+                    sstSetUniformData(program, "modelMatrix", &models[i*16]);
+                    sstDrawSet(set);
+                }
+                finishFrame(window);
+            }
+            frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            sstStateStats(&hits, &misses, GL_TRUE);
+            printf("%10d %10s %12lu %10lu %10.3f\n", counts[c],
+                   piped ? "pipeline" : "pieces", (hits + misses) / FRAMES,
+                   misses / FRAMES, frameTime);
+        }
+        free(models);
+    }
+    sstBindPipeline(NULL);
+    for( i = 0; i < 8; i++ ) {
+        sstFreePipeline(pipes[i]);
+    }
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/* A share of the scene for one thread to record */
+typedef struct {
+    sstCommandList *list;
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *models;
+    int first; /* First object */
+    int count; /* Number of objects */
+    GLfloat angle;
+} record_job;
+
+/*
+ * Spins each object of a job about its own axis and draws it, recording the
+ * calls if the job has a list and making them directly if not.
+ */
+static void * recordObjects( void *arg ) {
+    record_job *job;
+    GLfloat spin[16], model[16];
+    int i;
+    job = (record_job*)arg;
+    for( i = job->first; i < job->first + job->count; i++ ) {
+        sstRotateMatrixY_(job->angle + (GLfloat)i * 0.01f, spin);
+        sstMatMult4_(&job->models[i*16], spin, model);
+        if( job->list ) {
+            sstRecordUniform(job->list, job->program, "modelMatrix", model);
+            sstRecordDraw(job->list, job->set);
+        }
+        else {
+            sstSetUniformData(job->program, "modelMatrix", model);
+            sstDrawSet(job->set);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Draws a scene of spinning objects with the calls made directly, against the
+ * scene split between threads that each record a command list, executed in
+ * order once they are all done.
+ */
+static int benchCommands( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000 };
+    static const int threads[] = { 0, 1, 2, 4, 8 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    sstCommandList *lists[8];
+    record_job jobs[8];
+    pthread_t ids[8];
+    GLfloat *proj, *models;
+    double start, recorded, frameTime, recordTime;
+    unsigned int c, t;
+    int i, n, frame;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                 GL_UNSIGNED_BYTE, 3 * 12,
+                                 "in_Position", positions,
+                                 "in_Normal", normals);
+    for( i = 0; i < 8; i++ ) {
+        lists[i] = sstNewCommandList();
+    }
+    printf("%10s %8s %10s %10s\n", "objects", "threads", "record ms",
+           "frame ms");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        for( t = 0; t < sizeof(threads) / sizeof(threads[0]); t++ ) {
+            n = threads[t] ? threads[t] : 1;
+            for( i = 0; i < n; i++ ) {
+                jobs[i].list = threads[t] ? lists[i] : NULL;
+                jobs[i].program = program;
+                jobs[i].set = set;
+                jobs[i].models = models;
+                jobs[i].first = counts[c] * i / n;
+                jobs[i].count = counts[c] * (i + 1) / n - jobs[i].first;
+            }
+            recordTime = 0.0;
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                recorded = glfwGetTime();
+                for( i = 0; i < n; i++ ) {
+                    jobs[i].angle = (GLfloat)frame * 0.1f;
+                    if( !threads[t] ) {
+                        recordObjects(&jobs[i]);
+                        continue;
+                    }
+                    sstResetCommandList(lists[i]);
+                    pthread_create(&ids[i], NULL, recordObjects, &jobs[i]);
+                }
+                if( threads[t] ) {
+                    for( i = 0; i < n; i++ ) {
+                        pthread_join(ids[i], NULL);
+                    }
+                    recordTime += glfwGetTime() - recorded;
+                    sstExecuteCommandLists(lists, n);
+                }
+                finishFrame(window);
+            }
+            frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            if( threads[t] ) {
+                printf("%10d %8d %10.3f %10.3f\n", counts[c], threads[t],
+                       recordTime * 1000.0 / FRAMES, frameTime);
+            }
+            else {
+                printf("%10d %8s %10s %10.3f\n", counts[c], "direct", "-",
+                       frameTime);
+            }
+        }
+        free(models);
+    }
+    for( i = 0; i < 8; i++ ) {
+        sstFreeCommandList(lists[i]);
+    }
+    free(proj);
+    sstFreeDrawableSet(set);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Clears the screen, for handing to the render thread.
+ */
+static void clearScreen( void *arg ) {
+    (void)arg;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+/*
+ * Waits for the GPU, for handing to the render thread.
+ */
+static void finishGPU( void *arg ) {
+    (void)arg;
+    glFinish();
+}
+
+/*
+ * Draws a scene of spinning objects with the calls made on the main thread,
+ * against the calls handed to the render thread. Reports how long the main
+ * thread is kept busy each frame as well as how long frames take.
+ */
+static int benchRender( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/test2.vert", "shaders/test2.frag"};
+    static const int counts[] = { 10000, 100000 };
+    sstProgram *program;
+    sstDrawableSet *set;
+    GLfloat *proj, *models, spin[16], model[16];
+    double start, busy, mainTime, frameTime;
+    size_t most;
+    unsigned long waits;
+    unsigned int c;
+    int i, frame, threaded;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 5000.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    printf("%10s %8s %10s %10s %10s %8s\n", "objects", "mode", "main ms",
+           "frame ms", "ring KB", "waits");
+    for( c = 0; c < sizeof(counts) / sizeof(counts[0]); c++ ) {
+        models = generateModelMatrices(counts[c]);
+        for( threaded = 0; threaded < 2; threaded++ ) {
+            if( threaded ) {
+                sstStartRenderThread(window, 4 << 20);
+            }
+            /* Built anew each time, to include uploads in the frames */
+            set = sstDrawableSetElements(program, GL_TRIANGLES, 8, triangles,
+                                         GL_UNSIGNED_BYTE, 3 * 12,
+                                         "in_Position", positions,
+                                         "in_Normal", normals);
+            sstActivateProgram(program);
+            sstRenderStats(NULL, NULL, NULL, NULL, GL_TRUE);
+            busy = 0.0;
+            start = glfwGetTime();
+            for( frame = 0; frame < FRAMES; frame++ ) {
+                busy -= glfwGetTime();
+                sstRenderCall(clearScreen, NULL);
+                for( i = 0; i < counts[c]; i++ ) {
+                    sstRotateMatrixY_((GLfloat)frame * 0.1f
+                                      + (GLfloat)i * 0.01f, spin);
+                    sstMatMult4_(&models[i*16], spin, model);
+                    sstSetUniformData(program, "modelMatrix", model);
+                    sstDrawSet(set);
+                }
+                if( threaded ) {
+                    sstRenderCall(finishGPU, NULL);
+                    sstRenderSwap();
+                    busy += glfwGetTime();
+                    glfwPollEvents();
+                }
+                else {
+                    busy += glfwGetTime();
+                    finishFrame(window);
+                }
+            }
+            sstFreeDrawableSet(set);
+            sstRenderFinish();
+            frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+            mainTime = busy * 1000.0 / FRAMES;
+            sstRenderStats(NULL, NULL, &most, &waits, GL_FALSE);
+            if( threaded ) {
+                sstStopRenderThread();
+                printf("%10d %8s %10.3f %10.3f %10lu %8lu\n", counts[c],
+                       "thread", mainTime, frameTime,
+                       (unsigned long)(most >> 10), waits);
+            }
+            else {
+                printf("%10d %8s %10.3f %10.3f %10s %8s\n", counts[c],
+                       "direct", mainTime, frameTime, "-", "-");
+            }
+        }
+        free(models);
+    }
+    free(proj);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+/*
+ * Streams lines through immediate mode each frame, waiting for the GPU at the
+ * end of every frame against letting it fall one, two or three frames behind
+ * with the frames' transient data. Reports how long frames take, and how often
+ * and for how long a frame had to wait on the one that last used its slot.
+ */
+static int benchFrames( GLFWwindow window ) {
+    static const char *shaders[] = {"shaders/immediate.vert",
+                                    "shaders/immediate.frag"};
+    static const int lines = 100000;
+    sstProgram *program;
+    sstFrames *frames;
+    GLfloat *proj, *ends, end[3];
+    double start, frameTime, waited;
+    unsigned long waits;
+    int i, frame, inFlight, behind;
+    program = sstNewProgram(shaders, 2);
+    if( !program ) {
+        printf("Failed to create program!\n");
+        return 1;
+    }
+    proj = sstPerspectiveMatrix(60.0f, 1.0f, 1.0f, 500.0f);
+    sstActivateProgram(program);
+    sstSetUniformData(program, "projectionMatrix", proj);
+    ends = (GLfloat*)malloc(sizeof(GLfloat) * 6 * lines);
+    srand(7);
+    for( i = 0; i < 6 * lines; i++ ) {
+        ends[i] = (GLfloat)rand() / RAND_MAX * 100.0f - 50.0f;
+        ends[i] -= i % 3 == 2 ? 100.0f : 0.0f;
+    }
+    printf("%8s %10s %8s %10s %8s\n", "frames", "frame ms", "waits",
+           "wait ms", "behind");
+    for( inFlight = 0; inFlight <= 3; inFlight++ ) {
+        /* Room for a frame's lines, at 16 bytes a vertex */
+        frames = inFlight ? sstNewFrames(inFlight, 32 * lines) : NULL;
+        sstImmediateFrames(frames);
+        behind = 0;
+        start = glfwGetTime();
+        for( frame = 0; frame < FRAMES; frame++ ) {
+            if( frames ) {
+                sstBeginFrame(frames);
+            }
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for( i = 0; i < lines; i++ ) {
+                /* Move one end of each line so every frame's data differs */
+                end[0] = ends[i * 6 + 3] + (GLfloat)(frame % 10);
+                end[1] = ends[i * 6 + 4];
+                end[2] = ends[i * 6 + 5];
+                sstColor(1.0f, (GLfloat)(i & 1), 1.0f, 1.0f);
+                sstLine(&ends[i * 6], end);
+            }
+            sstFlushImmediate();
+            if( frames ) {
+                sstEndFrame(frames);
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+                i = sstFramesBehind(frames);
+                behind = i > behind ? i : behind;
+            }
+            else {
+                finishFrame(window);
+            }
+        }
+        glFinish();
+        frameTime = (glfwGetTime() - start) * 1000.0 / FRAMES;
+        if( frames ) {
+            sstFrameStats(frames, &waits, &waited, GL_TRUE);
+            printf("%8d %10.3f %8lu %10.3f %8d\n", inFlight, frameTime,
+                   waits, waited / FRAMES, behind);
+            sstImmediateFrames(NULL);
+            sstFreeFrames(frames);
+        }
+        else {
+            printf("%8s %10.3f %8s %10s %8s\n", "finish", frameTime, "-",
+                   "-", "-");
+        }
+    }
+    sstFreeImmediate();
+    free(ends);
+    free(proj);
+    sstFreeProgram(program);
+    return sstDisplayErrors() != GL_NO_ERROR;
+}
+
+static const benchmark benchmarks[] = {
+    { "instancing", benchInstancing },
+    { "deferred",   benchDeferred },
+#ifdef GL_SHADER_STORAGE_BUFFER
+    { "batch",      benchBatch },
+    { "pulling",    benchPulling },
+#endif
+    { "quantize",   benchQuantize },
+    { "optimize",   benchMeshOptimize },
+    { "weld",       benchWeld },
+    { "lod",        benchLOD },
+    { "cull",       benchCull },
+    { "occlusion",  benchOcclusion },
+    { "raycast",    benchRayCast },
+    { "normals",    benchNormals },
+    { "shapes",     benchShapes },
+    { "codec",      benchCodec },
+    { "import",     benchImport },
+    { "pack",       benchPack },
+    { "stream",     benchStream },
+    { "async",      benchAsync },
+    { "immediate",  benchImmediate },
+    { "state",      benchState },
+    { "queue",      benchQueue },
+    { "pipeline",   benchPipeline },
+    { "commands",   benchCommands },
+    { "render",     benchRender },
+    { "frames",     benchFrames },
+};
+
+static const int benchmark_count = sizeof(benchmarks) / sizeof(benchmark);
+
+/* Setup */
+
+GLFWwindow initialize() {
+    GLFWwindow window;
+    /* Hard-coded values for now */
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    window = glfwCreateWindow(600, 600, GLFW_WINDOWED, "SST Benchmark", NULL);
+    if( window == NULL ) {
+        printf("Failed to open window!\n");
+        printf("Error: %s\n", glfwErrorString(glfwGetError()));
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    /* Don't let vsync cap the frame times */
+    glfwSwapInterval(0);
+    sstEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, 600, 600);
+    return window;
+}
+
+int main( int argc, char **argv ) {
+    GLFWwindow window;
+    int i, j, result;
+    if( !glfwInit() ) {
+        printf("Failed to init GLFW!\n");
+        exit(EXIT_FAILURE);
+    }
+    window = initialize();
+    if( !window ) {
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+    result = 0;
+    for( i = 0; i < benchmark_count; i++ ) {
+        /* No arguments -> run everything */
+        for( j = 1; j < argc; j++ ) {
+            if( strcmp(argv[j], benchmarks[i].name) == 0 ) {
+                break;
+            }
+        }
+        if( argc > 1 && j == argc ) {
+            continue;
+        }
+        printf("== %s ==\n", benchmarks[i].name);
+        if( benchmarks[i].run(window) ) {
+            printf("Benchmark %s failed!\n", benchmarks[i].name);
+            result = 1;
+        }
+        printf("\n");
+    }
+    sstFreeStateCaches();
+    glfwTerminate();
+    if( result ) {
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+    return 0;
+}
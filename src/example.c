@@ -50,6 +50,7 @@ int main( void ) {
     sstProgram *program;
     GLFWwindow window;
     sstDrawableSet *set;
+    sstFrames *frames;
 
     if( (window = initialize()) == NULL ) {
         exit(EXIT_FAILURE);
@@ -71,7 +72,10 @@ int main( void ) {
 
     glViewport(0, 0, 600, 600);
 
+    /* Let the CPU get up to two frames ahead of the GPU */
+    frames = sstNewFrames(2, 0);
     while( 1 ) {
+        sstBeginFrame(frames);
         glClear(GL_COLOR_BUFFER_BIT);
 
         sstDrawSet(set);
@@ -80,7 +84,7 @@ int main( void ) {
             break;
         }
 
-        glFlush();
+        sstEndFrame(frames);
         glfwSwapBuffers(window);
         glfwPollEvents();
         if( glfwGetKey(window, GLFW_KEY_ESC)
@@ -88,6 +92,7 @@ int main( void ) {
             break;
         }
     }
+    sstFreeFrames(frames);
 
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -84,6 +84,7 @@ static GLfloat * generateNormals( GLfloat *verts ) {
 int main( void ) {
     sstProgram *program;
     sstDrawableSet *set;
+    sstFrames *frames;
     GLFWwindow window;
     GLfloat *verts, *norms, *proj, *rotY, *rotX, *trans, *scale;
 
@@ -98,6 +99,9 @@ int main( void ) {
         exit(EXIT_FAILURE);
     }
 
+    /* The cube is de-indexed, so let SST find the shared vertices again */
+    sstWeldMeshes(program, 0.0f);
+
     /* Set up data */
     verts = generateVertices();
     norms = generateNormals(verts);
@@ -121,7 +125,10 @@ int main( void ) {
 
     glViewport(0, 0, 600, 600);
 
+    /* Let the CPU get up to two frames ahead of the GPU */
+    frames = sstNewFrames(2, 0);
     while( 1 ) {
+        sstBeginFrame(frames);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         sstDrawSet(set);
@@ -130,7 +137,7 @@ int main( void ) {
             break;
         }
 
-        glFlush();
+        sstEndFrame(frames);
         glfwSwapBuffers(window);
         glfwPollEvents();
         if( glfwGetKey(window, GLFW_KEY_ESC)
@@ -138,6 +145,7 @@ int main( void ) {
             break;
         }
     }
+    sstFreeFrames(frames);
 
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -83,7 +83,8 @@ GLfloat *dy ) {
     *dy += (y * cosRot) + (x * sinRot);
 }
 
-int mainLoop( GLFWwindow window, sstProgram *program, sstDrawableSet *set ) {
+int mainLoop( GLFWwindow window, sstProgram *program, sstDrawableSet *set,
+sstFrames *frames ) {
     GLfloat model[16], temp[16];
     GLfloat x, y, rotx, roty, dx, dy;
     int mX, mY, mXl, mYl;
@@ -93,6 +94,7 @@ int mainLoop( GLFWwindow window, sstProgram *program, sstDrawableSet *set ) {
     mX = mY = mXl = mYl = -1;
     rotx = roty = 0.0f;
     while( 1 ) {
+        sstBeginFrame(frames);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         /* Update the look-at values */
         rotx += ((GLfloat) (mX - mXl)) / 25.0f;
@@ -116,7 +118,7 @@ int mainLoop( GLFWwindow window, sstProgram *program, sstDrawableSet *set ) {
         if( sstDisplayErrors() ) {
             return 1;
         }
-        glFlush();
+        sstEndFrame(frames);
         glfwSwapBuffers(window);
         glfwPollEvents();
         /* Quitting */
@@ -184,6 +186,9 @@ GLFWwindow initialize() {
 int dataSetup( GLFWwindow window ) {
     sstProgram *program;
     sstDrawableSet *set;
+    sstPipelineState state;
+    sstPipeline *pipeline;
+    sstFrames *frames;
     GLfloat *proj;
     int result;
     /* Create shader program */
@@ -200,9 +205,19 @@ int dataSetup( GLFWwindow window ) {
                                  "in_Position", positions,
                                  "in_Normal", normals);
     sstSetUniformData(program, "projectionMatrix", proj);
-    glEnable(GL_DEPTH_TEST);
-    glViewport(0, 0, 600, 600);
-    result = mainLoop(window, program, set);
+    /* Depth testing and the viewport go with the program */
+    sstDefaultPipelineState(&state);
+    state.program = program;
+    state.depth_test = GL_TRUE;
+    state.viewport[2] = 600;
+    state.viewport[3] = 600;
+    pipeline = sstNewPipeline(&state);
+    sstBindPipeline(pipeline);
+    /* Let the CPU get up to two frames ahead of the GPU */
+    frames = sstNewFrames(2, 0);
+    result = mainLoop(window, program, set, frames);
+    sstFreeFrames(frames);
+    sstFreePipeline(pipeline);
     free(proj);
     return result;
 }
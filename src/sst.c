@@ -7,9 +7,13 @@
 #include <stdio.h>
 #include <string.h>
 #include "sst.h"
+#include "sst_private.h"
 
 #define CHUNK_SIZE 512
 
+/* Input variables with this name prefix are treated as per-instance */
+#define INSTANCE_PREFIX "inst_"
+
 /*
  * Displays any OpenGL errors to stdout. Since some of the error types have been
  * removed in later versions of OpenGL, we check if they exist in the
@@ -56,7 +60,7 @@ GLenum sstDisplayErrors() {
  * Returns the shader type given a file path. Shader type is determined by the
  * file prefix.
  */
-static GLenum sstGetShaderTypeFromFilepath( const char *file ) {
+GLenum sstGetShaderTypeFromFilepath( const char *file ) {
     char *suffix;
     suffix = strrchr(file, '.'); /* Last . -> file suffix */
     /* Compare against potential suffixes to find type */
@@ -82,7 +86,7 @@ static GLenum sstGetShaderTypeFromFilepath( const char *file ) {
 /*
  * Returns the size of the component corresponding to the enum value given.
  */
-static GLuint sstSizeFromEnum( GLenum type ) {
+GLuint sstSizeFromEnum( GLenum type ) {
     switch( type ) {
     case GL_BYTE:                        return sizeof(GLbyte);
     case GL_UNSIGNED_BYTE:               return sizeof(GLubyte);
@@ -90,19 +94,60 @@ static GLuint sstSizeFromEnum( GLenum type ) {
     case GL_UNSIGNED_SHORT:              return sizeof(GLushort);
     case GL_INT:                         return sizeof(GLint);
     case GL_UNSIGNED_INT:                return sizeof(GLuint);
-    case GL_HALF_FLOAT:                  return sizeof(GLshort); /* Guess */
+    case GL_HALF_FLOAT:                  return sizeof(GLhalf);
     case GL_FLOAT:                       return sizeof(GLfloat);
     case GL_DOUBLE:                      return sizeof(GLdouble);
+    /* Packed types hold all four components in one value. See sstVertexSize()
+     * for the size of a whole attribute. */
 #ifdef GL_INT_2_10_10_10_REV
-    case GL_INT_2_10_10_10_REV:          return sizeof(GLint); /* Guess */
+    case GL_INT_2_10_10_10_REV:          return sizeof(GLint);
 #endif
-    case GL_UNSIGNED_INT_2_10_10_10_REV: return sizeof(GLuint); /* Guess */
+    case GL_UNSIGNED_INT_2_10_10_10_REV: return sizeof(GLuint);
     default:
         printf("WARN: Unrecognized GL type value: %d\n", type);
         return sizeof(GLint);
     }
 }
 
+/*
+ * Returns the largest index representable by the given index type.
+ */
+GLuint sstMaxIndex( GLenum type ) {
+    switch( type ) {
+    case GL_UNSIGNED_BYTE:  return 0xFF;
+    case GL_UNSIGNED_SHORT: return 0xFFFF;
+    default:                return 0xFFFFFFFF;
+    }
+}
+
+/*
+ * Reads index i from an array of indices of the given type.
+ */
+GLuint sstGetIndex( void *indices, GLenum type, int i ) {
+    switch( type ) {
+    case GL_UNSIGNED_BYTE:  return ((GLubyte*)indices)[i];
+    case GL_UNSIGNED_SHORT: return ((GLushort*)indices)[i];
+    default:                return ((GLuint*)indices)[i];
+    }
+}
+
+/*
+ * Writes index i to an array of indices of the given type.
+ */
+void sstPutIndex( void *indices, GLenum type, int i, GLuint value ) {
+    switch( type ) {
+    case GL_UNSIGNED_BYTE:
+        ((GLubyte*)indices)[i] = (GLubyte)value;
+        break;
+    case GL_UNSIGNED_SHORT:
+        ((GLushort*)indices)[i] = (GLushort)value;
+        break;
+    default:
+        ((GLuint*)indices)[i] = value;
+        break;
+    }
+}
+
 /*
  * For efficient rendering we use arrays of in and uniform structs. However, we
  * use linked lists to build up our data set so we can convert it into arrays.
@@ -394,7 +439,8 @@ static in_var_list *ins_end = NULL;
 static uniform_list *uns = NULL;
 static uniform_list *uns_end = NULL;
 
-static void sstAppendInputList( char *name, GLenum type, GLuint components ) {
+static void sstAppendInputList( char *name, GLenum type, GLuint components,
+GLuint slots ) {
     in_var_list *result;
     result = (in_var_list*)malloc(sizeof(in_var_list));
     result->value.name = name;
@@ -402,6 +448,17 @@ static void sstAppendInputList( char *name, GLenum type, GLuint components ) {
     result->value.type = type;
     result->value.size = sstSizeFromEnum(type);
     result->value.components = components;
+    result->value.data_components = components;
+    result->value.slots = slots;
+    result->value.compress = SST_UNCOMPRESSED;
+    result->value.max_error = 0.0f;
+    /* Per-instance inputs are identified by their name */
+    if( strncmp(name, INSTANCE_PREFIX, strlen(INSTANCE_PREFIX)) == 0 ) {
+        result->value.divisor = 1;
+    }
+    else {
+        result->value.divisor = 0;
+    }
     result->next = NULL;
     if( ins == NULL ) {
         ins = ins_end = result;
@@ -413,13 +470,18 @@ static void sstAppendInputList( char *name, GLenum type, GLuint components ) {
 }
 
 static void sstAppendUniformList( char *name, GLenum type, GLuint first,
-GLuint second, GLuint count ) {
+GLuint second, GLuint count, GLboolean vertex ) {
     uniform_list *result, *check;
     /* Check if the uniform already exists (is defined in another shader) */
     for( check = uns; check; check = check->next ) {
         if( strcmp(name, check->value.name) == 0 ) {
             /* The linker will check that the types match, so we can safely
-             * ignore the duplicates. */
+             * ignore the duplicates. We do need to note if it's used outside
+             * of the vertex shaders though. */
+            if( !vertex ) {
+                check->value.instanceable = GL_FALSE;
+            }
+            free(name);
             return;
         }
     }
@@ -431,6 +493,11 @@ GLuint second, GLuint count ) {
     result->value.second = second;
     result->value.transpose = GL_FALSE; /* Never transpose for now */
     result->value.count = count;
+    /* Single float values only read by the vertex shaders could just as well
+     * be per-instance inputs */
+    result->value.instanceable = vertex && type == GL_FLOAT && count == 1;
+    result->value.value = NULL;
+    result->value.replayed = 0;
     result->next = NULL;
     if( uns == NULL ) {
         uns = uns_end = result;
@@ -489,12 +556,14 @@ static void sstParseLineWithInputs( char *s ) {
     if( strncmp(s, "in ", 3) == 0 ) {
         s += 3;
         sstParseLine1(s, &name, &type, &first, &second, &count);
-        /* Add to the input list */
+        /* Add to the input list. Each array element and each matrix column
+         * takes up its own attribute location. */
         if( second == 0 ) { /* second == 0 -> not a matrix */
-            sstAppendInputList(name, type, first * count);
+            sstAppendInputList(name, type, first * count, count);
         }
         else {
-            sstAppendInputList(name, type, first * second * count);
+            sstAppendInputList(name, type, first * second * count,
+                               first * count);
         }
     }
     /* Uniform variables */
@@ -502,7 +571,7 @@ static void sstParseLineWithInputs( char *s ) {
         s += 8;
         sstParseLine1(s, &name, &type, &first, &second, &count);
         /* Add to the uniform list */
-        sstAppendUniformList(name, type, first, second, count);
+        sstAppendUniformList(name, type, first, second, count, GL_TRUE);
     }
 }
 
@@ -519,7 +588,7 @@ static void sstParseLine( char *s ) {
         s += 8;
         sstParseLine1(s, &name, &type, &first, &second, &count);
         /* Add to the uniform list */
-        sstAppendUniformList(name, type, first, second, count);
+        sstAppendUniformList(name, type, first, second, count, GL_FALSE);
     }
 }
 
@@ -560,19 +629,12 @@ static void sstParseShader( GLenum type, char **strings, int count ) {
 }
 
 /*
- * Given a shader type and a filepath, read in and attempt to compile a shader
- * program. Will return the ID of the shader program on success, or 0 if there
- * was an error. Will also attempt to parse the program for any input or uniform
- * variables to capture.
- * NOTE: The shader type can be determined from the filepath assuming the usual
- * conventions are kept and the shaders have the appropriate suffix.
+ * Compiles a shader of the given type from an array of source strings. Will
+ * return the ID of the shader on success, or 0 if there was an error. Unlike
+ * sstCreateShader() this does not parse the source.
  */
-static GLuint sstCreateShader( GLenum type, const char *filepath ) {
+GLuint sstCompileShader( GLenum type, const char **strings, int count ) {
     GLuint shader;
-    FILE *fp;
-    char **source;
-    int source_size, i;
-    size_t bytes_read;
     GLint result;
     GLchar *error;
     GLsizei error_length;
@@ -582,7 +644,63 @@ static GLuint sstCreateShader( GLenum type, const char *filepath ) {
         printf("Failed to create shader!\n");
         return 0;
     }
-    /* Step 2: Read in shader source */
+    /* Step 2: Load in shader source. lengths = NULL -> NULL-terminated
+     * strings */
+    glShaderSource(shader, count, strings, NULL);
+    /* Step 3: Compile shader */
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+    if( result == GL_FALSE ) {
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &error_length);
+        error = (GLchar*)malloc(sizeof(GLchar) * error_length);
+        glGetShaderInfoLog(shader, error_length, NULL, error);
+        printf("%s\n", error);
+        free(error);
+        glDeleteShader(shader);
+        return 0;
+    }
+    /* Step 4: Return compiled shader */
+    return shader;
+}
+
+/*
+ * Joins an array of source strings into a single newly allocated string.
+ */
+static char * sstJoinSource( char **strings, int count ) {
+    char *result;
+    size_t length;
+    int i;
+    length = 1;
+    for( i = 0; i < count; i++ ) {
+        length += strlen(strings[i]);
+    }
+    result = (char*)malloc(sizeof(char) * length);
+    result[0] = '\0';
+    for( i = 0; i < count; i++ ) {
+        strcat(result, strings[i]);
+    }
+    return result;
+}
+
+/*
+ * Given a shader type and a filepath, read in and attempt to compile a shader
+ * program. Will return the ID of the shader program on success, or 0 if there
+ * was an error. Will also attempt to parse the program for any input or uniform
+ * variables to capture. The source of vertex shaders is handed back through
+ * kept so that variants of the program can be built later, and is NULL
+ * otherwise.
+ * NOTE: The shader type can be determined from the filepath assuming the usual
+ * conventions are kept and the shaders have the appropriate suffix.
+ */
+static GLuint sstCreateShader( GLenum type, const char *filepath,
+char **kept ) {
+    GLuint shader;
+    FILE *fp;
+    char **source;
+    int source_size, i;
+    size_t bytes_read;
+    *kept = NULL;
+    /* Step 1: Read in shader source */
     fp = fopen(filepath, "r");
     if( !fp ) {
         printf("Failed to open shader file %s!\n", filepath);
@@ -602,32 +720,26 @@ skip_realloc:
         source[source_size-1][bytes_read] = '\0';
     }
     fclose(fp);
-    /* lengths = NULL -> NULL-terminated strings */
-    glShaderSource(shader, source_size, (const char**)source, NULL);
-    /* Step 3: Compile shader */
-    glCompileShader(shader);
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
-    if( result == GL_FALSE ) {
-        printf("Failed to compile shader %s:\n", filepath);
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &error_length);
-        error = (GLchar*)malloc(sizeof(GLchar) * error_length);
-        glGetShaderInfoLog(shader, error_length, NULL, error);
-        printf("%s\n", error);
-        free(error);
-        shader = 0;
+    /* Step 2: Compile shader */
+    shader = sstCompileShader(type, (const char**)source, source_size);
+    if( !shader ) {
+        printf("Failed to compile shader %s.\n", filepath);
     }
-    /* Step 4: Parse shader for input and uniform variables */
+    /* Step 3: Parse shader for input and uniform variables */
     else {
         /* We do this step after compiling to let the GLSL compiler catch any
          * source errors before we try to parse. */
         sstParseShader(type, source, source_size);
+        if( type == GL_VERTEX_SHADER ) {
+            *kept = sstJoinSource(source, source_size);
+        }
     }
     /* Free our source strings, as we are done with them */
     for( i = 0; i < source_size; i++ ) {
         free(source[i]);
     }
     free(source);
-    /* Step 5: Return compiled shader */
+    /* Step 4: Return compiled shader */
     return shader;
 }
 
@@ -635,41 +747,63 @@ skip_realloc:
  * Given a shader type and the source of a shader, read in and attempt to
  * compile a shader rpogram. Will return the ID of the shader program on
  * success, or 0 if there was an error. Will also attempt to parse the program
- * for any input or uniform variables to capture.
+ * for any input or uniform variables to capture. The source of vertex shaders
+ * is handed back through kept, and is NULL otherwise.
  */
-static GLuint sstCreateShaderS( GLenum type, const char *source ) {
+static GLuint sstCreateShaderS( GLenum type, const char *source,
+char **kept ) {
     GLuint shader;
+    *kept = NULL;
+    /* Step 1: Compile shader */
+    shader = sstCompileShader(type, &source, 1);
+    if( !shader ) {
+        printf("Failed to compile shader.\n");
+    }
+    /* Step 2: Parse shader for input and uniform variables */
+    else {
+        /* We do this step after compiling to let the GLSL compiler catch any
+         * source errors before we try to parse. */
+        sstParseShader(type, (char**)&source, 1);
+        if( type == GL_VERTEX_SHADER ) {
+            *kept = sstJoinSource((char**)&source, 1);
+        }
+    }
+    /* Step 3: Return the compiled shader */
+    return shader;
+}
+
+/*
+ * Links the given program object. Returns GL_TRUE on success, or prints the
+ * link log and returns GL_FALSE otherwise.
+ */
+GLboolean sstLinkProgram( GLuint program ) {
     GLint result;
     GLchar *error;
     GLsizei error_length;
-    /* Step 1: Create empty shader */
-    shader = glCreateShader(type);
-    if( !shader ) {
-        printf("Failed to create shader!\n");
-        return 0;
-    }
-    /* Step 2: Load in shader source */
-    glShaderSource(shader, 1, (const char**)&source, NULL);
-    /* Step 3: Compile shader */
-    glCompileShader(shader);
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
     if( result == GL_FALSE ) {
-        printf("Failed to compile shader:\n");
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &error_length);
+        printf("Failed to link program:\n");
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &error_length);
         error = (GLchar*)malloc(sizeof(GLchar) * error_length);
-        glGetShaderInfoLog(shader, error_length, NULL, error);
+        glGetProgramInfoLog(program, error_length, NULL, error);
         printf("%s\n", error);
         free(error);
-        shader = 0;
+        return GL_FALSE;
     }
-    /* Step 4: Parse shader for input and uniform variables */
-    else {
-        /* We do this step after compiling to let the GLSL compiler catch any
-         * source errors before we try to parse. */
-        sstParseShader(type, (char**)&source, 1);
+    return GL_TRUE;
+}
+
+/*
+ * Frees the shader sources kept by a program.
+ */
+static void sstFreeSources( sstProgram *p ) {
+    int i;
+    for( i = 0; i < p->shader_count; i++ ) {
+        free(p->sources[i]);
     }
-    /* Step 5: Return the compiled shader */
-    return shader;
+    free(p->sources);
+    p->sources = NULL;
 }
 
 /*
@@ -681,9 +815,6 @@ static void sstCreateProgram( sstProgram *p, const char **files, int count ) {
     GLuint program, shader;
     int i, j;
     GLenum type;
-    GLint result;
-    GLchar *error;
-    GLsizei error_length;
     p->program = 0;
     p->shader_count = count;
     /* Step 1: Create program */
@@ -694,13 +825,15 @@ static void sstCreateProgram( sstProgram *p, const char **files, int count ) {
     }
     /* Step 2: Compile shaders */
     p->shaders = (GLuint*)malloc(sizeof(GLuint) * count);
+    p->sources = (char**)calloc(count, sizeof(char*));
     for( i = 0; i < count; i++ ) {
         type = sstGetShaderTypeFromFilepath(files[i]);
-        shader = sstCreateShader(type, files[i]);
+        shader = sstCreateShader(type, files[i], &p->sources[i]);
         if( !shader ) {
             for( j = 0; j < i; j++ ) {
                 glDeleteShader(p->shaders[j]);
             }
+            sstFreeSources(p);
             glDeleteProgram(program);
             return;
         }
@@ -708,18 +841,11 @@ static void sstCreateProgram( sstProgram *p, const char **files, int count ) {
         glAttachShader(program, shader);
     }
     /* Step 3: Link program */
-    glLinkProgram(program);
-    glGetProgramiv(program, GL_LINK_STATUS, &result);
-    if( result == GL_FALSE ) {
-        printf("Failed to link program:\n");
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &error_length);
-        error = (GLchar*)malloc(sizeof(GLchar) * error_length);
-        glGetProgramInfoLog(program, error_length, NULL, error);
-        printf("%s\n", error);
-        free(error);
+    if( !sstLinkProgram(program) ) {
         for( i = 0; i < count; i++ ) {
             glDeleteShader(p->shaders[i]);
         }
+        sstFreeSources(p);
         glDeleteProgram(program);
         return;
     }
@@ -737,9 +863,6 @@ static void sstCreateProgramS( sstProgram *p, const char **vertSrcs,
 int vertCount, const char **fragSrcs, int fragCount ) {
     GLuint program, shader;
     int i, j;
-    GLint result;
-    GLchar *error;
-    GLsizei error_length;
     p->program = 0;
     p->shader_count = vertCount + fragCount;
     /* Step 1: Create program */
@@ -750,13 +873,16 @@ int vertCount, const char **fragSrcs, int fragCount ) {
     }
     /* Step 2: Compile shaders */
     p->shaders = (GLuint*)malloc(sizeof(GLuint) * (vertCount + fragCount));
+    p->sources = (char**)calloc(vertCount + fragCount, sizeof(char*));
     /* Step 2a: Vertex shaders */
     for( i = 0; i < vertCount; i++ ) {
-        shader = sstCreateShaderS(GL_VERTEX_SHADER, vertSrcs[i]);
+        shader = sstCreateShaderS(GL_VERTEX_SHADER, vertSrcs[i],
+                                  &p->sources[i]);
         if( !shader ) {
             for( j = 0; j < i; j++ ) {
                 glDeleteShader(p->shaders[j]);
             }
+            sstFreeSources(p);
             glDeleteProgram(program);
             return;
         }
@@ -765,11 +891,13 @@ int vertCount, const char **fragSrcs, int fragCount ) {
     }
     /* Step 2b: Fragment shaders */
     for( ; i < vertCount + fragCount; i++ ) {
-        shader = sstCreateShaderS(GL_FRAGMENT_SHADER, fragSrcs[i - vertCount]);
+        shader = sstCreateShaderS(GL_FRAGMENT_SHADER, fragSrcs[i - vertCount],
+                                  &p->sources[i]);
         if( !shader ) {
             for( j = 0; j < i; j++ ) {
                 glDeleteShader(p->shaders[j]);
             }
+            sstFreeSources(p);
             glDeleteProgram(program);
             return;
         }
@@ -777,18 +905,11 @@ int vertCount, const char **fragSrcs, int fragCount ) {
         glAttachShader(program, shader);
     }
     /* Step 3: Link program */
-    glLinkProgram(program);
-    glGetProgramiv(program, GL_LINK_STATUS, &result);
-    if( result == GL_FALSE ) {
-        printf("Failed to link program:\n");
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &error_length);
-        error = (GLchar*)malloc(sizeof(GLchar) * error_length);
-        glGetProgramInfoLog(program, error_length, NULL, error);
-        printf("%s\n", error);
-        free(error);
+    if( !sstLinkProgram(program) ) {
         for( i = 0; i < vertCount + fragCount; i++ ) {
             glDeleteShader(p->shaders[i]);
         }
+        sstFreeSources(p);
         glDeleteProgram(program);
         return;
     }
@@ -851,14 +972,27 @@ sstProgram * sstNewProgram( const char **files, int count ) {
     }
     uns = uns_end = NULL;
     /* Step 5: Get locations for inputs */
+    result->inst_count = 0;
     for( in = result->inputs; in < result->inputs + result->in_count; in++ ) {
         in->location = glGetAttribLocation(result->program, in->name);
+        if( in->divisor ) {
+            result->inst_count++;
+        }
     }
-    /* Step 6: Get locations for uniforms */
+    /* Step 6: Get locations for uniforms, and make room to remember their
+     * values. GL initializes uniforms to 0. */
     for( un = result->uniforms; un < result->uniforms + result->un_count; un++ )
     {
         un->location = glGetUniformLocation(result->program, un->name);
-    }
+        un->value = calloc(1, sstUniformSize(un));
+    }
+    result->variant = NULL;
+    result->mesh_passes = 0;
+    result->weld_epsilon = 0.0f;
+    result->lod_levels = 4;
+    result->lod_ratio = 0.5f;
+    result->build_bvh = GL_FALSE;
+    result->pulling = NULL;
     /* Step 7: Return the program object */
     return result;
 }
@@ -919,14 +1053,27 @@ const char **fragSrcs, int fragCount ) {
     }
     uns = uns_end = NULL;
     /* Step 5: Get locations for inputs */
+    result->inst_count = 0;
     for( in = result->inputs; in < result->inputs + result->in_count; in++ ) {
         in->location = glGetAttribLocation(result->program, in->name);
+        if( in->divisor ) {
+            result->inst_count++;
+        }
     }
-    /* Step 6: Get locations for uniforms */
+    /* Step 6: Get locations for uniforms, and make room to remember their
+     * values. GL initializes uniforms to 0. */
     for( un = result->uniforms; un < result->uniforms + result->un_count; un++ )
     {
         un->location = glGetUniformLocation(result->program, un->name);
-    }
+        un->value = calloc(1, sstUniformSize(un));
+    }
+    result->variant = NULL;
+    result->mesh_passes = 0;
+    result->weld_epsilon = 0.0f;
+    result->lod_levels = 4;
+    result->lod_ratio = 0.5f;
+    result->build_bvh = GL_FALSE;
+    result->pulling = NULL;
     /* Step 7: Return the program object */
     return result;
 }
@@ -936,7 +1083,368 @@ const char **fragSrcs, int fragCount ) {
  * variables and making the program the active OpenGL program.
  */
 void sstActivateProgram( sstProgram *program ) {
-    glUseProgram(program->program);
+    if( sst_threaded && sstRenderActivate(program) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferActivate(program);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueueActivate(program);
+        return;
+    }
+    sst_active = program;
+    sstUseProgram(program->program);
+}
+
+/*
+ * Returns the input variable in the program with the given name, or NULL if
+ * there is no such input.
+ */
+in_var * sstFindInput( sstProgram *program, char *name ) {
+    in_var *input;
+    for( input = program->inputs; input < program->inputs + program->in_count;
+         input++ ) {
+        if( strcmp(input->name, name) == 0 ) {
+            return input;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Copies the layout of an input variable into a drawable.
+ */
+void sstInitDrawable( sstDrawable *drawable, in_var *input ) {
+    drawable->components = input->components;
+    drawable->location   = input->location;
+    drawable->type       = input->type;
+    drawable->size       = input->size;
+    drawable->slots      = input->slots;
+    drawable->divisor    = input->divisor;
+    drawable->normalized = GL_FALSE;
+    drawable->transpose  = GL_FALSE;
+}
+
+/*
+ * Returns the number of bytes one entry takes up in the data passed in for an
+ * input, before any compression.
+ */
+GLsizei sstInputSize( in_var *input ) {
+    return input->size * input->data_components;
+}
+
+/*
+ * Returns the number of bytes one entry takes up in a drawable's buffer.
+ */
+GLsizei sstVertexSize( sstDrawable *drawable ) {
+    switch( drawable->type ) {
+#ifdef GL_INT_2_10_10_10_REV
+    case GL_INT_2_10_10_10_REV:
+#endif
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+        return sizeof(GLuint) * drawable->slots;
+    default:
+        return drawable->size * drawable->components;
+    }
+}
+
+/*
+ * Points the attribute locations of a drawable at its buffer in the currently
+ * bound vertex array. Inputs spanning several locations (matrices and arrays)
+ * are split up into one attribute per location, interleaved in the buffer.
+ */
+void sstAttribPointers( sstDrawable *drawable ) {
+    GLuint slot, per_slot;
+    GLsizei stride;
+    size_t offset;
+    per_slot = drawable->components / drawable->slots;
+    stride = drawable->slots > 1 ? sstVertexSize(drawable) : 0;
+    sstBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
+    for( slot = 0; slot < drawable->slots; slot++ ) {
+        offset = slot * (sstVertexSize(drawable) / drawable->slots);
+        glVertexAttribPointer(drawable->location + slot, per_slot,
+                              drawable->type, drawable->normalized, stride,
+                              (GLvoid*)offset);
+        glVertexAttribDivisor(drawable->location + slot, drawable->divisor);
+        glEnableVertexAttribArray(drawable->location + slot);
+    }
+}
+
+/*
+ * Creates the storage of the buffer bound to target, rounded up to whole 32-bit
+ * words so that pulling programs can read it as an array of uints, and fills
+ * in the first size bytes with data, unless data is NULL.
+ */
+void sstBufferWords( GLenum target, GLsizeiptr size, const GLvoid *data ) {
+    GLsizeiptr padded;
+    padded = (size + 3) & ~(GLsizeiptr)3;
+    if( padded == size || !data ) {
+        glBufferData(target, padded, data, GL_STATIC_DRAW);
+        return;
+    }
+    glBufferData(target, padded, NULL, GL_STATIC_DRAW);
+    glBufferSubData(target, 0, size, data);
+}
+
+/*
+ * Reads the pairs of input variable names and data given to
+ * sstDrawableSetArrays() and sstDrawableSetElements(), looking up the input
+ * variable for each. Returns 0 if any name isn't an input of the program.
+ */
+int sstReadInputs( sstProgram *program, int size, va_list ap,
+in_var **inputs, void **data ) {
+    char *name;
+    int i, ok;
+    ok = 1;
+    for( i = 0; i < size; i++ ) {
+        name = va_arg(ap, char*);
+        data[i] = va_arg(ap, void*);
+        inputs[i] = sstFindInput(program, name);
+        /* Lookup failure */
+        if( inputs[i] == NULL ) {
+            printf("ERROR: Input variable [%s] does not exist!\n", name);
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+/*
+ * Returns true iff there is an input for every per-vertex input of the
+ * program, printing an error if not.
+ */
+static int sstHasInputs( sstProgram *program, in_var **inputs ) {
+    int i;
+    for( i = 0; i < program->in_count - program->inst_count; i++ ) {
+        if( inputs[i] == NULL ) {
+            printf("ERROR: Drawable set is missing an input variable!\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Builds a drawable set from the data for each input, indexed if indices are
+ * given. Triangle meshes are processed first if the program asks for it, and
+ * come out indexed with the narrowest index type that fits.
+ */
+sstDrawableSet * sstBuildDrawableSet( sstProgram *program, GLenum mode,
+int count, void *indices, GLenum i_type, int i_count, in_var **inputs,
+void **data ) {
+    sstDrawableSet *set;
+    sstSetData staged;
+    set = sstPrepareDrawableSet(program, mode, count, indices, i_type, i_count,
+                                inputs, data, &staged);
+    if( set == NULL ) {
+        return NULL;
+    }
+    /* Only the buffers and vertex array are left for the render thread */
+    if( sst_threaded && sstRenderUploadSet(set, &staged) ) {
+        return set;
+    }
+    sstUploadSetData(set, &staged);
+    sstBindDrawableSet(set);
+    return set;
+}
+
+/*
+ * Sets up the vertex array of a set whose buffers have been filled, binding
+ * its index buffer and pointing each attribute at its drawable's buffer.
+ */
+void sstBindDrawableSet( sstDrawableSet *set ) {
+    int i;
+    glGenVertexArrays(1, &set->vao);
+    sstBindVertexArray(set->vao);
+    if( set->i_buffer ) {
+        sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, set->i_buffer);
+    }
+    for( i = 0; i < set->size; i++ ) {
+        sstBindBuffer(GL_ARRAY_BUFFER, set->drawables[i].buffer);
+        sstAttribPointers(&set->drawables[i]);
+    }
+}
+
+/*
+ * Does the work of sstBuildDrawableSet() that needs no GL: processes the mesh,
+ * computes its bounds and BVH, and compresses its inputs, leaving the contents
+ * of its buffers in staged.
+ */
+sstDrawableSet * sstPrepareDrawableSet( sstProgram *program, GLenum mode,
+int count, void *indices, GLenum i_type, int i_count, in_var **inputs,
+void **data, sstSetData *staged ) {
+    sstDrawableSet *set;
+    sstDrawable *drawable;
+    sstMesh mesh;
+    void *packed;
+    int i, total;
+    if( !sstHasInputs(program, inputs) ) {
+        return NULL;
+    }
+    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
+    set->size = program->in_count - program->inst_count;
+    set->mode = mode;
+    set->inst_id = 0;
+    set->lod_count = 0;
+    set->lods = NULL;
+    set->bvh = NULL;
+    set->vao = 0;
+    set->i_buffer = 0;
+    sstResetDecode(set);
+    /* Step 1: Process the mesh, if the program asks for it. Only welding is
+     * worth turning unindexed triangles into indexed ones for. */
+    packed = NULL;
+    mesh.data = NULL;
+    if( program->mesh_passes && mode == GL_TRIANGLES
+     && (indices || (program->mesh_passes & SST_OPTIMIZE_WELD))
+     && sstInitMesh(&mesh, count, indices, i_type, indices ? i_count : count,
+                    set->size, inputs, data) ) {
+        sstProcessMesh(program, &mesh);
+        count = mesh.count;
+        i_count = mesh.i_count;
+        packed = sstMeshIndices(&mesh, &i_type, &total);
+        indices = packed;
+        /* Levels of detail follow the full mesh in the index buffer */
+        set->lod_count = mesh.lod_count;
+        set->lods = (sstLOD*)malloc(sizeof(sstLOD) * (mesh.lod_count + 1));
+        for( i = 0; i < mesh.lod_count; i++ ) {
+            set->lods[i].first = i_count;
+            if( i > 0 ) {
+                set->lods[i].first = set->lods[i - 1].first
+                                   + set->lods[i - 1].size;
+            }
+            set->lods[i].size = mesh.lod_sizes[i];
+            set->lods[i].error = mesh.lod_errors[i];
+        }
+        data = mesh.data;
+    }
+    set->count = count;
+    sstComputeBounds(inputs, data, set->size, count, set);
+    if( program->build_bvh && mode == GL_TRIANGLES ) {
+        set->bvh = sstBuildBVH(inputs, data, set->size, indices, i_type,
+                               indices ? i_count : count);
+    }
+    /* Step 2: Stage indices, if there are any */
+    staged->data = (void**)malloc(sizeof(void*) * (set->size + 1));
+    staged->bytes = (size_t*)malloc(sizeof(size_t) * (set->size + 1));
+    staged->owned = (char*)calloc(set->size + 1, sizeof(char));
+    staged->size = set->size;
+    staged->indices = indices;
+    staged->i_bytes = 0;
+    staged->i_owned = packed != NULL;
+    if( indices ) {
+        set->i_size = i_count;
+        set->i_type = i_type;
+        staged->i_bytes = sstSizeFromEnum(i_type) * (packed ? total : i_count);
+    }
+    else {
+        /* Unused values due to this being array-based and not index-based */
+        set->i_size = 0;
+        set->i_type = 0;
+    }
+    /* Step 3: Set up memory for drawables */
+    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * set->size);
+    for( i = 0; i < set->size; i++ ) {
+        drawable = &set->drawables[i];
+        drawable->buffer = 0;
+        /* Sub-step 1: Copy over data */
+        sstInitDrawable(drawable, inputs[i]);
+        /* Sub-step 2: Compress it, if compression has been turned on for the
+         * input, or take it over from the processed mesh */
+        staged->data[i] = NULL;
+        if( inputs[i]->compress != SST_UNCOMPRESSED ) {
+            staged->data[i] = sstCompressData(set, drawable, inputs[i],
+                                              data[i], count);
+        }
+        if( staged->data[i] ) {
+            staged->owned[i] = 1;
+        }
+        else {
+            staged->data[i] = data[i];
+            staged->owned[i] = mesh.data != NULL;
+            if( mesh.data ) {
+                mesh.data[i] = NULL;
+            }
+        }
+        staged->bytes[i] = sstVertexSize(drawable) * count;
+    }
+    if( mesh.data ) {
+        sstFreeMesh(&mesh);
+    }
+    /* Step 4: Return drawable set */
+    return set;
+}
+
+/*
+ * Copies whatever staged data still belongs to the caller, so that it can be
+ * uploaded after the caller has freed its arrays.
+ */
+void sstKeepSetData( sstSetData *staged ) {
+    void *copy;
+    int i;
+    if( staged->indices && !staged->i_owned ) {
+        copy = malloc(staged->i_bytes);
+        memcpy(copy, staged->indices, staged->i_bytes);
+        staged->indices = copy;
+        staged->i_owned = 1;
+    }
+    for( i = 0; i < staged->size; i++ ) {
+        if( !staged->owned[i] ) {
+            copy = malloc(staged->bytes[i]);
+            memcpy(copy, staged->data[i], staged->bytes[i]);
+            staged->data[i] = copy;
+            staged->owned[i] = 1;
+        }
+    }
+}
+
+/*
+ * Creates the buffers of a prepared set and uploads the staged data into them,
+ * then frees the staged data. Buffers are filled through targets that aren't
+ * part of any vertex array's state, so no vertex array needs to be bound.
+ */
+void sstUploadSetData( sstDrawableSet *set, sstSetData *staged ) {
+    int i;
+    if( staged->indices ) {
+        glGenBuffers(1, &set->i_buffer);
+        sstBindBuffer(GL_COPY_WRITE_BUFFER, set->i_buffer);
+        sstBufferWords(GL_COPY_WRITE_BUFFER, staged->i_bytes,
+                       staged->indices);
+        if( staged->i_owned ) {
+            free(staged->indices);
+        }
+    }
+    for( i = 0; i < staged->size; i++ ) {
+        glGenBuffers(1, &set->drawables[i].buffer);
+        sstBindBuffer(GL_ARRAY_BUFFER, set->drawables[i].buffer);
+        sstBufferWords(GL_ARRAY_BUFFER, staged->bytes[i], staged->data[i]);
+        if( staged->owned[i] ) {
+            free(staged->data[i]);
+        }
+    }
+    free(staged->data);
+    free(staged->bytes);
+    free(staged->owned);
+}
+
+/*
+ * Does everything sstBuildDrawableSet() does but make the vertex array, which
+ * can't be shared between contexts, so this can run on a thread with a shared
+ * context.
+ */
+sstDrawableSet * sstFillDrawableSet( sstProgram *program, GLenum mode,
+int count, void *indices, GLenum i_type, int i_count, in_var **inputs,
+void **data ) {
+    sstDrawableSet *set;
+    sstSetData staged;
+    set = sstPrepareDrawableSet(program, mode, count, indices, i_type, i_count,
+                                inputs, data, &staged);
+    if( set ) {
+        sstUploadSetData(set, &staged);
+    }
+    return set;
 }
 
 /*
@@ -951,56 +1459,22 @@ void sstActivateProgram( sstProgram *program ) {
 sstDrawableSet * sstDrawableSetArrays( sstProgram *program, GLenum mode,
 int count, ... ) {
     sstDrawableSet *set;
-    sstDrawable *drawable;
-    char *name;
-    void *data;
-    in_var *input;
+    in_var **inputs;
+    void **data;
+    int size;
     va_list ap;
+    size = program->in_count - program->inst_count;
+    inputs = (in_var**)malloc(sizeof(in_var*) * size);
+    data = (void**)malloc(sizeof(void*) * size);
     va_start(ap, count);
-    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
-    set->size = program->in_count;
-    set->count = count;
-    set->mode = mode;
-    /* Unused values due to this being array-based and not index-based */
-    set->i_size = 0;
-    set->i_type = 0;
-    set->i_buffer = 0;
-    /* Step 1: Generate vertex array and bind it */
-    glGenVertexArrays(1, &set->vao);
-    glBindVertexArray(set->vao);
-    /* Step 2: Set up memory for drawables */
-    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * set->size);
-    for( drawable = set->drawables; drawable < set->drawables + set->size;
-         drawable++ ) {
-        glGenBuffers(1, &drawable->buffer);
-        /* Sub-step 1: Find our data */
-        name = va_arg(ap, char*);
-        data = va_arg(ap, void*);
-        for( input = program->inputs; input < program->inputs + program->in_count;
-             input++ ) {
-            /* Found match */
-            if( strcmp(input->name, name) == 0 ) {
-                break;
-            }
-        }
-        /* Lookup failure */
-        if( input >= program->inputs + program->in_count ) {
-            printf("ERROR: Input variable [%s] does not exist!\n", name);
-        }
-        /* Sub-step 2: Copy over data */
-        drawable->components = input->components;
-        drawable->location   = input->location;
-        drawable->type       = input->type;
-        /* Sub-step 3: Push data down the pipe */
-        glBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
-        glBufferData(GL_ARRAY_BUFFER, input->size * input->components * count,
-                     data, GL_STATIC_DRAW);
-        glVertexAttribPointer(drawable->location, drawable->components,
-                              drawable->type, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(drawable->location);
+    set = NULL;
+    if( sstReadInputs(program, size, ap, inputs, data) ) {
+        set = sstBuildDrawableSet(program, mode, count, NULL, 0, 0, inputs,
+                                  data);
     }
     va_end(ap);
-    /* Step 3: Return drawable set */
+    free(inputs);
+    free(data);
     return set;
 }
 
@@ -1018,75 +1492,229 @@ int count, ... ) {
 sstDrawableSet * sstDrawableSetElements( sstProgram *program, GLenum mode,
 int count, void *indices, GLenum i_type, int i_count, ... ) {
     sstDrawableSet *set;
-    sstDrawable *drawable;
+    in_var **inputs;
+    void **data;
+    int size;
+    va_list ap;
+    size = program->in_count - program->inst_count;
+    inputs = (in_var**)malloc(sizeof(in_var*) * size);
+    data = (void**)malloc(sizeof(void*) * size);
+    va_start(ap, i_count);
+    set = NULL;
+    if( sstReadInputs(program, size, ap, inputs, data) ) {
+        set = sstBuildDrawableSet(program, mode, count, indices, i_type,
+                                  i_count, inputs, data);
+    }
+    va_end(ap);
+    free(inputs);
+    free(data);
+    return set;
+}
+
+/*
+ * Draws the given sstDrawableSet. Assumes the correct program is currently
+ * active.
+ */
+void sstDrawSet( sstDrawableSet *set ) {
+    if( sst_threaded && sstRenderDraw(set, NULL, 0) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferDraw(set);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueueDraw(set, NULL, 0);
+        return;
+    }
+#ifdef GL_SHADER_STORAGE_BUFFER
+    /* Pulling programs don't need the vertex array */
+    if( sst_active && sst_active->pulling ) {
+        sstDrawPulled(sst_active->pulling, set, 0,
+                      set->i_buffer ? set->i_size : set->count);
+        return;
+    }
+#endif
+    /* Step 1: Bind our vertex array */
+    sstBindVertexArray(set->vao);
+    /* Step 3: Draw arrays */
+    if( set->i_buffer != 0 ) {
+        glDrawElements(set->mode, set->i_size, set->i_type, 0);
+    }
+    else {
+        glDrawArrays(set->mode, 0, set->count);
+    }
+}
+
+/* The program most recently made active with sstActivateProgram() */
+sstProgram *sst_active = NULL;
+
+/*
+ * Returns the number of bytes of vertex and index data the given set holds on
+ * the GPU.
+ */
+GLsizeiptr sstDrawableSetBytes( sstDrawableSet *set ) {
+    GLsizeiptr bytes;
+    sstDrawable *d;
+    int i;
+    bytes = 0;
+    for( d = set->drawables; d < set->drawables + set->size; d++ ) {
+        bytes += (GLsizeiptr)sstVertexSize(d) * set->count;
+    }
+    if( set->i_buffer ) {
+        bytes += (GLsizeiptr)sstSizeFromEnum(set->i_type) * set->i_size;
+    }
+    for( i = 0; i < set->lod_count; i++ ) {
+        bytes += (GLsizeiptr)sstSizeFromEnum(set->i_type) * set->lods[i].size;
+    }
+    return bytes;
+}
+
+static unsigned int next_instance_id = 1;
+
+/*
+ * Helper function for sstNewInstanceBuffer() and sstUpdateInstanceBuffer().
+ * Uploads the name/data pairs in the argument list to their buffers.
+ */
+static void sstFillInstanceBuffer( sstInstanceBuffer *buffer, int count,
+va_list ap ) {
+    sstDrawable *drawable, *end;
     char *name;
     void *data;
     in_var *input;
-    va_list ap;
-    va_start(ap, i_count);
-    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
-    set->size = program->in_count;
-    set->count = count;
-    set->mode = mode;
-    set->i_size = i_count;
-    set->i_type = i_type;
-    /* Step 1: Generate vertex array and bind it */
-    glGenVertexArrays(1, &set->vao);
-    glBindVertexArray(set->vao);
-    /* Step 2: Set up memory for drawables */
-    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * set->size);
-    glGenBuffers(1, &set->i_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, set->i_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sstSizeFromEnum(i_type) * i_count,
-                 indices, GL_STATIC_DRAW);
-    for( drawable = set->drawables; drawable < set->drawables + set->size;
-         drawable++ ) {
-        glGenBuffers(1, &drawable->buffer);
+    int i;
+    end = buffer->drawables + buffer->size;
+    for( i = 0; i < buffer->size; i++ ) {
         /* Sub-step 1: Find our data */
         name = va_arg(ap, char*);
         data = va_arg(ap, void*);
-        for( input = program->inputs; input < program->inputs +
-             program->in_count; input++ ) {
-            /* Found match */
-            if( strcmp(input->name, name) == 0 ) {
+        input = sstFindInput(buffer->program, name);
+        /* Lookup failure */
+        if( input == NULL || !input->divisor ) {
+            printf("ERROR: Per-instance input variable [%s] does not exist!\n",
+                   name);
+            continue;
+        }
+        /* Sub-step 2: Find the drawable for this input */
+        for( drawable = buffer->drawables; drawable < end; drawable++ ) {
+            if( drawable->location == input->location ) {
                 break;
             }
         }
-        /* Lookup failure */
-        if( input >= program->inputs + program->in_count ) {
-            printf("ERROR: Input variable [%s] does not exist!\n", name);
+        if( drawable == end || input->location < 0 ) {
+            printf("WARN: Per-instance input variable [%s] is not used!\n",
+                   name);
+            continue;
+        }
+        /* Sub-step 3: Push data down the pipe. Respecifying the storage
+         * orphans the old contents instead of waiting on draws using them. */
+        sstBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
+        glBufferData(GL_ARRAY_BUFFER, sstVertexSize(drawable) * count,
+                     data, GL_DYNAMIC_DRAW);
+    }
+    buffer->count = count;
+}
+
+/*
+ * Generates an instance buffer. This function takes in an sstProgram, the
+ * number of instances, and a number of pair values consisting of the name of a
+ * per-instance input variable in the program followed by its data.
+ */
+sstInstanceBuffer * sstNewInstanceBuffer( sstProgram *program, int count,
+... ) {
+    sstInstanceBuffer *buffer;
+    sstDrawable *drawable;
+    in_var *input;
+    va_list ap;
+    buffer = (sstInstanceBuffer*)malloc(sizeof(sstInstanceBuffer));
+    buffer->program = program;
+    buffer->size = program->inst_count;
+    buffer->id = next_instance_id++;
+    /* Step 1: Set up a drawable for every per-instance input */
+    buffer->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) *
+                                             buffer->size);
+    drawable = buffer->drawables;
+    for( input = program->inputs; input < program->inputs + program->in_count;
+         input++ ) {
+        if( input->divisor ) {
+            glGenBuffers(1, &drawable->buffer);
+            sstInitDrawable(drawable, input);
+            drawable++;
         }
-        /* Sub-step 2: Copy over data */
-        drawable->components = input->components;
-        drawable->location   = input->location;
-        drawable->type       = input->type;
-        /* Sub-step 3: Push data down the pipe */
-        glBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
-        glBufferData(GL_ARRAY_BUFFER, input->size * input->components * count,
-                     data, GL_STATIC_DRAW);
-        glVertexAttribPointer(drawable->location, drawable->components,
-                              drawable->type, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(drawable->location);
     }
+    /* Step 2: Upload the instance data */
+    va_start(ap, count);
+    sstFillInstanceBuffer(buffer, count, ap);
     va_end(ap);
-    /* Step 3: Return drawable set */
-    return set;
+    /* Step 3: Return instance buffer */
+    return buffer;
 }
 
 /*
- * Draws the given sstDrawableSet. Assumes the correct program is currently
- * active.
+ * Replaces the contents of an instance buffer. Takes the same pair values as
+ * sstNewInstanceBuffer().
  */
-void sstDrawSet( sstDrawableSet *set ) {
+void sstUpdateInstanceBuffer( sstInstanceBuffer *buffer, int count, ... ) {
+    va_list ap;
+    va_start(ap, count);
+    sstFillInstanceBuffer(buffer, count, ap);
+    va_end(ap);
+}
+
+/*
+ * Draws count instances of the given sstDrawableSet with a single draw call.
+ * Assumes the correct program is currently active.
+ */
+void sstDrawSetInstanced( sstDrawableSet *set, sstInstanceBuffer *buffer,
+int count ) {
+    sstDrawable *drawable;
+    if( sst_threaded && sstRenderDraw(set, buffer, count) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferDrawInstanced(set, buffer, count);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueueDraw(set, buffer, count);
+        return;
+    }
     /* Step 1: Bind our vertex array */
-    glBindVertexArray(set->vao);
-    /* Step 3: Draw arrays */
+    sstBindVertexArray(set->vao);
+    /* Step 2: Attach the instance buffer, unless it is already attached */
+    if( set->inst_id != buffer->id ) {
+        for( drawable = buffer->drawables;
+             drawable < buffer->drawables + buffer->size; drawable++ ) {
+            sstAttribPointers(drawable);
+        }
+        set->inst_id = buffer->id;
+    }
+#ifdef GL_SHADER_STORAGE_BUFFER
+    /* Pulling programs read the vertices themselves, with gl_VertexID already
+     * run through the index buffer */
+    if( sst_active && sst_active->pulling ) {
+        sstBindPulled(sst_active->pulling, set, GL_FALSE);
+    }
+#endif
+    /* Step 3: Draw instances */
     if( set->i_buffer != 0 ) {
-        glDrawElements(set->mode, set->i_size, set->i_type, 0);
+        glDrawElementsInstanced(set->mode, set->i_size, set->i_type, 0, count);
     }
     else {
-        glDrawArrays(set->mode, 0, set->count);
+        glDrawArraysInstanced(set->mode, 0, set->count, count);
+    }
+}
+
+/*
+ * Returns the number of bytes taken up by the value of a uniform variable.
+ */
+GLuint sstUniformSize( uniform *un ) {
+    GLuint size;
+    size = sizeof(GLfloat) * un->first * un->count;
+    if( un->second != 0 ) {
+        size *= un->second;
     }
+    return size;
 }
 
 /*
@@ -1107,20 +1735,42 @@ void sstSetUniformData( sstProgram *program, char *name, GLvoid *data ) {
         printf("WARN: Uniform variable [%s] does not exist!\n", name);
         return;
     }
+    /* Hand it to the render thread, or hold on to it for later when
+     * deferring */
+    if( sst_threaded && sstRenderUniform(program, i, data) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferUniform(program, i, data);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueueUniform(program, i, data);
+        return;
+    }
+    memcpy(un->value, data, sstUniformSize(un));
+    sstUploadUniform(un, un->location, data);
+}
+
+/*
+ * Uploads a value for the given uniform variable to the given location of the
+ * active program.
+ */
+void sstUploadUniform( uniform *un, GLint location, GLvoid *data ) {
     switch( un->first ) {
     case 1:
         switch( un->type ) {
         case GL_FLOAT:
-            glUniform1fv(un->location, un->count, (const GLfloat*)data);
+            glUniform1fv(location, un->count, (const GLfloat*)data);
             return;
         case GL_INT:
-            glUniform1iv(un->location, un->count, (const GLint*)data);
+            glUniform1iv(location, un->count, (const GLint*)data);
             return;
         case GL_UNSIGNED_INT:
-            glUniform1uiv(un->location, un->count, (const GLuint*)data);
+            glUniform1uiv(location, un->count, (const GLuint*)data);
             return;
         default:
-            printf("WARN: Invalid type for uniform value [%s]!\n", name);
+            printf("WARN: Invalid type for uniform value [%s]!\n", un->name);
             return;
         }
     case 2:
@@ -1129,28 +1779,29 @@ void sstSetUniformData( sstProgram *program, char *name, GLvoid *data ) {
         case 1:
             switch( un->type ) {
             case GL_FLOAT:
-                glUniform2fv(un->location, un->count, (const GLfloat*)data);
+                glUniform2fv(location, un->count, (const GLfloat*)data);
                 return;
             case GL_INT:
-                glUniform2iv(un->location, un->count, (const GLint*)data);
+                glUniform2iv(location, un->count, (const GLint*)data);
                 return;
             case GL_UNSIGNED_INT:
-                glUniform2uiv(un->location, un->count, (const GLuint*)data);
+                glUniform2uiv(location, un->count, (const GLuint*)data);
                 return;
             default:
-                printf("WARN: Invalid type for uniform value [%s]!\n", name);
+                printf("WARN: Invalid type for uniform value [%s]!\n",
+                       un->name);
                 return;
             }
         case 2:
-            glUniformMatrix2fv(un->location, un->count, un->transpose,
+            glUniformMatrix2fv(location, un->count, un->transpose,
                                (const GLfloat*)data);
             return;
         case 3:
-            glUniformMatrix2x3fv(un->location, un->count, un->transpose,
+            glUniformMatrix2x3fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         case 4:
-            glUniformMatrix2x4fv(un->location, un->count, un->transpose,
+            glUniformMatrix2x4fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         default:
@@ -1163,28 +1814,29 @@ void sstSetUniformData( sstProgram *program, char *name, GLvoid *data ) {
         case 1:
             switch( un->type ) {
             case GL_FLOAT:
-                glUniform3fv(un->location, un->count, (const GLfloat*)data);
+                glUniform3fv(location, un->count, (const GLfloat*)data);
                 return;
             case GL_INT:
-                glUniform3iv(un->location, un->count, (const GLint*)data);
+                glUniform3iv(location, un->count, (const GLint*)data);
                 return;
             case GL_UNSIGNED_INT:
-                glUniform3uiv(un->location, un->count, (const GLuint*)data);
+                glUniform3uiv(location, un->count, (const GLuint*)data);
                 return;
             default:
-                printf("WARN: Invalid type for uniform value [%s]!\n", name);
+                printf("WARN: Invalid type for uniform value [%s]!\n",
+                       un->name);
                 return;
             }
         case 2:
-            glUniformMatrix3x2fv(un->location, un->count, un->transpose,
+            glUniformMatrix3x2fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         case 3:
-            glUniformMatrix3fv(un->location, un->count, un->transpose,
+            glUniformMatrix3fv(location, un->count, un->transpose,
                                (const GLfloat*)data);
             return;
         case 4:
-            glUniformMatrix3x4fv(un->location, un->count, un->transpose,
+            glUniformMatrix3x4fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         default:
@@ -1197,28 +1849,29 @@ void sstSetUniformData( sstProgram *program, char *name, GLvoid *data ) {
         case 1:
             switch( un->type ) {
             case GL_FLOAT:
-                glUniform4fv(un->location, un->count, (const GLfloat*)data);
+                glUniform4fv(location, un->count, (const GLfloat*)data);
                 return;
             case GL_INT:
-                glUniform4iv(un->location, un->count, (const GLint*)data);
+                glUniform4iv(location, un->count, (const GLint*)data);
                 return;
             case GL_UNSIGNED_INT:
-                glUniform4uiv(un->location, un->count, (const GLuint*)data);
+                glUniform4uiv(location, un->count, (const GLuint*)data);
                 return;
             default:
-                printf("WARN: Invalid type for uniform value [%s]!\n", name);
+                printf("WARN: Invalid type for uniform value [%s]!\n",
+                       un->name);
                 return;
             }
         case 2:
-            glUniformMatrix4x2fv(un->location, un->count, un->transpose,
+            glUniformMatrix4x2fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         case 3:
-            glUniformMatrix4x3fv(un->location, un->count, un->transpose,
+            glUniformMatrix4x3fv(location, un->count, un->transpose,
                                  (const GLfloat*)data);
             return;
         case 4:
-            glUniformMatrix4fv(un->location, un->count, un->transpose,
+            glUniformMatrix4fv(location, un->count, un->transpose,
                                (const GLfloat*)data);
             return;
         default:
@@ -1237,28 +1890,75 @@ void sstSetUniformData( sstProgram *program, char *name, GLvoid *data ) {
  */
 void sstFreeDrawableSet( sstDrawableSet *set ) {
     sstDrawable *d;
+    if( sst_threaded && sstRenderFreeSet(set) ) {
+        return;
+    }
     /* Step 1: Delete OpenGL objects */
-    glDeleteVertexArrays(1, &set->vao);
+    sstDeleteVertexArrays(1, &set->vao);
     for( d = set->drawables; d < set->drawables + set->size; d++ ) {
-        glDeleteBuffers(1, &d->buffer);
+        sstDeleteBuffers(1, &d->buffer);
+    }
+    if( set->i_buffer ) {
+        sstDeleteBuffers(1, &set->i_buffer);
     }
     /* Step 2: Free memory */
     free(set->drawables);
+    free(set->lods);
+    if( set->bvh ) {
+        sstFreeBVH(set->bvh);
+    }
     free(set);
 }
 
+/*
+ * Frees the given sstInstanceBuffer object, deleting with it all related
+ * OpenGL objects.
+ */
+void sstFreeInstanceBuffer( sstInstanceBuffer *buffer ) {
+    sstDrawable *d;
+    if( sst_threaded && sstRenderFreeBuffer(buffer) ) {
+        return;
+    }
+    /* Step 1: Delete OpenGL objects */
+    for( d = buffer->drawables; d < buffer->drawables + buffer->size; d++ ) {
+        sstDeleteBuffers(1, &d->buffer);
+    }
+    /* Step 2: Free memory */
+    free(buffer->drawables);
+    free(buffer);
+}
+
 /*
  * Frees the given sstProgram object, deleting with it all related OpenGL
  * objects.
  */
 void sstFreeProgram( sstProgram *program ) {
     int i;
+    if( sst_threaded && sstRenderFreeProgram(program) ) {
+        return;
+    }
     /* Step 1: Delete OpenGL objects */
+    if( program->variant ) {
+        sstFreeVariant(program->variant);
+    }
+#ifdef GL_SHADER_STORAGE_BUFFER
+    if( program->pulling ) {
+        sstFreePulling(program->pulling);
+    }
+#endif
     for( i = 0; i < program->shader_count; i++ ) {
         glDeleteShader(program->shaders[i]);
     }
     glDeleteProgram(program->program);
+    if( sst_active == program ) {
+        sst_active = NULL;
+    }
+    sstForgetImmediate(program);
     /* Step 2: Free memory */
+    for( i = 0; i < program->un_count; i++ ) {
+        free(program->uniforms[i].value);
+    }
+    sstFreeSources(program);
     free(program->inputs);
     free(program->uniforms);
     free(program->shaders);
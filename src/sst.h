@@ -10,17 +10,71 @@
  * Stuff from sst.c
  */
 #include <stdarg.h>
+#include <stddef.h>
 
 /* Needed to get OpenGL 3+ bindings */
 #define GLFW_INCLUDE_GLCOREARB
 #include <GL/glfw3.h>
 
+/*
+ * Kinds of data an input variable can hold, used to pick a compressed format
+ * for it. See sstCompressInput().
+ */
+#define SST_UNCOMPRESSED     0
+#define SST_POSITION         1 /* Half floats */
+#define SST_POSITION_BOUNDED 2 /* Shorts normalized against the mesh bounds */
+#define SST_NORMAL           3 /* Packed 2_10_10_10 normalized ints */
+#define SST_OCTAHEDRAL       4 /* Octahedral encoded normalized shorts */
+#define SST_TEXCOORD         5 /* Half floats */
+
+/*
+ * Processing passes run over triangle meshes before they are uploaded. See
+ * sstOptimizeMeshes().
+ */
+#define SST_OPTIMIZE_CACHE    0x1 /* Triangle order for the vertex cache */
+#define SST_OPTIMIZE_OVERDRAW 0x2 /* Cluster order for less overdraw */
+#define SST_OPTIMIZE_FETCH    0x4 /* Vertex order for fetch locality */
+#define SST_OPTIMIZE_WELD     0x8 /* Merging of duplicate vertices */
+#define SST_OPTIMIZE_LOD      0x10 /* Simplified levels of detail */
+#define SST_OPTIMIZE_ALL      0x1F
+
+/*
+ * Weighting of the triangles around a vertex when generating normals. See
+ * sstGenerateNormals().
+ */
+#define SST_WEIGHT_AREA  0x1 /* By triangle area */
+#define SST_WEIGHT_ANGLE 0x2 /* By the angle of the triangle at the vertex */
+
+/*
+ * Shapes made by sstGenerateShape() and sstDrawableSetShape().
+ */
+#define SST_SPHERE  0 /* Radius a */
+#define SST_GRID    1 /* Flat in XZ facing +Y, a wide along X and b along Z */
+#define SST_TORUS   2 /* Ring radius a around Y, tube radius b */
+#define SST_CAPSULE 3 /* Radius a, cylinder length b along Y */
+
+/*
+ * GLSL function for decoding SST_OCTAHEDRAL normals in a vertex shader.
+ */
+#define SST_OCTAHEDRAL_GLSL \
+    "vec3 sstDecodeOctahedral(vec2 e) {\n" \
+    "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n" \
+    "    float t = max(-n.z, 0.0);\n" \
+    "    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n" \
+    "    return normalize(n);\n" \
+    "}\n"
+
 typedef struct {
     char *name;
     GLint location;
     GLenum type;
     GLuint size; /* Size of component, ie. sizeof(GLFLOAT) */
     GLuint components; /* Number of values per entry, ie. 3 for vec3 */
+    GLuint data_components; /* Values per entry in the data passed in */
+    GLuint slots; /* Number of attribute locations used, ie. 4 for mat4 */
+    GLuint divisor; /* 0 for per-vertex inputs, 1 for per-instance inputs */
+    int compress; /* Kind of data for compression, SST_UNCOMPRESSED if none */
+    GLfloat max_error; /* Largest error allowed when compressing */
 } in_var;
 
 typedef struct {
@@ -31,26 +85,49 @@ typedef struct {
     GLuint second; /* For matrices, number of rows. 0 otherwise */
     GLboolean transpose; /* Only for matrices */
     GLuint count;
+    GLboolean instanceable; /* Single float value only read by vertex shaders */
+    GLvoid *value; /* Last value set with sstSetUniformData() */
+    unsigned int replayed; /* Replay of command lists that last uploaded it */
 } uniform;
 
 typedef struct {
     in_var *inputs;
     int in_count;
+    int inst_count; /* Number of inputs that are per-instance */
     uniform *uniforms;
     int un_count;
     GLuint *shaders;
+    char **sources; /* Vertex shader sources, NULL for other shaders */
     int shader_count;
     GLuint program; /* Program ID */
+    struct sstVariant *variant; /* Instanced variants used by deferred drawing,
+                                 * most recently used first */
+    GLuint mesh_passes; /* Passes run on meshes, see sstOptimizeMeshes() */
+    GLfloat weld_epsilon; /* See sstWeldMeshes() */
+    int lod_levels; /* See sstGenerateLODs() */
+    GLfloat lod_ratio;
+    GLboolean build_bvh; /* See sstBuildBVHs() */
+    struct sstPulling *pulling; /* Vertex pulling state, see sstPullProgram() */
 } sstProgram;
 
 typedef struct {
     GLuint buffer; /* Buffer location */
     GLint location; /* Attribute location */
     GLuint components;
+    GLuint size; /* Size of component, ie. sizeof(GLFLOAT) */
+    GLuint slots; /* Number of attribute locations, ie. 4 for mat4 */
+    GLuint divisor; /* Attribute divisor, 0 for per-vertex data */
     GLenum type;
+    GLboolean normalized; /* Integer data is normalized to [-1,1] or [0,1] */
     GLboolean transpose;
 } sstDrawable;
 
+typedef struct {
+    GLuint first; /* Offset into the index buffer, in indices */
+    int size; /* Number of indices */
+    GLfloat error; /* Largest distance from the full mesh, in model space */
+} sstLOD;
+
 typedef struct {
     GLuint vao; /* Vertex array object for this set */
     int count; /* Number of inputs stored in the buffers */
@@ -60,8 +137,218 @@ typedef struct {
     int i_size; /* Size of indices, if this is an indexed drawable */
     GLenum i_type; /* Data type of indices: ubyte, ushort, uint */
     GLuint i_buffer; /* Buffer location if this is an index drawable, else 0 */
+    unsigned int inst_id; /* ID of the instance buffer bound to the vao, or 0 */
+    GLfloat scale[3]; /* Decodes SST_POSITION_BOUNDED positions, see */
+    GLfloat offset[3]; /* sstDrawableSetDecodeMatrix() */
+    GLfloat low[3]; /* Bounding box of the positions, in model space */
+    GLfloat high[3];
+    GLfloat center[3]; /* Bounding sphere of the positions, in model space */
+    GLfloat radius;
+    int lod_count; /* Number of levels of detail after the full mesh */
+    sstLOD *lods; /* Stored after the full mesh in the index buffer */
+    struct sstBVH *bvh; /* Triangles kept for ray casts, or NULL */
 } sstDrawableSet;
 
+typedef struct {
+    sstProgram *program; /* Program whose per-instance inputs are stored */
+    int size; /* Number of drawables */
+    int count; /* Number of instances stored in the buffers */
+    sstDrawable *drawables;
+    unsigned int id; /* Unique ID, used to skip redundant attribute setup */
+} sstInstanceBuffer;
+
+typedef struct {
+    int count; /* Number of entries */
+    int capacity;
+    sstDrawableSet **sets; /* Set of each entry */
+    /* World space bounds of each entry, one array per component so that they
+     * can be tested several at a time */
+    GLfloat *cx, *cy, *cz; /* Box centers, also the sphere centers */
+    GLfloat *ex, *ey, *ez; /* Box half extents */
+    GLfloat *radius; /* Sphere radii */
+    void *memory; /* Block holding the arrays */
+} sstCullList;
+
+typedef struct {
+    GLfloat *positions; /* 3 floats per vertex */
+    int count; /* Number of vertices */
+    GLuint *indices; /* Triangle list */
+    int i_count; /* Number of indices */
+} sstOccluder;
+
+typedef struct {
+    int width; /* Size of the depth buffer, in whole tiles */
+    int height;
+    int threads; /* Number of threads rasterizing */
+    int levels; /* Number of hierarchical-Z levels */
+    GLfloat **depth; /* Depth buffer, then each level holding the furthest
+                      * depth of the 2x2 block under it */
+    GLfloat viewProj[16]; /* Projection times view matrix of this frame */
+    struct sstOcclusionWork *work; /* Binned triangles */
+    /* Stats, reset by sstOcclusionBegin() */
+    int triangles; /* Occluder triangles rasterized */
+    int tested; /* Boxes tested */
+    int occluded; /* Boxes found hidden */
+    double raster_ms; /* Time spent setting up and rasterizing occluders */
+    double test_ms; /* Time spent testing boxes */
+} sstOcclusion;
+
+typedef struct {
+    GLfloat t; /* Distance to the hit, in lengths of the ray's direction */
+    GLfloat u; /* Barycentric coordinates of the hit on the triangle */
+    GLfloat v;
+    int triangle; /* Index of the triangle in the set's index buffer */
+    int instance; /* Index of the instance in the ray scene, or -1 */
+} sstRayHit;
+
+typedef struct {
+    int count; /* Number of instances */
+    int capacity;
+    sstDrawableSet **sets; /* Set of each instance */
+    GLfloat *models; /* Model matrix of each instance */
+    GLfloat *inverses; /* Inverse model matrices, to move rays to model space */
+    GLfloat *low; /* World space box of each instance */
+    GLfloat *high;
+    struct sstBVH *top; /* Hierarchy over the instance boxes */
+    GLboolean dirty; /* Instances changed since the hierarchy was built */
+} sstRayScene;
+
+typedef struct {
+    int count; /* Number of vertices */
+    GLfloat *positions; /* 3 floats per vertex */
+    GLfloat *normals; /* 3 floats per vertex, or NULL if the file has none */
+    GLfloat *texcoords; /* 2 floats per vertex, or NULL if the file has none */
+    int i_count; /* Number of indices */
+    GLuint *indices; /* Triangle list */
+} sstImportedMesh;
+
+/* Kinds of entry in an asset pack */
+#define SST_PACK_PROGRAM 1
+#define SST_PACK_SET 2
+
+typedef struct {
+    char name[48]; /* NUL terminated */
+    GLuint kind; /* SST_PACK_PROGRAM or SST_PACK_SET */
+    GLuint reserved;
+    GLuint64 offset; /* Of the entry's record in the pack */
+    GLuint64 size;
+} sstPackEntry;
+
+typedef struct {
+    const char *data; /* Mapping of the whole file */
+    size_t size;
+    int count; /* Number of entries */
+    const sstPackEntry *entries; /* Sorted by name, inside the mapping */
+} sstPack;
+
+typedef struct sstPackWriter sstPackWriter;
+
+typedef struct {
+    sstPack *pack; /* Pack the sets are streamed from */
+    sstProgram *program; /* Program the sets are made for */
+    size_t budget; /* Most bytes of streamed sets kept on the GPU */
+    size_t upload_budget; /* Bytes uploaded by each sstUpdateResidency() */
+    size_t resident; /* Bytes of streamed sets on the GPU */
+    size_t proxy_bytes; /* Bytes of proxies, which are always on the GPU */
+    int count; /* Number of sets */
+    int capacity;
+    struct sstResident *sets;
+    int newest; /* Resident sets, from the most recently drawn to the least */
+    int oldest;
+    unsigned int frame; /* Number of sstUpdateResidency() calls so far */
+    struct sstLoader *loader; /* Thread reading sets in from the pack */
+    /* Stats of the last sstUpdateResidency() */
+    int loads; /* Sets uploaded */
+    int evictions; /* Sets freed to make room */
+    int pending; /* Sets asked for and not yet uploaded */
+    size_t uploaded; /* Bytes uploaded */
+} sstResidency;
+
+typedef struct sstUploader sstUploader;
+typedef struct sstAsyncSet sstAsyncSet;
+
+/*
+ * Everything a pipeline sets when bound. See sstDefaultPipelineState().
+ */
+typedef struct {
+    sstProgram *program;
+    GLboolean depth_test;
+    GLenum depth_func;
+    GLboolean depth_write;
+    GLboolean blend;
+    GLenum blend_src; /* Blend factors */
+    GLenum blend_dst;
+    GLenum blend_equation;
+    GLboolean cull;
+    GLenum cull_face;
+    GLenum front_face;
+    GLboolean stencil_test;
+    GLenum stencil_func;
+    GLint stencil_ref;
+    GLuint stencil_mask; /* Mask for the stencil test */
+    GLenum stencil_fail; /* Stencil operations */
+    GLenum stencil_depth_fail;
+    GLenum stencil_pass;
+    GLuint stencil_write; /* Mask for stencil writes */
+    GLboolean color_write[4];
+    GLint viewport[4]; /* x, y, width, height; left alone if width is 0 */
+} sstPipelineState;
+
+typedef struct sstPipeline sstPipeline;
+typedef struct sstCommandList sstCommandList;
+typedef struct sstFrames sstFrames;
+
+/*
+ * Multi-draw-indirect batches need shader storage buffers, which are only
+ * available in later versions of OpenGL.
+ */
+#ifdef GL_SHADER_STORAGE_BUFFER
+typedef struct {
+    GLuint count; /* Number of indices */
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} sstDrawCommand;
+
+typedef struct {
+    GLfloat model[16]; /* Model matrix */
+    GLuint material; /* Material index */
+    GLuint padding[3]; /* std430 rounds the struct up to 16 bytes */
+} sstDrawData;
+
+typedef struct {
+    sstDrawableSet *set; /* Set the geometry was copied from */
+    GLint baseVertex; /* Offset of the vertices in the batch buffers */
+    GLuint firstIndex; /* Offset of the indices in the batch index buffer */
+    GLuint count; /* Number of indices */
+} sstBatchMesh;
+
+typedef struct {
+    GLuint vao; /* Vertex array object for the merged buffers */
+    GLenum mode; /* Draw mode, ie. GL_TRIANGLES */
+    GLenum i_type; /* Data type of indices: ubyte, ushort, uint */
+    sstDrawable *drawables; /* One merged buffer per input */
+    int size; /* Number of drawables */
+    int count; /* Number of vertices stored */
+    int capacity; /* Number of vertices there is room for */
+    GLuint i_buffer; /* Merged index buffer */
+    int i_count; /* Number of indices stored */
+    int i_capacity; /* Number of indices there is room for */
+    sstBatchMesh *meshes; /* Geometry of every set added so far */
+    int mesh_count;
+    int mesh_size;
+    sstDrawCommand *commands; /* One command per draw */
+    sstDrawData *draws; /* One entry per draw, indexed by gl_DrawID */
+    int draw_count;
+    int draw_size;
+    GLuint c_buffer; /* Indirect command buffer */
+    GLuint d_buffer; /* Shader storage buffer holding the draw data */
+    GLuint binding; /* Shader storage binding point for the draw data */
+    GLboolean dirty; /* Draws changed since they were last uploaded */
+} sstBatch;
+#endif
+
 /*
  * Displays any OpenGL errors to stdout. Since some of the error types have been
  * removed in later versions of OpenGL, we check if they exist in the
@@ -97,7 +384,7 @@ void sstActivateProgram( sstProgram *program );
  * Note that the count is the number of items in the dataset relative to its
  * GLSL type. Eg. given an array of six floats representing the dataset for a
  * series of 'vec3' values, count would be 2 because there are 2 'vec3's being
- * passed in.
+ * passed in. Returns NULL if a name isn't an input variable of the program.
  */
 sstDrawableSet * sstDrawableSetArrays( sstProgram *program, GLenum mode,
 int count, ... );
@@ -111,7 +398,8 @@ int count, ... );
  * Note that the component count is the number of items in the dataset relative
  * to its GLSL type. Eg. given an array of six floats representing the dataset
  * for a series of 'vec3' values, count would be 2 because there are 2 'vec3's
- * being passed in.
+ * being passed in. Returns NULL if a name isn't an input variable of the
+ * program.
  */
 sstDrawableSet * sstDrawableSetElements( sstProgram *program, GLenum mode,
 int count, void *indices, GLenum i_type, int i_count, ... );
@@ -122,6 +410,199 @@ int count, void *indices, GLenum i_type, int i_count, ... );
  */
 void sstDrawSet( sstDrawableSet *set );
 
+/*
+ * Turns on compression of the data for the given input variable when drawable
+ * sets are created with the program. The kind of data determines the one
+ * compact format tried, which is used if no component is off by more than
+ * max_error. Otherwise the data is left as floats, or for SST_OCTAHEDRAL, as
+ * the encoded vec2 in floats.
+ * SST_POSITION:         half floats (vec3 or vec4)
+ * SST_POSITION_BOUNDED: shorts normalized against the bounds of the mesh. The
+ *                       shader gets positions in [-1,1], and the model matrix
+ *                       must be multiplied by sstDrawableSetDecodeMatrix().
+ * SST_NORMAL:           INT_2_10_10_10_REV normalized, for unit normals and
+ *                       tangents (vec3 or vec4, the w sign is kept)
+ * SST_OCTAHEDRAL:       two normalized shorts. Takes unit vec3 data, but the
+ *                       input must be a vec2 decoded in the shader with the
+ *                       function in SST_OCTAHEDRAL_GLSL.
+ * SST_TEXCOORD:         half floats
+ * Only float vector inputs can be compressed. Defined in sst_quantize.c.
+ */
+void sstCompressInput( sstProgram *program, char *name, int kind,
+GLfloat max_error );
+
+/*
+ * Fills in the matrix that turns the positions of a set compressed with
+ * SST_POSITION_BOUNDED back into the original positions. It is the identity
+ * matrix for sets without bounded positions.
+ */
+void sstDrawableSetDecodeMatrix( sstDrawableSet *set, GLfloat *mat );
+
+/*
+ * Returns the number of bytes of vertex and index data the given set holds on
+ * the GPU.
+ */
+GLsizeiptr sstDrawableSetBytes( sstDrawableSet *set );
+
+/*
+ * Turns on processing of the triangle meshes given to sstDrawableSetElements()
+ * with the program. passes is a combination of:
+ * SST_OPTIMIZE_WELD:     merges vertices whose data is the same for every
+ *                        input. Also applies to sstDrawableSetArrays(), whose
+ *                        sets then become indexed. See sstWeldMeshes().
+ * SST_OPTIMIZE_CACHE:    reorders triangles so that vertices are reused while
+ *                        they are still in the post-transform cache.
+ * SST_OPTIMIZE_OVERDRAW: splits the triangles into clusters and draws the ones
+ *                        facing out from the middle of the mesh first, so that
+ *                        they hide the rest. Includes SST_OPTIMIZE_CACHE.
+ * SST_OPTIMIZE_FETCH:    reorders vertices into the order they are first used,
+ *                        dropping unused ones.
+ * The data for every input is reordered to match, and the indices are stored
+ * with the narrowest type that can hold them, whatever type they were given in.
+ * Overdraw sorting needs the positions, taken from the input with "Position" in
+ * its name, or else the first vec3 or vec4 input. Pass 0 to turn processing off
+ * again.
+ * Defined in sst_mesh.c.
+ */
+void sstOptimizeMeshes( sstProgram *program, GLuint passes );
+
+/*
+ * Turns on SST_OPTIMIZE_WELD for the program, leaving any other passes as they
+ * are. Float components are rounded to the nearest multiple of epsilon before
+ * vertices are compared, or compared exactly if epsilon is 0. The first of
+ * each group of welded vertices is the one kept.
+ */
+void sstWeldMeshes( sstProgram *program, GLfloat epsilon );
+
+/*
+ * Turns on SST_OPTIMIZE_LOD for the program, leaving any other passes as they
+ * are. Up to levels simplified versions of each triangle mesh are made by edge
+ * collapse with quadric error metrics, each with about ratio times the
+ * triangles of the one before. They share the vertices of the full mesh and are
+ * stored in its set, for sstDrawSetLOD() to pick from. Borders of the mesh can
+ * only slide along themselves, and vertices on seams, where several vertices
+ * share a position, are never moved. The defaults are 4 levels with a ratio of
+ * 0.5. The chain ends early once a level can't be simplified any further.
+ * Defined in sst_lod.c.
+ */
+void sstGenerateLODs( sstProgram *program, int levels, GLfloat ratio );
+
+/*
+ * Draws the coarsest level of detail of the given set whose error, projected
+ * onto the screen, is at most the given number of pixels. model is the matrix
+ * taking the set into eye space, projection is a matrix made by
+ * sstPerspectiveMatrix(), and height is the height of the viewport in pixels.
+ * Returns the level drawn, 0 being the full mesh. Assumes the correct program
+ * is currently active. When deferring or queueing, the level is picked now and
+ * recorded. With the render thread running, the level is picked by the render
+ * thread and 0 is returned.
+ */
+int sstDrawSetLOD( sstDrawableSet *set, GLfloat *model, GLfloat *projection,
+GLfloat height, GLfloat pixels );
+
+/*
+ * Runs indices for a triangle list through a FIFO post-transform cache of the
+ * given size, and fills in the average number of cache misses per triangle
+ * (ACMR, from 0.5 at best to 3) and per vertex (ATVR, 1 at best).
+ */
+void sstVertexCacheStats( void *indices, GLenum i_type, int i_count, int count,
+int cache_size, GLfloat *acmr, GLfloat *atvr );
+
+/*
+ * Same as sstVertexCacheStats(), for the indices of a set as stored on the GPU.
+ */
+void sstDrawableSetCacheStats( sstDrawableSet *set, int cache_size,
+GLfloat *acmr, GLfloat *atvr );
+
+/*
+ * Generates an instance buffer. Input variables whose names start with "inst_"
+ * are per-instance inputs: they advance once per instance rather than once per
+ * vertex, and are skipped by sstDrawableSetArrays() and
+ * sstDrawableSetElements(). The name is the only thing that marks an input as
+ * per-instance; no qualifier in the shader does. This function takes in an
+ * sstProgram, the number of instances, and a number of pair values consisting
+ * of the name of a per-instance input variable in the program followed by its
+ * data.
+ * Eg. given "in mat4 inst_modelMatrix;" in the vertex shader, passing 100 for
+ * count expects an array of 1600 floats for "inst_modelMatrix".
+ */
+sstInstanceBuffer * sstNewInstanceBuffer( sstProgram *program, int count,
+... );
+
+/*
+ * Replaces the contents of an instance buffer. Takes the same pair values as
+ * sstNewInstanceBuffer(). The buffer storage is orphaned rather than
+ * overwritten, so updating every frame does not wait on earlier draws.
+ */
+void sstUpdateInstanceBuffer( sstInstanceBuffer *buffer, int count, ... );
+
+/*
+ * Draws count instances of the given sstDrawableSet with a single draw call,
+ * pulling per-instance inputs from the given instance buffer. Assumes the
+ * correct program is currently active.
+ */
+void sstDrawSetInstanced( sstDrawableSet *set, sstInstanceBuffer *buffer,
+int count );
+
+/*
+ * Starts deferred drawing. Until sstFlushDeferred() is called, calls to
+ * sstActivateProgram(), sstSetUniformData(), sstBindPipeline(), sstDrawSet()
+ * and sstDrawSetInstanced() are recorded rather than executed. Any other OpenGL
+ * calls still happen immediately. Pipelines bound must outlive the flush.
+ */
+void sstBeginDeferred();
+
+/*
+ * Executes everything recorded since sstBeginDeferred() and stops deferring.
+ * Runs of sstDrawSet() calls on the same set and program, where only uniform
+ * values change between the draws, are merged into a single instanced draw.
+ * The changing uniforms are packed into an instance buffer and read by an
+ * instanced variant of the program, in which they are turned into per-instance
+ * inputs. Only uniforms holding a single float, vector or matrix that are not
+ * used by the fragment shader can be merged this way.
+ */
+void sstFlushDeferred();
+
+/*
+ * Starts queueing draws. Until sstFlushQueue() is called, calls to
+ * sstActivateProgram(), sstSetUniformData(), sstBindPipeline(), sstDrawSet()
+ * and sstDrawSetInstanced() are recorded rather than executed, each draw
+ * keeping the uniform values its program had, and the pipeline bound, when it
+ * was queued. Can't be used while deferring. Defined in sst_queue.c.
+ */
+void sstBeginQueue( void );
+
+/*
+ * Sets the material of the draws queued after it, and whether they are
+ * blended. Materials are numbers picked by the caller; draws with the same
+ * material are expected to share uniform values, such as colors, and are
+ * drawn together. Blended draws are drawn after the rest, back to front.
+ */
+void sstQueueMaterial( GLuint material, GLboolean blended );
+
+/*
+ * Sets the distance from the camera of the draws queued after it. Draws that
+ * aren't blended are drawn front to back among those sharing their program,
+ * material and set.
+ */
+void sstQueueDepth( GLfloat distance );
+
+/*
+ * Sorts the queued draws by pipeline, program, material, set and depth,
+ * executes them and stops queueing. Pipelines and programs are switched, and
+ * uniforms uploaded, only when they change from one draw to the next. Draws
+ * queued with no pipeline bound come first, with the state as it is now.
+ * Afterwards, uniform values, the bound pipeline and the active program are as
+ * if every call had been executed in order. Returns the number of draws
+ * executed.
+ */
+int sstFlushQueue( void );
+
+/*
+ * Frees the memory used for queueing draws.
+ */
+void sstFreeQueue( void );
+
 /*
  * Sets the given uniform variable to the given value.
  * DEV NOTE: Some of these functions are only defined in OpenGL versions later
@@ -130,12 +611,857 @@ void sstDrawSet( sstDrawableSet *set );
  */
 void sstSetUniformData( sstProgram *program, char *name, GLvoid *data );
 
+#ifdef GL_SHADER_STORAGE_BUFFER
+/*
+ * Generates an empty batch for drawing many sets with a single
+ * glMultiDrawElementsIndirect() call. Every set added must have the layout of
+ * the given program, and use the given draw mode. Indices are stored with the
+ * given index type. The per-draw data is bound as a shader storage buffer at
+ * the given binding point, and should be declared in the vertex shader as:
+ *     struct sstDrawData { mat4 model; uint material; };
+ *     layout(std430, binding = N) buffer sstDraws { sstDrawData draws[]; };
+ * and indexed with gl_DrawID (or gl_DrawIDARB).
+ * Defined in sst_batch.c.
+ */
+sstBatch * sstNewBatch( sstProgram *program, GLenum mode, GLenum i_type,
+GLuint binding );
+
+/*
+ * Adds a draw of the given set to the batch, with the given model matrix and
+ * material index. The geometry of the set is copied into the batch on the GPU
+ * the first time the set is added, so later draws of the same set are cheap.
+ * Returns the index of the draw, or -1 if the set doesn't fit the batch.
+ */
+int sstBatchAdd( sstBatch *batch, sstDrawableSet *set, GLfloat *model,
+GLuint material );
+
+/*
+ * Changes the model matrix and material index of a draw in the batch.
+ */
+void sstBatchSetDraw( sstBatch *batch, int draw, GLfloat *model,
+GLuint material );
+
+/*
+ * Removes every draw from the batch. Geometry already copied into the batch is
+ * kept, so re-adding the same sets is cheap.
+ */
+void sstBatchClear( sstBatch *batch );
+
+/*
+ * Draws every draw in the batch with a single call. Assumes the correct program
+ * is currently active.
+ */
+void sstDrawBatch( sstBatch *batch );
+
+/*
+ * Frees the given sstBatch object, deleting with it all related OpenGL
+ * objects. The sets added to it are not freed.
+ */
+void sstFreeBatch( sstBatch *batch );
+#endif
+
+#ifdef GL_SHADER_STORAGE_BUFFER
+/*
+ * Rebuilds the program so that its vertex shader pulls the per-vertex inputs
+ * out of shader storage buffers by gl_VertexID, rather than having them fed in
+ * through vertex arrays. The vertex shader is recompiled with its per-vertex
+ * "in" declarations turned into globals and with fetch code generated from the
+ * program's inputs run ahead of its main(). Each input takes one binding point
+ * starting at the given binding, and the indices the one after those, so the
+ * shader must not use those itself. Uniform values are kept. Once pulling,
+ * sstDrawSet() and sstDrawSetLOD() bind the buffers of each set directly and
+ * leave one shared vertex array bound, so sets with different layouts or
+ * compression don't cost vertex array switches. Per-instance inputs still come
+ * through attributes. Array inputs, double inputs and programs with several
+ * vertex shaders can't be pulled, and batches need a program that isn't
+ * pulling. Returns GL_TRUE on success, leaving the program as it was
+ * otherwise. Defined in sst_pull.c.
+ */
+GLboolean sstPullProgram( sstProgram *program, GLuint binding );
+#endif
+
+/*
+ * Generates an empty cull list with room for capacity entries. A cull list
+ * holds the world space bounds of sets to be frustum culled together, kept in
+ * a layout that lets them be tested with SSE, or AVX when built with it.
+ * Defined in sst_cull.c.
+ */
+sstCullList * sstNewCullList( int capacity );
+
+/*
+ * Adds a set drawn with the given model matrix to the list. The bounding box
+ * and sphere of the set are moved into world space now, so they don't need to
+ * be transformed when culling. Returns the index of the entry.
+ */
+int sstCullListAdd( sstCullList *list, sstDrawableSet *set, GLfloat *model );
+
+/*
+ * Changes the model matrix of an entry in the list.
+ */
+void sstCullListMove( sstCullList *list, int index, GLfloat *model );
+
+/*
+ * Removes every entry from the list.
+ */
+void sstCullListClear( sstCullList *list );
+
+/*
+ * Fills in the six planes of the frustum of the given projection times view
+ * matrix, as 24 floats (a, b, c, d) with unit normals pointing into the
+ * frustum, in the order left, right, bottom, top, near, far.
+ */
+void sstFrustumPlanes( GLfloat *viewProj, GLfloat *planes );
+
+/*
+ * Tests every entry in the list against the frustum of the given projection
+ * times view matrix. Fills in the indices of the visible entries, which must
+ * have room for every entry, and returns how many there are. Entries are
+ * visible unless their box or sphere is entirely outside one of the planes.
+ */
+int sstCullFrustum( sstCullList *list, GLfloat *viewProj, int *visible );
+
+/*
+ * Frees the given cull list. The sets in it are not freed.
+ */
+void sstFreeCullList( sstCullList *list );
+
+/*
+ * Generates an occluder from the given positions (3 floats each) and indices
+ * of a triangle mesh, which are copied. Occluders are usually a few large,
+ * simple shapes standing in for the walls and floors of a scene. Defined in
+ * sst_occlusion.c.
+ */
+sstOccluder * sstNewOccluder( GLfloat *positions, int count, void *indices,
+GLenum i_type, int i_count );
+
+/*
+ * Frees the given occluder.
+ */
+void sstFreeOccluder( sstOccluder *occluder );
+
+/*
+ * Generates an occlusion culler with a width by height depth buffer, which is
+ * rounded up to whole 32x32 tiles, rasterized by the given number of threads.
+ * The extra threads are started here and kept until sstFreeOcclusion(), so
+ * rasterizing each frame doesn't pay for starting them. Everything happens on
+ * the CPU, so no OpenGL context or GLFW is needed.
+ */
+sstOcclusion * sstNewOcclusion( int width, int height, int threads );
+
+/*
+ * Starts a new frame with the given projection times view matrix, clearing
+ * the depth buffer and the stats.
+ */
+void sstOcclusionBegin( sstOcclusion *occ, GLfloat *viewProj );
+
+/*
+ * Adds an occluder drawn with the given model matrix. Its triangles are
+ * clipped, projected and sorted into tiles now. Both sides of each triangle
+ * occlude.
+ */
+void sstOcclusionAddOccluder( sstOcclusion *occ, sstOccluder *occluder,
+GLfloat *model );
+
+/*
+ * Rasterizes every occluder added this frame, with the tiles shared out
+ * between threads, then builds the hierarchical-Z levels.
+ */
+void sstOcclusionRasterize( sstOcclusion *occ );
+
+/*
+ * Returns 1 if any of the world space box from low to high might be visible
+ * past the occluders, or 0 if it is hidden behind them or off the screen.
+ * Boxes crossing the near plane are always visible.
+ */
+int sstOcclusionTestBox( sstOcclusion *occ, GLfloat *low, GLfloat *high );
+
+/*
+ * Returns 1 if the given set drawn with the given model matrix might be
+ * visible past the occluders.
+ */
+int sstOcclusionTest( sstOcclusion *occ, sstDrawableSet *set,
+GLfloat *model );
+
+/*
+ * Tests count entries of a cull list, given by their indices in visible as
+ * filled in by sstCullFrustum(), removing the hidden ones. Returns the number
+ * left.
+ */
+int sstOcclusionCull( sstOcclusion *occ, sstCullList *list, int *visible,
+int count );
+
+/*
+ * Frees the given occlusion culler. Occluders added to it are not freed.
+ */
+void sstFreeOcclusion( sstOcclusion *occ );
+
+/*
+ * Fills in smooth normals, 3 floats per vertex, for a triangle mesh with the
+ * given positions, 3 floats each. Indices may be NULL for unindexed triangles,
+ * in which case i_count is ignored. Each normal is the sum of the normals of
+ * the triangles around the vertex, weighted by the SST_WEIGHT_ flags given,
+ * both together, or neither for a plain average. Triangles are wound
+ * counter-clockwise. The work is split between the given number of threads.
+ * The result can be passed straight to the drawable set constructors.
+ * Defined in sst_normals.c.
+ */
+void sstGenerateNormals( GLfloat *positions, int count, void *indices,
+GLenum i_type, int i_count, int weighting, int threads, GLfloat *normals );
+
+/*
+ * Fills in tangents, 4 floats per vertex, for a triangle mesh with the given
+ * positions, unit normals (3 floats each) and texture coordinates (2 floats
+ * each). Tangents follow the conventions of MikkTSpace: xyz points along
+ * increasing s, perpendicular to the normal, and w is the sign of the
+ * bitangent, which shaders rebuild as w * cross(normal, tangent). Vertices are
+ * not split where the tangent space of the triangles around them disagrees,
+ * so meshes should be split along texture seams and mirrored halves first.
+ */
+void sstGenerateTangents( GLfloat *positions, GLfloat *normals,
+GLfloat *texcoords, int count, void *indices, GLenum i_type, int i_count,
+int threads, GLfloat *tangents );
+
+/*
+ * Fills in the number of vertices and indices of a shape, tessellated with the
+ * given number of rings (rows from top to bottom, or around the tube of a
+ * torus, or per hemisphere of a capsule) and segments (columns around the Y
+ * axis, or along X for a grid). Returns 0 if the tessellation is too coarse
+ * for the shape. Defined in sst_shapes.c.
+ */
+int sstShapeCounts( int shape, int rings, int segments, int *count,
+int *i_count );
+
+/*
+ * Writes the vertices and indices of a shape, sized by a and b as described
+ * for each SST_ shape, into memory with room for the counts given by
+ * sstShapeCounts(), such as mapped buffers. Positions and normals are 3 floats
+ * each and texture coordinates 2. Any of them, or the indices, may be NULL to
+ * skip them. Base is added to every index, so several shapes can share
+ * buffers. Vertices are only repeated along texture seams and at poles, and
+ * triangles are ordered in bands narrow enough for the vertex cache.
+ */
+void sstGenerateShape( int shape, int rings, int segments, GLfloat a,
+GLfloat b, GLfloat *positions, GLfloat *normals, GLfloat *texcoords,
+void *indices, GLenum i_type, GLuint base );
+
+/*
+ * Generates an indexed triangle set of a shape, writing it straight into
+ * mapped buffers with the narrowest index type that fits. The positions,
+ * normals and texture coordinates go to the inputs with the given names, which
+ * must be vec3, vec3 and vec2. Any name may be NULL, but the names given must
+ * cover every per-vertex input of the program. Programs that process meshes,
+ * build BVHs or compress inputs need the data on the CPU first, and get it
+ * generated there and passed on as sstDrawableSetElements() would. So does
+ * every set made while the render thread is running.
+ */
+sstDrawableSet * sstDrawableSetShape( sstProgram *program, int shape,
+int rings, int segments, GLfloat a, GLfloat b, char *position, char *normal,
+char *texcoord );
+
+/*
+ * Returns the most bytes sstEncodeVertices() can need for count vertices of
+ * vertex_size bytes each. Defined in sst_codec.c.
+ */
+size_t sstEncodeVerticesBound( int count, int vertex_size );
+
+/*
+ * Encodes count vertices of vertex_size bytes each, which must be a multiple of
+ * 4 up to 256, into the given buffer. Each byte of the vertex is coded as the
+ * difference from the same byte of the previous vertex, bit packed in groups
+ * of 16, so data where neighbouring vertices are alike (ie. after
+ * sstOptimizeMeshes() with SST_OPTIMIZE_FETCH, or quantized) shrinks the most.
+ * Returns the number of bytes written, or 0 if the buffer is too small.
+ */
+size_t sstEncodeVertices( unsigned char *buffer, size_t size,
+const void *vertices, int count, int vertex_size );
+
+/*
+ * Decodes vertices encoded by sstEncodeVertices(), with SSE2 when built with
+ * it. The destination is only ever written, in order, so it can be mapped
+ * buffer memory. Returns 1 on success, or 0 if the buffer is corrupt.
+ */
+int sstDecodeVertices( void *vertices, int count, int vertex_size,
+const unsigned char *buffer, size_t size );
+
+/*
+ * Returns the most bytes sstEncodeIndices() can need for i_count indices.
+ */
+size_t sstEncodeIndicesBound( int i_count );
+
+/*
+ * Encodes i_count indices of the given type into the given buffer. Triangle
+ * lists are coded against the edges and vertices of recent triangles, which
+ * takes about a byte per triangle for meshes ordered for the vertex cache.
+ * Each triangle may come back rotated, with the same winding. Other modes are
+ * coded as differences between indices. Returns the number of bytes written,
+ * or 0 if the buffer is too small.
+ */
+size_t sstEncodeIndices( unsigned char *buffer, size_t size, GLenum mode,
+const void *indices, GLenum i_type, int i_count );
+
+/*
+ * Decodes indices encoded by sstEncodeIndices() into an array of the given
+ * type. Returns 1 on success, or 0 if the buffer is corrupt or any index isn't
+ * below count.
+ */
+int sstDecodeIndices( void *indices, GLenum i_type, int i_count, int count,
+const unsigned char *buffer, size_t size );
+
+/*
+ * Generates a drawable set from encoded streams. Takes the draw mode, the
+ * number of vertices, the encoded indices with their size in bytes and the
+ * number of indices (NULL, 0 and 0 for an unindexed set), then a triple for
+ * each per-vertex input: its name, its vertices encoded with the layout of
+ * the input, and the size of the encoded data as a size_t. Every stream is
+ * decoded straight into mapped buffers, with the narrowest index type that
+ * fits. The bounding sphere is the one around the bounding box. Programs that
+ * process meshes, build BVHs or compress inputs need the data on the CPU
+ * first, and get it decoded there and passed on as sstDrawableSetElements()
+ * would, as does every set made while the render thread is running. Returns
+ * NULL if a stream is corrupt.
+ */
+sstDrawableSet * sstDrawableSetEncoded( sstProgram *program, GLenum mode,
+int count, const unsigned char *indices, size_t i_size, int i_count, ... );
+
+/*
+ * Loads a triangle mesh from a Wavefront OBJ file, or a PLY file in ASCII or
+ * either binary byte order, told apart by their contents. The file is mapped
+ * into memory and parsed by the given number of threads, each taking a share
+ * of its lines, or of its items for binary PLY. Polygons are split into fans
+ * of triangles. OBJ corners are welded into one vertex for each different
+ * combination of position, texture coordinate and normal they index, numbered
+ * in the order they are first used. PLY vertices are kept as they are. The
+ * arrays can be passed straight to sstDrawableSetElements(). Returns NULL if
+ * the file can't be read or is malformed. Defined in sst_import.c.
+ */
+sstImportedMesh * sstImportMesh( const char *path, int threads );
+
+/*
+ * Frees the given imported mesh and its arrays.
+ */
+void sstFreeImportedMesh( sstImportedMesh *mesh );
+
+/*
+ * Starts writing an asset pack to the given path. Programs and drawable sets
+ * are added by name with the functions below, then the pack is finished with
+ * sstClosePackWriter(). Returns NULL if the file can't be created. Defined in
+ * sst_pack.c.
+ */
+sstPackWriter * sstNewPackWriter( const char *path );
+
+/*
+ * Builds a program from the given shader files, as sstNewProgram() does, and
+ * adds its sources, the tables of variables parsed from them, and its binary
+ * where the driver can give one. Returns 1 on success.
+ */
+int sstPackWriteProgram( sstPackWriter *writer, const char *name,
+                         const char **files, int count );
+
+/*
+ * Adds the given set, made with the given program, by reading its buffers
+ * back from the GPU. Levels of detail are kept, ray cast hierarchies are not.
+ * Returns 1 on success.
+ */
+int sstPackWriteSet( sstPackWriter *writer, const char *name,
+                     sstProgram *program, sstDrawableSet *set );
+
+/*
+ * Adds the coarsest level of detail of the given set as a set of its own,
+ * holding only the vertices that level uses. Streamed sets can draw it while
+ * their full data is loading, see sstResidencyAdd(). Returns 1 on success, or
+ * 0 if the set has no levels of detail.
+ */
+int sstPackWriteProxy( sstPackWriter *writer, const char *name,
+                       sstProgram *program, sstDrawableSet *set );
+
+/*
+ * Writes the pack's table of contents and closes it. Returns 1 on success.
+ */
+int sstClosePackWriter( sstPackWriter *writer );
+
+/*
+ * Maps the asset pack at the given path into memory. Returns NULL if it can't
+ * be read or isn't a pack.
+ */
+sstPack * sstOpenPack( const char *path );
+
+/*
+ * Creates the program with the given name from a pack. Its variables come
+ * from the pack rather than from parsing its sources, and its binary is loaded
+ * if the driver accepts it, else its sources are compiled from the mapping.
+ * Variable names point into the pack, which must stay open while the program
+ * is in use. Free with sstFreeProgram().
+ */
+sstProgram * sstPackProgram( sstPack *pack, const char *name );
+
+/*
+ * Creates the drawable set with the given name from a pack, for the given
+ * program or one with inputs of the same names. Buffers are uploaded straight
+ * from the mapping, or from a copy of it by the render thread when that is
+ * running. Free with sstFreeDrawableSet().
+ */
+sstDrawableSet * sstPackDrawableSet( sstPack *pack, const char *name,
+                                     sstProgram *program );
+
+/*
+ * Unmaps the given pack. Programs made from it must be freed first.
+ */
+void sstClosePack( sstPack *pack );
+
+/*
+ * Creates a residency manager, which streams drawable sets in from the given
+ * pack as they are drawn, keeping at most budget bytes of them on the GPU. A
+ * loader thread reads sets from the disk, and sstUpdateResidency() uploads them
+ * on the calling thread, evicting the sets drawn the longest time ago when
+ * there's no room. The pack must stay open until the manager is freed.
+ * Defined in sst_residency.c.
+ */
+sstResidency * sstNewResidency( sstPack *pack, sstProgram *program,
+                                size_t budget );
+
+/*
+ * Adds the set with the given name in the pack. If proxy names a set, such as
+ * one written by sstPackWriteProxy(), it's uploaded now and kept, outside the
+ * budget, to be drawn in the set's place while it's loading. Returns the index
+ * of the set, or -1 if the pack has no such set.
+ */
+int sstResidencyAdd( sstResidency *res, const char *name, const char *proxy );
+
+/*
+ * Marks the set with the given index as needed this frame, so it won't be
+ * evicted until the next. Returns the set if it's on the GPU, else asks for it
+ * to be loaded and returns its proxy, or NULL if it has none. The returned set
+ * may be freed by the next sstUpdateResidency().
+ */
+sstDrawableSet * sstResidencyUse( sstResidency *res, int index );
+
+/*
+ * Ends a frame. Uploads the sets the loader has read, in the order they were
+ * asked for, until upload_budget bytes have been uploaded, evicting sets as
+ * needed to keep within the budget. Sets that weren't asked for in this frame
+ * or the one before are dropped rather than uploaded.
+ */
+void sstUpdateResidency( sstResidency *res );
+
+/*
+ * Stops the loader thread and frees every set and proxy, and the manager.
+ */
+void sstFreeResidency( sstResidency *res );
+
+/*
+ * Creates an uploader, which makes drawable sets on a worker thread so that
+ * the render thread never waits on their buffers being uploaded. Must be called
+ * on the main thread, with the context the sets will be drawn in current; the
+ * worker gets a hidden window whose context shares its objects. Returns NULL if
+ * that window can't be made. Defined in sst_upload.c.
+ */
+sstUploader * sstNewUploader( void );
+
+/*
+ * Queue drawable sets to be made by the uploader's worker, taking the same
+ * arguments as sstDrawableSetArrays() and sstDrawableSetElements(). The data
+ * isn't copied, so it must be kept until the set is ready. Meshes are processed
+ * on the worker too. Returns a handle to check with sstAsyncSetReady(), or
+ * NULL if a name isn't an input variable of the program.
+ */
+sstAsyncSet * sstDrawableSetArraysAsync( sstUploader *up,
+                                         sstProgram *program, GLenum mode,
+                                         int count, ... );
+sstAsyncSet * sstDrawableSetElementsAsync( sstUploader *up,
+                                           sstProgram *program, GLenum mode,
+                                           int count, void *indices,
+                                           GLenum i_type, int i_count, ... );
+
+/*
+ * Returns the set once the worker has uploaded it and its fence has signaled,
+ * making its vertex array in the current context and freeing the handle.
+ * Returns NULL without waiting if it isn't ready yet.
+ */
+sstDrawableSet * sstAsyncSetReady( sstUploader *up, sstAsyncSet *async );
+
+/*
+ * Lets the worker upload every queued set, then stops it and destroys its
+ * context. Every set should be collected with sstAsyncSetReady() first.
+ */
+void sstFreeUploader( sstUploader *up );
+
+/*
+ * Immediate mode drawing, in place of glBegin() and glEnd(). Primitives are
+ * staged with the active program, grouped by program and by the kind of
+ * primitive they make, until sstFlushImmediate() draws each group with one
+ * upload and one draw call. Points are given as arrays of 3 floats. Positions
+ * go to the vec3 or vec4 input with "Position" in its name, or the first such
+ * input, and the color set with sstColor(), white at first, to the input named
+ * in_Color if there is one. Defined in sst_immediate.c.
+ */
+void sstColor( GLfloat r, GLfloat g, GLfloat b, GLfloat a );
+void sstPoint( GLfloat *p );
+void sstLine( GLfloat *a, GLfloat *b );
+
+/*
+ * Stages a quad with corners a, b, c and d, in order around it, as two
+ * triangles.
+ */
+void sstQuad( GLfloat *a, GLfloat *b, GLfloat *c, GLfloat *d );
+
+/*
+ * Draws everything staged since the last flush, then makes the program that was
+ * active before active again. Returns the number of draw calls made. Nothing is
+ * drawn while deferring or queueing, and the primitives stay staged for the
+ * next flush.
+ */
+int sstFlushImmediate( void );
+
+/*
+ * Has immediate mode stream its vertices through the current frame's
+ * transient data, or through a buffer of its own, orphaned on each flush, if
+ * frames is NULL, as it does at first. Must be set back to NULL before the
+ * frames are freed. See sstNewFrames().
+ */
+void sstImmediateFrames( sstFrames *frames );
+
+/*
+ * Frees the memory and GL objects used for immediate mode drawing.
+ */
+void sstFreeImmediate( void );
+
+/*
+ * Bind objects and set state through a copy of the state of the current
+ * context, kept for each context, skipping calls that wouldn't change
+ * anything. The toolkit sets all of its state this way. Texture units count
+ * from 0, and only the depth test, blending, face culling and the stencil test
+ * are kept by sstEnable() and sstDisable(). Defined in sst_state.c.
+ */
+void sstBindVertexArray( GLuint vao );
+void sstBindBuffer( GLenum target, GLuint buffer );
+void sstBindTexture( GLuint unit, GLenum target, GLuint texture );
+void sstEnable( GLenum cap );
+void sstDisable( GLenum cap );
+void sstDepthFunc( GLenum func );
+void sstDepthMask( GLboolean flag );
+void sstBlendFunc( GLenum src, GLenum dst );
+void sstBlendEquation( GLenum mode );
+void sstCullFace( GLenum mode );
+void sstFrontFace( GLenum mode );
+void sstStencilFunc( GLenum func, GLint ref, GLuint mask );
+void sstStencilOp( GLenum sfail, GLenum dpfail, GLenum dppass );
+void sstStencilMask( GLuint mask );
+void sstColorMask( GLboolean r, GLboolean g, GLboolean b, GLboolean a );
+void sstViewport( GLint x, GLint y, GLsizei width, GLsizei height );
+
+/*
+ * Delete objects, unbinding them in the copy of the current context's state.
+ * Objects bound through the functions above must be deleted with these.
+ */
+void sstDeleteBuffers( GLsizei n, GLuint *buffers );
+void sstDeleteVertexArrays( GLsizei n, GLuint *vaos );
+void sstDeleteTextures( GLsizei n, GLuint *textures );
+
+/*
+ * Forgets the copy of the current context's state, for when it has been
+ * changed with GL directly.
+ */
+void sstInvalidateState( void );
+
+/*
+ * Gets the number of calls made in the current context that were skipped,
+ * and that went to GL, since the counts were last reset. Resets them if reset
+ * is set.
+ */
+void sstStateStats( unsigned long *hits, unsigned long *misses,
+                    GLboolean reset );
+
+/*
+ * Forgets the copy of a context's state. Must be called before the context is
+ * destroyed.
+ */
+void sstForgetContext( GLFWwindow context );
+
+/*
+ * Frees the copies of every context's state, once no other thread is using the
+ * toolkit.
+ */
+void sstFreeStateCaches( void );
+
+/*
+ * Fills in the state a context starts out with, and no program, to be changed
+ * as needed before making a pipeline. Defined in sst_pipeline.c.
+ */
+void sstDefaultPipelineState( sstPipelineState *state );
+
+/*
+ * Makes a pipeline from a copy of the given state, which can't be changed
+ * afterwards. The vertex layout is the program's, since drawable sets are made
+ * for the inputs of a program. Returns NULL if the state has no program, or if
+ * there are too many pipelines.
+ */
+sstPipeline * sstNewPipeline( sstPipelineState *state );
+
+/*
+ * Returns the state a pipeline was made with, to be copied for making similar
+ * pipelines.
+ */
+const sstPipelineState * sstGetPipelineState( sstPipeline *pipeline );
+
+/*
+ * Binds a pipeline in the current context, activating its program. Only the
+ * state that differs from the pipeline bound before it is set, as worked out
+ * when the pipelines were made. State changed other than by binding pipelines
+ * isn't noticed; bind NULL, or call sstInvalidateState(), to have the next
+ * pipeline set all of its state. While deferring or queueing, the bind is
+ * recorded along with the draws and made when they are flushed.
+ */
+void sstBindPipeline( sstPipeline *pipeline );
+
+/*
+ * Frees a pipeline, unbinding it in every context.
+ */
+void sstFreePipeline( sstPipeline *pipeline );
+
+/*
+ * Creates a command list, which any thread can record calls into without a
+ * context, to be executed later by the thread whose context is current. A list
+ * must only be recorded into by one thread at a time, and the programs, sets,
+ * buffers and pipelines it names must outlive its recording. Defined in
+ * sst_commands.c.
+ */
+sstCommandList * sstNewCommandList( void );
+
+/*
+ * Empties a command list, keeping its memory for the next recording.
+ */
+void sstResetCommandList( sstCommandList *list );
+
+/*
+ * Record sstActivateProgram(), sstSetUniformData(), sstBindPipeline(),
+ * sstDrawSet() and sstDrawSetInstanced() calls into a list. Uniform values are
+ * copied.
+ */
+void sstRecordActivate( sstCommandList *list, sstProgram *program );
+void sstRecordUniform( sstCommandList *list, sstProgram *program, char *name,
+                       GLvoid *data );
+void sstRecordPipeline( sstCommandList *list, sstPipeline *pipeline );
+void sstRecordDraw( sstCommandList *list, sstDrawableSet *set );
+void sstRecordDrawInstanced( sstCommandList *list, sstDrawableSet *set,
+                             sstInstanceBuffer *buffer, int count );
+
+/*
+ * Returns the number of commands recorded since the list was made or reset.
+ */
+int sstCommandCount( sstCommandList *list );
+
+/*
+ * Executes command lists in the given order, as if their calls had been made
+ * one after another, skipping uploads of uniform values the active program
+ * already has. Executing while deferring or queueing records the calls there.
+ * Returns the number of commands executed.
+ */
+int sstExecuteCommandLists( sstCommandList **lists, int count );
+
+/*
+ * Frees a command list.
+ */
+void sstFreeCommandList( sstCommandList *list );
+
+/*
+ * Starts a render thread and hands it the window's context, which must be
+ * current. Until it is stopped, drawing, setting uniforms, binding pipelines,
+ * building drawable sets, including those from shapes, encoded meshes and
+ * packs, and freeing sets, instance buffers and programs are written into a
+ * ring of at least the given number of bytes for the render thread to do, and
+ * return without waiting on GL. Uniform values and set data are copied. Sets
+ * are processed on the calling thread, leaving the render thread only their
+ * buffers and vertex arrays to make. They are returned straight away and can
+ * be drawn before the render thread gets to them, but their buffers mustn't be
+ * looked into until sstRenderFinish(). The render thread is woken for a batch
+ * of calls at a time, or for sstRenderCall() and sstRenderSwap(). Anything
+ * else touching GL, including making programs, pipelines and instance buffers
+ * and queueing, deferring or immediate mode drawing, must be done in a
+ * function given to sstRenderCall(). Defined in sst_render.c.
+ */
+void sstStartRenderThread( GLFWwindow window, size_t bytes );
+
+/*
+ * Waits for the render thread to make every call written for it, then stops it
+ * and makes the window's context current again.
+ */
+void sstStopRenderThread( void );
+
+/*
+ * Has the render thread call a function with the given argument, in order
+ * with the other calls written for it. Calls it straight away if the render
+ * thread isn't running.
+ */
+void sstRenderCall( void (*func)( void *arg ), void *arg );
+
+/*
+ * Has the render thread swap the window's buffers.
+ */
+void sstRenderSwap( void );
+
+/*
+ * Waits for the render thread to make every call written for it.
+ */
+void sstRenderFinish( void );
+
+/*
+ * Gets the size of the render thread's ring, the bytes of it in use now, the
+ * most in use at once, and the number of times the ring was too full to write
+ * to and had to be waited on, since the stats were last reset. Resets them if
+ * reset is set. Any of the pointers may be NULL.
+ */
+void sstRenderStats( size_t *size, size_t *used, size_t *most,
+unsigned long *waits, GLboolean reset );
+
+/*
+ * Creates a frame manager, which keeps the CPU at most count frames ahead of
+ * the GPU, usually 2 or 3, by fencing off each frame and waiting on the fence
+ * before the frame count frames later starts. Each frame in flight gets the
+ * given number of bytes of a stream buffer for data it only needs until the
+ * GPU is done with it. Must be used on the thread whose context is current.
+ * Defined in sst_frames.c.
+ */
+sstFrames * sstNewFrames( int count, GLsizeiptr bytes );
+
+/*
+ * Start and end a frame, in place of a glFlush() or glFinish() before the
+ * buffers are swapped. Starting a frame waits only if the GPU is count frames
+ * behind, and makes the transient data of the frame that last used its slot
+ * free to use again.
+ */
+void sstBeginFrame( sstFrames *frames );
+void sstEndFrame( sstFrames *frames );
+
+/*
+ * Maps size bytes of the current frame's transient data for writing, giving
+ * their offset in the stream buffer, aligned for binding as a uniform block
+ * and to at least 16 bytes. Returns NULL if the frame is out of room. The data
+ * is written without the driver checking whether the GPU is reading it, which
+ * is safe because the frame manager already has. Must be unmapped with
+ * sstFrameUnmap() before drawing.
+ */
+GLvoid * sstFrameMap( sstFrames *frames, GLsizeiptr size, GLintptr *offset );
+void sstFrameUnmap( sstFrames *frames );
+
+/*
+ * Copies data into the current frame's transient data. Returns its offset in
+ * the stream buffer, or -1 if the frame is out of room.
+ */
+GLintptr sstFrameUpload( sstFrames *frames, const GLvoid *data,
+                         GLsizeiptr size );
+
+/*
+ * Returns the stream buffer transient data is given out from.
+ */
+GLuint sstFrameBuffer( sstFrames *frames );
+
+/*
+ * Returns the number of ended frames the GPU hasn't finished yet, without
+ * waiting.
+ */
+int sstFramesBehind( sstFrames *frames );
+
+/*
+ * Gets the number of frames that had to wait for the GPU before starting, and
+ * the milliseconds spent waiting, since the stats were last reset. Resets them
+ * if reset is set. Either pointer may be NULL.
+ */
+void sstFrameStats( sstFrames *frames, unsigned long *waits, double *ms,
+                    GLboolean reset );
+
+/*
+ * Frees a frame manager. Frames still in flight finish on their own.
+ */
+void sstFreeFrames( sstFrames *frames );
+
+/*
+ * Sets whether triangle sets made with the program keep a copy of their
+ * triangles on the CPU for ray casts, in a bounding volume hierarchy built with
+ * the surface area heuristic. Off by default. Defined in sst_bvh.c.
+ */
+void sstBuildBVHs( sstProgram *program, GLboolean build );
+
+/*
+ * Casts a ray in the model space of the given set, which must have been made
+ * with sstBuildBVHs() turned on. Returns 1 and fills in hit if the ray hits a
+ * triangle within tmax lengths of its direction, or 0 if it doesn't.
+ */
+int sstRaySet( sstDrawableSet *set, GLfloat *origin, GLfloat *dir,
+GLfloat tmax, sstRayHit *hit );
+
+/*
+ * Fills in the world space ray under a point on the screen, given in normalized
+ * device coordinates from -1 to 1, for the given projection times view matrix.
+ * The ray starts on the near plane and reaches the far plane at t = 1.
+ */
+void sstPickRay( GLfloat *viewProj, GLfloat x, GLfloat y, GLfloat *origin,
+GLfloat *dir );
+
+/*
+ * Generates an empty ray scene with room for capacity instances. A ray scene
+ * holds instances of sets with BVHs, under a second hierarchy over their world
+ * space boxes, which is rebuilt by the next cast after instances change.
+ */
+sstRayScene * sstNewRayScene( int capacity );
+
+/*
+ * Adds an instance of a set drawn with the given model matrix. Returns its
+ * index, or -1 if the set has no BVH.
+ */
+int sstRaySceneAdd( sstRayScene *scene, sstDrawableSet *set,
+GLfloat *model );
+
+/*
+ * Changes the model matrix of an instance.
+ */
+void sstRaySceneMove( sstRayScene *scene, int index, GLfloat *model );
+
+/*
+ * Removes every instance from the scene.
+ */
+void sstRaySceneClear( sstRayScene *scene );
+
+/*
+ * Casts a world space ray through the scene. Returns 1 and fills in the
+ * nearest hit if it hits a triangle within tmax lengths of its direction.
+ */
+int sstRayCast( sstRayScene *scene, GLfloat *origin, GLfloat *dir,
+GLfloat tmax, sstRayHit *hit );
+
+/*
+ * Returns 1 and fills in the nearest hit if the segment between two world
+ * space points hits anything in the scene, with t a fraction of the segment.
+ * Useful for line of sight checks.
+ */
+int sstSegmentCast( sstRayScene *scene, GLfloat *from, GLfloat *to,
+sstRayHit *hit );
+
+/*
+ * Casts count world space rays through the scene, with origins and directions
+ * 3 floats each, filling in a hit for each. Rays that miss get an instance of
+ * -1. Rays are traced together 4 at a time with SSE, so they are best kept
+ * coherent, like neighboring pixels. Returns the number that hit.
+ */
+int sstRayCastPacket( sstRayScene *scene, GLfloat *origins, GLfloat *dirs,
+int count, GLfloat tmax, sstRayHit *hits );
+
+/*
+ * Frees the given ray scene. The sets in it are not freed.
+ */
+void sstFreeRayScene( sstRayScene *scene );
+
 /*
  * Frees the given sstDrawableSet object, deleting with it all related OpenGL
  * objects.
  */
 void sstFreeDrawableSet( sstDrawableSet *set );
 
+/*
+ * Frees the given sstInstanceBuffer object, deleting with it all related
+ * OpenGL objects.
+ */
+void sstFreeInstanceBuffer( sstInstanceBuffer *buffer );
+
 /*
  * Frees the given sstProgram object, deleting with it all related OpenGL
  * objects.
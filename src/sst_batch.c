@@ -0,0 +1,471 @@
+/*
+ * sst_batch.c
+ * By Steven Smith
+ *
+ * This file contains multi-draw-indirect batches. A batch copies the geometry
+ * of many drawable sets sharing a layout into one set of buffers, and keeps an
+ * indirect command and a block of per-draw data for every draw of those sets.
+ * The whole batch is then drawn with a single glMultiDrawElementsIndirect()
+ * call, with shaders finding their per-draw data through gl_DrawID.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+#ifdef GL_SHADER_STORAGE_BUFFER
+
+/* Initial room in the batch buffers, in vertices/indices/draws */
+#define INITIAL_CAPACITY 1024
+
+/* Invocations in each work group of the index conversion shader */
+#define CONVERT_GROUP 64
+
+/*
+ * Converts indices between types on the GPU. Each invocation writes one word
+ * of the batch index buffer, keeping the bytes of it outside the range being
+ * written, so the range doesn't have to start or end on a word.
+ */
+static const char *convert_source =
+    "#version 430 core\n"
+    "layout(local_size_x = 64) in;\n"
+    "layout(std430, binding = 0) readonly buffer Src { uint src[]; };\n"
+    "layout(std430, binding = 1) buffer Dst { uint dst[]; };\n"
+    "uniform uint first; /* Byte the converted indices start at */\n"
+    "uniform uint count;\n"
+    "uniform uint srcSize;\n"
+    "uniform uint dstSize;\n"
+    "uint sizeMask( uint size ) {\n"
+    "    return size == 4u ? 0xFFFFFFFFu : (1u << (size * 8u)) - 1u;\n"
+    "}\n"
+    "void main() {\n"
+    "    uint word, end, value, b, byte, i, shift;\n"
+    "    word = first / 4u + gl_GlobalInvocationID.x;\n"
+    "    end = first + count * dstSize;\n"
+    "    if( word * 4u >= end ) {\n"
+    "        return;\n"
+    "    }\n"
+    "    value = dst[word];\n"
+    "    for( b = 0u; b < 4u; b += dstSize ) {\n"
+    "        byte = word * 4u + b;\n"
+    "        if( byte < first || byte >= end ) {\n"
+    "            continue;\n"
+    "        }\n"
+    "        i = (byte - first) / dstSize * srcSize;\n"
+    "        i = (src[i >> 2] >> ((i & 3u) * 8u)) & sizeMask(srcSize);\n"
+    "        shift = b * 8u;\n"
+    "        value &= ~(sizeMask(dstSize) << shift);\n"
+    "        value |= (i & sizeMask(dstSize)) << shift;\n"
+    "    }\n"
+    "    dst[word] = value;\n"
+    "}\n";
+
+/* Shared by every batch, and deleted along with the last one */
+static GLuint convert_program = 0;
+static GLuint convert_scratch = 0;
+static int batch_count = 0;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Replaces a buffer with a bigger one, keeping the first used bytes of its
+ * contents.
+ */
+static void sstGrowBuffer( GLuint *buffer, GLsizeiptr used, GLsizeiptr size ) {
+    GLuint grown;
+    glGenBuffers(1, &grown);
+    sstBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+    if( *buffer ) {
+        if( used > 0 ) {
+            sstBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                used);
+        }
+        sstDeleteBuffers(1, buffer);
+    }
+    *buffer = grown;
+}
+
+/*
+ * Makes sure the batch has room for the given number of extra vertices and
+ * indices, growing its buffers and re-pointing the vertex array if needed.
+ */
+static void sstReserveBatch( sstBatch *batch, int vertices, int indices ) {
+    sstDrawable *d;
+    GLuint i_size;
+    int grow;
+    grow = 0;
+    if( batch->count + vertices > batch->capacity ) {
+        while( batch->count + vertices > batch->capacity ) {
+            batch->capacity *= 2;
+        }
+        for( d = batch->drawables; d < batch->drawables + batch->size; d++ ) {
+            sstGrowBuffer(&d->buffer, sstVertexSize(d) * batch->count,
+                          sstVertexSize(d) * batch->capacity);
+        }
+        grow = 1;
+    }
+    if( batch->i_count + indices > batch->i_capacity ) {
+        while( batch->i_count + indices > batch->i_capacity ) {
+            batch->i_capacity *= 2;
+        }
+        i_size = sstSizeFromEnum(batch->i_type);
+        sstGrowBuffer(&batch->i_buffer, i_size * batch->i_count,
+                      i_size * batch->i_capacity);
+        grow = 1;
+    }
+    /* Point the vertex array at the new buffers */
+    if( grow ) {
+        sstBindVertexArray(batch->vao);
+        for( d = batch->drawables; d < batch->drawables + batch->size; d++ ) {
+            sstAttribPointers(d);
+        }
+        sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->i_buffer);
+    }
+}
+
+/*
+ * Builds the index conversion program. Returns 0 if it fails to build.
+ */
+static GLuint sstConvertProgram( void ) {
+    GLuint shader, program;
+    GLint result;
+    shader = sstCompileShader(GL_COMPUTE_SHADER, &convert_source, 1);
+    if( !shader ) {
+        return 0;
+    }
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if( result == GL_FALSE ) {
+        printf("ERROR: Failed to link the batch index conversion program\n");
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/*
+ * Copies the indices of a set to the end of the batch index buffer. Matching
+ * index types are copied straight over, anything else is copied to a scratch
+ * buffer and converted by a compute shader, so the indices never have to be
+ * read back. Sets without indices get sequential indices.
+ */
+static void sstCopyIndices( sstBatch *batch, sstDrawableSet *set,
+int i_count ) {
+    GLuint i_size, s_size, first, words;
+    void *dst;
+    int i;
+    i_size = sstSizeFromEnum(batch->i_type);
+    sstBindBuffer(GL_COPY_WRITE_BUFFER, batch->i_buffer);
+    if( set->i_buffer && set->i_type == batch->i_type ) {
+        sstBindBuffer(GL_COPY_READ_BUFFER, set->i_buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                            i_size * batch->i_count, i_size * i_count);
+        return;
+    }
+    if( !set->i_buffer ) {
+        dst = malloc(i_size * i_count);
+        for( i = 0; i < i_count; i++ ) {
+            sstPutIndex(dst, batch->i_type, i, i);
+        }
+        glBufferSubData(GL_COPY_WRITE_BUFFER, i_size * batch->i_count,
+                        i_size * i_count, dst);
+        free(dst);
+        return;
+    }
+    if( !convert_program && !(convert_program = sstConvertProgram()) ) {
+        return;
+    }
+    /* Step 1: Copy the indices somewhere the shader can read whole words */
+    s_size = sstSizeFromEnum(set->i_type);
+    if( !convert_scratch ) {
+        glGenBuffers(1, &convert_scratch);
+    }
+    sstBindBuffer(GL_COPY_WRITE_BUFFER, convert_scratch);
+    glBufferData(GL_COPY_WRITE_BUFFER, (s_size * i_count + 3) & ~3u, NULL,
+                 GL_STREAM_COPY);
+    sstBindBuffer(GL_COPY_READ_BUFFER, set->i_buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        s_size * i_count);
+    /* Step 2: Convert them into the batch, one word per invocation */
+    first = i_size * batch->i_count;
+    words = (first + i_size * i_count + 3) / 4 - first / 4;
+    sstUseProgram(convert_program);
+    glUniform1ui(glGetUniformLocation(convert_program, "first"), first);
+    glUniform1ui(glGetUniformLocation(convert_program, "count"), i_count);
+    glUniform1ui(glGetUniformLocation(convert_program, "srcSize"), s_size);
+    glUniform1ui(glGetUniformLocation(convert_program, "dstSize"), i_size);
+    sstBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, convert_scratch);
+    sstBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batch->i_buffer);
+    glDispatchCompute((words + CONVERT_GROUP - 1) / CONVERT_GROUP, 1, 1);
+    /* The next set's conversion may share a word with this one's */
+    glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT
+                    | GL_SHADER_STORAGE_BARRIER_BIT);
+    sstUseProgram(sst_active ? sst_active->program : 0);
+}
+
+/*
+ * Checks that a set matches the layout of the batch.
+ */
+static int sstCheckLayout( sstBatch *batch, sstDrawableSet *set ) {
+    sstDrawable *d, *s;
+    if( set->mode != batch->mode || set->size != batch->size ) {
+        printf("WARN: Set doesn't match the mode or inputs of the batch!\n");
+        return 0;
+    }
+    if( (GLuint)set->count - 1 > sstMaxIndex(batch->i_type) ) {
+        printf("WARN: Set has too many vertices for the batch index type!\n");
+        return 0;
+    }
+    for( d = batch->drawables; d < batch->drawables + batch->size; d++ ) {
+        for( s = set->drawables; s < set->drawables + set->size; s++ ) {
+            if( s->location == d->location ) {
+                break;
+            }
+        }
+        if( s >= set->drawables + set->size || s->type != d->type
+         || s->components != d->components
+         || s->normalized != d->normalized ) {
+            printf("WARN: Set doesn't match the layout of the batch!\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Returns the geometry of the given set in the batch, copying it into the batch
+ * first if this is the first time the set has been added. Returns NULL if the
+ * set doesn't fit the batch.
+ */
+static sstBatchMesh * sstAddMesh( sstBatch *batch, sstDrawableSet *set ) {
+    sstBatchMesh *mesh;
+    sstDrawable *d, *s;
+    int i_count;
+    for( mesh = batch->meshes; mesh < batch->meshes + batch->mesh_count;
+         mesh++ ) {
+        if( mesh->set == set ) {
+            return mesh;
+        }
+    }
+    if( !sstCheckLayout(batch, set) ) {
+        return NULL;
+    }
+    /* Step 1: Make room */
+    i_count = set->i_buffer ? set->i_size : set->count;
+    sstReserveBatch(batch, set->count, i_count);
+    if( batch->mesh_count == batch->mesh_size ) {
+        batch->mesh_size *= 2;
+        batch->meshes = (sstBatchMesh*)realloc(batch->meshes,
+                                               sizeof(sstBatchMesh) *
+                                               batch->mesh_size);
+    }
+    /* Step 2: Copy the vertices over on the GPU */
+    for( d = batch->drawables; d < batch->drawables + batch->size; d++ ) {
+        for( s = set->drawables; s->location != d->location; s++ );
+        sstBindBuffer(GL_COPY_READ_BUFFER, s->buffer);
+        sstBindBuffer(GL_COPY_WRITE_BUFFER, d->buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                            sstVertexSize(d) * batch->count,
+                            sstVertexSize(d) * set->count);
+    }
+    /* Step 3: Copy the indices over */
+    sstCopyIndices(batch, set, i_count);
+    /* Step 4: Remember where they went */
+    mesh = &batch->meshes[batch->mesh_count++];
+    mesh->set = set;
+    mesh->baseVertex = batch->count;
+    mesh->firstIndex = batch->i_count;
+    mesh->count = i_count;
+    batch->count += set->count;
+    batch->i_count += i_count;
+    return mesh;
+}
+
+/*
+ * Batch functions
+ */
+
+/*
+ * Generates an empty batch for drawing many sets with a single call.
+ */
+sstBatch * sstNewBatch( sstProgram *program, GLenum mode, GLenum i_type,
+GLuint binding ) {
+    sstBatch *batch;
+    sstDrawable *drawable;
+    in_var *input;
+    batch = (sstBatch*)malloc(sizeof(sstBatch));
+    batch_count++;
+    batch->mode = mode;
+    batch->i_type = i_type;
+    batch->size = program->in_count - program->inst_count;
+    batch->count = 0;
+    batch->capacity = INITIAL_CAPACITY;
+    batch->i_buffer = 0;
+    batch->i_count = 0;
+    batch->i_capacity = INITIAL_CAPACITY;
+    batch->binding = binding;
+    batch->dirty = GL_FALSE;
+    /* Step 1: Generate vertex array and bind it */
+    glGenVertexArrays(1, &batch->vao);
+    sstBindVertexArray(batch->vao);
+    /* Step 2: Set up a merged buffer for every per-vertex input */
+    batch->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * batch->size);
+    drawable = batch->drawables;
+    for( input = program->inputs; input < program->inputs + program->in_count;
+         input++ ) {
+        if( !input->divisor ) {
+            sstInitDrawable(drawable, input);
+            drawable->buffer = 0;
+            sstGrowBuffer(&drawable->buffer, 0,
+                          sstVertexSize(drawable) * batch->capacity);
+            sstAttribPointers(drawable);
+            drawable++;
+        }
+    }
+    sstGrowBuffer(&batch->i_buffer, 0,
+                  sstSizeFromEnum(i_type) * batch->i_capacity);
+    sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->i_buffer);
+    /* Step 3: Set up the draws */
+    batch->mesh_count = 0;
+    batch->mesh_size = 16;
+    batch->meshes = (sstBatchMesh*)malloc(sizeof(sstBatchMesh) *
+                                          batch->mesh_size);
+    batch->draw_count = 0;
+    batch->draw_size = INITIAL_CAPACITY;
+    batch->commands = (sstDrawCommand*)malloc(sizeof(sstDrawCommand) *
+                                              batch->draw_size);
+    batch->draws = (sstDrawData*)malloc(sizeof(sstDrawData) *
+                                        batch->draw_size);
+    glGenBuffers(1, &batch->c_buffer);
+    glGenBuffers(1, &batch->d_buffer);
+    /* Step 4: Return batch */
+    return batch;
+}
+
+/*
+ * Adds a draw of the given set to the batch. Returns the index of the draw, or
+ * -1 if the set doesn't fit the batch.
+ */
+int sstBatchAdd( sstBatch *batch, sstDrawableSet *set, GLfloat *model,
+GLuint material ) {
+    sstBatchMesh *mesh;
+    sstDrawCommand *command;
+    int draw;
+    mesh = sstAddMesh(batch, set);
+    if( !mesh ) {
+        return -1;
+    }
+    if( batch->draw_count == batch->draw_size ) {
+        batch->draw_size *= 2;
+        batch->commands = (sstDrawCommand*)realloc(batch->commands,
+                                                   sizeof(sstDrawCommand) *
+                                                   batch->draw_size);
+        batch->draws = (sstDrawData*)realloc(batch->draws,
+                                             sizeof(sstDrawData) *
+                                             batch->draw_size);
+    }
+    draw = batch->draw_count++;
+    command = &batch->commands[draw];
+    command->count = mesh->count;
+    command->instanceCount = 1;
+    command->firstIndex = mesh->firstIndex;
+    command->baseVertex = mesh->baseVertex;
+    /* Lets shaders without gl_DrawID use gl_BaseInstance instead */
+    command->baseInstance = draw;
+    sstBatchSetDraw(batch, draw, model, material);
+    return draw;
+}
+
+/*
+ * Changes the model matrix and material index of a draw in the batch.
+ */
+void sstBatchSetDraw( sstBatch *batch, int draw, GLfloat *model,
+GLuint material ) {
+    sstDrawData *data;
+    data = &batch->draws[draw];
+    memcpy(data->model, model, sizeof(GLfloat) * 16);
+    data->material = material;
+    batch->dirty = GL_TRUE;
+}
+
+/*
+ * Removes every draw from the batch, keeping its geometry.
+ */
+void sstBatchClear( sstBatch *batch ) {
+    batch->draw_count = 0;
+    batch->dirty = GL_TRUE;
+}
+
+/*
+ * Draws every draw in the batch with a single call. Assumes the correct program
+ * is currently active.
+ */
+void sstDrawBatch( sstBatch *batch ) {
+    if( batch->draw_count == 0 ) {
+        return;
+    }
+    /* Step 1: Upload the draws if they have changed */
+    if( batch->dirty ) {
+        sstBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->c_buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     sizeof(sstDrawCommand) * batch->draw_count,
+                     batch->commands, GL_DYNAMIC_DRAW);
+        sstBindBuffer(GL_SHADER_STORAGE_BUFFER, batch->d_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     sizeof(sstDrawData) * batch->draw_count,
+                     batch->draws, GL_DYNAMIC_DRAW);
+        batch->dirty = GL_FALSE;
+    }
+    /* Step 2: Bind everything */
+    sstBindVertexArray(batch->vao);
+    sstBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch->c_buffer);
+    sstBindBufferBase(GL_SHADER_STORAGE_BUFFER, batch->binding,
+                     batch->d_buffer);
+    /* Step 3: Draw */
+    glMultiDrawElementsIndirect(batch->mode, batch->i_type, 0,
+                                batch->draw_count, 0);
+}
+
+/*
+ * Frees the given sstBatch object, deleting with it all related OpenGL
+ * objects.
+ */
+void sstFreeBatch( sstBatch *batch ) {
+    sstDrawable *d;
+    /* Step 1: Delete OpenGL objects */
+    sstDeleteVertexArrays(1, &batch->vao);
+    for( d = batch->drawables; d < batch->drawables + batch->size; d++ ) {
+        sstDeleteBuffers(1, &d->buffer);
+    }
+    sstDeleteBuffers(1, &batch->i_buffer);
+    sstDeleteBuffers(1, &batch->c_buffer);
+    sstDeleteBuffers(1, &batch->d_buffer);
+    /* Step 2: Free memory */
+    free(batch->drawables);
+    free(batch->meshes);
+    free(batch->commands);
+    free(batch->draws);
+    free(batch);
+    /* Step 3: Delete the index conversion objects along with the last batch */
+    if( --batch_count == 0 ) {
+        if( convert_program ) {
+            glDeleteProgram(convert_program);
+            convert_program = 0;
+        }
+        if( convert_scratch ) {
+            sstDeleteBuffers(1, &convert_scratch);
+            convert_scratch = 0;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,1069 @@
+/*
+ * sst_bvh.c
+ * By Steven Smith
+ *
+ * This file contains ray casting against drawable sets. Sets made by programs
+ * that ask for it keep their triangles on the CPU in a bounding volume
+ * hierarchy, built by binning triangles along each axis and splitting where the
+ * surface area heuristic says rays will do the least work. A ray scene holds
+ * instances of such sets, with a second hierarchy over their world space
+ * boxes. Rays can be cast one at a time, or 4 at a time with SSE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "sst.h"
+#include "sst_private.h"
+
+/* Number of bins tried along each axis when splitting a node */
+#define BINS 12
+/* Nodes with this many primitives or fewer are always leaves */
+#define MIN_LEAF 2
+/* Nodes with more primitives than this are always split */
+#define MAX_LEAF 8
+/* Cost of visiting a node, relative to testing a primitive */
+#define TRAVERSAL_COST 1.0f
+/* Entries of the traversal stack kept on the C stack. Deeper hierarchies get
+ * one from the heap. */
+#define STACK_SIZE 64
+/* Smallest determinant of a triangle test, to skip rays parallel to it */
+#define EPSILON 1e-9f
+
+typedef struct {
+    GLfloat low[3];
+    int first; /* First child, or first primitive of a leaf */
+    GLfloat high[3];
+    int count; /* Number of primitives in a leaf, 0 for inner nodes */
+} sstBVHNode;
+
+struct sstBVH {
+    sstBVHNode *nodes;
+    int node_count;
+    int *items; /* Index of each primitive, in the order leaves refer to */
+    int count; /* Number of primitives */
+    GLfloat *triangles; /* For sets, the first vertex and two edges of each
+                         * triangle, in the order of items */
+    int depth; /* Number of levels, which bounds the traversal stack */
+};
+
+typedef struct {
+    GLfloat *low; /* Box of each primitive */
+    GLfloat *high;
+    GLfloat *centroid;
+    int *items;
+    sstBVHNode *nodes;
+    int node_count;
+    int depth; /* Deepest level reached so far */
+} sstBVHBuild;
+
+typedef struct {
+    GLfloat low[3];
+    GLfloat high[3];
+    int count;
+} sstBin;
+
+typedef struct {
+    int node;
+    GLfloat near; /* Distance to where the ray enters the node */
+} sstStackEntry;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns half the surface area of a box, which is all the SAH needs.
+ */
+static GLfloat sstHalfArea( GLfloat *low, GLfloat *high ) {
+    GLfloat d[3];
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        d[c] = high[c] > low[c] ? high[c] - low[c] : 0.0f;
+    }
+    return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+static void sstEmptyBox( GLfloat *low, GLfloat *high ) {
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        low[c] = 1e30f;
+        high[c] = -1e30f;
+    }
+}
+
+static void sstGrowBox( GLfloat *low, GLfloat *high, GLfloat *plow,
+GLfloat *phigh ) {
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        low[c] = plow[c] < low[c] ? plow[c] : low[c];
+        high[c] = phigh[c] > high[c] ? phigh[c] : high[c];
+    }
+}
+
+/*
+ * Builds the subtree under the given node, on the given level counting the
+ * root as 1, from count primitives starting at first in the item list, which
+ * is reordered so that leaves own runs of it.
+ */
+static void sstBuildNode( sstBVHBuild *build, int node, int level, int first,
+int count ) {
+    sstBin bins[3][BINS];
+    GLfloat clow[3], chigh[3], scale[3], low[3], high[3], area, cost, best;
+    GLfloat left_area[BINS];
+    int left_count[BINS], best_axis, best_split, c, b, i, j, p, right;
+    sstBVHNode *n;
+    n = &build->nodes[node];
+    build->depth = level > build->depth ? level : build->depth;
+    /* Step 1: Bound the primitives and their centroids */
+    sstEmptyBox(n->low, n->high);
+    sstEmptyBox(clow, chigh);
+    for( i = first; i < first + count; i++ ) {
+        p = build->items[i];
+        sstGrowBox(n->low, n->high, &build->low[p*3], &build->high[p*3]);
+        sstGrowBox(clow, chigh, &build->centroid[p*3], &build->centroid[p*3]);
+    }
+    n->first = first;
+    n->count = count;
+    if( count <= MIN_LEAF ) {
+        return;
+    }
+    /* Step 2: Bin the centroids along each axis and find the cheapest split */
+    area = sstHalfArea(n->low, n->high);
+    best = count * area;
+    best_axis = -1;
+    best_split = 0;
+    for( c = 0; c < 3; c++ ) {
+        scale[c] = chigh[c] > clow[c] ? BINS / (chigh[c] - clow[c]) : 0.0f;
+        if( scale[c] == 0.0f ) {
+            continue;
+        }
+        for( b = 0; b < BINS; b++ ) {
+            sstEmptyBox(bins[c][b].low, bins[c][b].high);
+            bins[c][b].count = 0;
+        }
+        for( i = first; i < first + count; i++ ) {
+            p = build->items[i];
+            b = (int)((build->centroid[p*3 + c] - clow[c]) * scale[c]);
+            b = b < BINS ? b : BINS - 1;
+            bins[c][b].count++;
+            sstGrowBox(bins[c][b].low, bins[c][b].high, &build->low[p*3],
+                       &build->high[p*3]);
+        }
+        /* Sub-step 1: Sweep from the left, then score each split from the
+         * right */
+        sstEmptyBox(low, high);
+        j = 0;
+        for( b = 0; b < BINS - 1; b++ ) {
+            sstGrowBox(low, high, bins[c][b].low, bins[c][b].high);
+            j += bins[c][b].count;
+            left_area[b] = sstHalfArea(low, high);
+            left_count[b] = j;
+        }
+        sstEmptyBox(low, high);
+        j = 0;
+        for( b = BINS - 1; b > 0; b-- ) {
+            sstGrowBox(low, high, bins[c][b].low, bins[c][b].high);
+            j += bins[c][b].count;
+            if( j == 0 || left_count[b - 1] == 0 ) {
+                continue;
+            }
+            cost = TRAVERSAL_COST * area + left_area[b - 1] * left_count[b - 1]
+                 + sstHalfArea(low, high) * j;
+            if( cost < best ) {
+                best = cost;
+                best_axis = c;
+                best_split = b;
+            }
+        }
+    }
+    /* Step 3: Stay a leaf if splitting doesn't pay. Big nodes are split down
+     * the middle of the list if no split was found, which only happens when
+     * every centroid is the same. */
+    if( best_axis < 0 && count <= MAX_LEAF ) {
+        return;
+    }
+    if( best_axis < 0 ) {
+        right = first + count / 2;
+    }
+    else {
+        i = first;
+        j = first + count - 1;
+        while( i <= j ) {
+            p = build->items[i];
+            b = (int)((build->centroid[p*3 + best_axis] - clow[best_axis])
+                      * scale[best_axis]);
+            b = b < BINS ? b : BINS - 1;
+            if( b < best_split ) {
+                i++;
+            }
+            else {
+                build->items[i] = build->items[j];
+                build->items[j--] = p;
+            }
+        }
+        right = i;
+    }
+    /* Step 4: Children are stored next to each other */
+    n->first = build->node_count;
+    n->count = 0;
+    build->node_count += 2;
+    sstBuildNode(build, n->first, level + 1, first, right - first);
+    sstBuildNode(build, build->nodes[node].first + 1, level + 1, right,
+                 first + count - right);
+}
+
+/*
+ * Builds a hierarchy over count primitives with the given boxes.
+ */
+static struct sstBVH * sstBuildHierarchy( GLfloat *low, GLfloat *high,
+int count ) {
+    struct sstBVH *bvh;
+    sstBVHBuild build;
+    int i, c;
+    bvh = (struct sstBVH*)malloc(sizeof(struct sstBVH));
+    build.low = low;
+    build.high = high;
+    build.centroid = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (count + 1));
+    build.items = (int*)malloc(sizeof(int) * (count + 1));
+    build.nodes = (sstBVHNode*)malloc(sizeof(sstBVHNode) * (2 * count + 1));
+    build.node_count = 1;
+    build.depth = 0;
+    for( i = 0; i < count; i++ ) {
+        build.items[i] = i;
+        for( c = 0; c < 3; c++ ) {
+            build.centroid[i*3 + c] = (low[i*3 + c] + high[i*3 + c]) * 0.5f;
+        }
+    }
+    sstBuildNode(&build, 0, 1, 0, count);
+    free(build.centroid);
+    bvh->nodes = build.nodes;
+    bvh->node_count = build.node_count;
+    bvh->items = build.items;
+    bvh->count = count;
+    bvh->triangles = NULL;
+    bvh->depth = build.depth;
+    return bvh;
+}
+
+/*
+ * Returns the distance along a ray to where it enters the given box, or a
+ * negative number if it misses it or only reaches it beyond tmax.
+ */
+static GLfloat sstRayBox( GLfloat *low, GLfloat *high, GLfloat *origin,
+GLfloat *inverse, GLfloat tmax ) {
+    GLfloat t0, t1, near, far, tmp;
+    int c;
+    near = 0.0f;
+    far = tmax;
+    for( c = 0; c < 3; c++ ) {
+        t0 = (low[c] - origin[c]) * inverse[c];
+        t1 = (high[c] - origin[c]) * inverse[c];
+        if( t0 > t1 ) {
+            tmp = t0;
+            t0 = t1;
+            t1 = tmp;
+        }
+        near = t0 > near ? t0 : near;
+        far = t1 < far ? t1 : far;
+    }
+    return near <= far ? near : -1.0f;
+}
+
+static void sstInverseDirection( GLfloat *dir, GLfloat *inverse ) {
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        inverse[c] = dir[c] != 0.0f ? 1.0f / dir[c] : 1e30f;
+    }
+}
+
+/*
+ * Returns a stack deep enough to traverse the given hierarchy. Each level
+ * pops one node and pushes at most two, so it never holds more than one entry
+ * per level plus one. The given local stack of STACK_SIZE entries is used if
+ * that fits, otherwise one is allocated, to be freed by sstFreeStack().
+ */
+static sstStackEntry * sstTraversalStack( struct sstBVH *bvh,
+sstStackEntry *local ) {
+    if( bvh->depth + 1 <= STACK_SIZE ) {
+        return local;
+    }
+    return (sstStackEntry*)malloc(sizeof(sstStackEntry) * (bvh->depth + 1));
+}
+
+static void sstFreeStack( sstStackEntry *stack, sstStackEntry *local ) {
+    if( stack != local ) {
+        free(stack);
+    }
+}
+
+/*
+ * Pushes the children of an inner node that the ray reaches before tmax onto
+ * the stack, the nearer one last so that it's visited first.
+ */
+static void sstPushChildren( struct sstBVH *bvh, sstBVHNode *n,
+GLfloat *origin, GLfloat *inverse, GLfloat tmax, sstStackEntry *stack,
+int *top ) {
+    sstBVHNode *l, *r;
+    GLfloat tl, tr;
+    l = &bvh->nodes[n->first];
+    r = l + 1;
+    tl = sstRayBox(l->low, l->high, origin, inverse, tmax);
+    tr = sstRayBox(r->low, r->high, origin, inverse, tmax);
+    if( tl >= 0.0f && tr >= 0.0f && tr < tl ) {
+        stack[*top].node = n->first;
+        stack[(*top)++].near = tl;
+        stack[*top].node = n->first + 1;
+        stack[(*top)++].near = tr;
+        return;
+    }
+    if( tr >= 0.0f ) {
+        stack[*top].node = n->first + 1;
+        stack[(*top)++].near = tr;
+    }
+    if( tl >= 0.0f ) {
+        stack[*top].node = n->first;
+        stack[(*top)++].near = tl;
+    }
+}
+
+/*
+ * Casts a ray against the triangles of a set's hierarchy, in model space,
+ * updating hit if something nearer than hit->t is found.
+ */
+static int sstRayTriangles( struct sstBVH *bvh, GLfloat *origin,
+GLfloat *dir, sstRayHit *hit ) {
+    GLfloat inverse[3], *tri, p[3], s[3], q[3], det, u, v, t;
+    sstStackEntry local[STACK_SIZE], *stack;
+    sstBVHNode *n;
+    int top, i, found;
+    if( bvh->count == 0 ) {
+        return 0;
+    }
+    stack = sstTraversalStack(bvh, local);
+    sstInverseDirection(dir, inverse);
+    found = 0;
+    top = 0;
+    stack[0].node = 0;
+    stack[0].near = sstRayBox(bvh->nodes[0].low, bvh->nodes[0].high, origin,
+                              inverse, hit->t);
+    top = stack[0].near >= 0.0f;
+    while( top > 0 ) {
+        /* Sub-step 1: Skip nodes behind what has been hit since */
+        top--;
+        if( stack[top].near > hit->t ) {
+            continue;
+        }
+        n = &bvh->nodes[stack[top].node];
+        if( n->count == 0 ) {
+            sstPushChildren(bvh, n, origin, inverse, hit->t, stack, &top);
+            continue;
+        }
+        /* Sub-step 2: Moller-Trumbore against each triangle of a leaf */
+        for( i = n->first; i < n->first + n->count; i++ ) {
+            tri = &bvh->triangles[i*9];
+            sstCrossProduct3_(dir, &tri[6], p);
+            det = sstDotProduct3(&tri[3], p);
+            if( det > -EPSILON && det < EPSILON ) {
+                continue;
+            }
+            det = 1.0f / det;
+            s[0] = origin[0] - tri[0];
+            s[1] = origin[1] - tri[1];
+            s[2] = origin[2] - tri[2];
+            u = sstDotProduct3(s, p) * det;
+            if( u < 0.0f || u > 1.0f ) {
+                continue;
+            }
+            sstCrossProduct3_(s, &tri[3], q);
+            v = sstDotProduct3(dir, q) * det;
+            if( v < 0.0f || u + v > 1.0f ) {
+                continue;
+            }
+            t = sstDotProduct3(&tri[6], q) * det;
+            if( t >= 0.0f && t < hit->t ) {
+                hit->t = t;
+                hit->u = u;
+                hit->v = v;
+                hit->triangle = bvh->items[i];
+                found = 1;
+            }
+        }
+    }
+    sstFreeStack(stack, local);
+    return found;
+}
+
+/*
+ * Inverts a 4x4 column major matrix by cofactors. Returns 0 if it can't be
+ * inverted.
+ */
+static int sstInvert4( GLfloat *m, GLfloat *out ) {
+    GLfloat inv[16], det;
+    int i;
+    inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15]
+           + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+    inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15]
+           - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+    inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15]
+           + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+    inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14]
+            - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+    inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15]
+           - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+    inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15]
+           + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+    inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15]
+           - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+    inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14]
+            + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+    inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15]
+           + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+    inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15]
+           - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+    inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15]
+            + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+    inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14]
+            - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+    inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11]
+           - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+    inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11]
+           + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+    inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11]
+            - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+    inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10]
+            + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+    det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+    if( det == 0.0f ) {
+        return 0;
+    }
+    det = 1.0f / det;
+    for( i = 0; i < 16; i++ ) {
+        out[i] = inv[i] * det;
+    }
+    return 1;
+}
+
+/*
+ * Moves a ray into the model space of an instance. The direction is not
+ * normalized, so distances along it stay the same.
+ */
+static void sstRayToModel( GLfloat *inverse, GLfloat *origin, GLfloat *dir,
+GLfloat *m_origin, GLfloat *m_dir ) {
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        m_origin[c] = inverse[c] * origin[0] + inverse[4 + c] * origin[1]
+                    + inverse[8 + c] * origin[2] + inverse[12 + c];
+        m_dir[c] = inverse[c] * dir[0] + inverse[4 + c] * dir[1]
+                 + inverse[8 + c] * dir[2];
+    }
+}
+
+/*
+ * Fits a world space box around the model space box of an instance.
+ */
+static void sstPlaceInstance( sstRayScene *scene, int index ) {
+    sstDrawableSet *set;
+    GLfloat *model, c[3], e[3];
+    int i, j;
+    set = scene->sets[index];
+    model = &scene->models[index*16];
+    for( i = 0; i < 3; i++ ) {
+        c[i] = model[12 + i];
+        e[i] = 0.0f;
+        for( j = 0; j < 3; j++ ) {
+            c[i] += model[j*4 + i] * set->center[j];
+            e[i] += fabsf(model[j*4 + i]) * (set->high[j] - set->low[j]) * 0.5f;
+        }
+        scene->low[index*3 + i] = c[i] - e[i];
+        scene->high[index*3 + i] = c[i] + e[i];
+    }
+    if( !sstInvert4(model, &scene->inverses[index*16]) ) {
+        printf("WARN: Model matrix can't be inverted!\n");
+        memset(&scene->inverses[index*16], 0, sizeof(GLfloat) * 16);
+    }
+}
+
+/*
+ * Rebuilds the hierarchy over the instances of a scene if they've changed.
+ */
+static void sstUpdateRayScene( sstRayScene *scene ) {
+    if( !scene->dirty ) {
+        return;
+    }
+    if( scene->top ) {
+        sstFreeBVH(scene->top);
+    }
+    scene->top = sstBuildHierarchy(scene->low, scene->high, scene->count);
+    scene->dirty = GL_FALSE;
+}
+
+#ifdef __SSE__
+/*
+ * A packet of 4 rays, one per lane.
+ */
+typedef struct {
+    __m128 origin[3];
+    __m128 dir[3];
+    __m128 inverse[3];
+    __m128 t; /* Nearest hit so far */
+    __m128 u;
+    __m128 v;
+    __m128 active; /* Lanes holding real rays */
+} sstRayPacket;
+
+/*
+ * Returns 1 over each lane of a direction, clamped to 1e30 where it's 0 like
+ * sstInverseDirection(). An infinity would turn into a NaN when multiplied by
+ * a 0 distance to a box, and NaNs fail every test, missing the box.
+ */
+static __m128 sstPacketInverse( __m128 dir ) {
+    __m128 mask;
+    mask = _mm_cmpneq_ps(dir, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(_mm_set1_ps(1.0f), dir)),
+                     _mm_andnot_ps(mask, _mm_set1_ps(1e30f)));
+}
+
+/*
+ * Returns a mask of the lanes of a packet that enter the given box before
+ * their nearest hit, and the nearest distance any of them enters it at.
+ */
+static int sstPacketBox( sstRayPacket *packet, GLfloat *low, GLfloat *high,
+GLfloat *nearest ) {
+    __m128 t0, t1, near, far, mask;
+    GLfloat lanes[4];
+    int c, bits;
+    near = _mm_setzero_ps();
+    far = packet->t;
+    for( c = 0; c < 3; c++ ) {
+        t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(low[c]), packet->origin[c]),
+                        packet->inverse[c]);
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(high[c]), packet->origin[c]),
+                        packet->inverse[c]);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+    }
+    mask = _mm_and_ps(_mm_cmple_ps(near, far), packet->active);
+    bits = _mm_movemask_ps(mask);
+    if( bits ) {
+        near = _mm_or_ps(_mm_and_ps(mask, near),
+                         _mm_andnot_ps(mask, _mm_set1_ps(1e30f)));
+        near = _mm_min_ps(near, _mm_shuffle_ps(near, near,
+                                               _MM_SHUFFLE(1, 0, 3, 2)));
+        near = _mm_min_ps(near, _mm_shuffle_ps(near, near,
+                                               _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(lanes, near);
+        *nearest = lanes[0];
+    }
+    return bits;
+}
+
+/*
+ * Returns the furthest nearest hit of the active lanes of a packet. Nodes
+ * entered beyond it can be skipped.
+ */
+static GLfloat sstPacketFar( sstRayPacket *packet ) {
+    __m128 t;
+    GLfloat lanes[4];
+    t = _mm_and_ps(packet->active, packet->t);
+    t = _mm_max_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+    t = _mm_max_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+    _mm_storeu_ps(lanes, t);
+    return lanes[0];
+}
+
+/*
+ * Pushes the children of an inner node that any lane of the packet reaches
+ * onto the stack, the nearer one last.
+ */
+static void sstPacketChildren( struct sstBVH *bvh, sstBVHNode *n,
+sstRayPacket *packet, sstStackEntry *stack, int *top ) {
+    sstBVHNode *l, *r;
+    GLfloat tl, tr;
+    int hit_l, hit_r;
+    l = &bvh->nodes[n->first];
+    r = l + 1;
+    hit_l = sstPacketBox(packet, l->low, l->high, &tl);
+    hit_r = sstPacketBox(packet, r->low, r->high, &tr);
+    if( hit_l && hit_r && tr < tl ) {
+        stack[*top].node = n->first;
+        stack[(*top)++].near = tl;
+        stack[*top].node = n->first + 1;
+        stack[(*top)++].near = tr;
+        return;
+    }
+    if( hit_r ) {
+        stack[*top].node = n->first + 1;
+        stack[(*top)++].near = tr;
+    }
+    if( hit_l ) {
+        stack[*top].node = n->first;
+        stack[(*top)++].near = tl;
+    }
+}
+
+static __m128 sstDot4( __m128 *a, __m128 *b ) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]),
+                                 _mm_mul_ps(a[1], b[1])),
+                      _mm_mul_ps(a[2], b[2]));
+}
+
+static void sstCross4( __m128 *a, __m128 *b, __m128 *out ) {
+    out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+    out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+    out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+}
+
+/*
+ * Casts a packet of rays, already in model space, against the triangles of a
+ * set's hierarchy. The triangle hit by each lane is written to triangles.
+ * Returns a mask of the lanes that hit something nearer than before.
+ */
+static int sstPacketTriangles( struct sstBVH *bvh, sstRayPacket *packet,
+int *triangles ) {
+    __m128 e1[3], e2[3], s[3], p[3], q[3], det, inv, u, v, t, mask, eps;
+    __m128 zero, one;
+    sstStackEntry local[STACK_SIZE], *stack;
+    sstBVHNode *n;
+    int top, i, c, bits, found, lane;
+    GLfloat *tri;
+    if( bvh->count == 0 ) {
+        return 0;
+    }
+    stack = sstTraversalStack(bvh, local);
+    zero = _mm_setzero_ps();
+    one = _mm_set1_ps(1.0f);
+    eps = _mm_set1_ps(EPSILON);
+    found = 0;
+    stack[0].node = 0;
+    top = sstPacketBox(packet, bvh->nodes[0].low, bvh->nodes[0].high,
+                       &stack[0].near) != 0;
+    while( top > 0 ) {
+        top--;
+        if( stack[top].near > sstPacketFar(packet) ) {
+            continue;
+        }
+        n = &bvh->nodes[stack[top].node];
+        if( n->count == 0 ) {
+            sstPacketChildren(bvh, n, packet, stack, &top);
+            continue;
+        }
+        for( i = n->first; i < n->first + n->count; i++ ) {
+            tri = &bvh->triangles[i*9];
+            for( c = 0; c < 3; c++ ) {
+                e1[c] = _mm_set1_ps(tri[3 + c]);
+                e2[c] = _mm_set1_ps(tri[6 + c]);
+                s[c] = _mm_sub_ps(packet->origin[c], _mm_set1_ps(tri[c]));
+            }
+            sstCross4(packet->dir, e2, p);
+            det = sstDot4(e1, p);
+            mask = _mm_and_ps(packet->active,
+                              _mm_cmpgt_ps(_mm_max_ps(det,
+                                                      _mm_sub_ps(zero, det)),
+                                           eps));
+            inv = _mm_div_ps(one, det);
+            u = _mm_mul_ps(sstDot4(s, p), inv);
+            sstCross4(s, e1, q);
+            v = _mm_mul_ps(sstDot4(packet->dir, q), inv);
+            t = _mm_mul_ps(sstDot4(e2, q), inv);
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+            mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(t, packet->t));
+            bits = _mm_movemask_ps(mask);
+            if( !bits ) {
+                continue;
+            }
+            packet->t = _mm_or_ps(_mm_and_ps(mask, t),
+                                  _mm_andnot_ps(mask, packet->t));
+            packet->u = _mm_or_ps(_mm_and_ps(mask, u),
+                                  _mm_andnot_ps(mask, packet->u));
+            packet->v = _mm_or_ps(_mm_and_ps(mask, v),
+                                  _mm_andnot_ps(mask, packet->v));
+            for( lane = 0; lane < 4; lane++ ) {
+                if( bits & (1 << lane) ) {
+                    triangles[lane] = bvh->items[i];
+                }
+            }
+            found |= bits;
+        }
+    }
+    sstFreeStack(stack, local);
+    return found;
+}
+
+/*
+ * Casts up to 4 rays through a scene together.
+ */
+static void sstPacketScene( sstRayScene *scene, GLfloat *origins,
+GLfloat *dirs, int count, GLfloat tmax, sstRayHit *hits ) {
+    sstRayPacket world, model;
+    GLfloat o[4][3], d[4][3], m_o[4][3], m_d[4][3], out[3][4], *inverse;
+    GLfloat active[4];
+    sstStackEntry local[STACK_SIZE], *stack;
+    sstBVHNode *n;
+    int top, i, c, lane, bits, instance, triangles[4];
+    /* Step 1: Set up the packet, with unused lanes turned off */
+    for( lane = 0; lane < 4; lane++ ) {
+        for( c = 0; c < 3; c++ ) {
+            o[lane][c] = lane < count ? origins[lane*3 + c] : 0.0f;
+            d[lane][c] = lane < count ? dirs[lane*3 + c] : 1.0f;
+        }
+        memset(&active[lane], lane < count ? 0xff : 0, sizeof(GLfloat));
+    }
+    for( lane = 0; lane < count; lane++ ) {
+        hits[lane].instance = -1;
+    }
+    for( c = 0; c < 3; c++ ) {
+        world.origin[c] = _mm_setr_ps(o[0][c], o[1][c], o[2][c], o[3][c]);
+        world.dir[c] = _mm_setr_ps(d[0][c], d[1][c], d[2][c], d[3][c]);
+        world.inverse[c] = sstPacketInverse(world.dir[c]);
+    }
+    world.t = _mm_set1_ps(tmax);
+    world.u = world.v = _mm_setzero_ps();
+    world.active = _mm_loadu_ps(active);
+    /* Step 2: Walk the instance hierarchy, casting into each set reached */
+    stack = sstTraversalStack(scene->top, local);
+    stack[0].node = 0;
+    top = scene->count > 0
+       && sstPacketBox(&world, scene->top->nodes[0].low,
+                       scene->top->nodes[0].high, &stack[0].near);
+    while( top > 0 ) {
+        top--;
+        if( stack[top].near > sstPacketFar(&world) ) {
+            continue;
+        }
+        n = &scene->top->nodes[stack[top].node];
+        if( n->count == 0 ) {
+            sstPacketChildren(scene->top, n, &world, stack, &top);
+            continue;
+        }
+        for( i = n->first; i < n->first + n->count; i++ ) {
+            /* Sub-step 1: Move the packet into the model space of the set */
+            instance = scene->top->items[i];
+            inverse = &scene->inverses[instance*16];
+            for( lane = 0; lane < 4; lane++ ) {
+                sstRayToModel(inverse, o[lane], d[lane], m_o[lane], m_d[lane]);
+            }
+            for( c = 0; c < 3; c++ ) {
+                model.origin[c] = _mm_setr_ps(m_o[0][c], m_o[1][c], m_o[2][c],
+                                              m_o[3][c]);
+                model.dir[c] = _mm_setr_ps(m_d[0][c], m_d[1][c], m_d[2][c],
+                                           m_d[3][c]);
+                model.inverse[c] = sstPacketInverse(model.dir[c]);
+            }
+            model.t = world.t;
+            model.u = world.u;
+            model.v = world.v;
+            model.active = world.active;
+            /* Sub-step 2: Cast it, keeping whatever is nearer */
+            bits = sstPacketTriangles(scene->sets[instance]->bvh, &model,
+                                      triangles);
+            if( !bits ) {
+                continue;
+            }
+            world.t = model.t;
+            world.u = model.u;
+            world.v = model.v;
+            for( lane = 0; lane < count; lane++ ) {
+                if( bits & (1 << lane) ) {
+                    hits[lane].instance = instance;
+                    hits[lane].triangle = triangles[lane];
+                }
+            }
+        }
+    }
+    sstFreeStack(stack, local);
+    /* Step 3: Copy out the nearest hits */
+    _mm_storeu_ps(out[0], world.t);
+    _mm_storeu_ps(out[1], world.u);
+    _mm_storeu_ps(out[2], world.v);
+    for( lane = 0; lane < count; lane++ ) {
+        hits[lane].t = out[0][lane];
+        hits[lane].u = out[1][lane];
+        hits[lane].v = out[2][lane];
+    }
+}
+#endif
+
+/*
+ * BVH functions
+ */
+
+/*
+ * Builds the hierarchy over the triangles of a set from the positions in the
+ * given input data. Returns NULL if there are no positions.
+ */
+struct sstBVH * sstBuildBVH( in_var **inputs, void **data, int size,
+void *indices, GLenum i_type, int i_count ) {
+    struct sstBVH *bvh;
+    GLfloat *pos, *low, *high, *tri, *v[3];
+    int position, stride, t, k, c, tris;
+    position = sstFindPositions(inputs, size);
+    if( position < 0 ) {
+        printf("WARN: No positions to build a BVH from!\n");
+        return NULL;
+    }
+    pos = (GLfloat*)data[position];
+    stride = inputs[position]->components;
+    tris = i_count / 3;
+    /* Step 1: Bound each triangle */
+    low = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (tris + 1));
+    high = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (tris + 1));
+    for( t = 0; t < tris; t++ ) {
+        sstEmptyBox(&low[t*3], &high[t*3]);
+        for( k = 0; k < 3; k++ ) {
+            v[k] = &pos[stride * (indices ? sstGetIndex(indices, i_type,
+                                                        t*3 + k)
+                                          : (GLuint)(t*3 + k))];
+            sstGrowBox(&low[t*3], &high[t*3], v[k], v[k]);
+        }
+    }
+    /* Step 2: Build, then store the triangles in leaf order */
+    bvh = sstBuildHierarchy(low, high, tris);
+    bvh->triangles = (GLfloat*)malloc(sizeof(GLfloat) * 9 * (tris + 1));
+    for( t = 0; t < tris; t++ ) {
+        for( k = 0; k < 3; k++ ) {
+            c = bvh->items[t] * 3 + k;
+            v[k] = &pos[stride * (indices ? sstGetIndex(indices, i_type, c)
+                                          : (GLuint)c)];
+        }
+        tri = &bvh->triangles[t*9];
+        for( c = 0; c < 3; c++ ) {
+            tri[c] = v[0][c];
+            tri[3 + c] = v[1][c] - v[0][c];
+            tri[6 + c] = v[2][c] - v[0][c];
+        }
+    }
+    free(low);
+    free(high);
+    return bvh;
+}
+
+void sstFreeBVH( struct sstBVH *bvh ) {
+    free(bvh->nodes);
+    free(bvh->items);
+    free(bvh->triangles);
+    free(bvh);
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Sets whether sets made with the program keep their triangles on the CPU for
+ * ray casts.
+ */
+void sstBuildBVHs( sstProgram *program, GLboolean build ) {
+    program->build_bvh = build;
+}
+
+/*
+ * Casts a ray in the model space of the given set. Returns 1 and fills in hit
+ * if it hits a triangle within tmax lengths of its direction.
+ */
+int sstRaySet( sstDrawableSet *set, GLfloat *origin, GLfloat *dir,
+GLfloat tmax, sstRayHit *hit ) {
+    if( !set->bvh ) {
+        printf("WARN: Set has no BVH to cast rays against!\n");
+        return 0;
+    }
+    hit->t = tmax;
+    hit->instance = -1;
+    return sstRayTriangles(set->bvh, origin, dir, hit);
+}
+
+/*
+ * Fills in the world space ray under a point on the screen, given in normalized
+ * device coordinates, for the given projection times view matrix. The ray
+ * starts on the near plane and reaches the far plane at a distance of 1.
+ */
+void sstPickRay( GLfloat *viewProj, GLfloat x, GLfloat y, GLfloat *origin,
+GLfloat *dir ) {
+    GLfloat inverse[16], p[2][4];
+    int i, c;
+    sstInvert4(viewProj, inverse);
+    for( i = 0; i < 2; i++ ) {
+        for( c = 0; c < 4; c++ ) {
+            p[i][c] = inverse[c] * x + inverse[4 + c] * y
+                    + inverse[8 + c] * (i ? 1.0f : -1.0f) + inverse[12 + c];
+        }
+    }
+    for( c = 0; c < 3; c++ ) {
+        origin[c] = p[0][c] / p[0][3];
+        dir[c] = p[1][c] / p[1][3] - origin[c];
+    }
+}
+
+/*
+ * Generates an empty ray scene with room for capacity instances.
+ */
+sstRayScene * sstNewRayScene( int capacity ) {
+    sstRayScene *scene;
+    scene = (sstRayScene*)malloc(sizeof(sstRayScene));
+    scene->count = 0;
+    scene->capacity = capacity > 0 ? capacity : 16;
+    scene->sets = (sstDrawableSet**)malloc(sizeof(sstDrawableSet*)
+                                           * scene->capacity);
+    scene->models = (GLfloat*)malloc(sizeof(GLfloat) * 16 * scene->capacity);
+    scene->inverses = (GLfloat*)malloc(sizeof(GLfloat) * 16 * scene->capacity);
+    scene->low = (GLfloat*)malloc(sizeof(GLfloat) * 3 * scene->capacity);
+    scene->high = (GLfloat*)malloc(sizeof(GLfloat) * 3 * scene->capacity);
+    scene->top = NULL;
+    scene->dirty = GL_TRUE;
+    return scene;
+}
+
+/*
+ * Adds an instance of a set drawn with the given model matrix. Returns its
+ * index, or -1 if the set has no BVH.
+ */
+int sstRaySceneAdd( sstRayScene *scene, sstDrawableSet *set,
+GLfloat *model ) {
+    if( !set->bvh ) {
+        printf("WARN: Set has no BVH to cast rays against!\n");
+        return -1;
+    }
+    if( scene->count == scene->capacity ) {
+        scene->capacity *= 2;
+        scene->sets = (sstDrawableSet**)realloc(scene->sets,
+            sizeof(sstDrawableSet*) * scene->capacity);
+        scene->models = (GLfloat*)realloc(scene->models,
+            sizeof(GLfloat) * 16 * scene->capacity);
+        scene->inverses = (GLfloat*)realloc(scene->inverses,
+            sizeof(GLfloat) * 16 * scene->capacity);
+        scene->low = (GLfloat*)realloc(scene->low,
+            sizeof(GLfloat) * 3 * scene->capacity);
+        scene->high = (GLfloat*)realloc(scene->high,
+            sizeof(GLfloat) * 3 * scene->capacity);
+    }
+    scene->sets[scene->count] = set;
+    sstRaySceneMove(scene, scene->count++, model);
+    return scene->count - 1;
+}
+
+/*
+ * Changes the model matrix of an instance.
+ */
+void sstRaySceneMove( sstRayScene *scene, int index, GLfloat *model ) {
+    memcpy(&scene->models[index*16], model, sizeof(GLfloat) * 16);
+    sstPlaceInstance(scene, index);
+    scene->dirty = GL_TRUE;
+}
+
+/*
+ * Removes every instance from the scene.
+ */
+void sstRaySceneClear( sstRayScene *scene ) {
+    scene->count = 0;
+    scene->dirty = GL_TRUE;
+}
+
+/*
+ * Casts a world space ray through the scene. Returns 1 and fills in hit if it
+ * hits a triangle within tmax lengths of its direction.
+ */
+int sstRayCast( sstRayScene *scene, GLfloat *origin, GLfloat *dir,
+GLfloat tmax, sstRayHit *hit ) {
+    GLfloat inverse[3], m_origin[3], m_dir[3];
+    sstStackEntry local[STACK_SIZE], *stack;
+    sstBVHNode *n;
+    int top, i, instance, found;
+    sstUpdateRayScene(scene);
+    hit->t = tmax;
+    hit->instance = -1;
+    if( scene->count == 0 ) {
+        return 0;
+    }
+    stack = sstTraversalStack(scene->top, local);
+    sstInverseDirection(dir, inverse);
+    found = 0;
+    stack[0].node = 0;
+    stack[0].near = sstRayBox(scene->top->nodes[0].low,
+                              scene->top->nodes[0].high, origin, inverse,
+                              hit->t);
+    top = stack[0].near >= 0.0f;
+    while( top > 0 ) {
+        top--;
+        if( stack[top].near > hit->t ) {
+            continue;
+        }
+        n = &scene->top->nodes[stack[top].node];
+        if( n->count == 0 ) {
+            sstPushChildren(scene->top, n, origin, inverse, hit->t, stack,
+                            &top);
+            continue;
+        }
+        for( i = n->first; i < n->first + n->count; i++ ) {
+            instance = scene->top->items[i];
+            sstRayToModel(&scene->inverses[instance*16], origin, dir,
+                          m_origin, m_dir);
+            if( sstRayTriangles(scene->sets[instance]->bvh, m_origin, m_dir,
+                                hit) ) {
+                hit->instance = instance;
+                found = 1;
+            }
+        }
+    }
+    sstFreeStack(stack, local);
+    return found;
+}
+
+/*
+ * Returns 1 and fills in hit if the segment between two world space points
+ * hits anything in the scene. The distance is a fraction of the segment.
+ */
+int sstSegmentCast( sstRayScene *scene, GLfloat *from, GLfloat *to,
+sstRayHit *hit ) {
+    GLfloat dir[3];
+    dir[0] = to[0] - from[0];
+    dir[1] = to[1] - from[1];
+    dir[2] = to[2] - from[2];
+    return sstRayCast(scene, from, dir, 1.0f, hit);
+}
+
+/*
+ * Casts count world space rays through the scene, filling in a hit for each.
+ * Rays are traced 4 at a time with SSE. Returns the number that hit.
+ */
+int sstRayCastPacket( sstRayScene *scene, GLfloat *origins, GLfloat *dirs,
+int count, GLfloat tmax, sstRayHit *hits ) {
+    int i, found;
+    found = 0;
+    sstUpdateRayScene(scene);
+#ifdef __SSE__
+    for( i = 0; i < count; i += 4 ) {
+        sstPacketScene(scene, &origins[i*3], &dirs[i*3],
+                       count - i < 4 ? count - i : 4, tmax, &hits[i]);
+    }
+    for( i = 0; i < count; i++ ) {
+        found += hits[i].instance >= 0;
+    }
+#else
+    for( i = 0; i < count; i++ ) {
+        found += sstRayCast(scene, &origins[i*3], &dirs[i*3], tmax, &hits[i]);
+    }
+#endif
+    return found;
+}
+
+/*
+ * Frees the given ray scene. The sets in it are not freed.
+ */
+void sstFreeRayScene( sstRayScene *scene ) {
+    if( scene->top ) {
+        sstFreeBVH(scene->top);
+    }
+    free(scene->sets);
+    free(scene->models);
+    free(scene->inverses);
+    free(scene->low);
+    free(scene->high);
+    free(scene);
+}
@@ -0,0 +1,914 @@
+/*
+ * sst_codec.c
+ * By Steven Smith
+ *
+ * This file contains a compressed format for vertex and index streams, so that
+ * meshes take up less room on disk and load faster than they can be read raw.
+ *
+ * Vertices are split into blocks that fit in the cache, and each byte of the
+ * vertex is coded as a column down the block: the difference from the same
+ * byte of the previous vertex, zigzagged so that small changes either way are
+ * small numbers. Each group of 16 differences is then packed with the fewest
+ * bits (0, 2, 4 or 8) that hold all of them, with 2 bits per group saying
+ * which. Groups decode with a handful of SSE2 instructions, and the columns are
+ * turned back into vertices 16 at a time before being written out in order,
+ * so decoding straight into mapped buffers never reads them back.
+ *
+ * Triangle indices are coded a triangle at a time against a FIFO of recently
+ * seen edges and one of recently seen vertices. Meshes ordered for the vertex
+ * cache mostly come out as fans and strips, where each triangle shares an edge
+ * with one just before it and adds the next new vertex, which takes a single
+ * byte. Other index streams are coded as differences between indices.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "sst.h"
+#include "sst_private.h"
+
+/* First byte of each kind of stream, changed with the format */
+#define VERTEX_HEADER    0xA0
+#define TRIANGLE_HEADER  0xB0
+#define SEQUENCE_HEADER  0xB1
+
+/* Largest vertex that can be coded, in bytes */
+#define MAX_VERTEX_SIZE 256
+
+/* Size of the decoded columns of a block, and most vertices in a block */
+#define BLOCK_BYTES 8192
+#define MAX_BLOCK   256
+
+/* Number of entries in the edge and vertex FIFOs */
+#define FIFO_SIZE 16
+
+/* Triangle codes. The high nibble is the slot of the shared edge, and the low
+ * nibble says where the third vertex comes from. */
+#define CODE_NEW      0x0  /* The next new vertex */
+#define CODE_EXPLICIT 0xF  /* Coded as a difference */
+#define CODE_FRESH    0xF0 /* No shared edge, three new vertices */
+#define CODE_LOOSE    0xF1 /* No shared edge, three differences */
+
+/*
+ * Helper functions for vertices
+ */
+
+/*
+ * Returns the number of vertices per block for the given vertex size. It is a
+ * multiple of 16 so that blocks are made of whole groups.
+ */
+static int sstBlockSize( int vertex_size ) {
+    int block;
+    block = (BLOCK_BYTES / vertex_size) & ~15;
+    return block < MAX_BLOCK ? block : MAX_BLOCK;
+}
+
+/*
+ * Returns the number of bytes taken up by the group headers of a column.
+ */
+static int sstHeaderBytes( int padded ) {
+    return (padded / 16 + 3) / 4;
+}
+
+/*
+ * Packs a column of padded zigzagged differences. Returns the end of the
+ * written data, or NULL if it doesn't fit before end.
+ */
+static unsigned char * sstEncodeColumn( unsigned char *out,
+unsigned char *end, unsigned char *z, int padded ) {
+    unsigned char *header, max;
+    int g, i, code, bytes;
+    header = out;
+    out += sstHeaderBytes(padded);
+    if( out > end ) {
+        return NULL;
+    }
+    memset(header, 0, sstHeaderBytes(padded));
+    for( g = 0; g < padded / 16; g++, z += 16 ) {
+        /* Step 1: Pick the narrowest width */
+        max = 0;
+        for( i = 0; i < 16; i++ ) {
+            max = z[i] > max ? z[i] : max;
+        }
+        code = max == 0 ? 0 : max < 4 ? 1 : max < 16 ? 2 : 3;
+        bytes = code ? 2 << code : 0;
+        if( out + bytes > end ) {
+            return NULL;
+        }
+        header[g / 4] |= code << ((g % 4) * 2);
+        /* Step 2: Pack, first value in the high bits */
+        switch( code ) {
+        case 1:
+            for( i = 0; i < 4; i++ ) {
+                out[i] = (z[4*i] << 6) | (z[4*i + 1] << 4) | (z[4*i + 2] << 2)
+                       | z[4*i + 3];
+            }
+            break;
+        case 2:
+            for( i = 0; i < 8; i++ ) {
+                out[i] = (z[2*i] << 4) | z[2*i + 1];
+            }
+            break;
+        case 3:
+            memcpy(out, z, 16);
+            break;
+        }
+        out += bytes;
+    }
+    return out;
+}
+
+/*
+ * Unpacks a column of a block, undoing the differences against the last byte
+ * of the previous block, which is updated. Returns the end of the column's
+ * data, or NULL if it runs past end.
+ */
+static const unsigned char * sstDecodeColumn( const unsigned char *in,
+const unsigned char *end, unsigned char *column, int padded,
+unsigned char *last ) {
+    const unsigned char *header;
+    int g, code, bytes;
+#ifdef __SSE2__
+    __m128i x, z, v, t, carry, zero, m1, m3, m15, m127;
+    int word;
+#else
+    unsigned char z[16], value;
+    int i;
+#endif
+    header = in;
+    in += sstHeaderBytes(padded);
+    if( in > end ) {
+        return NULL;
+    }
+#ifdef __SSE2__
+    zero = _mm_setzero_si128();
+    m1 = _mm_set1_epi8(1);
+    m3 = _mm_set1_epi8(3);
+    m15 = _mm_set1_epi8(15);
+    m127 = _mm_set1_epi8(127);
+    carry = _mm_set1_epi8((char)*last);
+#else
+    value = *last;
+#endif
+    for( g = 0; g < padded / 16; g++ ) {
+        code = (header[g / 4] >> ((g % 4) * 2)) & 3;
+        bytes = code ? 2 << code : 0;
+        if( in + bytes > end ) {
+            return NULL;
+        }
+#ifdef __SSE2__
+        /* Step 1: Unpack 16 values */
+        switch( code ) {
+        case 0:
+            z = zero;
+            break;
+        case 1:
+            memcpy(&word, in, 4);
+            x = _mm_cvtsi32_si128(word);
+            z = _mm_unpacklo_epi16(
+                    _mm_unpacklo_epi8(
+                        _mm_and_si128(_mm_srli_epi16(x, 6), m3),
+                        _mm_and_si128(_mm_srli_epi16(x, 4), m3)),
+                    _mm_unpacklo_epi8(
+                        _mm_and_si128(_mm_srli_epi16(x, 2), m3),
+                        _mm_and_si128(x, m3)));
+            break;
+        case 2:
+            x = _mm_loadl_epi64((const __m128i*)in);
+            z = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(x, 4), m15),
+                                  _mm_and_si128(x, m15));
+            break;
+        default:
+            z = _mm_loadu_si128((const __m128i*)in);
+            break;
+        }
+        /* Step 2: Undo the zigzag */
+        v = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(z, 1), m127),
+                          _mm_sub_epi8(zero, _mm_and_si128(z, m1)));
+        /* Step 3: Running sum of the differences */
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, carry);
+        _mm_storeu_si128((__m128i*)(column + g * 16), v);
+        /* Step 4: Carry the last value over to the next group */
+        t = _mm_unpackhi_epi8(v, v);
+        t = _mm_unpackhi_epi16(t, t);
+        carry = _mm_shuffle_epi32(t, 0xFF);
+#else
+        switch( code ) {
+        case 0:
+            memset(z, 0, 16);
+            break;
+        case 1:
+            for( i = 0; i < 4; i++ ) {
+                z[4*i] = in[i] >> 6;
+                z[4*i + 1] = (in[i] >> 4) & 3;
+                z[4*i + 2] = (in[i] >> 2) & 3;
+                z[4*i + 3] = in[i] & 3;
+            }
+            break;
+        case 2:
+            for( i = 0; i < 8; i++ ) {
+                z[2*i] = in[i] >> 4;
+                z[2*i + 1] = in[i] & 15;
+            }
+            break;
+        default:
+            memcpy(z, in, 16);
+            break;
+        }
+        for( i = 0; i < 16; i++ ) {
+            value += (unsigned char)((z[i] >> 1) ^ -(z[i] & 1));
+            column[g * 16 + i] = value;
+        }
+#endif
+        in += bytes;
+    }
+    /* Padding differences are 0, so this is the last real vertex's byte */
+    *last = column[padded - 1];
+    return in;
+}
+
+/*
+ * Writes m vertices of a block's decoded columns out as whole vertices, by way
+ * of a staging area so that the destination is written in order. Widens the
+ * given box to take in the first 3 floats of each vertex if low isn't NULL.
+ */
+static void sstWriteVertices( unsigned char *dst, unsigned char *columns,
+int padded, int base, int m, int vertex_size, GLfloat *low, GLfloat *high ) {
+    /* Room for the last vertex's 16 byte stores to run over */
+    unsigned char stage[16 * MAX_VERTEX_SIZE + 16];
+    GLfloat p[3];
+    int i, k, c;
+#ifdef __SSE2__
+    __m128i r[16], t[4];
+    int j, g;
+#else
+    int j;
+#endif
+    /* Step 1: Transpose 16 columns by 16 vertices at a time. Chunks are
+     * written last to first, so that where a chunk runs over into the next
+     * vertex, the next vertex's own chunks are written after it. */
+    for( k = (vertex_size - 1) & ~15; k >= 0; k -= 16 ) {
+#ifdef __SSE2__
+        for( j = 0; j < 16; j++ ) {
+            r[j] = k + j < vertex_size
+                 ? _mm_loadu_si128((__m128i*)(columns + (k + j) * padded
+                                              + base))
+                 : _mm_setzero_si128();
+        }
+        /* Sub-step 1: Each 4 columns into 4 bytes per vertex */
+        for( g = 0; g < 16; g += 4 ) {
+            t[0] = _mm_unpacklo_epi8(r[g], r[g + 1]);
+            t[1] = _mm_unpackhi_epi8(r[g], r[g + 1]);
+            t[2] = _mm_unpacklo_epi8(r[g + 2], r[g + 3]);
+            t[3] = _mm_unpackhi_epi8(r[g + 2], r[g + 3]);
+            r[g] = _mm_unpacklo_epi16(t[0], t[2]);
+            r[g + 1] = _mm_unpackhi_epi16(t[0], t[2]);
+            r[g + 2] = _mm_unpacklo_epi16(t[1], t[3]);
+            r[g + 3] = _mm_unpackhi_epi16(t[1], t[3]);
+        }
+        /* Sub-step 2: Then 4 of those into 16 bytes per vertex */
+        for( g = 0; g < 4; g++ ) {
+            t[0] = _mm_unpacklo_epi32(r[g], r[g + 4]);
+            t[1] = _mm_unpacklo_epi32(r[g + 8], r[g + 12]);
+            t[2] = _mm_unpackhi_epi32(r[g], r[g + 4]);
+            t[3] = _mm_unpackhi_epi32(r[g + 8], r[g + 12]);
+            _mm_storeu_si128((__m128i*)(stage + (4 * g) * vertex_size + k),
+                             _mm_unpacklo_epi64(t[0], t[1]));
+            _mm_storeu_si128((__m128i*)(stage + (4 * g + 1) * vertex_size + k),
+                             _mm_unpackhi_epi64(t[0], t[1]));
+            _mm_storeu_si128((__m128i*)(stage + (4 * g + 2) * vertex_size + k),
+                             _mm_unpacklo_epi64(t[2], t[3]));
+            _mm_storeu_si128((__m128i*)(stage + (4 * g + 3) * vertex_size + k),
+                             _mm_unpackhi_epi64(t[2], t[3]));
+        }
+#else
+        for( i = 0; i < 16; i++ ) {
+            for( j = 0; j < 16 && k + j < vertex_size; j++ ) {
+                stage[i * vertex_size + k + j] =
+                    columns[(k + j) * padded + base + i];
+            }
+        }
+#endif
+    }
+    /* Step 2: Track the bounds while the vertices are still in the cache */
+    if( low ) {
+        for( i = 0; i < m; i++ ) {
+            memcpy(p, stage + i * vertex_size, sizeof(p));
+            for( c = 0; c < 3; c++ ) {
+                low[c] = p[c] < low[c] ? p[c] : low[c];
+                high[c] = p[c] > high[c] ? p[c] : high[c];
+            }
+        }
+    }
+    /* Step 3: Write them out in one go */
+    memcpy(dst, stage, m * vertex_size);
+}
+
+/*
+ * Decodes a vertex stream, optionally tracking the box around the first 3
+ * floats of each vertex. Returns 1 on success, or 0 if the stream is corrupt.
+ */
+static int sstDecodeStream( unsigned char *dst, int count, int vertex_size,
+const unsigned char *buffer, size_t size, GLfloat *low, GLfloat *high ) {
+    unsigned char columns[BLOCK_BYTES], last[MAX_VERTEX_SIZE];
+    const unsigned char *in, *end;
+    int first, block, n, padded, base, k;
+    if( vertex_size <= 0 || vertex_size > MAX_VERTEX_SIZE || vertex_size % 4
+     || count < 0 || size < 1 || buffer[0] != VERTEX_HEADER ) {
+        return 0;
+    }
+    in = buffer + 1;
+    end = buffer + size;
+    block = sstBlockSize(vertex_size);
+    memset(last, 0, vertex_size);
+    for( first = 0; first < count; first += block ) {
+        n = count - first < block ? count - first : block;
+        padded = (n + 15) & ~15;
+        for( k = 0; k < vertex_size; k++ ) {
+            in = sstDecodeColumn(in, end, columns + k * padded, padded,
+                                 &last[k]);
+            if( !in ) {
+                return 0;
+            }
+        }
+        for( base = 0; base < n; base += 16 ) {
+            sstWriteVertices(dst + (size_t)(first + base) * vertex_size,
+                             columns, padded, base,
+                             n - base < 16 ? n - base : 16, vertex_size, low,
+                             high);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Helper functions for indices
+ */
+
+/*
+ * Writes an unsigned number 7 bits at a time, low bits first. Returns the end
+ * of the written bytes, or NULL if they don't fit before end.
+ */
+static unsigned char * sstPutVarint( unsigned char *out, unsigned char *end,
+GLuint value ) {
+    do {
+        if( out >= end ) {
+            return NULL;
+        }
+        *out++ = (unsigned char)((value & 127) | (value > 127 ? 128 : 0));
+        value >>= 7;
+    } while( value );
+    return out;
+}
+
+/*
+ * Reads a number written by sstPutVarint(). Returns the end of its bytes, or
+ * NULL if it runs past end.
+ */
+static const unsigned char * sstGetVarint( const unsigned char *in,
+const unsigned char *end, GLuint *value ) {
+    int shift;
+    *value = 0;
+    for( shift = 0; shift < 35; shift += 7 ) {
+        if( in >= end ) {
+            return NULL;
+        }
+        *value |= (GLuint)(*in & 127) << shift;
+        if( !(*in++ & 128) ) {
+            return in;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Differences between indices are zigzagged, so small steps back are small
+ * numbers too.
+ */
+static GLuint sstZigzag( GLuint value, GLuint last ) {
+    GLuint d;
+    d = value - last;
+    return (d << 1) ^ (GLuint)-(GLint)(d >> 31);
+}
+
+static GLuint sstUnzigzag( GLuint z, GLuint last ) {
+    return last + ((z >> 1) ^ (GLuint)-(GLint)(z & 1));
+}
+
+/*
+ * The state shared by the encoder and the decoder of triangles.
+ */
+typedef struct {
+    GLuint edges[FIFO_SIZE][2];
+    int edge_next;
+    GLuint vertices[FIFO_SIZE];
+    int vertex_next;
+    GLuint next; /* One past the highest index seen */
+    GLuint last; /* Last index coded as a difference */
+} sstIndexState;
+
+static void sstInitIndexState( sstIndexState *s ) {
+    memset(s->edges, 0xFF, sizeof(s->edges));
+    memset(s->vertices, 0xFF, sizeof(s->vertices));
+    s->edge_next = 0;
+    s->vertex_next = 0;
+    s->next = 0;
+    s->last = 0;
+}
+
+static void sstPushVertex( sstIndexState *s, GLuint v ) {
+    s->vertices[s->vertex_next++ % FIFO_SIZE] = v;
+    if( v + 1 > s->next ) {
+        s->next = v + 1;
+    }
+}
+
+/*
+ * Remembers the edges of a triangle the way round a neighbour sharing them
+ * would have them.
+ */
+static void sstPushTriangle( sstIndexState *s, GLuint a, GLuint b, GLuint c ) {
+    GLuint *e;
+    e = s->edges[s->edge_next++ % FIFO_SIZE];
+    e[0] = b;
+    e[1] = a;
+    e = s->edges[s->edge_next++ % FIFO_SIZE];
+    e[0] = c;
+    e[1] = b;
+    e = s->edges[s->edge_next++ % FIFO_SIZE];
+    e[0] = a;
+    e[1] = c;
+}
+
+/*
+ * Returns the index of the given FIFO slot, counted back from the newest.
+ */
+static int sstEdgeSlot( sstIndexState *s, int slot ) {
+    return (s->edge_next - 1 - slot) & (FIFO_SIZE - 1);
+}
+
+static int sstVertexSlot( sstIndexState *s, int slot ) {
+    return (s->vertex_next - 1 - slot) & (FIFO_SIZE - 1);
+}
+
+/*
+ * Codec functions
+ */
+
+/*
+ * Returns the most bytes sstEncodeVertices() can need for the given vertices.
+ */
+size_t sstEncodeVerticesBound( int count, int vertex_size ) {
+    size_t bound;
+    int first, block, n, padded;
+    if( vertex_size <= 0 || vertex_size > MAX_VERTEX_SIZE ) {
+        return 0;
+    }
+    bound = 1;
+    block = sstBlockSize(vertex_size);
+    for( first = 0; first < count; first += block ) {
+        n = count - first < block ? count - first : block;
+        padded = (n + 15) & ~15;
+        bound += (size_t)vertex_size * (padded + sstHeaderBytes(padded));
+    }
+    return bound;
+}
+
+/*
+ * Encodes count vertices of vertex_size bytes each into the buffer. Returns the
+ * number of bytes written, or 0 if they don't fit or can't be coded.
+ */
+size_t sstEncodeVertices( unsigned char *buffer, size_t size,
+const void *vertices, int count, int vertex_size ) {
+    unsigned char z[MAX_BLOCK], last[MAX_VERTEX_SIZE];
+    const unsigned char *src;
+    unsigned char *out, *end;
+    signed char d;
+    int first, block, n, padded, i, k;
+    if( vertex_size <= 0 || vertex_size > MAX_VERTEX_SIZE || vertex_size % 4 ) {
+        printf("WARN: Vertices must be a multiple of 4 bytes, up to %d!\n",
+               MAX_VERTEX_SIZE);
+        return 0;
+    }
+    if( size < 1 ) {
+        return 0;
+    }
+    src = (const unsigned char*)vertices;
+    out = buffer;
+    end = buffer + size;
+    *out++ = VERTEX_HEADER;
+    block = sstBlockSize(vertex_size);
+    memset(last, 0, vertex_size);
+    for( first = 0; first < count; first += block ) {
+        n = count - first < block ? count - first : block;
+        padded = (n + 15) & ~15;
+        for( k = 0; k < vertex_size; k++ ) {
+            /* Step 1: Zigzagged differences down the column */
+            for( i = 0; i < n; i++ ) {
+                d = (signed char)(src[(size_t)(first + i) * vertex_size + k]
+                                  - last[k]);
+                last[k] = src[(size_t)(first + i) * vertex_size + k];
+                z[i] = (unsigned char)(((unsigned char)d << 1)
+                                       ^ (d < 0 ? 0xFF : 0));
+            }
+            memset(z + n, 0, padded - n);
+            /* Step 2: Pack them */
+            out = sstEncodeColumn(out, end, z, padded);
+            if( !out ) {
+                return 0;
+            }
+        }
+    }
+    return out - buffer;
+}
+
+/*
+ * Decodes count vertices of vertex_size bytes each from an encoded buffer.
+ * Returns 1 on success, or 0 if the buffer is corrupt.
+ */
+int sstDecodeVertices( void *vertices, int count, int vertex_size,
+const unsigned char *buffer, size_t size ) {
+    return sstDecodeStream((unsigned char*)vertices, count, vertex_size, buffer,
+                           size, NULL, NULL);
+}
+
+/*
+ * Returns the most bytes sstEncodeIndices() can need for the given indices.
+ */
+size_t sstEncodeIndicesBound( int i_count ) {
+    /* Loose triangles take a code and up to 5 bytes per index */
+    return 1 + (size_t)i_count * 6;
+}
+
+/*
+ * Encodes i_count indices of the given type into the buffer. Triangle lists
+ * are coded a triangle at a time, anything else as differences. Returns the
+ * number of bytes written, or 0 if they don't fit.
+ */
+size_t sstEncodeIndices( unsigned char *buffer, size_t size, GLenum mode,
+const void *indices, GLenum i_type, int i_count ) {
+    sstIndexState s;
+    unsigned char *out, *end;
+    GLuint t[3], x, y, z;
+    int i, r, slot, found, code, e;
+    if( size < 1 ) {
+        return 0;
+    }
+    out = buffer;
+    end = buffer + size;
+    sstInitIndexState(&s);
+    /* Sequences of indices */
+    if( mode != GL_TRIANGLES || i_count % 3 ) {
+        *out++ = SEQUENCE_HEADER;
+        for( i = 0; i < i_count; i++ ) {
+            x = sstGetIndex((void*)indices, i_type, i);
+            out = sstPutVarint(out, end, sstZigzag(x, s.last));
+            if( !out ) {
+                return 0;
+            }
+            s.last = x;
+        }
+        return out - buffer;
+    }
+    /* Triangles */
+    *out++ = TRIANGLE_HEADER;
+    for( i = 0; i < i_count; i += 3 ) {
+        t[0] = sstGetIndex((void*)indices, i_type, i);
+        t[1] = sstGetIndex((void*)indices, i_type, i + 1);
+        t[2] = sstGetIndex((void*)indices, i_type, i + 2);
+        /* Step 1: Look for a shared edge, trying each rotation */
+        found = -1;
+        x = y = z = 0;
+        for( slot = 0; slot < FIFO_SIZE - 1 && found < 0; slot++ ) {
+            e = sstEdgeSlot(&s, slot);
+            for( r = 0; r < 3; r++ ) {
+                if( s.edges[e][0] == t[r] && s.edges[e][1] == t[(r + 1) % 3] ) {
+                    x = t[r];
+                    y = t[(r + 1) % 3];
+                    z = t[(r + 2) % 3];
+                    found = slot;
+                    break;
+                }
+            }
+        }
+        if( out >= end ) {
+            return 0;
+        }
+        if( found >= 0 ) {
+            /* Step 2: Code where the third vertex comes from */
+            code = CODE_EXPLICIT;
+            if( z == s.next ) {
+                code = CODE_NEW;
+            }
+            else {
+                for( slot = 0; slot < CODE_EXPLICIT - 1; slot++ ) {
+                    if( s.vertices[sstVertexSlot(&s, slot)] == z ) {
+                        code = slot + 1;
+                        break;
+                    }
+                }
+            }
+            *out++ = (unsigned char)((found << 4) | code);
+            if( code == CODE_EXPLICIT ) {
+                out = sstPutVarint(out, end, sstZigzag(z, s.last));
+                if( !out ) {
+                    return 0;
+                }
+                s.last = z;
+            }
+            if( code == CODE_NEW || code == CODE_EXPLICIT ) {
+                sstPushVertex(&s, z);
+            }
+        }
+        else {
+            /* Step 3: No shared edge, code all three */
+            x = t[0];
+            y = t[1];
+            z = t[2];
+            if( x == s.next && y == s.next + 1 && z == s.next + 2 ) {
+                *out++ = CODE_FRESH;
+            }
+            else {
+                *out++ = CODE_LOOSE;
+                for( r = 0; r < 3; r++ ) {
+                    out = sstPutVarint(out, end, sstZigzag(t[r], s.last));
+                    if( !out ) {
+                        return 0;
+                    }
+                    s.last = t[r];
+                }
+            }
+            for( r = 0; r < 3; r++ ) {
+                sstPushVertex(&s, t[r]);
+            }
+        }
+        sstPushTriangle(&s, x, y, z);
+    }
+    return out - buffer;
+}
+
+/*
+ * Decodes i_count indices into an array of the given type. Returns 1 on
+ * success, or 0 if the buffer is corrupt or an index isn't below count.
+ */
+int sstDecodeIndices( void *indices, GLenum i_type, int i_count, int count,
+const unsigned char *buffer, size_t size ) {
+    sstIndexState s;
+    const unsigned char *in, *end;
+    GLuint t[3], value;
+    int i, r, code, e;
+    if( size < 1 ) {
+        return 0;
+    }
+    in = buffer + 1;
+    end = buffer + size;
+    sstInitIndexState(&s);
+    /* Sequences of indices */
+    if( buffer[0] == SEQUENCE_HEADER ) {
+        for( i = 0; i < i_count; i++ ) {
+            in = sstGetVarint(in, end, &value);
+            if( !in ) {
+                return 0;
+            }
+            s.last = sstUnzigzag(value, s.last);
+            if( s.last >= (GLuint)count ) {
+                return 0;
+            }
+            sstPutIndex(indices, i_type, i, s.last);
+        }
+        return 1;
+    }
+    if( buffer[0] != TRIANGLE_HEADER || i_count % 3 ) {
+        return 0;
+    }
+    /* Triangles */
+    for( i = 0; i < i_count; i += 3 ) {
+        if( in >= end ) {
+            return 0;
+        }
+        code = *in++;
+        if( code == CODE_FRESH ) {
+            for( r = 0; r < 3; r++ ) {
+                t[r] = s.next + r;
+            }
+        }
+        else if( code == CODE_LOOSE ) {
+            for( r = 0; r < 3; r++ ) {
+                in = sstGetVarint(in, end, &value);
+                if( !in ) {
+                    return 0;
+                }
+                t[r] = s.last = sstUnzigzag(value, s.last);
+            }
+        }
+        else {
+            /* Shared edge, then the third vertex */
+            e = sstEdgeSlot(&s, code >> 4);
+            t[0] = s.edges[e][0];
+            t[1] = s.edges[e][1];
+            code &= 15;
+            if( code == CODE_NEW ) {
+                t[2] = s.next;
+            }
+            else if( code == CODE_EXPLICIT ) {
+                in = sstGetVarint(in, end, &value);
+                if( !in ) {
+                    return 0;
+                }
+                t[2] = s.last = sstUnzigzag(value, s.last);
+            }
+            else {
+                t[2] = s.vertices[sstVertexSlot(&s, code - 1)];
+            }
+        }
+        for( r = 0; r < 3; r++ ) {
+            if( t[r] >= (GLuint)count ) {
+                return 0;
+            }
+            sstPutIndex(indices, i_type, i + r, t[r]);
+        }
+        /* Same FIFO updates as the encoder */
+        if( code == CODE_FRESH || code == CODE_LOOSE ) {
+            for( r = 0; r < 3; r++ ) {
+                sstPushVertex(&s, t[r]);
+            }
+        }
+        else if( code == CODE_NEW || code == CODE_EXPLICIT ) {
+            sstPushVertex(&s, t[2]);
+        }
+        sstPushTriangle(&s, t[0], t[1], t[2]);
+    }
+    return 1;
+}
+
+/*
+ * Generates a drawable set from encoded streams, decoding them straight into
+ * mapped buffers.
+ */
+sstDrawableSet * sstDrawableSetEncoded( sstProgram *program, GLenum mode,
+int count, const unsigned char *indices, size_t i_size, int i_count, ... ) {
+    sstDrawableSet *set;
+    sstDrawable *drawable;
+    in_var **inputs;
+    const unsigned char **streams;
+    size_t *sizes;
+    void **data, *decoded;
+    GLfloat *low, *high, d;
+    GLenum i_type;
+    char *name;
+    int i, c, size, position, direct, ok;
+    va_list ap;
+    /* Step 1: Read the name, stream and size of each input */
+    size = program->in_count - program->inst_count;
+    inputs = (in_var**)malloc(sizeof(in_var*) * size);
+    streams = (const unsigned char**)malloc(sizeof(unsigned char*) * size);
+    sizes = (size_t*)malloc(sizeof(size_t) * size);
+    data = (void**)calloc(size, sizeof(void*));
+    ok = 1;
+    direct = !program->mesh_passes && !program->build_bvh
+          && !sstRenderRemote();
+    va_start(ap, i_count);
+    for( i = 0; i < size; i++ ) {
+        name = va_arg(ap, char*);
+        streams[i] = va_arg(ap, const unsigned char*);
+        sizes[i] = va_arg(ap, size_t);
+        inputs[i] = sstFindInput(program, name);
+        if( inputs[i] == NULL ) {
+            printf("ERROR: Input variable [%s] does not exist!\n", name);
+            ok = 0;
+        }
+        else {
+            direct = direct && inputs[i]->compress == SST_UNCOMPRESSED;
+        }
+    }
+    va_end(ap);
+    set = NULL;
+    if( !ok ) {
+        goto done;
+    }
+    /* Step 2: Sets that are processed or compressed need the data on the
+     * CPU, so they go the usual way, as do sets for the render thread to
+     * build */
+    if( !direct ) {
+        for( i = 0; i < size && ok; i++ ) {
+            data[i] = malloc((size_t)sstInputSize(inputs[i]) * count);
+            ok = sstDecodeVertices(data[i], count, sstInputSize(inputs[i]),
+                                   streams[i], sizes[i]);
+        }
+        decoded = indices ? malloc(sizeof(GLuint) * i_count) : NULL;
+        if( ok && indices ) {
+            ok = sstDecodeIndices(decoded, GL_UNSIGNED_INT, i_count, count,
+                                  indices, i_size);
+        }
+        if( ok ) {
+            set = sstBuildDrawableSet(program, mode, count, decoded,
+                                      GL_UNSIGNED_INT, i_count, inputs, data);
+        }
+        else {
+            printf("WARN: Encoded mesh is corrupt!\n");
+        }
+        free(decoded);
+        goto done;
+    }
+    /* Step 3: Set up the set, with the narrowest index type that fits */
+    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
+    set->size = size;
+    set->mode = mode;
+    set->count = count;
+    set->inst_id = 0;
+    set->lod_count = 0;
+    set->lods = NULL;
+    set->bvh = NULL;
+    sstResetDecode(set);
+    glGenVertexArrays(1, &set->vao);
+    sstBindVertexArray(set->vao);
+    set->i_size = 0;
+    set->i_type = 0;
+    set->i_buffer = 0;
+    if( indices ) {
+        if( (GLuint)count - 1 <= sstMaxIndex(GL_UNSIGNED_BYTE) ) {
+            i_type = GL_UNSIGNED_BYTE;
+        }
+        else if( (GLuint)count - 1 <= sstMaxIndex(GL_UNSIGNED_SHORT) ) {
+            i_type = GL_UNSIGNED_SHORT;
+        }
+        else {
+            i_type = GL_UNSIGNED_INT;
+        }
+        set->i_size = i_count;
+        set->i_type = i_type;
+        glGenBuffers(1, &set->i_buffer);
+        sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, set->i_buffer);
+        sstBufferWords(GL_ELEMENT_ARRAY_BUFFER,
+                       sstSizeFromEnum(i_type) * i_count, NULL);
+        decoded = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0,
+                                   sstSizeFromEnum(i_type) * i_count,
+                                   GL_MAP_WRITE_BIT
+                                   | GL_MAP_INVALIDATE_BUFFER_BIT);
+        ok = sstDecodeIndices(decoded, i_type, i_count, count, indices, i_size);
+        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    }
+    /* Step 4: Decode each input into its mapped buffer. The box around the
+     * positions is found on the way, and the sphere is taken around it. */
+    position = sstFindPositions(inputs, size);
+    for( c = 0; c < 3; c++ ) {
+        set->low[c] = count > 0 ? 3.4e38f : 0.0f;
+        set->high[c] = count > 0 ? -3.4e38f : 0.0f;
+    }
+    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * size);
+    for( i = 0; i < size; i++ ) {
+        drawable = &set->drawables[i];
+        sstInitDrawable(drawable, inputs[i]);
+        glGenBuffers(1, &drawable->buffer);
+        sstBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
+        sstBufferWords(GL_ARRAY_BUFFER, sstVertexSize(drawable) * count, NULL);
+        if( ok && count > 0 ) {
+            decoded = glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                       sstVertexSize(drawable) * count,
+                                       GL_MAP_WRITE_BIT
+                                       | GL_MAP_INVALIDATE_BUFFER_BIT);
+            low = i == position && count > 0 ? set->low : NULL;
+            high = i == position && count > 0 ? set->high : NULL;
+            ok = sstDecodeStream((unsigned char*)decoded, count,
+                                 sstVertexSize(drawable), streams[i], sizes[i],
+                                 low, high);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        sstAttribPointers(drawable);
+    }
+    if( position < 0 ) {
+        for( c = 0; c < 3; c++ ) {
+            set->low[c] = set->high[c] = 0.0f;
+        }
+    }
+    set->radius = 0.0f;
+    for( c = 0; c < 3; c++ ) {
+        set->center[c] = (set->low[c] + set->high[c]) * 0.5f;
+        d = (set->high[c] - set->low[c]) * 0.5f;
+        set->radius += d * d;
+    }
+    set->radius = sqrtf(set->radius);
+    if( !ok ) {
+        printf("WARN: Encoded mesh is corrupt!\n");
+        sstFreeDrawableSet(set);
+        set = NULL;
+    }
+done:
+    for( i = 0; i < size; i++ ) {
+        free(data[i]);
+    }
+    free(inputs);
+    free(streams);
+    free(sizes);
+    free(data);
+    return set;
+}
@@ -0,0 +1,288 @@
+/*
+ * sst_commands.c
+ * By Steven Smith
+ *
+ * This file contains command lists. Any thread can record program changes,
+ * uniform values, pipeline binds and draws into a list of its own, without
+ * touching GL or anything shared with other threads. The thread the context
+ * belongs to then executes the lists in order. Commands are packed one after
+ * another into blocks that are never moved and are kept when the list is
+ * reset, so recording is a bump of a pointer and reusing a list from frame to
+ * frame allocates nothing.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Size of the blocks commands are packed into, unless one needs more */
+#define BLOCK_SIZE 65536
+
+/* Commands and values are kept aligned for any type they hold */
+#define ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef enum {
+    CMD_ACTIVATE,
+    CMD_UNIFORM,
+    CMD_PIPELINE,
+    CMD_DRAW,
+    CMD_DRAW_INSTANCED
+} command_type;
+
+typedef struct {
+    command_type type;
+    int index; /* Uniform index, or instance count for instanced draws */
+    size_t size; /* Bytes to the next command, including the uniform value */
+    void *object; /* Program, pipeline or set */
+    sstInstanceBuffer *buffer;
+} command; /* Uniform commands are followed by the value */
+
+/* Counts calls to sstExecuteCommandLists(), starting from 1 */
+static unsigned int replay = 0;
+
+typedef struct block {
+    struct block *next;
+    size_t size; /* Bytes of data */
+    size_t used;
+    char *data; /* Directly after the block */
+} block;
+
+struct sstCommandList {
+    block *first;
+    block *current; /* Block being recorded into */
+    int count; /* Commands recorded */
+};
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns a new, empty block with room for at least the given number of bytes.
+ */
+static block * sstNewBlock( size_t size ) {
+    block *b;
+    size = size > BLOCK_SIZE ? ALIGN(size) : BLOCK_SIZE;
+    b = (block*)malloc(ALIGN(sizeof(block)) + size);
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    b->data = (char*)b + ALIGN(sizeof(block));
+    return b;
+}
+
+/*
+ * Returns room at the end of the list for a command of the given size, moving
+ * on to the next block, or adding one, if it doesn't fit in the current one.
+ */
+static command * sstNewCommand( sstCommandList *list, command_type type,
+size_t size ) {
+    block *b, *next;
+    command *cmd;
+    b = list->current;
+    if( b->used + size > b->size ) {
+        /* Step 1: Reuse the next block from earlier recordings if it fits,
+         * otherwise put a new one in its place */
+        next = b->next;
+        if( next && next->size < size ) {
+            b->next = next->next;
+            free(next);
+            next = NULL;
+        }
+        if( !next ) {
+            next = sstNewBlock(size);
+            next->next = b->next;
+            b->next = next;
+        }
+        next->used = 0;
+        list->current = b = next;
+    }
+    /* Step 2: Bump */
+    cmd = (command*)(b->data + b->used);
+    b->used += size;
+    cmd->type = type;
+    cmd->size = size;
+    list->count++;
+    return cmd;
+}
+
+/*
+ * Sets a uniform of a program to a value from a command list, the way
+ * sstSetUniformData() would, but only uploading it if it has changed since
+ * this replay last uploaded it.
+ */
+static void sstReplayUniform( sstProgram *program, int index, GLvoid *data ) {
+    uniform *un;
+    if( sst_threaded && sstRenderUniform(program, index, data) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferUniform(program, index, data);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueueUniform(program, index, data);
+        return;
+    }
+    /* The last value set may only have been recorded, or uploaded to another
+     * program, so only values this replay uploaded to the program itself are
+     * known to be in it */
+    un = &program->uniforms[index];
+    if( program == sst_active && un->replayed == replay
+     && memcmp(un->value, data, sstUniformSize(un)) == 0 ) {
+        return;
+    }
+    memcpy(un->value, data, sstUniformSize(un));
+    sstUploadUniform(un, un->location, data);
+    un->replayed = program == sst_active ? replay : 0;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Creates an empty command list.
+ */
+sstCommandList * sstNewCommandList( void ) {
+    sstCommandList *list;
+    list = (sstCommandList*)malloc(sizeof(sstCommandList));
+    list->first = sstNewBlock(0);
+    list->current = list->first;
+    list->count = 0;
+    return list;
+}
+
+/*
+ * Empties a command list, keeping its memory for the next recording.
+ */
+void sstResetCommandList( sstCommandList *list ) {
+    list->first->used = 0;
+    list->current = list->first;
+    list->count = 0;
+}
+
+/*
+ * Records the recording equivalents of sstActivateProgram(),
+ * sstSetUniformData(), sstBindPipeline(), sstDrawSet() and
+ * sstDrawSetInstanced().
+ */
+void sstRecordActivate( sstCommandList *list, sstProgram *program ) {
+    command *cmd;
+    cmd = sstNewCommand(list, CMD_ACTIVATE, ALIGN(sizeof(command)));
+    cmd->object = program;
+}
+
+void sstRecordUniform( sstCommandList *list, sstProgram *program, char *name,
+GLvoid *data ) {
+    command *cmd;
+    uniform *un;
+    GLuint size;
+    int i;
+    for( i = 0; i < program->un_count; i++ ) {
+        if( strcmp(program->uniforms[i].name, name) == 0 ) {
+            break;
+        }
+    }
+    if( i >= program->un_count ) {
+        printf("WARN: Uniform variable [%s] does not exist!\n", name);
+        return;
+    }
+    un = &program->uniforms[i];
+    size = sstUniformSize(un);
+    cmd = sstNewCommand(list, CMD_UNIFORM, ALIGN(sizeof(command))
+                                           + ALIGN(size));
+    cmd->object = program;
+    cmd->index = i;
+    memcpy((char*)cmd + ALIGN(sizeof(command)), data, size);
+}
+
+void sstRecordPipeline( sstCommandList *list, sstPipeline *pipeline ) {
+    command *cmd;
+    cmd = sstNewCommand(list, CMD_PIPELINE, ALIGN(sizeof(command)));
+    cmd->object = pipeline;
+}
+
+void sstRecordDraw( sstCommandList *list, sstDrawableSet *set ) {
+    command *cmd;
+    cmd = sstNewCommand(list, CMD_DRAW, ALIGN(sizeof(command)));
+    cmd->object = set;
+}
+
+void sstRecordDrawInstanced( sstCommandList *list, sstDrawableSet *set,
+sstInstanceBuffer *buffer, int count ) {
+    command *cmd;
+    cmd = sstNewCommand(list, CMD_DRAW_INSTANCED, ALIGN(sizeof(command)));
+    cmd->object = set;
+    cmd->buffer = buffer;
+    cmd->index = count;
+}
+
+/*
+ * Returns the number of commands recorded since the list was made or reset.
+ */
+int sstCommandCount( sstCommandList *list ) {
+    return list->count;
+}
+
+/*
+ * Executes the given command lists in order, on the thread whose context is
+ * current. Returns the number of commands executed.
+ */
+int sstExecuteCommandLists( sstCommandList **lists, int count ) {
+    block *b;
+    command *cmd;
+    char *end;
+    int i, executed;
+    executed = 0;
+    if( ++replay == 0 ) {
+        replay = 1;
+    }
+    for( i = 0; i < count; i++ ) {
+        for( b = lists[i]->first; b; b = b->next ) {
+            cmd = (command*)b->data;
+            end = b->data + b->used;
+            for( ; (char*)cmd < end;
+                 cmd = (command*)((char*)cmd + cmd->size) ) {
+                switch( cmd->type ) {
+                case CMD_ACTIVATE:
+                    sstActivateProgram((sstProgram*)cmd->object);
+                    break;
+                case CMD_UNIFORM:
+                    sstReplayUniform((sstProgram*)cmd->object, cmd->index,
+                                     (char*)cmd + ALIGN(sizeof(command)));
+                    break;
+                case CMD_PIPELINE:
+                    sstBindPipeline((sstPipeline*)cmd->object);
+                    break;
+                case CMD_DRAW:
+                    sstDrawSet((sstDrawableSet*)cmd->object);
+                    break;
+                case CMD_DRAW_INSTANCED:
+                    sstDrawSetInstanced((sstDrawableSet*)cmd->object,
+                                        cmd->buffer, cmd->index);
+                    break;
+                }
+            }
+            if( b == lists[i]->current ) {
+                break;
+            }
+        }
+        executed += lists[i]->count;
+    }
+    return executed;
+}
+
+/*
+ * Frees a command list.
+ */
+void sstFreeCommandList( sstCommandList *list ) {
+    block *b, *next;
+    for( b = list->first; b; b = next ) {
+        next = b->next;
+        free(b);
+    }
+    free(list);
+}
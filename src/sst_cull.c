@@ -0,0 +1,333 @@
+/*
+ * sst_cull.c
+ * By Steven Smith
+ *
+ * This file contains frustum culling of drawable sets. The world space bounds
+ * of every entry in a cull list are kept one array per component, so that they
+ * can be tested against the planes of the frustum 8 at a time with AVX or 4 at
+ * a time with SSE, falling back to plain C when neither is available.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "sst.h"
+#include "sst_private.h"
+
+/* Entries are padded out to this many, the widest SIMD width */
+#define LANES 8
+/* Number of per-entry arrays in a cull list */
+#define ARRAYS 7
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Makes room for at least capacity entries, keeping the ones already there.
+ * The arrays are aligned for the widest SIMD loads.
+ */
+static void sstReserveCullList( sstCullList *list, int capacity ) {
+    GLfloat *old[ARRAYS], **arrays[ARRAYS];
+    void *memory;
+    size_t aligned;
+    int i;
+    if( capacity <= list->capacity ) {
+        return;
+    }
+    capacity = (capacity + LANES - 1) / LANES * LANES;
+    if( capacity < list->capacity * 2 ) {
+        capacity = list->capacity * 2;
+    }
+    arrays[0] = &list->cx;
+    arrays[1] = &list->cy;
+    arrays[2] = &list->cz;
+    arrays[3] = &list->ex;
+    arrays[4] = &list->ey;
+    arrays[5] = &list->ez;
+    arrays[6] = &list->radius;
+    memory = malloc(sizeof(GLfloat) * ARRAYS * capacity + 32);
+    aligned = ((size_t)memory + 31) & ~(size_t)31;
+    for( i = 0; i < ARRAYS; i++ ) {
+        old[i] = *arrays[i];
+        *arrays[i] = (GLfloat*)aligned + i * capacity;
+        /* Padding entries are empty boxes at the origin, and are never
+         * reported as visible */
+        memset(*arrays[i], 0, sizeof(GLfloat) * capacity);
+        if( list->count ) {
+            memcpy(*arrays[i], old[i], sizeof(GLfloat) * list->count);
+        }
+    }
+    free(list->memory);
+    list->memory = memory;
+    list->sets = (sstDrawableSet**)realloc(list->sets,
+                                           sizeof(sstDrawableSet*) * capacity);
+    list->capacity = capacity;
+}
+
+/*
+ * Transforms the bounds of an entry's set into world space. The box is
+ * re-fitted around the transformed box, and the sphere radius is scaled by the
+ * largest scale of the model matrix.
+ */
+static void sstPlaceEntry( sstCullList *list, int index, GLfloat *model ) {
+    sstDrawableSet *set;
+    GLfloat c[3], e[3], world[3], extent[3], scale, s;
+    int i, j;
+    set = list->sets[index];
+    for( i = 0; i < 3; i++ ) {
+        c[i] = set->center[i];
+        e[i] = (set->high[i] - set->low[i]) * 0.5f;
+    }
+    scale = 0.0f;
+    for( i = 0; i < 3; i++ ) {
+        world[i] = model[12 + i];
+        extent[i] = 0.0f;
+        for( j = 0; j < 3; j++ ) {
+            world[i] += model[j*4 + i] * c[j];
+            extent[i] += fabsf(model[j*4 + i]) * e[j];
+        }
+        s = model[i*4] * model[i*4] + model[i*4 + 1] * model[i*4 + 1]
+          + model[i*4 + 2] * model[i*4 + 2];
+        if( s > scale ) {
+            scale = s;
+        }
+    }
+    list->cx[index] = world[0];
+    list->cy[index] = world[1];
+    list->cz[index] = world[2];
+    list->ex[index] = extent[0];
+    list->ey[index] = extent[1];
+    list->ez[index] = extent[2];
+    list->radius[index] = set->radius * sqrtf(scale);
+}
+
+#ifdef __AVX__
+/*
+ * Tests 8 entries at a time. An entry is outside a plane if its center is
+ * further behind it than the smaller of the box and sphere reach along the
+ * plane normal.
+ */
+static int sstCullEntries( sstCullList *list, GLfloat *planes, int *visible ) {
+    __m256 cx, cy, cz, ex, ey, ez, r, nx, ny, nz, d, dist, reach, inside, sign;
+    int i, p, mask, n;
+    sign = _mm256_set1_ps(-0.0f);
+    n = 0;
+    for( i = 0; i < list->count; i += 8 ) {
+        cx = _mm256_load_ps(&list->cx[i]);
+        cy = _mm256_load_ps(&list->cy[i]);
+        cz = _mm256_load_ps(&list->cz[i]);
+        ex = _mm256_load_ps(&list->ex[i]);
+        ey = _mm256_load_ps(&list->ey[i]);
+        ez = _mm256_load_ps(&list->ez[i]);
+        r = _mm256_load_ps(&list->radius[i]);
+        inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for( p = 0; p < 6; p++ ) {
+            nx = _mm256_set1_ps(planes[p*4]);
+            ny = _mm256_set1_ps(planes[p*4 + 1]);
+            nz = _mm256_set1_ps(planes[p*4 + 2]);
+            d = _mm256_set1_ps(planes[p*4 + 3]);
+            dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx),
+                                               _mm256_mul_ps(ny, cy)),
+                                 _mm256_add_ps(_mm256_mul_ps(nz, cz), d));
+            reach = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, nx), ex),
+                              _mm256_mul_ps(_mm256_andnot_ps(sign, ny), ey)),
+                _mm256_mul_ps(_mm256_andnot_ps(sign, nz), ez));
+            reach = _mm256_min_ps(reach, r);
+            inside = _mm256_and_ps(inside,
+                                   _mm256_cmp_ps(_mm256_add_ps(dist, reach),
+                                                 _mm256_setzero_ps(),
+                                                 _CMP_GE_OQ));
+        }
+        mask = _mm256_movemask_ps(inside);
+        for( p = 0; mask; p++, mask >>= 1 ) {
+            if( (mask & 1) && i + p < list->count ) {
+                visible[n++] = i + p;
+            }
+        }
+    }
+    return n;
+}
+#elif defined(__SSE__)
+/*
+ * Tests 4 entries at a time. An entry is outside a plane if its center is
+ * further behind it than the smaller of the box and sphere reach along the
+ * plane normal.
+ */
+static int sstCullEntries( sstCullList *list, GLfloat *planes, int *visible ) {
+    __m128 cx, cy, cz, ex, ey, ez, r, nx, ny, nz, d, dist, reach, inside, sign;
+    int i, p, mask, n;
+    sign = _mm_set1_ps(-0.0f);
+    n = 0;
+    for( i = 0; i < list->count; i += 4 ) {
+        cx = _mm_load_ps(&list->cx[i]);
+        cy = _mm_load_ps(&list->cy[i]);
+        cz = _mm_load_ps(&list->cz[i]);
+        ex = _mm_load_ps(&list->ex[i]);
+        ey = _mm_load_ps(&list->ey[i]);
+        ez = _mm_load_ps(&list->ez[i]);
+        r = _mm_load_ps(&list->radius[i]);
+        inside = _mm_cmpeq_ps(cx, cx);
+        for( p = 0; p < 6; p++ ) {
+            nx = _mm_set1_ps(planes[p*4]);
+            ny = _mm_set1_ps(planes[p*4 + 1]);
+            nz = _mm_set1_ps(planes[p*4 + 2]);
+            d = _mm_set1_ps(planes[p*4 + 3]);
+            dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx),
+                                         _mm_mul_ps(ny, cy)),
+                              _mm_add_ps(_mm_mul_ps(nz, cz), d));
+            reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, nx),
+                                                     ex),
+                                          _mm_mul_ps(_mm_andnot_ps(sign, ny),
+                                                     ey)),
+                               _mm_mul_ps(_mm_andnot_ps(sign, nz), ez));
+            reach = _mm_min_ps(reach, r);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, reach),
+                                                     _mm_setzero_ps()));
+        }
+        mask = _mm_movemask_ps(inside);
+        for( p = 0; mask; p++, mask >>= 1 ) {
+            if( (mask & 1) && i + p < list->count ) {
+                visible[n++] = i + p;
+            }
+        }
+    }
+    return n;
+}
+#else
+/*
+ * Tests one entry at a time. An entry is outside a plane if its center is
+ * further behind it than the smaller of the box and sphere reach along the
+ * plane normal.
+ */
+static int sstCullEntries( sstCullList *list, GLfloat *planes, int *visible ) {
+    GLfloat *n, dist, reach;
+    int i, p, count;
+    count = 0;
+    for( i = 0; i < list->count; i++ ) {
+        for( p = 0; p < 6; p++ ) {
+            n = &planes[p*4];
+            dist = n[0] * list->cx[i] + n[1] * list->cy[i]
+                 + n[2] * list->cz[i] + n[3];
+            reach = fabsf(n[0]) * list->ex[i] + fabsf(n[1]) * list->ey[i]
+                  + fabsf(n[2]) * list->ez[i];
+            if( list->radius[i] < reach ) {
+                reach = list->radius[i];
+            }
+            if( dist + reach < 0.0f ) {
+                break;
+            }
+        }
+        if( p == 6 ) {
+            visible[count++] = i;
+        }
+    }
+    return count;
+}
+#endif
+
+/*
+ * Cull list functions
+ */
+
+/*
+ * Generates an empty cull list with room for capacity entries.
+ */
+sstCullList * sstNewCullList( int capacity ) {
+    sstCullList *list;
+    list = (sstCullList*)malloc(sizeof(sstCullList));
+    list->count = 0;
+    list->capacity = 0;
+    list->sets = NULL;
+    list->memory = NULL;
+    list->cx = list->cy = list->cz = NULL;
+    list->ex = list->ey = list->ez = NULL;
+    list->radius = NULL;
+    sstReserveCullList(list, capacity > 0 ? capacity : LANES);
+    return list;
+}
+
+/*
+ * Adds a set drawn with the given model matrix to the list. Returns the index
+ * of the entry.
+ */
+int sstCullListAdd( sstCullList *list, sstDrawableSet *set, GLfloat *model ) {
+    sstReserveCullList(list, list->count + 1);
+    list->sets[list->count] = set;
+    sstPlaceEntry(list, list->count, model);
+    return list->count++;
+}
+
+/*
+ * Changes the model matrix of an entry in the list.
+ */
+void sstCullListMove( sstCullList *list, int index, GLfloat *model ) {
+    sstPlaceEntry(list, index, model);
+}
+
+/*
+ * Removes every entry from the list.
+ */
+void sstCullListClear( sstCullList *list ) {
+    int i;
+    for( i = 0; i < list->count; i++ ) {
+        list->cx[i] = list->cy[i] = list->cz[i] = 0.0f;
+        list->ex[i] = list->ey[i] = list->ez[i] = 0.0f;
+        list->radius[i] = 0.0f;
+    }
+    list->count = 0;
+}
+
+/*
+ * Fills in the six planes of the frustum of the given projection times view
+ * matrix, as (a, b, c, d) with unit normals pointing into the frustum: left,
+ * right, bottom, top, near, far.
+ */
+void sstFrustumPlanes( GLfloat *viewProj, GLfloat *planes ) {
+    GLfloat length;
+    int p, i, row;
+    for( p = 0; p < 6; p++ ) {
+        /* Each plane is the last row plus or minus one of the others */
+        row = p / 2;
+        for( i = 0; i < 4; i++ ) {
+            planes[p*4 + i] = viewProj[i*4 + 3]
+                            + (p % 2 ? -viewProj[i*4 + row]
+                                     : viewProj[i*4 + row]);
+        }
+        length = sqrtf(planes[p*4] * planes[p*4]
+                     + planes[p*4 + 1] * planes[p*4 + 1]
+                     + planes[p*4 + 2] * planes[p*4 + 2]);
+        if( length > 0.0f ) {
+            for( i = 0; i < 4; i++ ) {
+                planes[p*4 + i] /= length;
+            }
+        }
+    }
+}
+
+/*
+ * Tests every entry in the list against the frustum of the given projection
+ * times view matrix. Fills in the indices of the visible entries, in order, and
+ * returns how many there are.
+ */
+int sstCullFrustum( sstCullList *list, GLfloat *viewProj, int *visible ) {
+    GLfloat planes[24];
+    sstFrustumPlanes(viewProj, planes);
+    return sstCullEntries(list, planes, visible);
+}
+
+/*
+ * Frees the given cull list. The sets in it are not freed.
+ */
+void sstFreeCullList( sstCullList *list ) {
+    free(list->memory);
+    free(list->sets);
+    free(list);
+}
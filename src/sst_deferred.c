@@ -0,0 +1,630 @@
+/*
+ * sst_deferred.c
+ * By Steven Smith
+ *
+ * This file contains deferred drawing. While deferring, draw calls and the
+ * uniform changes between them are recorded instead of being executed. When
+ * flushed, runs of draws of the same set with the same program where only a few
+ * uniforms change from draw to draw are merged into a single instanced draw.
+ * The merged draws use a variant of the program where the changing uniforms
+ * have been turned into per-instance inputs, so existing shaders and call sites
+ * get the benefit of instancing without having to be rewritten.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Runs of draws shorter than this are drawn one at a time */
+#define MIN_RUN 2
+
+/* Merged uniforms are tracked in a bitmask, so only this many can be merged */
+#define MAX_UNIFORMS 32
+
+/* Most instanced variants kept per program, least recently used dropped */
+#define MAX_VARIANTS 8
+
+typedef enum {
+    CMD_ACTIVATE,
+    CMD_UNIFORM,
+    CMD_DRAW,
+    CMD_DRAW_INSTANCED,
+    CMD_DRAW_RANGE,
+    CMD_PIPELINE
+} command_type;
+
+typedef struct {
+    command_type type;
+    sstProgram *program; /* Program to activate, or program active for draws */
+    sstDrawableSet *set;
+    sstInstanceBuffer *buffer;
+    sstPipeline *pipeline; /* Pipeline to bind */
+    int index; /* Uniform index, instance count or number of indices */
+    size_t offset; /* Offset of the uniform value, or first index of a range */
+} command;
+
+struct sstVariant {
+    GLuint program; /* Program ID, 0 if building the variant failed */
+    unsigned int mask; /* Uniforms that are per-instance inputs */
+    GLint *locations; /* Uniform locations, or attribute locations if masked */
+    GLuint buffer; /* Buffer holding the per-instance values */
+    GLsizei stride; /* Size of the per-instance values for one instance */
+    struct sstVariant *next; /* Next most recently used variant */
+};
+
+/* Non-zero while draw calls are being recorded */
+int sst_deferred = 0;
+
+/* The recorded commands and the uniform values they set */
+static command *commands = NULL;
+static int command_count = 0;
+static int command_size = 0;
+static char *payload = NULL;
+static size_t payload_count = 0;
+static size_t payload_size = 0;
+
+/* The program that will be active when the last recorded command runs */
+static sstProgram *recorded = NULL;
+
+/* Scratch space for tracking the values of mergeable uniforms during a run */
+static char *running = NULL;
+static size_t running_size = 0;
+static size_t offsets[MAX_UNIFORMS];
+
+/* Scratch space for packing per-instance values */
+static char *instances = NULL;
+static size_t instances_size = 0;
+
+/*
+ * Helper functions for recording
+ */
+
+/*
+ * Returns a new command at the end of the command list, growing it if needed.
+ */
+static command * sstNewCommand( command_type type ) {
+    command *cmd;
+    if( command_count == command_size ) {
+        command_size = command_size ? command_size * 2 : 64;
+        commands = (command*)realloc(commands, sizeof(command) * command_size);
+    }
+    cmd = &commands[command_count++];
+    cmd->type = type;
+    cmd->program = recorded;
+    cmd->set = NULL;
+    cmd->buffer = NULL;
+    cmd->pipeline = NULL;
+    cmd->index = 0;
+    cmd->offset = 0;
+    return cmd;
+}
+
+/*
+ * Copies data to the end of the payload buffer, returning its offset.
+ */
+static size_t sstPushPayload( GLvoid *data, size_t size ) {
+    size_t offset;
+    if( payload_count + size > payload_size ) {
+        for( payload_size = payload_size ? payload_size : 1024;
+             payload_count + size > payload_size; payload_size *= 2 );
+        payload = (char*)realloc(payload, payload_size);
+    }
+    offset = payload_count;
+    memcpy(payload + offset, data, size);
+    payload_count += size;
+    return offset;
+}
+
+void sstDeferActivate( sstProgram *program ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_ACTIVATE);
+    cmd->program = program;
+    recorded = program;
+}
+
+void sstDeferUniform( sstProgram *program, int index, GLvoid *data ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_UNIFORM);
+    cmd->program = program;
+    cmd->index = index;
+    cmd->offset = sstPushPayload(data,
+                                 sstUniformSize(&program->uniforms[index]));
+}
+
+void sstDeferDraw( sstDrawableSet *set ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_DRAW);
+    cmd->set = set;
+}
+
+void sstDeferDrawInstanced( sstDrawableSet *set, sstInstanceBuffer *buffer,
+int count ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_DRAW_INSTANCED);
+    cmd->set = set;
+    cmd->buffer = buffer;
+    cmd->index = count;
+}
+
+void sstDeferPipeline( sstPipeline *pipeline ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_PIPELINE);
+    cmd->pipeline = pipeline;
+    /* Binding a pipeline activates its program */
+    if( pipeline ) {
+        recorded = sstGetPipelineState(pipeline)->program;
+    }
+}
+
+void sstDeferDrawRange( sstDrawableSet *set, GLuint first, int size ) {
+    command *cmd;
+    cmd = sstNewCommand(CMD_DRAW_RANGE);
+    cmd->set = set;
+    cmd->index = size;
+    cmd->offset = first;
+}
+
+/*
+ * Helper functions for building instanced variants
+ */
+
+/*
+ * Returns true iff the given uniform can be merged into per-instance data.
+ */
+static int sstMergeable( sstProgram *program, int index ) {
+    return index < MAX_UNIFORMS && program->uniforms[index].instanceable;
+}
+
+/*
+ * Returns the number of attribute locations a uniform takes up as an input.
+ */
+static GLuint sstUniformSlots( uniform *un ) {
+    return un->second != 0 ? un->first : 1;
+}
+
+/*
+ * Returns true iff the given character is a valid character for an identifier.
+ */
+static int sstIsIdentChar( char c ) {
+    return (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9')
+        || (c == '_');
+}
+
+/*
+ * Returns a copy of a vertex shader source where the uniforms in the mask have
+ * been turned into input variables. Declarations are rewritten in place, so
+ * the copy has the same length and line numbers as the original.
+ */
+static char * sstRewriteUniforms( sstProgram *program, char *source,
+unsigned int mask ) {
+    char *result, *line, *s, *name;
+    size_t length;
+    int i;
+    result = (char*)malloc(sizeof(char) * (strlen(source) + 1));
+    strcpy(result, source);
+    for( line = result; line; line = strchr(line, '\n') ) {
+        if( *line == '\n' ) {
+            line++;
+        }
+        /* Same rule as the parser: declarations start at the start of a line */
+        if( strncmp(line, "uniform ", 8) != 0 ) {
+            continue;
+        }
+        /* Skip over the type to get to the name */
+        for( s = line + 8; *s == ' ' || *s == '\t'; s++ );
+        for( ; *s && *s != ' ' && *s != '\t' && *s != '\n'; s++ );
+        for( ; *s == ' ' || *s == '\t'; s++ );
+        for( i = 0; i < program->un_count; i++ ) {
+            if( !(mask & (1u << i)) ) {
+                continue;
+            }
+            name = program->uniforms[i].name;
+            length = strlen(name);
+            if( strncmp(s, name, length) == 0 && !sstIsIdentChar(s[length]) ) {
+                /* "uniform" -> "in     " */
+                memcpy(line, "in     ", 7);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ * Builds the instanced variant of a program for the given set of merged
+ * uniforms. The variant keeps the attribute locations of the original program
+ * so that it can be used with the original program's drawable sets. Returns
+ * the variant, which has a program ID of 0 if it couldn't be built.
+ */
+static struct sstVariant * sstBuildVariant( sstProgram *program,
+unsigned int mask ) {
+    struct sstVariant *variant;
+    GLuint prog, shader;
+    GLint max_attribs;
+    GLint next;
+    char *source;
+    in_var *in;
+    uniform *un;
+    int i;
+    variant = (struct sstVariant*)malloc(sizeof(struct sstVariant));
+    variant->program = 0;
+    variant->mask = mask;
+    variant->locations = (GLint*)malloc(sizeof(GLint) * program->un_count);
+    variant->buffer = 0;
+    variant->stride = 0;
+    variant->next = NULL;
+    /* Step 1: Create program and attach shaders, rewriting vertex shaders */
+    prog = glCreateProgram();
+    for( i = 0; i < program->shader_count; i++ ) {
+        if( program->sources[i] ) {
+            source = sstRewriteUniforms(program, program->sources[i], mask);
+            shader = sstCompileShader(GL_VERTEX_SHADER, (const char**)&source,
+                                      1);
+            free(source);
+            if( !shader ) {
+                printf("WARN: Failed to compile instanced variant!\n");
+                glDeleteProgram(prog);
+                return variant;
+            }
+            glAttachShader(prog, shader);
+            /* Flagged for deletion, goes away along with the program */
+            glDeleteShader(shader);
+        }
+        else {
+            glAttachShader(prog, program->shaders[i]);
+        }
+    }
+    /* Step 2: Keep the original input locations and put the new per-instance
+     * inputs after them */
+    next = 0;
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( in->location >= 0 ) {
+            glBindAttribLocation(prog, in->location, in->name);
+            if( in->location + (GLint)in->slots > next ) {
+                next = in->location + in->slots;
+            }
+        }
+    }
+    for( i = 0; i < program->un_count; i++ ) {
+        if( mask & (1u << i) ) {
+            un = &program->uniforms[i];
+            glBindAttribLocation(prog, next, un->name);
+            variant->locations[i] = next;
+            next += sstUniformSlots(un);
+            variant->stride += sstUniformSize(un);
+        }
+    }
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+    if( next > max_attribs ) {
+        printf("WARN: Not enough attribute locations for instanced variant!\n");
+        glDeleteProgram(prog);
+        return variant;
+    }
+    /* Step 3: Link program */
+    if( !sstLinkProgram(prog) ) {
+        printf("WARN: Failed to link instanced variant!\n");
+        glDeleteProgram(prog);
+        return variant;
+    }
+    /* Step 4: Get locations for the remaining uniforms */
+    for( i = 0; i < program->un_count; i++ ) {
+        if( !(mask & (1u << i)) ) {
+            un = &program->uniforms[i];
+            variant->locations[i] = glGetUniformLocation(prog, un->name);
+        }
+    }
+    glGenBuffers(1, &variant->buffer);
+    variant->program = prog;
+    return variant;
+}
+
+/*
+ * Returns the instanced variant of a program for the given set of merged
+ * uniforms, building it if needed. The program keeps a list of its variants,
+ * most recently used first, so that runs switching between a few masks don't
+ * rebuild them; past MAX_VARIANTS, the least recently used is freed. Variants
+ * that failed to build are kept too, so they aren't tried again. Returns NULL
+ * if the variant can't be built.
+ */
+static struct sstVariant * sstGetVariant( sstProgram *program,
+unsigned int mask ) {
+    struct sstVariant **link, *variant;
+    int kept;
+    /* Step 1: Look for it, noting the last link if the list is full */
+    kept = 0;
+    for( link = &program->variant; *link && (*link)->mask != mask;
+         link = &(*link)->next ) {
+        kept++;
+    }
+    variant = *link;
+    if( variant ) {
+        *link = variant->next;
+    }
+    else {
+        variant = sstBuildVariant(program, mask);
+        if( kept >= MAX_VARIANTS ) {
+            for( link = &program->variant; (*link)->next;
+                 link = &(*link)->next );
+            sstFreeVariant(*link);
+            *link = NULL;
+        }
+    }
+    /* Step 2: Move it to the front */
+    variant->next = program->variant;
+    program->variant = variant;
+    return variant->program ? variant : NULL;
+}
+
+/*
+ * Frees an instanced variant built for a program by sstFlushDeferred(), along
+ * with every variant after it in the program's list.
+ */
+void sstFreeVariant( struct sstVariant *variant ) {
+    struct sstVariant *next;
+    for( ; variant; variant = next ) {
+        next = variant->next;
+        if( variant->program ) {
+            glDeleteProgram(variant->program);
+            sstDeleteBuffers(1, &variant->buffer);
+        }
+        free(variant->locations);
+        free(variant);
+    }
+}
+
+/*
+ * Helper functions for flushing
+ */
+
+/*
+ * Resets the running values of the mergeable uniforms of a program to their
+ * current values.
+ */
+static void sstResetRunning( sstProgram *program ) {
+    size_t size;
+    int i;
+    size = 0;
+    for( i = 0; i < program->un_count && i < MAX_UNIFORMS; i++ ) {
+        offsets[i] = size;
+        if( sstMergeable(program, i) ) {
+            size += sstUniformSize(&program->uniforms[i]);
+        }
+    }
+    if( size > running_size ) {
+        running_size = size;
+        running = (char*)realloc(running, running_size);
+    }
+    for( i = 0; i < program->un_count && i < MAX_UNIFORMS; i++ ) {
+        if( sstMergeable(program, i) ) {
+            memcpy(running + offsets[i], program->uniforms[i].value,
+                   sstUniformSize(&program->uniforms[i]));
+        }
+    }
+}
+
+/*
+ * Starting at a draw command, finds the run of draws of the same set with the
+ * same program where only mergeable uniforms change in between. Returns the
+ * index just past the last draw of the run, along with the number of draws and
+ * the uniforms that change.
+ */
+static int sstScanRun( int start, int *count, unsigned int *mask ) {
+    command *first, *cmd;
+    sstProgram *program;
+    uniform *un;
+    unsigned int pending;
+    int i, end;
+    first = &commands[start];
+    program = first->program;
+    *count = 1;
+    *mask = 0;
+    end = start + 1;
+    if( program == NULL ) {
+        return end;
+    }
+    sstResetRunning(program);
+    pending = 0;
+    for( i = start + 1; i < command_count; i++ ) {
+        cmd = &commands[i];
+        if( cmd->type == CMD_UNIFORM && cmd->program == program ) {
+            un = &program->uniforms[cmd->index];
+            if( sstMergeable(program, cmd->index) ) {
+                if( memcmp(running + offsets[cmd->index], payload + cmd->offset,
+                           sstUniformSize(un)) != 0 ) {
+                    memcpy(running + offsets[cmd->index], payload + cmd->offset,
+                           sstUniformSize(un));
+                    pending |= 1u << cmd->index;
+                }
+            }
+            /* Anything else may only be set to the value it already has */
+            else if( memcmp(un->value, payload + cmd->offset,
+                            sstUniformSize(un)) != 0 ) {
+                break;
+            }
+        }
+        else if( cmd->type == CMD_DRAW && cmd->set == first->set
+              && cmd->program == program ) {
+            (*count)++;
+            *mask |= pending;
+            end = i + 1;
+        }
+        else {
+            break;
+        }
+    }
+    return end;
+}
+
+/*
+ * Draws the run of draws from start to end as a single instanced draw. Returns
+ * 0 if the run couldn't be merged, in which case nothing has been drawn.
+ */
+static int sstDrawRun( int start, int end, int count, unsigned int mask ) {
+    struct sstVariant *variant;
+    sstProgram *program;
+    sstDrawableSet *set;
+    command *cmd;
+    uniform *un;
+    char *out;
+    size_t offset;
+    GLuint slot, slots, per_slot;
+    int i, j;
+    program = commands[start].program;
+    set = commands[start].set;
+    variant = sstGetVariant(program, mask);
+    if( !variant ) {
+        return 0;
+    }
+    /* Step 1: Pack the values of the merged uniforms for every draw */
+    if( (size_t)(count * variant->stride) > instances_size ) {
+        instances_size = count * variant->stride;
+        instances = (char*)realloc(instances, instances_size);
+    }
+    sstResetRunning(program);
+    out = instances;
+    for( i = start; i < end; i++ ) {
+        cmd = &commands[i];
+        if( cmd->type == CMD_UNIFORM && (mask & (1u << cmd->index)) ) {
+            memcpy(running + offsets[cmd->index], payload + cmd->offset,
+                   sstUniformSize(&program->uniforms[cmd->index]));
+        }
+        else if( cmd->type == CMD_DRAW ) {
+            for( j = 0; j < program->un_count && j < MAX_UNIFORMS; j++ ) {
+                if( mask & (1u << j) ) {
+                    memcpy(out, running + offsets[j],
+                           sstUniformSize(&program->uniforms[j]));
+                    out += sstUniformSize(&program->uniforms[j]);
+                }
+            }
+        }
+    }
+    /* Step 2: Switch to the variant and bring its uniforms up to date */
+    sstUseProgram(variant->program);
+    for( j = 0; j < program->un_count; j++ ) {
+        if( !(mask & (1u << j)) && variant->locations[j] >= 0 ) {
+            un = &program->uniforms[j];
+            sstUploadUniform(un, variant->locations[j], un->value);
+        }
+    }
+    /* Step 3: Upload the per-instance values and attach them to the set */
+    sstBindVertexArray(set->vao);
+    sstBindBuffer(GL_ARRAY_BUFFER, variant->buffer);
+    glBufferData(GL_ARRAY_BUFFER, count * variant->stride, instances,
+                 GL_STREAM_DRAW);
+    offset = 0;
+    for( j = 0; j < program->un_count && j < MAX_UNIFORMS; j++ ) {
+        if( !(mask & (1u << j)) ) {
+            continue;
+        }
+        un = &program->uniforms[j];
+        slots = sstUniformSlots(un);
+        per_slot = un->second != 0 ? un->second : un->first;
+        for( slot = 0; slot < slots; slot++ ) {
+            glVertexAttribPointer(variant->locations[j] + slot, per_slot,
+                                  GL_FLOAT, GL_FALSE, variant->stride,
+                                  (GLvoid*)offset);
+            glVertexAttribDivisor(variant->locations[j] + slot, 1);
+            glEnableVertexAttribArray(variant->locations[j] + slot);
+            offset += sizeof(GLfloat) * per_slot;
+        }
+    }
+    /* Step 4: Draw */
+    if( set->i_buffer != 0 ) {
+        glDrawElementsInstanced(set->mode, set->i_size, set->i_type, 0, count);
+    }
+    else {
+        glDrawArraysInstanced(set->mode, 0, set->count, count);
+    }
+    /* Step 5: Detach the per-instance values again so that regular draws of the
+     * set are unaffected */
+    for( j = 0; j < program->un_count && j < MAX_UNIFORMS; j++ ) {
+        if( mask & (1u << j) ) {
+            slots = sstUniformSlots(&program->uniforms[j]);
+            for( slot = 0; slot < slots; slot++ ) {
+                glVertexAttribDivisor(variant->locations[j] + slot, 0);
+                glDisableVertexAttribArray(variant->locations[j] + slot);
+            }
+        }
+    }
+    /* Step 6: Switch back, leaving the merged uniforms with the values they
+     * would have had if every draw had been executed */
+    sstUseProgram(program->program);
+    for( j = 0; j < program->un_count && j < MAX_UNIFORMS; j++ ) {
+        if( mask & (1u << j) ) {
+            un = &program->uniforms[j];
+            memcpy(un->value, running + offsets[j], sstUniformSize(un));
+            sstUploadUniform(un, un->location, un->value);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Starts deferred drawing.
+ */
+void sstBeginDeferred() {
+    sst_deferred = 1;
+    command_count = 0;
+    payload_count = 0;
+    recorded = sst_active;
+}
+
+/*
+ * Executes everything recorded since sstBeginDeferred() and stops deferring,
+ * merging runs of draws into instanced draws where possible.
+ */
+void sstFlushDeferred() {
+    command *cmd;
+    uniform *un;
+    unsigned int mask;
+    int i, end, count;
+    sst_deferred = 0;
+    i = 0;
+    while( i < command_count ) {
+        cmd = &commands[i];
+        switch( cmd->type ) {
+        case CMD_ACTIVATE:
+            sstActivateProgram(cmd->program);
+            i++;
+            break;
+        case CMD_UNIFORM:
+            un = &cmd->program->uniforms[cmd->index];
+            memcpy(un->value, payload + cmd->offset, sstUniformSize(un));
+            sstUploadUniform(un, un->location, un->value);
+            i++;
+            break;
+        case CMD_DRAW:
+            end = sstScanRun(i, &count, &mask);
+            if( count >= MIN_RUN && mask != 0
+             && sstDrawRun(i, end, count, mask) ) {
+                i = end;
+            }
+            else {
+                sstDrawSet(cmd->set);
+                i++;
+            }
+            break;
+        case CMD_DRAW_INSTANCED:
+            sstDrawSetInstanced(cmd->set, cmd->buffer, cmd->index);
+            i++;
+            break;
+        case CMD_DRAW_RANGE:
+            /* Ranges are levels of detail, which aren't merged */
+            sstDrawSetRange(cmd->set, (GLuint)cmd->offset, cmd->index);
+            i++;
+            break;
+        case CMD_PIPELINE:
+            /* Changes state, so runs of draws never merge across it */
+            sstBindPipeline(cmd->pipeline);
+            i++;
+            break;
+        }
+    }
+    command_count = 0;
+    payload_count = 0;
+}
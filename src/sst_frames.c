@@ -0,0 +1,254 @@
+/*
+ * sst_frames.c
+ * By Steven Smith
+ *
+ * This file keeps track of frames in flight. Each frame ends with a fence, and
+ * a frame only starts once the fence of the frame that last used its slot has
+ * signaled, so the CPU runs at most a set number of frames ahead of the GPU
+ * without ever draining it. Each slot has its own part of a stream buffer for
+ * data that only lives for a frame. Since the GPU is known to be done with a
+ * slot's part by the time it is reused, it is written without the driver
+ * checking whether it is still being read.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Transient data is never aligned to less than this */
+#define MIN_ALIGN 16
+
+/* How long to wait on a fence before checking it again, in nanoseconds */
+#define WAIT_TIMEOUT 100000000
+
+struct sstFrames {
+    int count; /* Frames in flight */
+    int current; /* Slot of the frame being recorded */
+    GLboolean recording; /* Between sstBeginFrame() and sstEndFrame() */
+    GLsync *fences; /* End of the last frame in each slot, or 0 */
+    GLuint buffer; /* Stream buffer, split evenly between the slots */
+    GLsizeiptr size; /* Bytes of the buffer for each slot */
+    GLsizeiptr used; /* Bytes given out so far this frame */
+    GLsizeiptr align; /* Alignment of the data given out */
+    /* Stats for sstFrameStats() */
+    double waited; /* Seconds spent waiting on fences */
+    unsigned long waits; /* Frames that had to wait */
+};
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Waits for a fence to signal, flushing it to the GPU first. Returns true iff
+ * it hadn't signaled already.
+ */
+static int sstWaitFence( GLsync fence ) {
+    GLenum status;
+    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if( status == GL_ALREADY_SIGNALED ) {
+        return 0;
+    }
+    while( status == GL_TIMEOUT_EXPIRED ) {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                  WAIT_TIMEOUT);
+    }
+    if( status == GL_WAIT_FAILED ) {
+        printf("ERROR: Waiting on the end of a frame failed\n");
+    }
+    return 1;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Creates a frame manager for the given number of frames in flight, each with
+ * the given number of bytes for transient data.
+ */
+sstFrames * sstNewFrames( int count, GLsizeiptr bytes ) {
+    sstFrames *frames;
+    GLint align;
+    if( count < 1 ) {
+        printf("WARN: Need at least one frame in flight, not %d\n", count);
+        count = 1;
+    }
+    frames = (sstFrames*)malloc(sizeof(sstFrames));
+    frames->count = count;
+    frames->current = count - 1;
+    frames->recording = GL_FALSE;
+    frames->fences = (GLsync*)calloc(count, sizeof(GLsync));
+    /* Step 1: Work out the alignment, so uniform blocks can be read from it */
+    align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    frames->align = align > MIN_ALIGN ? align : MIN_ALIGN;
+    /* Step 2: Make room for every slot's transient data */
+    frames->size = (bytes + frames->align - 1) / frames->align * frames->align;
+    frames->used = 0;
+    frames->buffer = 0;
+    if( frames->size ) {
+        glGenBuffers(1, &frames->buffer);
+        sstBindBuffer(GL_COPY_WRITE_BUFFER, frames->buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, frames->size * count, NULL,
+                     GL_STREAM_DRAW);
+    }
+    frames->waited = 0.0;
+    frames->waits = 0;
+    return frames;
+}
+
+/*
+ * Starts a frame in the next slot, first waiting for the GPU to finish the
+ * last frame that used it.
+ */
+void sstBeginFrame( sstFrames *frames ) {
+    GLsync *fence;
+    double start;
+    if( frames->recording ) {
+        printf("WARN: Began a frame without ending the last one\n");
+        sstEndFrame(frames);
+    }
+    frames->current = (frames->current + 1) % frames->count;
+    fence = &frames->fences[frames->current];
+    if( *fence ) {
+        start = glfwGetTime();
+        if( sstWaitFence(*fence) ) {
+            frames->waited += glfwGetTime() - start;
+            frames->waits++;
+        }
+        glDeleteSync(*fence);
+        *fence = 0;
+    }
+    frames->used = 0;
+    frames->recording = GL_TRUE;
+}
+
+/*
+ * Ends the frame, fencing off everything the GPU was asked to do in it.
+ */
+void sstEndFrame( sstFrames *frames ) {
+    if( !frames->recording ) {
+        printf("WARN: Ended a frame that wasn't begun\n");
+        return;
+    }
+    frames->fences[frames->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,
+                                                  0);
+    frames->recording = GL_FALSE;
+}
+
+/*
+ * Maps size bytes of the current frame's transient data for writing, giving
+ * their offset in the stream buffer. Returns NULL if the frame is out of room.
+ */
+GLvoid * sstFrameMap( sstFrames *frames, GLsizeiptr size, GLintptr *offset ) {
+    GLsizeiptr start;
+    if( !frames->recording ) {
+        printf("WARN: Transient data is only given out during a frame\n");
+        return NULL;
+    }
+    start = (frames->used + frames->align - 1) / frames->align * frames->align;
+    if( size <= 0 || start + size > frames->size ) {
+        printf("WARN: Frame is out of room for %ld bytes of transient data\n",
+               (long)size);
+        return NULL;
+    }
+    frames->used = start + size;
+    *offset = frames->current * frames->size + start;
+    /* The fence waited on in sstBeginFrame() means nothing reads this part */
+    sstBindBuffer(GL_COPY_WRITE_BUFFER, frames->buffer);
+    return glMapBufferRange(GL_COPY_WRITE_BUFFER, *offset, size,
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+                            | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+/*
+ * Unmaps the transient data mapped by sstFrameMap(), which must be done
+ * before drawing with it.
+ */
+void sstFrameUnmap( sstFrames *frames ) {
+    sstBindBuffer(GL_COPY_WRITE_BUFFER, frames->buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+}
+
+/*
+ * Copies data into the current frame's transient data. Returns its offset in
+ * the stream buffer, or -1 if the frame is out of room.
+ */
+GLintptr sstFrameUpload( sstFrames *frames, const GLvoid *data,
+GLsizeiptr size ) {
+    GLvoid *mapped;
+    GLintptr offset;
+    mapped = sstFrameMap(frames, size, &offset);
+    if( !mapped ) {
+        return -1;
+    }
+    memcpy(mapped, data, size);
+    sstFrameUnmap(frames);
+    return offset;
+}
+
+/*
+ * Returns the stream buffer the transient data is given out from.
+ */
+GLuint sstFrameBuffer( sstFrames *frames ) {
+    return frames->buffer;
+}
+
+/*
+ * Returns the number of ended frames the GPU hasn't finished yet, without
+ * waiting.
+ */
+int sstFramesBehind( sstFrames *frames ) {
+    GLint status;
+    int i, behind;
+    behind = 0;
+    for( i = 0; i < frames->count; i++ ) {
+        if( !frames->fences[i] ) {
+            continue;
+        }
+        glGetSynciv(frames->fences[i], GL_SYNC_STATUS, 1, NULL, &status);
+        if( status != GL_SIGNALED ) {
+            behind++;
+        }
+    }
+    return behind;
+}
+
+/*
+ * Gets the number of frames that had to wait for the GPU before starting, and
+ * the milliseconds spent waiting, since the stats were last reset. Resets them
+ * if reset is set.
+ */
+void sstFrameStats( sstFrames *frames, unsigned long *waits, double *ms,
+GLboolean reset ) {
+    if( waits ) {
+        *waits = frames->waits;
+    }
+    if( ms ) {
+        *ms = frames->waited * 1000.0;
+    }
+    if( reset ) {
+        frames->waits = 0;
+        frames->waited = 0.0;
+    }
+}
+
+/*
+ * Frees a frame manager. Frames still in flight finish on their own.
+ */
+void sstFreeFrames( sstFrames *frames ) {
+    int i;
+    for( i = 0; i < frames->count; i++ ) {
+        if( frames->fences[i] ) {
+            glDeleteSync(frames->fences[i]);
+        }
+    }
+    if( frames->buffer ) {
+        sstDeleteBuffers(1, &frames->buffer);
+    }
+    free(frames->fences);
+    free(frames);
+}
@@ -0,0 +1,321 @@
+/*
+ * sst_immediate.c
+ * By Steven Smith
+ *
+ * This file contains an immediate mode batcher, standing in for glBegin() and
+ * friends. Points, lines and quads are appended to a staging array for the
+ * active program and the kind of primitive they make, and each array is drawn
+ * with one upload and one draw call when flushed, however many primitives it
+ * holds.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Name of the input that gets the color set with sstColor() */
+#define COLOR_INPUT "in_Color"
+
+typedef struct {
+    GLfloat position[3];
+    GLubyte color[4];
+} vertex;
+
+typedef struct {
+    sstProgram *program;
+    GLenum mode; /* GL_POINTS, GL_LINES or GL_TRIANGLES */
+    vertex *vertices; /* Staged since the last flush */
+    int count;
+    int size;
+    GLuint vao; /* Reads the stream buffer for the program, 0 until drawn */
+} group;
+
+/* One group per program and mode used, kept between flushes */
+static group *groups = NULL;
+static int group_count = 0;
+static int group_size = 0;
+
+/* Group of the last primitive, which the next one is most likely to share */
+static group *current = NULL;
+
+/* Color of the vertices that follow */
+static GLubyte color[4] = { 255, 255, 255, 255 };
+
+/* Buffer every group is streamed through in turn */
+static GLuint stream = 0;
+
+/* Frames whose transient data is streamed through instead, if any */
+static sstFrames *streaming = NULL;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns the group for the active program and the given mode, making it if
+ * needed.
+ */
+static group * sstFindGroup( GLenum mode ) {
+    group *g;
+    for( g = groups; g < groups + group_count; g++ ) {
+        if( g->program == sst_active && g->mode == mode ) {
+            return g;
+        }
+    }
+    if( group_count == group_size ) {
+        group_size = group_size * 2 + 4;
+        groups = (group*)realloc(groups, sizeof(group) * group_size);
+    }
+    g = &groups[group_count++];
+    g->program = sst_active;
+    g->mode = mode;
+    g->vertices = NULL;
+    g->count = 0;
+    g->size = 0;
+    g->vao = 0;
+    return g;
+}
+
+/*
+ * Returns room for n more vertices in the group for the active program and
+ * the given mode, or NULL if no program is active.
+ */
+static vertex * sstStage( GLenum mode, int n ) {
+    group *g;
+    g = current;
+    if( !g || g->program != sst_active || g->mode != mode ) {
+        if( !sst_active ) {
+            printf("ERROR: Immediate drawing needs an active program\n");
+            return NULL;
+        }
+        g = current = sstFindGroup(mode);
+    }
+    if( g->count + n > g->size ) {
+        g->size = g->size * 2 + 1024;
+        g->vertices = (vertex*)realloc(g->vertices, sizeof(vertex) * g->size);
+    }
+    g->count += n;
+    return g->vertices + g->count - n;
+}
+
+static void sstPutVertex( vertex *v, GLfloat *position ) {
+    v->position[0] = position[0];
+    v->position[1] = position[1];
+    v->position[2] = position[2];
+    memcpy(v->color, color, sizeof(color));
+}
+
+/*
+ * Makes the vertex array reading the stream buffer for a group's program.
+ */
+static void sstBindGroup( group *g ) {
+    sstProgram *program;
+    in_var **inputs, *input;
+    int i, position;
+    program = g->program;
+    glGenVertexArrays(1, &g->vao);
+    sstBindVertexArray(g->vao);
+    sstBindBuffer(GL_ARRAY_BUFFER, streaming ? sstFrameBuffer(streaming)
+                                             : stream);
+    /* Positions go to the input that sstFindPositions() picks */
+    inputs = (in_var**)malloc(sizeof(in_var*) * program->in_count);
+    for( i = 0; i < program->in_count; i++ ) {
+        inputs[i] = program->inputs[i].divisor ? NULL : &program->inputs[i];
+    }
+    position = sstFindPositions(inputs, program->in_count);
+    free(inputs);
+    if( position >= 0 && program->inputs[position].location >= 0 ) {
+        glEnableVertexAttribArray(program->inputs[position].location);
+        glVertexAttribPointer(program->inputs[position].location, 3, GL_FLOAT,
+                              GL_FALSE, sizeof(vertex),
+                              (GLvoid*)offsetof(vertex, position));
+    }
+    else {
+        printf("WARN: Program has no input for immediate positions\n");
+    }
+    /* Colors are optional */
+    input = sstFindInput(program, COLOR_INPUT);
+    if( input && input->location >= 0 ) {
+        glEnableVertexAttribArray(input->location);
+        glVertexAttribPointer(input->location, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                              sizeof(vertex),
+                              (GLvoid*)offsetof(vertex, color));
+    }
+}
+
+/*
+ * Drops a group, swapping the last group into its place.
+ */
+static void sstDropGroup( group *g ) {
+    if( g->vao ) {
+        sstDeleteVertexArrays(1, &g->vao);
+    }
+    free(g->vertices);
+    *g = groups[--group_count];
+    current = NULL;
+}
+
+/*
+ * Private functions
+ */
+
+/*
+ * Drops the groups staged for a program that is being freed.
+ */
+void sstForgetImmediate( sstProgram *program ) {
+    int i;
+    for( i = group_count - 1; i >= 0; i-- ) {
+        if( groups[i].program == program ) {
+            sstDropGroup(&groups[i]);
+        }
+    }
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Sets the color of the vertices that follow.
+ */
+void sstColor( GLfloat r, GLfloat g, GLfloat b, GLfloat a ) {
+    GLfloat c[4];
+    int i;
+    c[0] = r;
+    c[1] = g;
+    c[2] = b;
+    c[3] = a;
+    for( i = 0; i < 4; i++ ) {
+        c[i] = c[i] < 0.0f ? 0.0f : c[i] > 1.0f ? 1.0f : c[i];
+        color[i] = (GLubyte)(c[i] * 255.0f + 0.5f);
+    }
+}
+
+/*
+ * Stages a point.
+ */
+void sstPoint( GLfloat *p ) {
+    vertex *v;
+    if( (v = sstStage(GL_POINTS, 1)) ) {
+        sstPutVertex(v, p);
+    }
+}
+
+/*
+ * Stages a line from a to b.
+ */
+void sstLine( GLfloat *a, GLfloat *b ) {
+    vertex *v;
+    if( (v = sstStage(GL_LINES, 2)) ) {
+        sstPutVertex(v, a);
+        sstPutVertex(v + 1, b);
+    }
+}
+
+/*
+ * Stages a quad with corners a, b, c and d in order, as two triangles.
+ */
+void sstQuad( GLfloat *a, GLfloat *b, GLfloat *c, GLfloat *d ) {
+    vertex *v;
+    if( (v = sstStage(GL_TRIANGLES, 6)) ) {
+        sstPutVertex(v, a);
+        sstPutVertex(v + 1, b);
+        sstPutVertex(v + 2, c);
+        sstPutVertex(v + 3, a);
+        sstPutVertex(v + 4, c);
+        sstPutVertex(v + 5, d);
+    }
+}
+
+/*
+ * Draws everything staged since the last flush, one draw call per program and
+ * mode, then makes the program that was active before active again. Returns
+ * the number of draw calls made.
+ */
+int sstFlushImmediate( void ) {
+    sstProgram *active;
+    group *g;
+    GLintptr offset;
+    int draws;
+    /* The draws below go straight to GL, so they can't be recorded */
+    if( sst_deferred || sst_queued ) {
+        printf("WARN: Immediate mode can't be flushed while recording\n");
+        return 0;
+    }
+    active = sst_active;
+    draws = 0;
+    if( !stream ) {
+        glGenBuffers(1, &stream);
+    }
+    for( g = groups; g < groups + group_count; g++ ) {
+        if( g->count == 0 ) {
+            continue;
+        }
+        if( !g->vao ) {
+            sstBindGroup(g);
+        }
+        sstActivateProgram(g->program);
+        sstBindVertexArray(g->vao);
+        if( streaming ) {
+            /* Transient data is aligned to a whole number of vertices */
+            offset = sstFrameUpload(streaming, g->vertices,
+                                    sizeof(vertex) * g->count);
+            if( offset >= 0 ) {
+                glDrawArrays(g->mode, offset / sizeof(vertex), g->count);
+                draws++;
+            }
+            g->count = 0;
+            continue;
+        }
+        /* Respecifying the whole buffer lets the driver hand over fresh
+         * storage instead of waiting on draws still reading the old */
+        sstBindBuffer(GL_ARRAY_BUFFER, stream);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * g->count, g->vertices,
+                     GL_STREAM_DRAW);
+        glDrawArrays(g->mode, 0, g->count);
+        g->count = 0;
+        draws++;
+    }
+    if( active && active != sst_active ) {
+        sstActivateProgram(active);
+    }
+    return draws;
+}
+
+/*
+ * Has immediate mode stream through the transient data of the given frames,
+ * or through a buffer of its own if frames is NULL.
+ */
+void sstImmediateFrames( sstFrames *frames ) {
+    group *g;
+    if( frames == streaming ) {
+        return;
+    }
+    /* Vertex arrays point at the buffer, so have them made again */
+    for( g = groups; g < groups + group_count; g++ ) {
+        if( g->vao ) {
+            sstDeleteVertexArrays(1, &g->vao);
+            g->vao = 0;
+        }
+    }
+    streaming = frames;
+}
+
+/*
+ * Frees the staging arrays, vertex arrays and stream buffer.
+ */
+void sstFreeImmediate( void ) {
+    while( group_count ) {
+        sstDropGroup(&groups[group_count - 1]);
+    }
+    free(groups);
+    groups = NULL;
+    group_size = 0;
+    if( stream ) {
+        sstDeleteBuffers(1, &stream);
+        stream = 0;
+    }
+    streaming = NULL;
+}
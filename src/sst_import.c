@@ -0,0 +1,1331 @@
+/*
+ * sst_import.c
+ * By Steven Smith
+ *
+ * This file contains loading of triangle meshes from Wavefront OBJ and PLY
+ * files. The file is mapped into memory and split between threads, at line
+ * boundaries for text and at item boundaries for binary PLY, and each thread
+ * parses its share into arrays of its own, which are then copied together,
+ * again in parallel. OBJ faces index positions, texture coordinates and
+ * normals separately, so their corners are welded into shared vertices, each
+ * thread owning the corners whose hash falls to it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Longest number handed to strtod() when the fast path can't take it */
+#define MAX_NUMBER 64
+/* Longest PLY header line */
+#define MAX_LINE 256
+/* Most properties of a PLY element, and elements of a PLY file */
+#define MAX_PROPERTIES 32
+#define MAX_ELEMENTS 16
+
+/* What a PLY property is read into */
+#define PLY_SKIP     -1
+#define PLY_POSITION 0 /* Then 1 and 2 */
+#define PLY_NORMAL   3 /* Then 4 and 5 */
+#define PLY_TEXCOORD 6 /* Then 7 */
+#define PLY_FACE     8
+
+/* PLY formats */
+#define PLY_ASCII  0
+#define PLY_LITTLE 1
+#define PLY_BIG    2
+
+typedef struct {
+    void *data;
+    size_t size; /* Bytes used */
+    size_t capacity;
+} sstArray;
+
+typedef struct {
+    GLenum type; /* Type of the value, or of the items of a list */
+    GLenum count_type; /* Type of a list's length, or 0 for a single value */
+    int size; /* Bytes of the value or list item, and of the list length */
+    int count_size;
+    int target; /* PLY_ value it's read into */
+} sstPlyProperty;
+
+typedef struct {
+    char name[32];
+    int count; /* Number of items */
+    sstPlyProperty properties[MAX_PROPERTIES];
+    int size; /* Number of properties */
+    const char **shares; /* Binary start of each thread's share of items */
+} sstPlyElement;
+
+typedef struct sstImportJob sstImportJob;
+
+typedef struct {
+    sstImportJob *job;
+    int index;
+    const char *start; /* Text lines of the thread's share */
+    const char *end;
+    sstArray values[3]; /* OBJ positions, texture coordinates and normals */
+    sstArray corners; /* OBJ face corners, 3 ints each: indices of the
+                       * position, texture coordinate and normal, or -1 */
+    sstArray relative; /* Offsets of corner ints given relative to the end */
+    sstArray triangles; /* PLY indices */
+    int bases[4]; /* Where the values and corners go in the merged arrays */
+    int line; /* Number of the first line, for ASCII PLY */
+    int lines;
+    GLboolean identity; /* Every corner's indices are the same, or -1 */
+    GLboolean has[3]; /* Some corner has each of the values */
+    const char *error;
+} sstImportChunk;
+
+struct sstImportJob {
+    const char *data; /* Mapped file */
+    const char *end;
+    int threads;
+    sstImportChunk *chunks;
+    sstImportedMesh *mesh;
+    /* OBJ */
+    GLfloat *values[3]; /* Merged positions, texture coordinates and normals */
+    int counts[4]; /* Number of each, then of corners */
+    int *corners;
+    GLuint *hashes; /* Of each corner */
+    GLuint *reps; /* Each corner's first match, then its vertex */
+    int *firsts; /* First corner of each vertex */
+    /* PLY */
+    int format;
+    GLboolean swap; /* Byte order differs from this machine's */
+    sstPlyElement elements[MAX_ELEMENTS];
+    int size; /* Number of elements */
+    int vertex; /* Index of the vertex and face elements, or -1 */
+    int face;
+};
+
+static const double sst_powers[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                     1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                     1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/*
+ * Helper functions
+ */
+
+static void * sstGrow( sstArray *array, size_t bytes ) {
+    void *p;
+    if( array->size + bytes > array->capacity ) {
+        array->capacity = array->capacity * 2 + bytes + 4096;
+        array->data = realloc(array->data, array->capacity);
+    }
+    p = (char*)array->data + array->size;
+    array->size += bytes;
+    return p;
+}
+
+/*
+ * Fills in the range of total items that is the given chunk's share.
+ */
+static void sstShare( sstImportChunk *chunk, int total, int *first,
+int *last ) {
+    *first = (int)((double)total * chunk->index / chunk->job->threads);
+    *last = (int)((double)total * (chunk->index + 1) / chunk->job->threads);
+}
+
+/*
+ * Runs a pass on every chunk, each on its own thread, the calling thread
+ * included.
+ */
+static void sstRunImportPass( sstImportJob *job, void * (*pass)( void *arg ) ) {
+    pthread_t *threads;
+    int i;
+    threads = (pthread_t*)malloc(sizeof(pthread_t) * job->threads);
+    for( i = 1; i < job->threads; i++ ) {
+        pthread_create(&threads[i], NULL, pass, &job->chunks[i]);
+    }
+    pass(&job->chunks[0]);
+    for( i = 1; i < job->threads; i++ ) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+/*
+ * Returns the first error any chunk ran into, or NULL.
+ */
+static const char * sstChunkError( sstImportJob *job ) {
+    int i;
+    for( i = 0; i < job->threads; i++ ) {
+        if( job->chunks[i].error ) {
+            return job->chunks[i].error;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Splits the text from start to the end of the file into a chunk per thread,
+ * each starting at the beginning of a line.
+ */
+static void sstSplitLines( sstImportJob *job, const char *start ) {
+    const char *p, *q;
+    size_t size;
+    int i;
+    size = job->end - start;
+    job->chunks[0].start = start;
+    for( i = 1; i < job->threads; i++ ) {
+        p = start + (size_t)((double)size * i / job->threads);
+        q = memchr(p - 1, '\n', job->end - (p - 1));
+        p = q ? q + 1 : job->end;
+        if( p < job->chunks[i - 1].start ) {
+            p = job->chunks[i - 1].start;
+        }
+        job->chunks[i].start = p;
+        job->chunks[i - 1].end = p;
+    }
+    job->chunks[job->threads - 1].end = job->end;
+}
+
+static const char * sstSkipSpace( const char *p, const char *end ) {
+    while( p < end && (*p == ' ' || *p == '\t' || *p == '\r') ) {
+        p++;
+    }
+    return p;
+}
+
+static const char * sstSkipToken( const char *p, const char *end ) {
+    while( p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' ) {
+        p++;
+    }
+    return p;
+}
+
+/*
+ * Parses a float from the text at p, before end, in any of the forms printf()
+ * writes. The significant digits go into integers and are scaled by a single
+ * exact power of ten, which rounds the same as strtod() while there are at
+ * most 15 of them and the power is at most 22. Anything else, including nan
+ * and inf, is handed to strtod(). Returns the character after the number, or
+ * NULL if there isn't one.
+ */
+static const char * sstParseFloat( const char *p, const char *end,
+GLfloat *f ) {
+    char number[MAX_NUMBER];
+    const char *s;
+    GLuint high, low;
+    int n, scale, e, seen, negative, exp_negative;
+    double m;
+    char *stop;
+    s = p;
+    negative = 0;
+    if( p < end && (*p == '-' || *p == '+') ) {
+        negative = *p == '-';
+        p++;
+    }
+    /* Step 1: Digits before and after the point, skipping leading zeros */
+    high = low = 0;
+    n = scale = seen = 0;
+    for( ; p < end && *p >= '0' && *p <= '9'; p++ ) {
+        seen = 1;
+        if( n == 0 && *p == '0' ) {
+            continue;
+        }
+        if( n < 9 ) {
+            high = high * 10 + (*p - '0');
+        } else if( n < 18 ) {
+            low = low * 10 + (*p - '0');
+        } else {
+            scale++;
+        }
+        n++;
+    }
+    if( p < end && *p == '.' ) {
+        for( p++; p < end && *p >= '0' && *p <= '9'; p++ ) {
+            seen = 1;
+            if( n == 0 && *p == '0' ) {
+                scale--;
+                continue;
+            }
+            if( n < 9 ) {
+                high = high * 10 + (*p - '0');
+                scale--;
+            } else if( n < 18 ) {
+                low = low * 10 + (*p - '0');
+                scale--;
+            }
+            n++;
+        }
+    }
+    /* Step 2: Exponent */
+    if( seen && p < end && (*p == 'e' || *p == 'E') ) {
+        p++;
+        exp_negative = 0;
+        if( p < end && (*p == '-' || *p == '+') ) {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if( p >= end || *p < '0' || *p > '9' ) {
+            seen = 0;
+        }
+        for( e = 0; p < end && *p >= '0' && *p <= '9'; p++ ) {
+            e = e < 10000 ? e * 10 + (*p - '0') : e;
+        }
+        scale += exp_negative ? -e : e;
+    }
+    /* Step 3: Scale exactly if possible */
+    if( seen && n <= 15 && scale >= -22 && scale <= 22 ) {
+        m = n <= 9 ? (double)high : high * sst_powers[n - 9] + low;
+        m = scale < 0 ? m / sst_powers[-scale] : m * sst_powers[scale];
+        *f = (GLfloat)(negative ? -m : m);
+        return p;
+    }
+    if( seen && n == 0 ) {
+        *f = negative ? -0.0f : 0.0f;
+        return p;
+    }
+    /* Step 4: Otherwise leave it to strtod() */
+    p = sstSkipToken(s, end);
+    if( p - s >= MAX_NUMBER ) {
+        return NULL;
+    }
+    memcpy(number, s, p - s);
+    number[p - s] = '\0';
+    *f = (GLfloat)strtod(number, &stop);
+    return stop == number ? NULL : s + (stop - number);
+}
+
+/*
+ * Parses a decimal int from the text at p, before end. Returns the character
+ * after it, or NULL if there isn't one or it doesn't fit.
+ */
+static const char * sstParseInt( const char *p, const char *end, int *value ) {
+    const char *s;
+    int negative, v;
+    negative = 0;
+    if( p < end && (*p == '-' || *p == '+') ) {
+        negative = *p == '-';
+        p++;
+    }
+    s = p;
+    for( v = 0; p < end && *p >= '0' && *p <= '9'; p++ ) {
+        if( v > 214748363 ) {
+            return NULL;
+        }
+        v = v * 10 + (*p - '0');
+    }
+    *value = negative ? -v : v;
+    return p == s ? NULL : p;
+}
+
+/*
+ * OBJ files
+ */
+
+/*
+ * Appends n floats from the rest of a line to the given array, with missing
+ * ones 0. Returns 0 if something else is in the way.
+ */
+static int sstParseValues( sstArray *array, const char *p, const char *eol,
+int n ) {
+    GLfloat *values;
+    int i;
+    values = (GLfloat*)sstGrow(array, sizeof(GLfloat) * n);
+    for( i = 0; i < n; i++ ) {
+        values[i] = 0.0f;
+        p = sstSkipSpace(p, eol);
+        if( p < eol && !(p = sstParseFloat(p, eol, &values[i])) ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Appends a corner to the chunk, remembering which of its indices were
+ * relative so that the merge can add the values of earlier chunks to them.
+ */
+static void sstEmitCorner( sstImportChunk *chunk, int *corner, int relative ) {
+    int *dst, offset, c;
+    offset = (int)(chunk->corners.size / sizeof(int));
+    dst = (int*)sstGrow(&chunk->corners, 3 * sizeof(int));
+    for( c = 0; c < 3; c++ ) {
+        dst[c] = corner[c];
+        if( relative & (1 << c) ) {
+            *(int*)sstGrow(&chunk->relative, sizeof(int)) = offset + c;
+        }
+    }
+}
+
+/*
+ * Parses the corners of a face, as v, v/vt, v//vn or v/vt/vn, and splits it
+ * into a fan of triangles. Returns 0 if the face is malformed.
+ */
+static int sstParseFace( sstImportChunk *chunk, const char *p,
+const char *eol ) {
+    int first[3], prev[3], corner[3];
+    int first_rel, prev_rel, rel, k, c, value;
+    static const int sizes[3] = { 3, 2, 3 };
+    first_rel = prev_rel = 0;
+    for( k = 0; ; k++ ) {
+        p = sstSkipSpace(p, eol);
+        if( p >= eol ) {
+            break;
+        }
+        rel = 0;
+        corner[1] = corner[2] = -1;
+        for( c = 0; c < 3; c++ ) {
+            if( c > 0 ) {
+                if( p >= eol || *p != '/' ) {
+                    break;
+                }
+                p++;
+                if( p < eol && *p == '/' && c == 1 ) {
+                    continue;
+                }
+            }
+            p = sstParseInt(p, eol, &value);
+            if( !p || value == 0 ) {
+                return 0;
+            }
+            if( value > 0 ) {
+                corner[c] = value - 1;
+            } else {
+                /* Relative to the end of this chunk's values so far */
+                corner[c] = (int)(chunk->values[c].size
+                                  / (sizeof(GLfloat) * sizes[c])) + value;
+                rel |= 1 << c;
+            }
+        }
+        if( k == 0 ) {
+            memcpy(first, corner, sizeof(first));
+            first_rel = rel;
+        } else if( k >= 2 ) {
+            sstEmitCorner(chunk, first, first_rel);
+            sstEmitCorner(chunk, prev, prev_rel);
+            sstEmitCorner(chunk, corner, rel);
+        }
+        memcpy(prev, corner, sizeof(prev));
+        prev_rel = rel;
+    }
+    return 1;
+}
+
+static void * sstParseObjThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    const char *p, *eol;
+    int ok;
+    for( p = chunk->start; p < chunk->end; p = eol + 1 ) {
+        eol = memchr(p, '\n', chunk->end - p);
+        if( !eol ) {
+            eol = chunk->end;
+        }
+        p = sstSkipSpace(p, eol);
+        ok = 1;
+        if( eol - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t') ) {
+            ok = sstParseValues(&chunk->values[0], p + 2, eol, 3);
+        } else if( eol - p > 2 && p[0] == 'v' && p[1] == 't'
+                   && (p[2] == ' ' || p[2] == '\t') ) {
+            ok = sstParseValues(&chunk->values[1], p + 3, eol, 2);
+        } else if( eol - p > 2 && p[0] == 'v' && p[1] == 'n'
+                   && (p[2] == ' ' || p[2] == '\t') ) {
+            ok = sstParseValues(&chunk->values[2], p + 3, eol, 3);
+        } else if( eol - p > 1 && p[0] == 'f'
+                   && (p[1] == ' ' || p[1] == '\t') ) {
+            if( !sstParseFace(chunk, p + 2, eol) ) {
+                chunk->error = "Malformed face";
+                return NULL;
+            }
+        }
+        if( !ok ) {
+            chunk->error = "Malformed vertex";
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Copies the chunk's values and corners into the merged arrays, resolves its
+ * relative indices and checks every index.
+ */
+static void * sstMergeObjThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    int *corners, *relative, i, c, n;
+    for( c = 0; c < 3; c++ ) {
+        memcpy(job->values[c] + (size_t)chunk->bases[c] * (c == 1 ? 2 : 3),
+               chunk->values[c].data, chunk->values[c].size);
+    }
+    corners = job->corners + (size_t)chunk->bases[3] * 3;
+    memcpy(corners, chunk->corners.data, chunk->corners.size);
+    relative = (int*)chunk->relative.data;
+    n = (int)(chunk->relative.size / sizeof(int));
+    for( i = 0; i < n; i++ ) {
+        corners[relative[i]] += chunk->bases[relative[i] % 3];
+    }
+    chunk->identity = GL_TRUE;
+    n = (int)(chunk->corners.size / (3 * sizeof(int)));
+    for( i = 0; i < n * 3; i += 3 ) {
+        if( corners[i] < 0 || corners[i] >= job->counts[0] ) {
+            chunk->error = "Position index out of range";
+            return NULL;
+        }
+        for( c = 1; c < 3; c++ ) {
+            if( corners[i + c] == -1 ) {
+                continue;
+            }
+            if( corners[i + c] < 0 || corners[i + c] >= job->counts[c] ) {
+                chunk->error = "Index out of range";
+                return NULL;
+            }
+            chunk->has[c] = GL_TRUE;
+            if( corners[i + c] != corners[i] ) {
+                chunk->identity = GL_FALSE;
+            }
+        }
+    }
+    return NULL;
+}
+
+static GLuint sstHashCorner( int *corner ) {
+    GLuint h;
+    h = (GLuint)corner[0] * 0x9E3779B1u ^ (GLuint)corner[1] * 0x85EBCA77u
+        ^ (GLuint)corner[2] * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    return h ^ (h >> 12);
+}
+
+static void * sstHashThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    int i, first, last;
+    sstShare(chunk, job->counts[3], &first, &last);
+    for( i = first; i < last; i++ ) {
+        job->hashes[i] = sstHashCorner(job->corners + (size_t)i * 3);
+    }
+    return NULL;
+}
+
+/*
+ * Finds the first corner matching each corner whose hash belongs to this
+ * thread, through an open addressed table of corner indices plus one.
+ */
+static void * sstMatchThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    GLuint *table, *grown, h, mask, slot, e, used;
+    int i, j, *corner;
+    mask = 1024;
+    while( mask < (GLuint)(job->counts[3] / job->threads) * 2 ) {
+        mask *= 2;
+    }
+    table = (GLuint*)calloc(mask, sizeof(GLuint));
+    mask--;
+    used = 0;
+    for( i = 0; i < job->counts[3]; i++ ) {
+        h = job->hashes[i];
+        if( (int)((h >> 20) % job->threads) != chunk->index ) {
+            continue;
+        }
+        corner = job->corners + (size_t)i * 3;
+        for( slot = h & mask; (e = table[slot]) != 0;
+             slot = (slot + 1) & mask ) {
+            if( job->hashes[e - 1] == h
+                && memcmp(job->corners + (size_t)(e - 1) * 3, corner,
+                          3 * sizeof(int)) == 0 ) {
+                break;
+            }
+        }
+        if( e ) {
+            job->reps[i] = e - 1;
+            continue;
+        }
+        job->reps[i] = i;
+        table[slot] = i + 1;
+        /* Keep the table at most half full */
+        if( ++used > mask / 2 ) {
+            grown = (GLuint*)calloc((mask + 1) * 2, sizeof(GLuint));
+            mask = mask * 2 + 1;
+            for( j = 0; j <= (int)(mask / 2); j++ ) {
+                if( !(e = table[j]) ) {
+                    continue;
+                }
+                for( slot = job->hashes[e - 1] & mask; grown[slot];
+                     slot = (slot + 1) & mask );
+                grown[slot] = e;
+            }
+            free(table);
+            table = grown;
+        }
+    }
+    free(table);
+    return NULL;
+}
+
+/*
+ * Fills in the values of this thread's share of the welded vertices.
+ */
+static void * sstGatherThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    sstImportedMesh *mesh = job->mesh;
+    int i, first, last, *corner;
+    sstShare(chunk, mesh->count, &first, &last);
+    for( i = first; i < last; i++ ) {
+        corner = job->corners + (size_t)job->firsts[i] * 3;
+        memcpy(mesh->positions + (size_t)i * 3,
+               job->values[0] + (size_t)corner[0] * 3, 3 * sizeof(GLfloat));
+        if( mesh->texcoords ) {
+            if( corner[1] >= 0 ) {
+                memcpy(mesh->texcoords + (size_t)i * 2,
+                       job->values[1] + (size_t)corner[1] * 2,
+                       2 * sizeof(GLfloat));
+            } else {
+                memset(mesh->texcoords + (size_t)i * 2, 0, 2 * sizeof(GLfloat));
+            }
+        }
+        if( mesh->normals ) {
+            if( corner[2] >= 0 ) {
+                memcpy(mesh->normals + (size_t)i * 3,
+                       job->values[2] + (size_t)corner[2] * 3,
+                       3 * sizeof(GLfloat));
+            } else {
+                memset(mesh->normals + (size_t)i * 3, 0, 3 * sizeof(GLfloat));
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fills in this thread's share of the indices when every corner's values
+ * share an index, so the positions can serve as the vertices as they are.
+ */
+static void * sstIdentityThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    int i, first, last;
+    sstShare(chunk, job->counts[3], &first, &last);
+    for( i = first; i < last; i++ ) {
+        job->mesh->indices[i] = job->corners[(size_t)i * 3];
+    }
+    return NULL;
+}
+
+/*
+ * Returns an array of count values of n floats from the merged ones, which
+ * are taken over if they are exactly that many, else copied and padded with
+ * 0.
+ */
+static GLfloat * sstTakeValues( sstImportJob *job, int c, int count, int n ) {
+    GLfloat *values;
+    if( job->counts[c] == count ) {
+        values = job->values[c];
+        job->values[c] = NULL;
+        return values;
+    }
+    values = (GLfloat*)calloc((size_t)count * n, sizeof(GLfloat));
+    memcpy(values, job->values[c], (size_t)(job->counts[c] < count
+                                            ? job->counts[c] : count)
+                                   * n * sizeof(GLfloat));
+    return values;
+}
+
+static int sstImportObj( sstImportJob *job ) {
+    sstImportedMesh *mesh = job->mesh;
+    sstImportChunk *chunk;
+    const char *error;
+    GLboolean identity, has[3];
+    int i, c, count;
+    /* Step 1: Parse the chunks */
+    sstSplitLines(job, job->data);
+    sstRunImportPass(job, sstParseObjThread);
+    if( (error = sstChunkError(job)) ) {
+        printf("ERROR: %s\n", error);
+        return 0;
+    }
+    /* Step 2: Merge them */
+    for( i = 0; i < job->threads; i++ ) {
+        chunk = &job->chunks[i];
+        for( c = 0; c < 4; c++ ) {
+            chunk->bases[c] = job->counts[c];
+        }
+        job->counts[0] += chunk->values[0].size / (3 * sizeof(GLfloat));
+        job->counts[1] += chunk->values[1].size / (2 * sizeof(GLfloat));
+        job->counts[2] += chunk->values[2].size / (3 * sizeof(GLfloat));
+        job->counts[3] += chunk->corners.size / (3 * sizeof(int));
+    }
+    job->values[0] = (GLfloat*)malloc(sizeof(GLfloat) * 3 * job->counts[0] + 1);
+    job->values[1] = (GLfloat*)malloc(sizeof(GLfloat) * 2 * job->counts[1] + 1);
+    job->values[2] = (GLfloat*)malloc(sizeof(GLfloat) * 3 * job->counts[2] + 1);
+    job->corners = (int*)malloc(sizeof(int) * 3 * job->counts[3] + 1);
+    sstRunImportPass(job, sstMergeObjThread);
+    if( (error = sstChunkError(job)) ) {
+        printf("ERROR: %s\n", error);
+        return 0;
+    }
+    identity = GL_TRUE;
+    has[1] = has[2] = GL_FALSE;
+    for( i = 0; i < job->threads; i++ ) {
+        identity = identity && job->chunks[i].identity;
+        for( c = 1; c < 3; c++ ) {
+            has[c] = has[c] || job->chunks[i].has[c];
+        }
+    }
+    mesh->i_count = job->counts[3];
+    mesh->indices = (GLuint*)malloc(sizeof(GLuint) * mesh->i_count + 1);
+    /* Step 3: When every corner indexes all its values alike the positions
+     * are the vertices already */
+    if( identity ) {
+        mesh->count = job->counts[0];
+        mesh->positions = sstTakeValues(job, 0, mesh->count, 3);
+        if( has[1] ) {
+            mesh->texcoords = sstTakeValues(job, 1, mesh->count, 2);
+        }
+        if( has[2] ) {
+            mesh->normals = sstTakeValues(job, 2, mesh->count, 3);
+        }
+        sstRunImportPass(job, sstIdentityThread);
+        return 1;
+    }
+    /* Step 4: Otherwise weld equal corners, numbering vertices in the order
+     * they are first used */
+    job->hashes = (GLuint*)malloc(sizeof(GLuint) * job->counts[3]);
+    job->reps = mesh->indices;
+    job->firsts = (int*)malloc(sizeof(int) * job->counts[3]);
+    sstRunImportPass(job, sstHashThread);
+    sstRunImportPass(job, sstMatchThread);
+    count = 0;
+    for( i = 0; i < job->counts[3]; i++ ) {
+        if( job->reps[i] == (GLuint)i ) {
+            job->firsts[count] = i;
+            job->reps[i] = count++;
+        } else {
+            job->reps[i] = job->reps[job->reps[i]];
+        }
+    }
+    mesh->count = count;
+    mesh->positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    if( has[1] ) {
+        mesh->texcoords = (GLfloat*)malloc(sizeof(GLfloat) * 2 * count);
+    }
+    if( has[2] ) {
+        mesh->normals = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    }
+    sstRunImportPass(job, sstGatherThread);
+    return 1;
+}
+
+/*
+ * PLY files
+ */
+
+static GLenum sstPlyType( const char *name ) {
+    static const char *names[] = { "char", "int8", "uchar", "uint8", "short",
+                                   "int16", "ushort", "uint16", "int",
+                                   "int32", "uint", "uint32", "float",
+                                   "float32", "double", "float64" };
+    static const GLenum types[] = { GL_BYTE, GL_UNSIGNED_BYTE, GL_SHORT,
+                                    GL_UNSIGNED_SHORT, GL_INT,
+                                    GL_UNSIGNED_INT, GL_FLOAT, GL_DOUBLE };
+    unsigned int i;
+    for( i = 0; i < sizeof(names) / sizeof(names[0]); i++ ) {
+        if( strcmp(name, names[i]) == 0 ) {
+            return types[i / 2];
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the PLY_ value a property of the vertex element is read into.
+ */
+static int sstPlyTarget( const char *name ) {
+    static const char *names[] = { "x", "y", "z", "nx", "ny", "nz", "s", "t",
+                                   "u", "v", "texture_u", "texture_v",
+                                   "texture_s", "texture_t" };
+    static const int targets[] = { 0, 1, 2, 3, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7 };
+    unsigned int i;
+    for( i = 0; i < sizeof(names) / sizeof(names[0]); i++ ) {
+        if( strcmp(name, names[i]) == 0 ) {
+            return targets[i];
+        }
+    }
+    return PLY_SKIP;
+}
+
+/*
+ * Reads the header, up to the line after end_header. Returns the start of the
+ * data, or NULL if the header is malformed.
+ */
+static const char * sstParsePlyHeader( sstImportJob *job ) {
+    char line[MAX_LINE], word[MAX_LINE], a[MAX_LINE], b[MAX_LINE];
+    char c[MAX_LINE];
+    const char *p, *eol;
+    sstPlyElement *element;
+    sstPlyProperty *property;
+    size_t length;
+    int count;
+    element = NULL;
+    job->format = -1;
+    for( p = job->data; p < job->end; p = eol + 1 ) {
+        eol = memchr(p, '\n', job->end - p);
+        if( !eol ) {
+            return NULL;
+        }
+        length = eol - p < MAX_LINE ? (size_t)(eol - p) : MAX_LINE - 1;
+        memcpy(line, p, length);
+        line[length] = '\0';
+        if( sscanf(line, "%255s", word) != 1 || strcmp(word, "comment") == 0
+            || strcmp(word, "obj_info") == 0 || strcmp(word, "ply") == 0 ) {
+            continue;
+        }
+        if( strcmp(word, "end_header") == 0 ) {
+            return job->format < 0 ? NULL : eol + 1;
+        }
+        if( strcmp(word, "format") == 0 && sscanf(line, "%*s %255s", a) == 1 ) {
+            job->format = strcmp(a, "ascii") == 0 ? PLY_ASCII
+                        : strcmp(a, "binary_little_endian") == 0 ? PLY_LITTLE
+                        : strcmp(a, "binary_big_endian") == 0 ? PLY_BIG : -1;
+        } else if( strcmp(word, "element") == 0 && job->size < MAX_ELEMENTS
+                   && sscanf(line, "%*s %31s %d",
+                             job->elements[job->size].name, &count) == 2
+                   && count >= 0 ) {
+            element = &job->elements[job->size++];
+            element->count = count;
+        } else if( strcmp(word, "property") == 0 && element
+                   && element->size < MAX_PROPERTIES ) {
+            property = &element->properties[element->size++];
+            property->target = PLY_SKIP;
+            if( sscanf(line, "%*s list %255s %255s %255s", a, b, c) == 3 ) {
+                property->count_type = sstPlyType(a);
+                property->type = sstPlyType(b);
+                if( strcmp(c, "vertex_indices") == 0
+                    || strcmp(c, "vertex_index") == 0 ) {
+                    property->target = PLY_FACE;
+                }
+                if( !property->count_type ) {
+                    return NULL;
+                }
+            } else if( sscanf(line, "%*s %255s %255s", a, b) == 2 ) {
+                property->count_type = 0;
+                property->type = sstPlyType(a);
+                property->target = sstPlyTarget(b);
+            } else {
+                return NULL;
+            }
+            if( !property->type ) {
+                return NULL;
+            }
+            property->size = sstSizeFromEnum(property->type);
+            property->count_size = property->count_type
+                                 ? (int)sstSizeFromEnum(property->count_type)
+                                 : 0;
+        } else {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void sstSwapBytes( void *value, int size ) {
+    unsigned char *bytes, t;
+    int k;
+    bytes = (unsigned char*)value;
+    for( k = 0; k < size / 2; k++ ) {
+        t = bytes[k];
+        bytes[k] = bytes[size - 1 - k];
+        bytes[size - 1 - k] = t;
+    }
+}
+
+/*
+ * Reads a binary value of the given type, swapping its bytes if need be.
+ */
+static double sstPlyValue( sstImportJob *job, const char *p, GLenum type ) {
+    GLfloat f;
+    GLdouble d;
+    GLint i;
+    GLuint u;
+    GLshort s;
+    GLushort us;
+    switch( type ) {
+    case GL_BYTE:
+        return (GLbyte)*p;
+    case GL_UNSIGNED_BYTE:
+        return (GLubyte)*p;
+    case GL_SHORT:
+        memcpy(&s, p, sizeof(s));
+        if( job->swap ) {
+            sstSwapBytes(&s, sizeof(s));
+        }
+        return s;
+    case GL_UNSIGNED_SHORT:
+        memcpy(&us, p, sizeof(us));
+        if( job->swap ) {
+            sstSwapBytes(&us, sizeof(us));
+        }
+        return us;
+    case GL_INT:
+        memcpy(&i, p, sizeof(i));
+        if( job->swap ) {
+            sstSwapBytes(&i, sizeof(i));
+        }
+        return i;
+    case GL_UNSIGNED_INT:
+        memcpy(&u, p, sizeof(u));
+        if( job->swap ) {
+            sstSwapBytes(&u, sizeof(u));
+        }
+        return u;
+    case GL_FLOAT:
+        memcpy(&f, p, sizeof(f));
+        if( job->swap ) {
+            sstSwapBytes(&f, sizeof(f));
+        }
+        return f;
+    default:
+        memcpy(&d, p, sizeof(d));
+        if( job->swap ) {
+            sstSwapBytes(&d, sizeof(d));
+        }
+        return d;
+    }
+}
+
+/*
+ * Returns the size of the binary item at p, or 0 if it runs past the end.
+ */
+static size_t sstPlyItemSize( sstImportJob *job, sstPlyElement *element,
+const char *p ) {
+    sstPlyProperty *property;
+    size_t size, n;
+    double length;
+    int i;
+    size = 0;
+    for( i = 0; i < element->size; i++ ) {
+        property = &element->properties[i];
+        if( property->count_type ) {
+            if( p + size + property->count_size > job->end
+                || (length = sstPlyValue(job, p + size,
+                                         property->count_type)) < 0 ) {
+                return 0;
+            }
+            n = property->count_size + (size_t)length * property->size;
+        } else {
+            n = property->size;
+        }
+        size += n;
+    }
+    return p + size > job->end ? 0 : size;
+}
+
+/*
+ * Appends a fan of triangles over the corners of a face, checking each index.
+ * Returns 0 if one is out of range.
+ */
+static int sstEmitFace( sstImportChunk *chunk, GLuint *corners, int n ) {
+    GLuint *dst;
+    int k;
+    for( k = 0; k < n; k++ ) {
+        if( corners[k] >= (GLuint)chunk->job->mesh->count ) {
+            return 0;
+        }
+    }
+    for( k = 2; k < n; k++ ) {
+        dst = (GLuint*)sstGrow(&chunk->triangles, 3 * sizeof(GLuint));
+        dst[0] = corners[0];
+        dst[1] = corners[k - 1];
+        dst[2] = corners[k];
+    }
+    return 1;
+}
+
+/*
+ * Stores a vertex value read for the given PLY_ target.
+ */
+static void sstPlyStore( sstImportedMesh *mesh, int v, int target,
+GLfloat value ) {
+    if( target < PLY_NORMAL ) {
+        mesh->positions[(size_t)v * 3 + target] = value;
+    } else if( target < PLY_TEXCOORD ) {
+        mesh->normals[(size_t)v * 3 + target - PLY_NORMAL] = value;
+    } else {
+        mesh->texcoords[(size_t)v * 2 + target - PLY_TEXCOORD] = value;
+    }
+}
+
+/*
+ * Parses this thread's share of the vertices and faces of a binary file.
+ */
+static void * sstParsePlyBinaryThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    sstPlyElement *element;
+    sstPlyProperty *property;
+    GLuint corners[256];
+    const char *p;
+    int e, i, j, k, n, first, last, size;
+    for( e = 0; e < job->size; e++ ) {
+        if( e != job->vertex && e != job->face ) {
+            continue;
+        }
+        element = &job->elements[e];
+        sstShare(chunk, element->count, &first, &last);
+        p = element->shares[chunk->index];
+        for( i = first; i < last; i++ ) {
+            for( k = 0; k < element->size; k++ ) {
+                property = &element->properties[k];
+                size = property->size;
+                if( !property->count_type ) {
+                    if( e == job->vertex && property->target != PLY_SKIP ) {
+                        sstPlyStore(job->mesh, i, property->target,
+                                    (GLfloat)sstPlyValue(job, p,
+                                                         property->type));
+                    }
+                    p += size;
+                    continue;
+                }
+                n = (int)sstPlyValue(job, p, property->count_type);
+                p += property->count_size;
+                if( e == job->face && property->target == PLY_FACE ) {
+                    if( n > 256 ) {
+                        chunk->error = "Face with over 256 corners";
+                        return NULL;
+                    }
+                    for( j = 0; j < n; j++ ) {
+                        corners[j] = (GLuint)sstPlyValue(job, p + j * size,
+                                                         property->type);
+                    }
+                    if( !sstEmitFace(chunk, corners, n) ) {
+                        chunk->error = "Index out of range";
+                        return NULL;
+                    }
+                }
+                p += (size_t)n * size;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Walks the binary items of every element in turn, noting where each
+ * thread's share of them starts. Items of elements without lists are found
+ * directly. Returns 0 if the file ends early.
+ */
+static int sstLayoutPlyBinary( sstImportJob *job, const char *p ) {
+    sstPlyElement *element;
+    size_t stride, size;
+    int e, i, k, t, next;
+    for( e = 0; e < job->size; e++ ) {
+        element = &job->elements[e];
+        element->shares = (const char**)malloc(sizeof(char*)
+                                                * (job->threads + 1));
+        stride = 0;
+        for( k = 0; k < element->size; k++ ) {
+            if( element->properties[k].count_type ) {
+                stride = 0;
+                break;
+            }
+            stride += element->properties[k].size;
+        }
+        if( stride ) {
+            if( (size_t)(job->end - p) / stride < (size_t)element->count ) {
+                return 0;
+            }
+            for( t = 0; t <= job->threads; t++ ) {
+                element->shares[t] = p + stride
+                    * (size_t)((double)element->count * t / job->threads);
+            }
+            p += stride * element->count;
+            continue;
+        }
+        t = 0;
+        next = 0;
+        for( i = 0; i <= element->count; i++ ) {
+            while( t <= job->threads && i == next ) {
+                element->shares[t++] = p;
+                next = (int)((double)element->count * t / job->threads);
+            }
+            if( i == element->count ) {
+                break;
+            }
+            if( !(size = sstPlyItemSize(job, element, p)) ) {
+                return 0;
+            }
+            p += size;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Counts the lines of this thread's share of an ASCII file.
+ */
+static void * sstCountLinesThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    const char *p;
+    chunk->lines = 0;
+    for( p = chunk->start; p < chunk->end; p++ ) {
+        if( !(p = memchr(p, '\n', chunk->end - p)) ) {
+            /* A last line without a newline */
+            chunk->lines++;
+            break;
+        }
+        chunk->lines++;
+    }
+    return NULL;
+}
+
+/*
+ * Parses this thread's share of the lines of an ASCII file, each an item of
+ * an element.
+ */
+static void * sstParsePlyAsciiThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    sstImportJob *job = chunk->job;
+    sstPlyElement *element;
+    sstPlyProperty *property;
+    GLuint corners[256];
+    const char *p, *eol;
+    GLfloat value;
+    int e, k, j, n, line, item, index;
+    /* Step 1: Find the element of the first line */
+    item = chunk->line;
+    for( e = 0; e < job->size && item >= job->elements[e].count; e++ ) {
+        item -= job->elements[e].count;
+    }
+    for( p = chunk->start, line = 0; line < chunk->lines;
+         line++, p = eol + 1 ) {
+        eol = memchr(p, '\n', chunk->end - p);
+        if( !eol ) {
+            eol = chunk->end;
+        }
+        while( e < job->size && item >= job->elements[e].count ) {
+            item = 0;
+            e++;
+        }
+        if( e >= job->size ) {
+            break;
+        }
+        element = &job->elements[e];
+        if( e != job->vertex && e != job->face ) {
+            item++;
+            continue;
+        }
+        /* Step 2: Parse the properties of the item */
+        for( k = 0; k < element->size; k++ ) {
+            property = &element->properties[k];
+            p = sstSkipSpace(p, eol);
+            if( !property->count_type ) {
+                if( !(p = sstParseFloat(p, eol, &value)) ) {
+                    chunk->error = "Malformed value";
+                    return NULL;
+                }
+                if( e == job->vertex && property->target != PLY_SKIP ) {
+                    sstPlyStore(job->mesh, item, property->target, value);
+                }
+                continue;
+            }
+            if( !(p = sstParseInt(p, eol, &n)) || n < 0 || n > 256 ) {
+                chunk->error = "Malformed list";
+                return NULL;
+            }
+            for( j = 0; j < n; j++ ) {
+                p = sstSkipSpace(p, eol);
+                if( !(p = sstParseInt(p, eol, &index)) ) {
+                    chunk->error = "Malformed list";
+                    return NULL;
+                }
+                corners[j] = (GLuint)index;
+            }
+            if( e == job->face && property->target == PLY_FACE
+                && !sstEmitFace(chunk, corners, n) ) {
+                chunk->error = "Index out of range";
+                return NULL;
+            }
+        }
+        item++;
+    }
+    return NULL;
+}
+
+/*
+ * Copies this thread's triangles into the mesh's indices.
+ */
+static void * sstMergePlyThread( void *arg ) {
+    sstImportChunk *chunk = (sstImportChunk*)arg;
+    memcpy(chunk->job->mesh->indices + chunk->bases[3], chunk->triangles.data,
+           chunk->triangles.size);
+    return NULL;
+}
+
+static int sstImportPly( sstImportJob *job ) {
+    sstImportedMesh *mesh = job->mesh;
+    sstPlyElement *element;
+    const char *body, *error;
+    GLuint one;
+    int e, k, i, line, targets;
+    /* Step 1: Read the header and make room for the vertices */
+    if( !(body = sstParsePlyHeader(job)) ) {
+        printf("ERROR: Malformed PLY header\n");
+        return 0;
+    }
+    one = 1;
+    job->swap = *(unsigned char*)&one ? job->format == PLY_BIG
+                                      : job->format == PLY_LITTLE;
+    job->vertex = job->face = -1;
+    targets = 0;
+    for( e = 0; e < job->size; e++ ) {
+        element = &job->elements[e];
+        for( k = 0; k < element->size; k++ ) {
+            if( strcmp(element->name, "vertex") == 0
+                && (job->vertex < 0 || job->vertex == e)
+                && element->properties[k].target != PLY_SKIP
+                && !element->properties[k].count_type ) {
+                job->vertex = e;
+                targets |= 1 << element->properties[k].target;
+            } else if( strcmp(element->name, "face") == 0
+                       && element->properties[k].target == PLY_FACE ) {
+                job->face = e;
+            } else if( element->properties[k].target != PLY_FACE ) {
+                element->properties[k].target = PLY_SKIP;
+            }
+        }
+    }
+    if( job->vertex < 0 || (targets & 0x7) != 0x7 ) {
+        printf("ERROR: PLY file has no vertex positions\n");
+        return 0;
+    }
+    mesh->count = job->elements[job->vertex].count;
+    mesh->positions = (GLfloat*)calloc((size_t)mesh->count * 3 + 1,
+                                       sizeof(GLfloat));
+    if( targets & (0x7 << PLY_NORMAL) ) {
+        mesh->normals = (GLfloat*)calloc((size_t)mesh->count * 3 + 1,
+                                         sizeof(GLfloat));
+    }
+    if( targets & (0x3 << PLY_TEXCOORD) ) {
+        mesh->texcoords = (GLfloat*)calloc((size_t)mesh->count * 2 + 1,
+                                           sizeof(GLfloat));
+    }
+    /* Step 2: Parse the items */
+    if( job->format == PLY_ASCII ) {
+        sstSplitLines(job, body);
+        sstRunImportPass(job, sstCountLinesThread);
+        for( i = 0, line = 0; i < job->threads; i++ ) {
+            job->chunks[i].line = line;
+            line += job->chunks[i].lines;
+        }
+        sstRunImportPass(job, sstParsePlyAsciiThread);
+    } else {
+        if( !sstLayoutPlyBinary(job, body) ) {
+            printf("ERROR: PLY file ends early\n");
+            return 0;
+        }
+        sstRunImportPass(job, sstParsePlyBinaryThread);
+    }
+    if( (error = sstChunkError(job)) ) {
+        printf("ERROR: %s\n", error);
+        return 0;
+    }
+    /* Step 3: Merge the triangles */
+    for( i = 0; i < job->threads; i++ ) {
+        job->chunks[i].bases[3] = mesh->i_count;
+        mesh->i_count += job->chunks[i].triangles.size / sizeof(GLuint);
+    }
+    mesh->indices = (GLuint*)malloc(sizeof(GLuint) * mesh->i_count + 1);
+    sstRunImportPass(job, sstMergePlyThread);
+    return 1;
+}
+
+/*
+ * Loads a triangle mesh from an OBJ or PLY file with the given number of
+ * threads.
+ */
+sstImportedMesh * sstImportMesh( const char *path, int threads ) {
+    sstImportedMesh *mesh;
+    sstImportJob job;
+    struct stat info;
+    void *data;
+    int fd, i, c, ok;
+    /* Step 1: Map the file */
+    if( (fd = open(path, O_RDONLY)) < 0 ) {
+        printf("ERROR: Could not open %s\n", path);
+        return NULL;
+    }
+    if( fstat(fd, &info) != 0 || info.st_size == 0 ) {
+        printf("ERROR: %s is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( data == MAP_FAILED ) {
+        printf("ERROR: Could not map %s\n", path);
+        return NULL;
+    }
+    /* Every page gets read, just not in order */
+    madvise(data, info.st_size, MADV_WILLNEED);
+    /* Step 2: Parse it by its contents */
+    memset(&job, 0, sizeof(job));
+    job.data = (const char*)data;
+    job.end = job.data + info.st_size;
+    job.threads = threads < 1 ? 1 : threads;
+    job.chunks = (sstImportChunk*)calloc(job.threads, sizeof(sstImportChunk));
+    for( i = 0; i < job.threads; i++ ) {
+        job.chunks[i].job = &job;
+        job.chunks[i].index = i;
+    }
+    mesh = (sstImportedMesh*)calloc(1, sizeof(sstImportedMesh));
+    job.mesh = mesh;
+    if( info.st_size > 3 && memcmp(job.data, "ply", 3) == 0
+        && (job.data[3] == '\n' || job.data[3] == '\r') ) {
+        ok = sstImportPly(&job);
+    } else {
+        ok = sstImportObj(&job);
+    }
+    if( !ok ) {
+        printf("ERROR: Could not import %s\n", path);
+    }
+    /* Step 3: Clean up */
+    for( i = 0; i < job.threads; i++ ) {
+        for( c = 0; c < 3; c++ ) {
+            free(job.chunks[i].values[c].data);
+        }
+        free(job.chunks[i].corners.data);
+        free(job.chunks[i].relative.data);
+        free(job.chunks[i].triangles.data);
+    }
+    for( i = 0; i < job.size; i++ ) {
+        free(job.elements[i].shares);
+    }
+    for( c = 0; c < 3; c++ ) {
+        free(job.values[c]);
+    }
+    free(job.corners);
+    free(job.hashes);
+    free(job.firsts);
+    free(job.chunks);
+    munmap(data, info.st_size);
+    if( !ok ) {
+        sstFreeImportedMesh(mesh);
+        return NULL;
+    }
+    return mesh;
+}
+
+/*
+ * Frees the given mesh and its arrays.
+ */
+void sstFreeImportedMesh( sstImportedMesh *mesh ) {
+    free(mesh->positions);
+    free(mesh->normals);
+    free(mesh->texcoords);
+    free(mesh->indices);
+    free(mesh);
+}
@@ -0,0 +1,564 @@
+/*
+ * sst_lod.c
+ * By Steven Smith
+ *
+ * This file contains the generation of simplified levels of detail for triangle
+ * meshes, and the drawing of the right one for how big a set is on the screen.
+ * Meshes are simplified by collapsing edges, cheapest first, where the cost of
+ * a collapse is measured with quadric error metrics (Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics"). Vertices only ever
+ * collapse onto other vertices, so every level can share the vertex data of the
+ * full mesh.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* A level that doesn't get below this fraction of the triangles of the one
+ * before it ends the chain */
+#define MIN_REDUCTION 0.95f
+/* How much more moving a border costs than moving the surface itself */
+#define BORDER_WEIGHT 10.0
+
+typedef struct {
+    double q[10]; /* Symmetric 4x4 matrix: xx xy xz xw yy yz yw zz zw ww */
+    double weight; /* Total weight of the planes summed in */
+} sstQuadric;
+
+typedef struct {
+    GLuint from; /* Vertex that goes away */
+    GLuint to; /* Vertex it is collapsed onto */
+    double cost;
+} sstCollapse;
+
+typedef struct {
+    GLuint low;
+    GLuint high;
+    int triangle;
+} sstEdge;
+
+typedef struct {
+    GLfloat pos[3]; /* Copied so the sort needs nothing but the records */
+    GLuint index;
+} sstPosition;
+
+/*
+ * Quadric helper functions
+ */
+
+/*
+ * Adds the plane with unit normal n and offset d to a quadric, so that the
+ * quadric measures the squared distance to it.
+ */
+static void sstAddPlane( sstQuadric *quadric, double *n, double d,
+double weight ) {
+    double *q;
+    q = quadric->q;
+    q[0] += weight * n[0] * n[0];
+    q[1] += weight * n[0] * n[1];
+    q[2] += weight * n[0] * n[2];
+    q[3] += weight * n[0] * d;
+    q[4] += weight * n[1] * n[1];
+    q[5] += weight * n[1] * n[2];
+    q[6] += weight * n[1] * d;
+    q[7] += weight * n[2] * n[2];
+    q[8] += weight * n[2] * d;
+    q[9] += weight * d * d;
+    quadric->weight += weight;
+}
+
+static void sstAddQuadric( sstQuadric *dst, sstQuadric *src ) {
+    int i;
+    for( i = 0; i < 10; i++ ) {
+        dst->q[i] += src->q[i];
+    }
+    dst->weight += src->weight;
+}
+
+/*
+ * Returns the weighted sum of squared distances from the point to the planes in
+ * the quadric.
+ */
+static double sstQuadricError( sstQuadric *quadric, GLfloat *p ) {
+    double *q, x, y, z;
+    q = quadric->q;
+    x = p[0];
+    y = p[1];
+    z = p[2];
+    return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z
+         + 2.0 * q[3] * x + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+         + q[7] * z * z + 2.0 * q[8] * z + q[9];
+}
+
+/*
+ * Returns the cost of collapsing vertex from onto vertex to: the mean squared
+ * distance from the position of to to the planes of both.
+ */
+static double sstCollapseCost( sstQuadric *quadrics, GLfloat *pos, int stride,
+GLuint from, GLuint to ) {
+    double weight, error;
+    weight = quadrics[from].weight + quadrics[to].weight;
+    error = sstQuadricError(&quadrics[from], &pos[to * stride])
+          + sstQuadricError(&quadrics[to], &pos[to * stride]);
+    if( weight <= 0.0 ) {
+        return 0.0;
+    }
+    return error > 0.0 ? error / weight : 0.0;
+}
+
+/*
+ * Returns the normal of the triangle a, b, c, with a length of twice its area.
+ */
+static void sstTriangleNormal( GLfloat *a, GLfloat *b, GLfloat *c,
+double *n ) {
+    double e1[3], e2[3];
+    int k;
+    for( k = 0; k < 3; k++ ) {
+        e1[k] = b[k] - a[k];
+        e2[k] = c[k] - a[k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static int sstCompareEdges( const void *a, const void *b ) {
+    const sstEdge *ea, *eb;
+    ea = (const sstEdge*)a;
+    eb = (const sstEdge*)b;
+    if( ea->low != eb->low ) {
+        return ea->low < eb->low ? -1 : 1;
+    }
+    if( ea->high != eb->high ) {
+        return ea->high < eb->high ? -1 : 1;
+    }
+    return 0;
+}
+
+static int sstCompareCollapses( const void *a, const void *b ) {
+    double ca, cb;
+    ca = ((const sstCollapse*)a)->cost;
+    cb = ((const sstCollapse*)b)->cost;
+    return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+/*
+ * Fills in the quadric of every vertex from the planes of the triangles around
+ * it, weighted by area. Edges used by only one triangle are on the border of
+ * the mesh, and get a plane at right angles to their triangle, so that the
+ * border can slide along itself but not move in or out.
+ */
+static void sstBuildQuadrics( GLuint *indices, int i_count, GLfloat *pos,
+int stride, sstQuadric *quadrics ) {
+    sstEdge *edges;
+    GLfloat *a, *b;
+    double n[3], e[3], p[3], length, d;
+    int t, k, i, j, tris;
+    tris = i_count / 3;
+    /* Step 1: Planes of the triangles */
+    for( t = 0; t < tris; t++ ) {
+        sstTriangleNormal(&pos[indices[t*3] * stride],
+                          &pos[indices[t*3 + 1] * stride],
+                          &pos[indices[t*3 + 2] * stride], n);
+        length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if( length <= 0.0 ) {
+            continue;
+        }
+        for( k = 0; k < 3; k++ ) {
+            n[k] /= length;
+        }
+        a = &pos[indices[t*3] * stride];
+        d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+        for( k = 0; k < 3; k++ ) {
+            sstAddPlane(&quadrics[indices[t*3 + k]], n, d, length * 0.5);
+        }
+    }
+    /* Step 2: Find the edges used by only one triangle */
+    edges = (sstEdge*)malloc(sizeof(sstEdge) * (i_count + 1));
+    for( i = 0; i < tris * 3; i++ ) {
+        t = i / 3;
+        edges[i].low = indices[i];
+        edges[i].high = indices[t*3 + (i + 1) % 3];
+        if( edges[i].low > edges[i].high ) {
+            edges[i].high = edges[i].low;
+            edges[i].low = indices[t*3 + (i + 1) % 3];
+        }
+        edges[i].triangle = t;
+    }
+    qsort(edges, tris * 3, sizeof(sstEdge), sstCompareEdges);
+    for( i = 0; i < tris * 3; i = j ) {
+        for( j = i + 1; j < tris * 3
+                        && sstCompareEdges(&edges[i], &edges[j]) == 0; j++ );
+        if( j - i != 1 ) {
+            continue;
+        }
+        /* Step 3: Add the planes along the borders */
+        t = edges[i].triangle;
+        sstTriangleNormal(&pos[indices[t*3] * stride],
+                          &pos[indices[t*3 + 1] * stride],
+                          &pos[indices[t*3 + 2] * stride], n);
+        a = &pos[edges[i].low * stride];
+        b = &pos[edges[i].high * stride];
+        for( k = 0; k < 3; k++ ) {
+            e[k] = b[k] - a[k];
+        }
+        p[0] = e[1] * n[2] - e[2] * n[1];
+        p[1] = e[2] * n[0] - e[0] * n[2];
+        p[2] = e[0] * n[1] - e[1] * n[0];
+        length = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if( length <= 0.0 ) {
+            continue;
+        }
+        for( k = 0; k < 3; k++ ) {
+            p[k] /= length;
+        }
+        d = -(p[0] * a[0] + p[1] * a[1] + p[2] * a[2]);
+        length = BORDER_WEIGHT * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+        sstAddPlane(&quadrics[edges[i].low], p, d, length);
+        sstAddPlane(&quadrics[edges[i].high], p, d, length);
+    }
+    free(edges);
+}
+
+static int sstComparePositions( const void *a, const void *b ) {
+    const GLfloat *pa, *pb;
+    int k;
+    pa = ((const sstPosition*)a)->pos;
+    pb = ((const sstPosition*)b)->pos;
+    for( k = 0; k < 3; k++ ) {
+        if( pa[k] != pb[k] ) {
+            return pa[k] < pb[k] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns an array flagging the vertices that share their position with
+ * another vertex. These sit on seams in the other inputs, such as texture
+ * coordinates, and moving them would tear the seam open.
+ */
+static char * sstFindSeams( GLfloat *pos, int stride, int count ) {
+    sstPosition *order;
+    char *locked;
+    int i, j, k;
+    order = (sstPosition*)malloc(sizeof(sstPosition) * (count + 1));
+    locked = (char*)calloc(count + 1, sizeof(char));
+    for( i = 0; i < count; i++ ) {
+        for( k = 0; k < 3; k++ ) {
+            order[i].pos[k] = pos[i * stride + k];
+        }
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(sstPosition), sstComparePositions);
+    for( i = 0; i < count; i = j ) {
+        for( j = i + 1;
+             j < count && sstComparePositions(&order[i], &order[j]) == 0;
+             j++ );
+        for( k = i; j - i > 1 && k < j; k++ ) {
+            locked[order[k].index] = 1;
+        }
+    }
+    free(order);
+    return locked;
+}
+
+/*
+ * Returns 1 if moving vertex from onto vertex to would flip any of the
+ * triangles around from that are left afterwards.
+ */
+static int sstCollapseFlips( GLuint *indices, int *offsets, int *adjacency,
+GLfloat *pos, int stride, GLuint from, GLuint to ) {
+    GLfloat *p[3];
+    double before[3], after[3];
+    GLuint v;
+    int i, t, k, gone;
+    for( i = offsets[from]; i < offsets[from + 1]; i++ ) {
+        t = adjacency[i];
+        gone = 0;
+        for( k = 0; k < 3; k++ ) {
+            v = indices[t*3 + k];
+            gone |= v == to;
+            p[k] = &pos[v * stride];
+        }
+        if( gone ) {
+            continue;
+        }
+        sstTriangleNormal(p[0], p[1], p[2], before);
+        for( k = 0; k < 3; k++ ) {
+            if( indices[t*3 + k] == from ) {
+                p[k] = &pos[to * stride];
+            }
+        }
+        sstTriangleNormal(p[0], p[1], p[2], after);
+        if( before[0] * after[0] + before[1] * after[1] + before[2] * after[2]
+            <= 0.0 ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Simplifies the triangles in indices until there are at most target of them,
+ * or no more edges can be collapsed. Each pass costs every edge, then makes the
+ * cheapest collapses, at most one around any vertex. Quadrics of collapsed
+ * vertices are merged into the vertex they collapse onto, so later levels carry
+ * on measuring against the full mesh. Returns the new number of indices and
+ * raises error to the largest distance moved.
+ */
+static int sstSimplify( GLuint *indices, int i_count, GLfloat *pos, int stride,
+int count, sstQuadric *quadrics, char *locked, int target, GLfloat *error ) {
+    sstCollapse *collapses;
+    int *offsets, *adjacency;
+    char *touched;
+    GLuint *remap, a, b, c;
+    double ab, ba;
+    int i, k, t, n, removed, collapsed, out;
+    collapses = (sstCollapse*)malloc(sizeof(sstCollapse) * (i_count + 1));
+    offsets = (int*)malloc(sizeof(int) * (count + 2));
+    adjacency = (int*)malloc(sizeof(int) * (i_count + 1));
+    touched = (char*)malloc(count + 1);
+    remap = (GLuint*)malloc(sizeof(GLuint) * (count + 1));
+    while( i_count / 3 > target ) {
+        /* Step 1: Cost every edge in its cheaper direction */
+        n = 0;
+        for( i = 0; i < i_count; i++ ) {
+            a = indices[i];
+            b = indices[i - i % 3 + (i + 1) % 3];
+            ab = locked[a] ? -1.0
+                           : sstCollapseCost(quadrics, pos, stride, a, b);
+            ba = locked[b] ? -1.0
+                           : sstCollapseCost(quadrics, pos, stride, b, a);
+            if( ab < 0.0 && ba < 0.0 ) {
+                continue;
+            }
+            if( ba < 0.0 || (ab >= 0.0 && ab <= ba) ) {
+                collapses[n].from = a;
+                collapses[n].to = b;
+                collapses[n++].cost = ab;
+            }
+            else {
+                collapses[n].from = b;
+                collapses[n].to = a;
+                collapses[n++].cost = ba;
+            }
+        }
+        qsort(collapses, n, sizeof(sstCollapse), sstCompareCollapses);
+        /* Step 2: Find the triangles around each vertex */
+        memset(offsets, 0, sizeof(int) * (count + 2));
+        for( i = 0; i < i_count; i++ ) {
+            offsets[indices[i] + 2]++;
+        }
+        for( i = 2; i < count + 2; i++ ) {
+            offsets[i] += offsets[i - 1];
+        }
+        for( i = 0; i < i_count; i++ ) {
+            adjacency[offsets[indices[i] + 1]++] = i / 3;
+        }
+        /* Step 3: Collapse, cheapest first */
+        memset(touched, 0, count + 1);
+        for( i = 0; i < count; i++ ) {
+            remap[i] = i;
+        }
+        removed = collapsed = 0;
+        for( i = 0; i < n && removed < i_count / 3 - target; i++ ) {
+            a = collapses[i].from;
+            b = collapses[i].to;
+            if( touched[a] || touched[b] || a == b
+             || sstCollapseFlips(indices, offsets, adjacency, pos, stride,
+                                 a, b) ) {
+                continue;
+            }
+            /* Everything around a changes, so leave it alone until the next
+             * pass has looked at it again */
+            for( k = offsets[a]; k < offsets[a + 1]; k++ ) {
+                t = adjacency[k];
+                touched[indices[t*3]] = 1;
+                touched[indices[t*3 + 1]] = 1;
+                touched[indices[t*3 + 2]] = 1;
+                if( indices[t*3] == b || indices[t*3 + 1] == b
+                 || indices[t*3 + 2] == b ) {
+                    removed++;
+                }
+            }
+            remap[a] = b;
+            sstAddQuadric(&quadrics[b], &quadrics[a]);
+            if( sqrt(collapses[i].cost) > *error ) {
+                *error = (GLfloat)sqrt(collapses[i].cost);
+            }
+            collapsed++;
+        }
+        if( collapsed == 0 ) {
+            break;
+        }
+        /* Step 4: Drop the triangles that collapsed away */
+        out = 0;
+        for( t = 0; t < i_count / 3; t++ ) {
+            a = remap[indices[t*3]];
+            b = remap[indices[t*3 + 1]];
+            c = remap[indices[t*3 + 2]];
+            if( a == b || b == c || a == c ) {
+                continue;
+            }
+            indices[out++] = a;
+            indices[out++] = b;
+            indices[out++] = c;
+        }
+        i_count = out;
+    }
+    free(collapses);
+    free(offsets);
+    free(adjacency);
+    free(touched);
+    free(remap);
+    return i_count;
+}
+
+/*
+ * Builds the chain of levels of detail asked for by the program from the full
+ * mesh, all sharing its vertices.
+ */
+void sstBuildLODs( sstProgram *program, sstMesh *mesh ) {
+    sstQuadric *quadrics;
+    GLuint *current;
+    GLfloat *pos, error;
+    char *locked;
+    int position, stride, size, next, level;
+    position = sstFindPositions(mesh->inputs, mesh->size);
+    if( position < 0 || program->lod_levels <= 0 || mesh->i_count < 3 ) {
+        return;
+    }
+    pos = (GLfloat*)mesh->data[position];
+    stride = mesh->inputs[position]->components;
+    /* Step 1: Measure the full mesh */
+    quadrics = (sstQuadric*)calloc(mesh->count + 1, sizeof(sstQuadric));
+    sstBuildQuadrics(mesh->indices, mesh->i_count, pos, stride, quadrics);
+    locked = sstFindSeams(pos, stride, mesh->count);
+    /* Step 2: Simplify each level from the one before it */
+    mesh->lod_indices = (GLuint**)malloc(sizeof(GLuint*) * program->lod_levels);
+    mesh->lod_sizes = (int*)malloc(sizeof(int) * program->lod_levels);
+    mesh->lod_errors = (GLfloat*)malloc(sizeof(GLfloat) * program->lod_levels);
+    current = (GLuint*)malloc(sizeof(GLuint) * mesh->i_count);
+    memcpy(current, mesh->indices, sizeof(GLuint) * mesh->i_count);
+    size = mesh->i_count;
+    error = 0.0f;
+    for( level = 0; level < program->lod_levels; level++ ) {
+        next = sstSimplify(current, size, pos, stride, mesh->count, quadrics,
+                           locked, (int)(size / 3 * program->lod_ratio),
+                           &error);
+        if( next == 0 || next > size * MIN_REDUCTION ) {
+            break;
+        }
+        mesh->lod_indices[level] = (GLuint*)malloc(sizeof(GLuint) * next);
+        memcpy(mesh->lod_indices[level], current, sizeof(GLuint) * next);
+        mesh->lod_sizes[level] = next;
+        mesh->lod_errors[level] = error;
+        mesh->lod_count++;
+        size = next;
+    }
+    free(current);
+    free(quadrics);
+    free(locked);
+}
+
+/*
+ * Private functions
+ */
+
+void sstDrawSetRange( sstDrawableSet *set, GLuint first, int size ) {
+#ifdef GL_SHADER_STORAGE_BUFFER
+    if( sst_active && sst_active->pulling ) {
+        sstDrawPulled(sst_active->pulling, set, first, size);
+        return;
+    }
+#endif
+    sstBindVertexArray(set->vao);
+    glDrawElements(set->mode, size, set->i_type,
+                   (GLvoid*)((size_t)first * sstSizeFromEnum(set->i_type)));
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Turns on SST_OPTIMIZE_LOD for the program, with up to levels levels of detail
+ * each with about ratio times the triangles of the one before.
+ */
+void sstGenerateLODs( sstProgram *program, int levels, GLfloat ratio ) {
+    if( levels < 0 || ratio <= 0.0f || ratio >= 1.0f ) {
+        printf("WARN: Invalid level of detail settings!\n");
+        return;
+    }
+    program->mesh_passes |= SST_OPTIMIZE_LOD;
+    program->lod_levels = levels;
+    program->lod_ratio = ratio;
+}
+
+/*
+ * Draws the coarsest level of detail of the given set whose error, projected
+ * onto the screen, is at most the given number of pixels.
+ */
+int sstDrawSetLOD( sstDrawableSet *set, GLfloat *model, GLfloat *projection,
+GLfloat height, GLfloat pixels ) {
+    GLfloat scale, s, z, distance, per_unit;
+    int c, level;
+    /* The set may not even be built yet, so the level is picked over there */
+    if( sst_threaded && sstRenderDrawLOD(set, model, projection, height,
+                                         pixels) ) {
+        return 0;
+    }
+    if( set->lod_count == 0 ) {
+        sstDrawSet(set);
+        return 0;
+    }
+    /* Step 1: Find how much the model matrix scales the set, and how far in
+     * front of the eye the nearest point of its bounding sphere is */
+    scale = 0.0f;
+    for( c = 0; c < 3; c++ ) {
+        s = model[c*4] * model[c*4] + model[c*4 + 1] * model[c*4 + 1]
+          + model[c*4 + 2] * model[c*4 + 2];
+        if( s > scale ) {
+            scale = s;
+        }
+    }
+    scale = sqrtf(scale);
+    z = -(model[2] * set->center[0] + model[6] * set->center[1]
+        + model[10] * set->center[2] + model[14]);
+    distance = z - set->radius * scale;
+    /* Step 2: Pick the coarsest level that is close enough. projection[5] is
+     * the cotangent of half the field of view. */
+    level = 0;
+    if( distance > 0.0f ) {
+        per_unit = projection[5] * height * 0.5f / distance;
+        for( c = set->lod_count; c > 0; c-- ) {
+            if( set->lods[c - 1].error * scale * per_unit <= pixels ) {
+                level = c;
+                break;
+            }
+        }
+    }
+    /* Step 3: Draw it, or record drawing it */
+    if( level == 0 ) {
+        sstDrawSet(set);
+        return 0;
+    }
+    if( sst_deferred ) {
+        sstDeferDrawRange(set, set->lods[level - 1].first,
+                          set->lods[level - 1].size);
+    }
+    else if( sst_queued ) {
+        sstQueueDrawRange(set, set->lods[level - 1].first,
+                          set->lods[level - 1].size);
+    }
+    else {
+        sstDrawSetRange(set, set->lods[level - 1].first,
+                        set->lods[level - 1].size);
+    }
+    return level;
+}
@@ -0,0 +1,759 @@
+/*
+ * sst_mesh.c
+ * By Steven Smith
+ *
+ * This file contains the processing done on triangle meshes before they are
+ * uploaded by sstDrawableSetArrays() and sstDrawableSetElements(): welding
+ * duplicate vertices, reordering triangles to make better use of the
+ * post-transform vertex cache and to reduce overdraw, and reordering vertices
+ * into the order they are fetched. Every pass keeps the data for each input
+ * consistent with the indices.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Size of the FIFO cache the triangle reordering aims for. Small enough to hold
+ * on any hardware, newer GPUs only do better. */
+#define CACHE_SIZE 16
+/* How close to the ACMR of a whole cluster a piece of it must get before it can
+ * be split off as a cluster of its own when sorting for overdraw */
+#define OVERDRAW_THRESHOLD 1.05f
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Runs a triangle through a FIFO cache, returning the number of vertices that
+ * missed. Rather than keeping a queue, time moves on with every miss and each
+ * vertex remembers the time it was loaded, so a vertex is still in the cache if
+ * fewer than cache_size misses have happened since. Moving time on by
+ * cache_size empties the cache.
+ */
+static int sstCacheMisses( GLuint *triangle, int *stamps, int *time,
+int cache_size ) {
+    int k, misses;
+    misses = 0;
+    for( k = 0; k < 3; k++ ) {
+        if( *time - stamps[triangle[k]] >= cache_size ) {
+            stamps[triangle[k]] = ++(*time);
+            misses++;
+        }
+    }
+    return misses;
+}
+
+/*
+ * Returns a new, empty timestamp array for sstCacheMisses().
+ */
+static int * sstNewStamps( int count ) {
+    return (int*)calloc(count > 0 ? count : 1, sizeof(int));
+}
+
+/*
+ * Returns the index of the input holding positions, or -1 if there isn't one.
+ */
+int sstFindPositions( in_var **inputs, int size ) {
+    in_var *input;
+    int i, found;
+    found = -1;
+    for( i = size - 1; i >= 0; i-- ) {
+        input = inputs[i];
+        if( input == NULL ) {
+            continue;
+        }
+        if( input->type != GL_FLOAT || input->slots != 1
+         || input->components < 3 || input->components > 4 ) {
+            continue;
+        }
+        if( strstr(input->name, "Position") ) {
+            return i;
+        }
+        found = i;
+    }
+    return found;
+}
+
+/*
+ * Mesh functions
+ */
+
+/*
+ * Copies the given vertex and index data into a mesh. NULL indices stand for
+ * the vertices in order. Returns 0, leaving the mesh empty, if any of the
+ * inputs are missing or an index is out of range.
+ */
+int sstInitMesh( sstMesh *mesh, int count, void *indices, GLenum i_type,
+int i_count, int size, in_var **inputs, void **data ) {
+    size_t bytes;
+    int i;
+    mesh->data = NULL;
+    mesh->lod_count = 0;
+    mesh->lod_indices = NULL;
+    mesh->lod_sizes = NULL;
+    mesh->lod_errors = NULL;
+    for( i = 0; i < size; i++ ) {
+        if( inputs[i] == NULL ) {
+            return 0;
+        }
+    }
+    mesh->count = count;
+    mesh->size = size;
+    mesh->inputs = (in_var**)malloc(sizeof(in_var*) * size);
+    mesh->data = (void**)malloc(sizeof(void*) * size);
+    for( i = 0; i < size; i++ ) {
+        mesh->inputs[i] = inputs[i];
+        bytes = (size_t)sstInputSize(inputs[i]) * count;
+        mesh->data[i] = malloc(bytes);
+        memcpy(mesh->data[i], data[i], bytes);
+    }
+    /* Trailing indices that don't make up a triangle are dropped */
+    mesh->i_count = i_count - i_count % 3;
+    mesh->indices = (GLuint*)malloc(sizeof(GLuint) * mesh->i_count);
+    for( i = 0; i < mesh->i_count; i++ ) {
+        mesh->indices[i] = indices ? sstGetIndex(indices, i_type, i)
+                                   : (GLuint)i;
+        if( mesh->indices[i] >= (GLuint)count ) {
+            printf("WARN: Index %u is out of range, skipping processing!\n",
+                   mesh->indices[i]);
+            sstFreeMesh(mesh);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Builds the key a vertex is welded by: the bytes of its data for every input,
+ * with float components rounded to the nearest multiple of epsilon first (and
+ * -0 turned into 0) so that vertices within epsilon of each other match.
+ */
+static void sstWeldKey( sstMesh *mesh, int v, GLfloat epsilon, char *key ) {
+    in_var *input;
+    GLfloat *f;
+    double rounded;
+    size_t size;
+    GLuint c;
+    int i;
+    for( i = 0; i < mesh->size; i++ ) {
+        input = mesh->inputs[i];
+        size = sstInputSize(input);
+        if( input->type != GL_FLOAT ) {
+            memcpy(key, (char*)mesh->data[i] + v * size, size);
+            key += size;
+            continue;
+        }
+        f = (GLfloat*)mesh->data[i] + v * input->data_components;
+        for( c = 0; c < input->data_components; c++ ) {
+            rounded = epsilon > 0.0f ? floor(f[c] / epsilon + 0.5) : f[c];
+            rounded += 0.0;
+            memcpy(key, &rounded, sizeof(double));
+            key += sizeof(double);
+        }
+    }
+}
+
+/*
+ * Returns the size of the key built by sstWeldKey().
+ */
+static size_t sstWeldKeySize( sstMesh *mesh ) {
+    size_t size;
+    int i;
+    size = 0;
+    for( i = 0; i < mesh->size; i++ ) {
+        if( mesh->inputs[i]->type == GL_FLOAT ) {
+            size += sizeof(double) * mesh->inputs[i]->data_components;
+        }
+        else {
+            size += sstInputSize(mesh->inputs[i]);
+        }
+    }
+    return size;
+}
+
+/*
+ * FNV-1a hash of a weld key.
+ */
+static GLuint sstHashKey( char *key, size_t size ) {
+    GLuint hash;
+    size_t i;
+    hash = 2166136261u;
+    for( i = 0; i < size; i++ ) {
+        hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Welds together vertices whose data matches for every input, keeping the
+ * first of each and pointing the indices at it. Vertices are looked up in an
+ * open addressing hash table of their keys.
+ */
+static void sstWeldVertices( sstMesh *mesh, GLfloat epsilon ) {
+    char *keys, *src, *dst;
+    int *table, *unique;
+    GLuint *remap, mask, h, next;
+    size_t key_size, size;
+    int i, v;
+    /* Step 1: Build the keys */
+    key_size = sstWeldKeySize(mesh);
+    keys = (char*)malloc(key_size * (mesh->count + 1));
+    for( v = 0; v < mesh->count; v++ ) {
+        sstWeldKey(mesh, v, epsilon, keys + v * key_size);
+    }
+    /* Step 2: Find the first vertex with each key, keeping the table at most
+     * half full */
+    for( mask = 1; mask < (GLuint)mesh->count * 2; mask <<= 1 );
+    table = (int*)malloc(sizeof(int) * mask);
+    for( h = 0; h < mask; h++ ) {
+        table[h] = -1;
+    }
+    mask--;
+    remap = (GLuint*)malloc(sizeof(GLuint) * (mesh->count + 1));
+    unique = (int*)malloc(sizeof(int) * (mesh->count + 1));
+    next = 0;
+    for( v = 0; v < mesh->count; v++ ) {
+        h = sstHashKey(keys + v * key_size, key_size) & mask;
+        while( table[h] >= 0 && memcmp(keys + table[h] * key_size,
+                                       keys + v * key_size, key_size) ) {
+            h = (h + 1) & mask;
+        }
+        if( table[h] >= 0 ) {
+            remap[v] = remap[table[h]];
+            continue;
+        }
+        table[h] = v;
+        unique[next] = v;
+        remap[v] = next++;
+    }
+    /* Step 3: Keep the first of each vertex and point the indices at them */
+    for( i = 0; i < mesh->size; i++ ) {
+        size = sstInputSize(mesh->inputs[i]);
+        src = (char*)mesh->data[i];
+        dst = (char*)malloc(size * (next + 1));
+        for( v = 0; v < (int)next; v++ ) {
+            memcpy(dst + v * size, src + unique[v] * size, size);
+        }
+        free(src);
+        mesh->data[i] = dst;
+    }
+    for( i = 0; i < mesh->i_count; i++ ) {
+        mesh->indices[i] = remap[mesh->indices[i]];
+    }
+    mesh->count = next;
+    free(keys);
+    free(table);
+    free(remap);
+    free(unique);
+}
+
+/*
+ * Reorders triangles for the vertex cache with Tipsify, from Sander, Nehab and
+ * Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+ * Triangles are emitted in fans around a vertex, and the next vertex to fan
+ * around is picked from the ones just used, preferring the ones that will still
+ * be in the cache once all of their triangles are emitted. When none are left
+ * the walk has hit a dead end and starts a new cluster, recorded in clusters.
+ * Returns the number of clusters.
+ */
+static int sstTipsify( GLuint *indices, int i_count, int count,
+int *clusters ) {
+    int *offsets, *adjacency, *live, *stamps, *dead;
+    char *emitted;
+    GLuint *result, v;
+    int i, k, t, f, time, cursor, out, top, start, best, priority, p, n;
+    n = i_count / 3;
+    /* Step 1: Find the triangles using each vertex */
+    live = (int*)calloc(count + 1, sizeof(int));
+    offsets = (int*)malloc(sizeof(int) * (count + 1));
+    adjacency = (int*)malloc(sizeof(int) * (i_count + 1));
+    for( i = 0; i < i_count; i++ ) {
+        live[indices[i]]++;
+    }
+    offsets[0] = 0;
+    for( i = 0; i < count; i++ ) {
+        offsets[i + 1] = offsets[i] + live[i];
+    }
+    for( i = 0; i < i_count; i++ ) {
+        adjacency[offsets[indices[i]]++] = i / 3;
+    }
+    for( i = count; i > 0; i-- ) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+    /* Step 2: Walk the mesh */
+    stamps = sstNewStamps(count);
+    dead = (int*)malloc(sizeof(int) * (i_count + 1));
+    emitted = (char*)calloc(n + 1, sizeof(char));
+    result = (GLuint*)malloc(sizeof(GLuint) * (i_count + 1));
+    time = CACHE_SIZE;
+    cursor = out = top = 0;
+    clusters[0] = 0;
+    k = 1;
+    for( f = 0; f < count && live[f] == 0; f++ );
+    while( f < count ) {
+        /* Sub-step 1: Emit every remaining triangle around f */
+        start = top;
+        for( i = offsets[f]; i < offsets[f + 1]; i++ ) {
+            t = adjacency[i];
+            if( emitted[t] ) {
+                continue;
+            }
+            emitted[t] = 1;
+            sstCacheMisses(&indices[t*3], stamps, &time, CACHE_SIZE);
+            for( p = 0; p < 3; p++ ) {
+                v = indices[t*3 + p];
+                result[out++] = v;
+                dead[top++] = v;
+                live[v]--;
+            }
+        }
+        /* Sub-step 2: Pick the next vertex from the ones just used */
+        best = -1;
+        priority = -1;
+        for( i = start; i < top; i++ ) {
+            v = dead[i];
+            if( live[v] == 0 ) {
+                continue;
+            }
+            p = 0;
+            if( time - stamps[v] + 2 * live[v] <= CACHE_SIZE ) {
+                p = time - stamps[v];
+            }
+            if( p > priority ) {
+                priority = p;
+                best = v;
+            }
+        }
+        /* Sub-step 3: Dead end, so back track through the vertices used so
+         * far, then fall back to the next vertex with triangles left */
+        if( best < 0 ) {
+            while( top > 0 && best < 0 ) {
+                v = dead[--top];
+                if( live[v] > 0 ) {
+                    best = v;
+                }
+            }
+            for( ; best < 0 && cursor < count; cursor++ ) {
+                if( live[cursor] > 0 ) {
+                    best = cursor;
+                }
+            }
+            if( best >= 0 ) {
+                clusters[k++] = out / 3;
+            }
+        }
+        f = best < 0 ? count : best;
+    }
+    /* Step 3: Copy back the new order */
+    memcpy(indices, result, sizeof(GLuint) * i_count);
+    free(result);
+    free(live);
+    free(offsets);
+    free(adjacency);
+    free(stamps);
+    free(dead);
+    free(emitted);
+    return k;
+}
+
+typedef struct {
+    GLfloat key;
+    int start;
+    int end;
+} sstCluster;
+
+/*
+ * Orders clusters by their sort key, largest first.
+ */
+static int sstCompareClusters( const void *a, const void *b ) {
+    GLfloat ka, kb;
+    ka = ((const sstCluster*)a)->key;
+    kb = ((const sstCluster*)b)->key;
+    return ka > kb ? -1 : (ka < kb ? 1 : 0);
+}
+
+/*
+ * Splits the clusters found by sstTipsify() wherever the cache has been used
+ * about as well as it is by the whole cluster, since the pieces can then be
+ * moved around without costing any extra cache misses. Returns the new number
+ * of clusters.
+ */
+static int sstSplitClusters( sstMesh *mesh, int *clusters, int n,
+sstCluster *result ) {
+    int *stamps;
+    int c, t, start, end, time, misses, running, tris, k;
+    GLfloat threshold;
+    stamps = sstNewStamps(mesh->count);
+    time = CACHE_SIZE;
+    k = 0;
+    for( c = 0; c < n; c++ ) {
+        start = clusters[c];
+        end = c + 1 < n ? clusters[c + 1] : mesh->i_count / 3;
+        /* Step 1: Find the ACMR of the whole cluster */
+        time += CACHE_SIZE;
+        misses = 0;
+        for( t = start; t < end; t++ ) {
+            misses += sstCacheMisses(&mesh->indices[t*3], stamps, &time,
+                                     CACHE_SIZE);
+        }
+        threshold = OVERDRAW_THRESHOLD * misses / (GLfloat)(end - start);
+        /* Step 2: Split off pieces that get close to it */
+        time += CACHE_SIZE;
+        result[k].start = start;
+        running = tris = 0;
+        for( t = start; t < end; t++ ) {
+            running += sstCacheMisses(&mesh->indices[t*3], stamps, &time,
+                                      CACHE_SIZE);
+            tris++;
+            if( running <= threshold * tris && t + 1 < end ) {
+                result[k].end = t + 1;
+                result[++k].start = t + 1;
+                time += CACHE_SIZE;
+                running = tris = 0;
+            }
+        }
+        /* The last piece may not reach the threshold, so it joins the piece
+         * before it */
+        if( running > threshold * tris && result[k].start > start ) {
+            k--;
+        }
+        result[k++].end = end;
+    }
+    free(stamps);
+    return k;
+}
+
+/*
+ * Reorders the clusters of a mesh so that the ones facing away from its middle
+ * are drawn first, from the same paper as sstTipsify(). Those are the most
+ * likely to be in front of the rest of the mesh, whatever the view direction.
+ */
+static void sstSortClusters( sstMesh *mesh, int *clusters, int n ) {
+    sstCluster *sorted;
+    GLfloat *pos, *a, *b, *c, center[3], sum[3], normal[3], mid[3], e1[3];
+    GLfloat e2[3], cross[3], area, total, weight;
+    GLuint *result;
+    int i, j, t, out, stride, position;
+    position = sstFindPositions(mesh->inputs, mesh->size);
+    if( position < 0 ) {
+        return;
+    }
+    pos = (GLfloat*)mesh->data[position];
+    stride = mesh->inputs[position]->components;
+    sorted = (sstCluster*)malloc(sizeof(sstCluster) * (mesh->i_count / 3 + 1));
+    n = sstSplitClusters(mesh, clusters, n, sorted);
+    /* Step 1: Find the area weighted middle of the mesh */
+    center[0] = center[1] = center[2] = 0.0f;
+    total = 0.0f;
+    for( t = 0; t < mesh->i_count / 3; t++ ) {
+        a = &pos[mesh->indices[t*3] * stride];
+        b = &pos[mesh->indices[t*3 + 1] * stride];
+        c = &pos[mesh->indices[t*3 + 2] * stride];
+        for( j = 0; j < 3; j++ ) {
+            e1[j] = b[j] - a[j];
+            e2[j] = c[j] - a[j];
+        }
+        sstCrossProduct3_(e1, e2, cross);
+        area = sqrtf(sstDotProduct3(cross, cross));
+        for( j = 0; j < 3; j++ ) {
+            center[j] += (a[j] + b[j] + c[j]) * area;
+        }
+        total += area;
+    }
+    for( j = 0; j < 3; j++ ) {
+        center[j] = total > 0.0f ? center[j] / (3.0f * total) : 0.0f;
+    }
+    /* Step 2: Key each cluster by how far it faces out from the middle */
+    for( i = 0; i < n; i++ ) {
+        sum[0] = sum[1] = sum[2] = 0.0f;
+        normal[0] = normal[1] = normal[2] = 0.0f;
+        total = 0.0f;
+        for( t = sorted[i].start; t < sorted[i].end; t++ ) {
+            a = &pos[mesh->indices[t*3] * stride];
+            b = &pos[mesh->indices[t*3 + 1] * stride];
+            c = &pos[mesh->indices[t*3 + 2] * stride];
+            for( j = 0; j < 3; j++ ) {
+                e1[j] = b[j] - a[j];
+                e2[j] = c[j] - a[j];
+            }
+            /* The length of the cross product is twice the area, so summing
+             * them weights the normals by area */
+            sstCrossProduct3_(e1, e2, cross);
+            weight = sqrtf(sstDotProduct3(cross, cross));
+            for( j = 0; j < 3; j++ ) {
+                normal[j] += cross[j];
+                sum[j] += (a[j] + b[j] + c[j]) * weight;
+            }
+            total += weight;
+        }
+        weight = sqrtf(sstDotProduct3(normal, normal));
+        sorted[i].key = 0.0f;
+        if( total > 0.0f && weight > 0.0f ) {
+            for( j = 0; j < 3; j++ ) {
+                mid[j] = sum[j] / (3.0f * total) - center[j];
+                normal[j] /= weight;
+            }
+            sorted[i].key = sstDotProduct3(mid, normal);
+        }
+    }
+    /* Step 3: Emit the clusters in order */
+    qsort(sorted, n, sizeof(sstCluster), sstCompareClusters);
+    result = (GLuint*)malloc(sizeof(GLuint) * (mesh->i_count + 1));
+    out = 0;
+    for( i = 0; i < n; i++ ) {
+        for( t = sorted[i].start * 3; t < sorted[i].end * 3; t++ ) {
+            result[out++] = mesh->indices[t];
+        }
+    }
+    free(mesh->indices);
+    mesh->indices = result;
+    free(sorted);
+}
+
+/*
+ * Reorders vertices into the order the indices first use them, so that vertex
+ * fetch walks through memory in order. Vertices that are never used are
+ * dropped.
+ */
+static void sstRemapFetch( sstMesh *mesh ) {
+    GLuint *remap, next;
+    char *src, *dst;
+    size_t size;
+    int i, v, l;
+    /* Step 1: Number the vertices in order of first use */
+    remap = (GLuint*)malloc(sizeof(GLuint) * (mesh->count + 1));
+    for( v = 0; v < mesh->count; v++ ) {
+        remap[v] = 0xFFFFFFFF;
+    }
+    next = 0;
+    for( i = 0; i < mesh->i_count; i++ ) {
+        v = mesh->indices[i];
+        if( remap[v] == 0xFFFFFFFF ) {
+            remap[v] = next++;
+        }
+        mesh->indices[i] = remap[v];
+    }
+    /* Levels of detail only use vertices of the full mesh */
+    for( l = 0; l < mesh->lod_count; l++ ) {
+        for( i = 0; i < mesh->lod_sizes[l]; i++ ) {
+            mesh->lod_indices[l][i] = remap[mesh->lod_indices[l][i]];
+        }
+    }
+    /* Step 2: Move the data for every input to match */
+    for( i = 0; i < mesh->size; i++ ) {
+        size = sstInputSize(mesh->inputs[i]);
+        src = (char*)mesh->data[i];
+        dst = (char*)malloc(size * (next + 1));
+        for( v = 0; v < mesh->count; v++ ) {
+            if( remap[v] != 0xFFFFFFFF ) {
+                memcpy(dst + remap[v] * size, src + v * size, size);
+            }
+        }
+        free(src);
+        mesh->data[i] = dst;
+    }
+    mesh->count = next;
+    free(remap);
+}
+
+/*
+ * Runs the mesh processing passes turned on for the program over the mesh.
+ */
+void sstProcessMesh( sstProgram *program, sstMesh *mesh ) {
+    int *clusters, n, l;
+    if( program->mesh_passes & SST_OPTIMIZE_WELD ) {
+        sstWeldVertices(mesh, program->weld_epsilon);
+    }
+    if( program->mesh_passes & SST_OPTIMIZE_LOD ) {
+        sstBuildLODs(program, mesh);
+    }
+    if( program->mesh_passes & (SST_OPTIMIZE_CACHE | SST_OPTIMIZE_OVERDRAW) ) {
+        clusters = (int*)malloc(sizeof(int) * (mesh->i_count / 3 + 1));
+        n = sstTipsify(mesh->indices, mesh->i_count, mesh->count, clusters);
+        if( program->mesh_passes & SST_OPTIMIZE_OVERDRAW ) {
+            sstSortClusters(mesh, clusters, n);
+        }
+        /* Levels of detail are drawn from far away, so only the cache
+         * matters for them */
+        for( l = 0; l < mesh->lod_count; l++ ) {
+            sstTipsify(mesh->lod_indices[l], mesh->lod_sizes[l], mesh->count,
+                       clusters);
+        }
+        free(clusters);
+    }
+    if( program->mesh_passes & SST_OPTIMIZE_FETCH ) {
+        sstRemapFetch(mesh);
+    }
+}
+
+/*
+ * Returns the indices of the mesh converted to the narrowest index type that
+ * can hold them, to be freed by the caller. The indices of each level of
+ * detail follow the full mesh. Fills in the type used and the total number of
+ * indices.
+ */
+void * sstMeshIndices( sstMesh *mesh, GLenum *i_type, int *total ) {
+    void *result;
+    int i, l, out;
+    if( (GLuint)mesh->count - 1 <= sstMaxIndex(GL_UNSIGNED_BYTE) ) {
+        *i_type = GL_UNSIGNED_BYTE;
+    }
+    else if( (GLuint)mesh->count - 1 <= sstMaxIndex(GL_UNSIGNED_SHORT) ) {
+        *i_type = GL_UNSIGNED_SHORT;
+    }
+    else {
+        *i_type = GL_UNSIGNED_INT;
+    }
+    *total = mesh->i_count;
+    for( l = 0; l < mesh->lod_count; l++ ) {
+        *total += mesh->lod_sizes[l];
+    }
+    result = malloc(sstSizeFromEnum(*i_type) * (*total + 1));
+    for( i = 0; i < mesh->i_count; i++ ) {
+        sstPutIndex(result, *i_type, i, mesh->indices[i]);
+    }
+    out = mesh->i_count;
+    for( l = 0; l < mesh->lod_count; l++ ) {
+        for( i = 0; i < mesh->lod_sizes[l]; i++ ) {
+            sstPutIndex(result, *i_type, out++, mesh->lod_indices[l][i]);
+        }
+    }
+    return result;
+}
+
+void sstFreeMesh( sstMesh *mesh ) {
+    int i;
+    for( i = 0; i < mesh->size; i++ ) {
+        free(mesh->data[i]);
+    }
+    for( i = 0; i < mesh->lod_count; i++ ) {
+        free(mesh->lod_indices[i]);
+    }
+    free(mesh->lod_indices);
+    free(mesh->lod_sizes);
+    free(mesh->lod_errors);
+    free(mesh->data);
+    free(mesh->inputs);
+    free(mesh->indices);
+    mesh->data = NULL;
+}
+
+/*
+ * Fills in the bounding box and bounding sphere of the positions in the given
+ * input data. The sphere is centered on the middle of the box. Both are empty,
+ * at the origin, if there are no positions.
+ */
+void sstComputeBounds( in_var **inputs, void **data, int size, int count,
+sstDrawableSet *set ) {
+    GLfloat *pos, d[3], r;
+    int position, stride, v, c;
+    for( c = 0; c < 3; c++ ) {
+        set->low[c] = set->high[c] = set->center[c] = 0.0f;
+    }
+    set->radius = 0.0f;
+    position = sstFindPositions(inputs, size);
+    if( position < 0 || count <= 0 ) {
+        return;
+    }
+    pos = (GLfloat*)data[position];
+    stride = inputs[position]->components;
+    for( c = 0; c < 3; c++ ) {
+        set->low[c] = set->high[c] = pos[c];
+    }
+    for( v = 1; v < count; v++ ) {
+        for( c = 0; c < 3; c++ ) {
+            if( pos[v*stride + c] < set->low[c] ) {
+                set->low[c] = pos[v*stride + c];
+            }
+            if( pos[v*stride + c] > set->high[c] ) {
+                set->high[c] = pos[v*stride + c];
+            }
+        }
+    }
+    for( c = 0; c < 3; c++ ) {
+        set->center[c] = (set->low[c] + set->high[c]) * 0.5f;
+    }
+    for( v = 0; v < count; v++ ) {
+        for( c = 0; c < 3; c++ ) {
+            d[c] = pos[v*stride + c] - set->center[c];
+        }
+        r = sstDotProduct3(d, d);
+        if( r > set->radius ) {
+            set->radius = r;
+        }
+    }
+    set->radius = sqrtf(set->radius);
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Turns on processing of the triangle meshes given to sstDrawableSetElements()
+ * with the program.
+ */
+void sstOptimizeMeshes( sstProgram *program, GLuint passes ) {
+    program->mesh_passes = passes;
+}
+
+/*
+ * Turns on SST_OPTIMIZE_WELD for the program, welding vertices within epsilon
+ * of each other.
+ */
+void sstWeldMeshes( sstProgram *program, GLfloat epsilon ) {
+    program->mesh_passes |= SST_OPTIMIZE_WELD;
+    program->weld_epsilon = epsilon;
+}
+
+/*
+ * Runs indices for a triangle list through a FIFO post-transform cache of the
+ * given size, and fills in the average number of cache misses per triangle and
+ * per vertex.
+ */
+void sstVertexCacheStats( void *indices, GLenum i_type, int i_count, int count,
+int cache_size, GLfloat *acmr, GLfloat *atvr ) {
+    int *stamps;
+    GLuint triangle[3];
+    int i, time, misses;
+    stamps = sstNewStamps(count);
+    time = cache_size;
+    misses = 0;
+    for( i = 0; i + 2 < i_count; i += 3 ) {
+        triangle[0] = sstGetIndex(indices, i_type, i);
+        triangle[1] = sstGetIndex(indices, i_type, i + 1);
+        triangle[2] = sstGetIndex(indices, i_type, i + 2);
+        misses += sstCacheMisses(triangle, stamps, &time, cache_size);
+    }
+    *acmr = i_count >= 3 ? misses / (GLfloat)(i_count / 3) : 0.0f;
+    *atvr = count > 0 ? misses / (GLfloat)count : 0.0f;
+    free(stamps);
+}
+
+/*
+ * Same as sstVertexCacheStats(), for the indices of a set as stored on the GPU.
+ */
+void sstDrawableSetCacheStats( sstDrawableSet *set, int cache_size,
+GLfloat *acmr, GLfloat *atvr ) {
+    void *indices;
+    GLsizeiptr bytes;
+    /* Without indices every vertex is transformed exactly once */
+    if( !set->i_buffer ) {
+        *acmr = 3.0f;
+        *atvr = 1.0f;
+        return;
+    }
+    bytes = (GLsizeiptr)sstSizeFromEnum(set->i_type) * set->i_size;
+    indices = malloc(bytes + 1);
+    sstBindBuffer(GL_COPY_READ_BUFFER, set->i_buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, indices);
+    sstVertexCacheStats(indices, set->i_type, set->i_size, set->count,
+                        cache_size, acmr, atvr);
+    free(indices);
+}
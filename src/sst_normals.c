@@ -0,0 +1,379 @@
+/*
+ * sst_normals.c
+ * By Steven Smith
+ *
+ * This file contains generation of smooth normals and tangents for triangle
+ * meshes. The triangles are split between threads, each adding up the
+ * contribution of its share into a buffer of its own covering only the range
+ * of vertices it touches, which is small for meshes with any locality. The
+ * vertices are then split between threads again to add the buffers together,
+ * so no two threads ever write the same memory and no atomics are needed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Largest number of floats added up per vertex */
+#define MAX_SUMS 6
+
+typedef struct sstNormalJob sstNormalJob;
+
+typedef struct {
+    sstNormalJob *job;
+    int index;
+    GLuint low; /* Range of vertices touched by the thread's triangles */
+    GLuint high;
+    GLfloat *sums; /* Sums for the vertices from low to high */
+} sstNormalWorker;
+
+struct sstNormalJob {
+    GLfloat *positions;
+    GLfloat *normals; /* Input when making tangents, else output */
+    GLfloat *texcoords;
+    GLfloat *tangents;
+    int count;
+    void *indices;
+    GLenum i_type;
+    int i_count;
+    int weighting; /* SST_WEIGHT_ flags */
+    int sums; /* Floats added up per vertex, 3 for normals, 6 for tangents */
+    int threads;
+    sstNormalWorker *workers;
+};
+
+/*
+ * Helper functions
+ */
+
+static GLuint sstCorner( sstNormalJob *job, int i ) {
+    return job->indices ? sstGetIndex(job->indices, job->i_type, i) : (GLuint)i;
+}
+
+/*
+ * Returns the angle of a triangle at the corner p, between q and r.
+ */
+static GLfloat sstCornerAngle( GLfloat *p, GLfloat *q, GLfloat *r ) {
+    GLfloat a[3], b[3], d;
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        a[c] = q[c] - p[c];
+        b[c] = r[c] - p[c];
+    }
+    d = sqrtf(sstDotProduct3(a, a) * sstDotProduct3(b, b));
+    if( d == 0.0f ) {
+        return 0.0f;
+    }
+    d = sstDotProduct3(a, b) / d;
+    return acosf(d < -1.0f ? -1.0f : d > 1.0f ? 1.0f : d);
+}
+
+/*
+ * Removes the part of v along the unit vector n, then normalizes it. Returns
+ * 0 if nothing is left.
+ */
+static int sstOrthonormalize( GLfloat *v, GLfloat *n ) {
+    GLfloat d, l;
+    int c;
+    d = sstDotProduct3(v, n);
+    for( c = 0; c < 3; c++ ) {
+        v[c] -= n[c] * d;
+    }
+    l = sqrtf(sstDotProduct3(v, v));
+    if( l < 1e-20f ) {
+        return 0;
+    }
+    for( c = 0; c < 3; c++ ) {
+        v[c] /= l;
+    }
+    return 1;
+}
+
+/*
+ * Fills in the contribution of a triangle to the normal at each corner: its
+ * normal, scaled by its area and corner angles as asked for.
+ */
+static void sstFaceNormals( sstNormalJob *job, GLuint *v,
+GLfloat out[3][MAX_SUMS] ) {
+    GLfloat *p[3], e1[3], e2[3], n[3], l, w;
+    int k, c;
+    for( k = 0; k < 3; k++ ) {
+        p[k] = &job->positions[v[k]*3];
+    }
+    for( c = 0; c < 3; c++ ) {
+        e1[c] = p[1][c] - p[0][c];
+        e2[c] = p[2][c] - p[0][c];
+    }
+    /* The cross product is twice the area long */
+    sstCrossProduct3_(e1, e2, n);
+    if( !(job->weighting & SST_WEIGHT_AREA) ) {
+        l = sqrtf(sstDotProduct3(n, n));
+        l = l > 0.0f ? 1.0f / l : 0.0f;
+        for( c = 0; c < 3; c++ ) {
+            n[c] *= l;
+        }
+    }
+    for( k = 0; k < 3; k++ ) {
+        w = job->weighting & SST_WEIGHT_ANGLE
+          ? sstCornerAngle(p[k], p[(k + 1) % 3], p[(k + 2) % 3])
+          : 1.0f;
+        for( c = 0; c < 3; c++ ) {
+            out[k][c] = n[c] * w;
+        }
+    }
+}
+
+/*
+ * Fills in the contribution of a triangle to the tangent and bitangent at each
+ * corner. As in MikkTSpace, the directions of increasing s and t across the
+ * triangle are projected onto the plane of each corner's normal, normalized,
+ * and weighted by the corner's angle. Triangles with degenerate texture
+ * coordinates add nothing.
+ */
+static void sstFaceTangents( sstNormalJob *job, GLuint *v,
+GLfloat out[3][MAX_SUMS] ) {
+    GLfloat *p[3], *uv[3], e1[3], e2[3], s[3], t[3], d, w;
+    int k, c;
+    memset(out, 0, sizeof(GLfloat) * 3 * MAX_SUMS);
+    for( k = 0; k < 3; k++ ) {
+        p[k] = &job->positions[v[k]*3];
+        uv[k] = &job->texcoords[v[k]*2];
+    }
+    for( c = 0; c < 3; c++ ) {
+        e1[c] = p[1][c] - p[0][c];
+        e2[c] = p[2][c] - p[0][c];
+    }
+    d = (uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1])
+      - (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]);
+    if( d == 0.0f ) {
+        return;
+    }
+    d = 1.0f / d;
+    for( k = 0; k < 3; k++ ) {
+        for( c = 0; c < 3; c++ ) {
+            s[c] = (e1[c] * (uv[2][1] - uv[0][1])
+                  - e2[c] * (uv[1][1] - uv[0][1])) * d;
+            t[c] = (e2[c] * (uv[1][0] - uv[0][0])
+                  - e1[c] * (uv[2][0] - uv[0][0])) * d;
+        }
+        w = sstCornerAngle(p[k], p[(k + 1) % 3], p[(k + 2) % 3]);
+        if( sstOrthonormalize(s, &job->normals[v[k]*3]) ) {
+            for( c = 0; c < 3; c++ ) {
+                out[k][c] = s[c] * w;
+            }
+        }
+        if( sstOrthonormalize(t, &job->normals[v[k]*3]) ) {
+            for( c = 0; c < 3; c++ ) {
+                out[k][3 + c] = t[c] * w;
+            }
+        }
+    }
+}
+
+/*
+ * First pass: adds up the contributions of a thread's share of the triangles
+ * into a buffer of its own.
+ */
+static void * sstAccumulateThread( void *arg ) {
+    sstNormalWorker *worker;
+    sstNormalJob *job;
+    GLfloat out[3][MAX_SUMS], *sum;
+    GLuint v[3];
+    int first, last, i, k, c, tris;
+    worker = (sstNormalWorker*)arg;
+    job = worker->job;
+    tris = job->i_count / 3;
+    first = (int)((long)tris * worker->index / job->threads) * 3;
+    last = (int)((long)tris * (worker->index + 1) / job->threads) * 3;
+    /* Step 1: Find the range of vertices to make room for */
+    worker->low = 1;
+    worker->high = 0;
+    for( i = first; i < last; i++ ) {
+        v[0] = sstCorner(job, i);
+        if( i == first || v[0] < worker->low ) {
+            worker->low = v[0];
+        }
+        if( i == first || v[0] > worker->high ) {
+            worker->high = v[0];
+        }
+    }
+    if( first == last ) {
+        worker->sums = NULL;
+        return NULL;
+    }
+    worker->sums = (GLfloat*)calloc((worker->high - worker->low + 1)
+                                    * job->sums, sizeof(GLfloat));
+    /* Step 2: Add up each triangle */
+    for( i = first; i < last; i += 3 ) {
+        for( k = 0; k < 3; k++ ) {
+            v[k] = sstCorner(job, i + k);
+        }
+        if( job->tangents ) {
+            sstFaceTangents(job, v, out);
+        }
+        else {
+            sstFaceNormals(job, v, out);
+        }
+        for( k = 0; k < 3; k++ ) {
+            sum = &worker->sums[(v[k] - worker->low) * job->sums];
+            for( c = 0; c < job->sums; c++ ) {
+                sum[c] += out[k][c];
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Second pass: adds together every buffer's sums for a thread's share of the
+ * vertices, and turns them into normals or tangents.
+ */
+static void * sstResolveThread( void *arg ) {
+    sstNormalWorker *worker, *w;
+    sstNormalJob *job;
+    GLfloat sum[MAX_SUMS], *n, *t, b[3];
+    int first, last, i, c;
+    worker = (sstNormalWorker*)arg;
+    job = worker->job;
+    first = (int)((long)job->count * worker->index / job->threads);
+    last = (int)((long)job->count * (worker->index + 1) / job->threads);
+    for( i = first; i < last; i++ ) {
+        memset(sum, 0, sizeof(sum));
+        for( w = job->workers; w < job->workers + job->threads; w++ ) {
+            if( w->sums && (GLuint)i >= w->low && (GLuint)i <= w->high ) {
+                for( c = 0; c < job->sums; c++ ) {
+                    sum[c] += w->sums[(i - w->low) * job->sums + c];
+                }
+            }
+        }
+        if( !job->tangents ) {
+            /* Vertices in no triangle get an arbitrary unit normal */
+            n = &job->normals[i*3];
+            memcpy(n, sum, sizeof(GLfloat) * 3);
+            if( sqrtf(sstDotProduct3(n, n)) < 1e-20f ) {
+                n[0] = n[1] = 0.0f;
+                n[2] = 1.0f;
+            }
+            else {
+                sstNormalize3_(n);
+            }
+            continue;
+        }
+        /* Tangents are the summed s direction, made perpendicular to the
+         * normal, with the handedness of the bitangent in w */
+        n = &job->normals[i*3];
+        t = &job->tangents[i*4];
+        memcpy(t, sum, sizeof(GLfloat) * 3);
+        if( !sstOrthonormalize(t, n) ) {
+            t[0] = 1.0f;
+            t[1] = t[2] = 0.0f;
+            if( !sstOrthonormalize(t, n) ) {
+                t[0] = 0.0f;
+                t[1] = 1.0f;
+                sstOrthonormalize(t, n);
+            }
+        }
+        sstCrossProduct3_(n, t, b);
+        t[3] = sstDotProduct3(b, &sum[3]) < 0.0f ? -1.0f : 1.0f;
+    }
+    return NULL;
+}
+
+/*
+ * Runs both passes of a job on its threads, the calling thread included.
+ */
+static void sstRunNormalJob( sstNormalJob *job ) {
+    pthread_t *threads;
+    int i, pass;
+    void * (*passes[2])( void *arg );
+    passes[0] = sstAccumulateThread;
+    passes[1] = sstResolveThread;
+    threads = (pthread_t*)malloc(sizeof(pthread_t) * job->threads);
+    job->workers = (sstNormalWorker*)malloc(sizeof(sstNormalWorker)
+                                            * job->threads);
+    for( i = 0; i < job->threads; i++ ) {
+        job->workers[i].job = job;
+        job->workers[i].index = i;
+    }
+    for( pass = 0; pass < 2; pass++ ) {
+        for( i = 1; i < job->threads; i++ ) {
+            pthread_create(&threads[i], NULL, passes[pass], &job->workers[i]);
+        }
+        passes[pass](&job->workers[0]);
+        for( i = 1; i < job->threads; i++ ) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    for( i = 0; i < job->threads; i++ ) {
+        free(job->workers[i].sums);
+    }
+    free(job->workers);
+    free(threads);
+}
+
+/*
+ * Checks the indices of a mesh, filling in the parts of the job describing it.
+ * Returns 0 if they point past the vertices.
+ */
+static int sstInitNormalJob( sstNormalJob *job, GLfloat *positions, int count,
+void *indices, GLenum i_type, int i_count, int threads ) {
+    int i;
+    for( i = 0; indices && i < i_count; i++ ) {
+        if( sstGetIndex(indices, i_type, i) >= (GLuint)count ) {
+            printf("ERROR: Indices point past the vertices!\n");
+            return 0;
+        }
+    }
+    memset(job, 0, sizeof(sstNormalJob));
+    job->positions = positions;
+    job->count = count;
+    job->indices = indices;
+    job->i_type = i_type;
+    job->i_count = indices ? i_count : count;
+    job->threads = threads > 0 ? threads : 1;
+    return 1;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Fills in smooth normals for an indexed triangle mesh, each the sum of the
+ * normals of the triangles around the vertex weighted as asked for.
+ */
+void sstGenerateNormals( GLfloat *positions, int count, void *indices,
+GLenum i_type, int i_count, int weighting, int threads, GLfloat *normals ) {
+    sstNormalJob job;
+    if( !sstInitNormalJob(&job, positions, count, indices, i_type, i_count,
+                          threads) ) {
+        return;
+    }
+    job.normals = normals;
+    job.weighting = weighting;
+    job.sums = 3;
+    sstRunNormalJob(&job);
+}
+
+/*
+ * Fills in tangents for an indexed triangle mesh with normals and texture
+ * coordinates, in the same space as MikkTSpace.
+ */
+void sstGenerateTangents( GLfloat *positions, GLfloat *normals,
+GLfloat *texcoords, int count, void *indices, GLenum i_type, int i_count,
+int threads, GLfloat *tangents ) {
+    sstNormalJob job;
+    if( !sstInitNormalJob(&job, positions, count, indices, i_type, i_count,
+                          threads) ) {
+        return;
+    }
+    job.normals = normals;
+    job.texcoords = texcoords;
+    job.tangents = tangents;
+    job.sums = 6;
+    sstRunNormalJob(&job);
+}
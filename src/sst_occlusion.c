@@ -0,0 +1,690 @@
+/*
+ * sst_occlusion.c
+ * By Steven Smith
+ *
+ * This file contains occlusion culling done entirely on the CPU. A few
+ * occluder meshes are rasterized into a small depth buffer, split into tiles
+ * that are shared out between threads, with SSE doing 4 pixels at a time. The
+ * depth buffer is then reduced into a hierarchical-Z pyramid holding the
+ * furthest depth of each block, which the screen space bounds of drawable sets
+ * are tested against before drawing.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "sst.h"
+#include "sst_private.h"
+
+/* Size of the tiles the depth buffer is split into for threading. Multiples
+ * of 4, so that SSE never writes across tiles. */
+#define TILE_W 32
+#define TILE_H 32
+/* Size of the largest block of a hierarchical-Z level a test looks at */
+#define TEST_SIZE 4
+
+typedef struct {
+    GLfloat x[3]; /* Screen position of each vertex, in pixels */
+    GLfloat y[3];
+    GLfloat z[3]; /* Depth of each vertex, 0 at the near plane to 1 at far */
+} sstScreenTriangle;
+
+struct sstOcclusionWork {
+    sstScreenTriangle *triangles;
+    int count;
+    int capacity;
+    int tiles_x;
+    int tiles_y;
+    int **bins; /* Triangles touching each tile */
+    int *bin_counts;
+    int *bin_capacities;
+    /* Worker threads, kept from sstNewOcclusion() to sstFreeOcclusion() */
+    pthread_t *pool;
+    struct sstRasterJob *jobs;
+    pthread_mutex_t lock;
+    pthread_cond_t start; /* Signalled when a new frame is ready */
+    pthread_cond_t done; /* Signalled when the last worker finishes */
+    unsigned int frame; /* Counts calls to sstOcclusionRasterize() */
+    int running; /* Workers still rasterizing this frame */
+    int quit;
+};
+
+typedef struct sstRasterJob {
+    sstOcclusion *occ;
+    int index;
+} sstRasterJob;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns the time in seconds from a monotonic clock. This doesn't need GLFW
+ * to be initialized, so the culler works without a window.
+ */
+static double sstSeconds( void ) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Transforms a point by a column major matrix into clip space.
+ */
+static void sstToClip( GLfloat *m, GLfloat *p, GLfloat *clip ) {
+    int i;
+    for( i = 0; i < 4; i++ ) {
+        clip[i] = m[i] * p[0] + m[4 + i] * p[1] + m[8 + i] * p[2] + m[12 + i];
+    }
+}
+
+/*
+ * Adds a triangle in screen space to the bins of every tile its bounds touch.
+ */
+static void sstBinTriangle( sstOcclusion *occ, sstScreenTriangle *tri ) {
+    struct sstOcclusionWork *work;
+    GLfloat low[2], high[2];
+    int k, tx, ty, x0, x1, y0, y1, tile;
+    work = occ->work;
+    low[0] = high[0] = tri->x[0];
+    low[1] = high[1] = tri->y[0];
+    for( k = 1; k < 3; k++ ) {
+        low[0] = tri->x[k] < low[0] ? tri->x[k] : low[0];
+        high[0] = tri->x[k] > high[0] ? tri->x[k] : high[0];
+        low[1] = tri->y[k] < low[1] ? tri->y[k] : low[1];
+        high[1] = tri->y[k] > high[1] ? tri->y[k] : high[1];
+    }
+    if( high[0] < 0.0f || high[1] < 0.0f || low[0] >= occ->width
+     || low[1] >= occ->height ) {
+        return;
+    }
+    if( work->count == work->capacity ) {
+        work->capacity = work->capacity ? work->capacity * 2 : 1024;
+        work->triangles = (sstScreenTriangle*)realloc(work->triangles,
+            sizeof(sstScreenTriangle) * work->capacity);
+    }
+    work->triangles[work->count] = *tri;
+    x0 = low[0] < 0.0f ? 0 : (int)low[0] / TILE_W;
+    y0 = low[1] < 0.0f ? 0 : (int)low[1] / TILE_H;
+    x1 = high[0] >= occ->width ? work->tiles_x - 1 : (int)high[0] / TILE_W;
+    y1 = high[1] >= occ->height ? work->tiles_y - 1 : (int)high[1] / TILE_H;
+    for( ty = y0; ty <= y1; ty++ ) {
+        for( tx = x0; tx <= x1; tx++ ) {
+            tile = ty * work->tiles_x + tx;
+            if( work->bin_counts[tile] == work->bin_capacities[tile] ) {
+                work->bin_capacities[tile] = work->bin_capacities[tile]
+                                           ? work->bin_capacities[tile] * 2
+                                           : 64;
+                work->bins[tile] = (int*)realloc(work->bins[tile],
+                    sizeof(int) * work->bin_capacities[tile]);
+            }
+            work->bins[tile][work->bin_counts[tile]++] = work->count;
+        }
+    }
+    work->count++;
+    occ->triangles++;
+}
+
+/*
+ * Clips a triangle in clip space against the near plane, then projects what
+ * is left onto the screen and bins it, wound counter-clockwise.
+ */
+static void sstSetupTriangle( sstOcclusion *occ, GLfloat *a, GLfloat *b,
+GLfloat *c ) {
+    GLfloat in[3][4], out[4][4], *p, *q, t, area;
+    sstScreenTriangle tri;
+    int i, j, k, n, v[3];
+    memcpy(in[0], a, sizeof(GLfloat) * 4);
+    memcpy(in[1], b, sizeof(GLfloat) * 4);
+    memcpy(in[2], c, sizeof(GLfloat) * 4);
+    /* Step 1: Clip against z >= -w */
+    n = 0;
+    for( i = 0; i < 3; i++ ) {
+        p = in[i];
+        q = in[(i + 1) % 3];
+        if( p[2] >= -p[3] ) {
+            memcpy(out[n++], p, sizeof(GLfloat) * 4);
+        }
+        if( (p[2] >= -p[3]) != (q[2] >= -q[3]) ) {
+            t = (p[2] + p[3]) / ((p[2] + p[3]) - (q[2] + q[3]));
+            for( k = 0; k < 4; k++ ) {
+                out[n][k] = p[k] + (q[k] - p[k]) * t;
+            }
+            n++;
+        }
+    }
+    /* Step 2: Project and bin the fan of what's left */
+    for( i = 1; i + 1 < n; i++ ) {
+        v[0] = 0;
+        v[1] = i;
+        v[2] = i + 1;
+        for( j = 0; j < 3; j++ ) {
+            p = out[v[j]];
+            if( p[3] <= 0.0f ) {
+                return;
+            }
+            tri.x[j] = (p[0] / p[3] * 0.5f + 0.5f) * occ->width;
+            tri.y[j] = (p[1] / p[3] * 0.5f + 0.5f) * occ->height;
+            tri.z[j] = p[2] / p[3] * 0.5f + 0.5f;
+        }
+        /* Occluders are two sided, since walls are often single quads */
+        area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0])
+             - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+        if( area < 0.0f ) {
+            t = tri.x[1]; tri.x[1] = tri.x[2]; tri.x[2] = t;
+            t = tri.y[1]; tri.y[1] = tri.y[2]; tri.y[2] = t;
+            t = tri.z[1]; tri.z[1] = tri.z[2]; tri.z[2] = t;
+        }
+        if( area != 0.0f ) {
+            sstBinTriangle(occ, &tri);
+        }
+    }
+}
+
+/*
+ * Rasterizes a triangle into the part of the depth buffer inside a tile,
+ * keeping the nearest depth.
+ */
+static void sstRasterTriangle( sstOcclusion *occ, sstScreenTriangle *tri,
+int x0, int y0, int x1, int y1 ) {
+    GLfloat A[3], B[3], C[3], area, za, zb, zc, low, high, *row;
+    int k, a, b, x, y, minx, maxx, miny, maxy;
+    /* Step 1: Edge functions, positive inside, and the depth plane */
+    for( k = 0; k < 3; k++ ) {
+        a = (k + 1) % 3;
+        b = (k + 2) % 3;
+        A[k] = -(tri->y[b] - tri->y[a]);
+        B[k] = tri->x[b] - tri->x[a];
+        C[k] = -(A[k] * tri->x[a] + B[k] * tri->y[a]);
+    }
+    area = A[0] * tri->x[0] + B[0] * tri->y[0] + C[0];
+    if( area <= 0.0f ) {
+        return;
+    }
+    za = (A[0] * tri->z[0] + A[1] * tri->z[1] + A[2] * tri->z[2]) / area;
+    zb = (B[0] * tri->z[0] + B[1] * tri->z[1] + B[2] * tri->z[2]) / area;
+    zc = (C[0] * tri->z[0] + C[1] * tri->z[1] + C[2] * tri->z[2]) / area;
+    /* Step 2: Bounds, clamped to the tile */
+    low = high = tri->x[0];
+    for( k = 1; k < 3; k++ ) {
+        low = tri->x[k] < low ? tri->x[k] : low;
+        high = tri->x[k] > high ? tri->x[k] : high;
+    }
+    minx = low > x0 ? (int)low : x0;
+    maxx = high < x1 - 1 ? (int)high : x1 - 1;
+    low = high = tri->y[0];
+    for( k = 1; k < 3; k++ ) {
+        low = tri->y[k] < low ? tri->y[k] : low;
+        high = tri->y[k] > high ? tri->y[k] : high;
+    }
+    miny = low > y0 ? (int)low : y0;
+    maxy = high < y1 - 1 ? (int)high : y1 - 1;
+    minx &= ~3;
+    /* Step 3: Fill */
+    for( y = miny; y <= maxy; y++ ) {
+        row = &occ->depth[0][y * occ->width];
+#ifdef __SSE__
+        {
+            __m128 px, py, e0, e1, e2, z, d, mask, offsets;
+            offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            py = _mm_set1_ps(y + 0.5f);
+            for( x = minx; x <= maxx; x += 4 ) {
+                px = _mm_add_ps(_mm_set1_ps((GLfloat)x), offsets);
+                e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[0]), px),
+                                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(B[0]), py),
+                                           _mm_set1_ps(C[0])));
+                e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[1]), px),
+                                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(B[1]), py),
+                                           _mm_set1_ps(C[1])));
+                e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[2]), px),
+                                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(B[2]), py),
+                                           _mm_set1_ps(C[2])));
+                mask = _mm_and_ps(_mm_cmpge_ps(e0, _mm_setzero_ps()),
+                                  _mm_and_ps(_mm_cmpge_ps(e1, _mm_setzero_ps()),
+                                             _mm_cmpge_ps(e2,
+                                                          _mm_setzero_ps())));
+                if( _mm_movemask_ps(mask) == 0 ) {
+                    continue;
+                }
+                z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                               _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zb), py),
+                                          _mm_set1_ps(zc)));
+                d = _mm_loadu_ps(&row[x]);
+                d = _mm_or_ps(_mm_and_ps(mask, _mm_min_ps(d, z)),
+                              _mm_andnot_ps(mask, d));
+                _mm_storeu_ps(&row[x], d);
+            }
+        }
+#else
+        for( x = minx; x <= maxx; x++ ) {
+            GLfloat px, py, z;
+            px = x + 0.5f;
+            py = y + 0.5f;
+            if( A[0] * px + B[0] * py + C[0] < 0.0f
+             || A[1] * px + B[1] * py + C[1] < 0.0f
+             || A[2] * px + B[2] * py + C[2] < 0.0f ) {
+                continue;
+            }
+            z = za * px + zb * py + zc;
+            if( z < row[x] ) {
+                row[x] = z;
+            }
+        }
+#endif
+    }
+}
+
+/*
+ * Rasterizes the tiles belonging to one thread: every threads'th tile,
+ * starting from its index.
+ */
+static void * sstRasterThread( void *arg ) {
+    sstRasterJob *job;
+    struct sstOcclusionWork *work;
+    int tile, i, x0, y0;
+    job = (sstRasterJob*)arg;
+    work = job->occ->work;
+    for( tile = job->index; tile < work->tiles_x * work->tiles_y;
+         tile += job->occ->threads ) {
+        x0 = (tile % work->tiles_x) * TILE_W;
+        y0 = (tile / work->tiles_x) * TILE_H;
+        for( i = 0; i < work->bin_counts[tile]; i++ ) {
+            sstRasterTriangle(job->occ, &work->triangles[work->bins[tile][i]],
+                              x0, y0, x0 + TILE_W, y0 + TILE_H);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Body of each worker thread past the first. It sleeps until
+ * sstOcclusionRasterize() starts a new frame, rasterizes its tiles, then
+ * sleeps again until sstFreeOcclusion() tells it to quit.
+ */
+static void * sstRasterWorker( void *arg ) {
+    sstRasterJob *job;
+    struct sstOcclusionWork *work;
+    unsigned int frame;
+    job = (sstRasterJob*)arg;
+    work = job->occ->work;
+    /* Start from frame 0, in case a frame began before this thread did */
+    frame = 0;
+    pthread_mutex_lock(&work->lock);
+    for( ;; ) {
+        while( work->frame == frame && !work->quit ) {
+            pthread_cond_wait(&work->start, &work->lock);
+        }
+        if( work->quit ) {
+            break;
+        }
+        frame = work->frame;
+        pthread_mutex_unlock(&work->lock);
+        sstRasterThread(job);
+        pthread_mutex_lock(&work->lock);
+        if( --work->running == 0 ) {
+            pthread_cond_signal(&work->done);
+        }
+    }
+    pthread_mutex_unlock(&work->lock);
+    return NULL;
+}
+
+/*
+ * Fills in each level of the hierarchical-Z pyramid with the furthest depth
+ * of the 2x2 block under it in the level before.
+ */
+static void sstBuildHiZ( sstOcclusion *occ ) {
+    GLfloat *src, *dst, d;
+    int l, x, y, w, h, sw, sh, sx, sy, i, j;
+    sw = occ->width;
+    sh = occ->height;
+    for( l = 1; l < occ->levels; l++ ) {
+        src = occ->depth[l - 1];
+        dst = occ->depth[l];
+        w = (sw + 1) / 2;
+        h = (sh + 1) / 2;
+        for( y = 0; y < h; y++ ) {
+            for( x = 0; x < w; x++ ) {
+                d = 0.0f;
+                for( j = 0; j < 2; j++ ) {
+                    for( i = 0; i < 2; i++ ) {
+                        sx = x * 2 + i < sw ? x * 2 + i : sw - 1;
+                        sy = y * 2 + j < sh ? y * 2 + j : sh - 1;
+                        if( src[sy * sw + sx] > d ) {
+                            d = src[sy * sw + sx];
+                        }
+                    }
+                }
+                dst[y * w + x] = d;
+            }
+        }
+        sw = w;
+        sh = h;
+    }
+}
+
+/*
+ * Occluder functions
+ */
+
+/*
+ * Generates an occluder from the given positions (3 floats each) and indices
+ * of a triangle mesh. The data is copied.
+ */
+sstOccluder * sstNewOccluder( GLfloat *positions, int count, void *indices,
+GLenum i_type, int i_count ) {
+    sstOccluder *occluder;
+    int i;
+    occluder = (sstOccluder*)malloc(sizeof(sstOccluder));
+    occluder->count = count;
+    occluder->positions = (GLfloat*)malloc(sizeof(GLfloat) * 3 * count);
+    memcpy(occluder->positions, positions, sizeof(GLfloat) * 3 * count);
+    occluder->i_count = i_count - i_count % 3;
+    occluder->indices = (GLuint*)malloc(sizeof(GLuint) * occluder->i_count);
+    for( i = 0; i < occluder->i_count; i++ ) {
+        occluder->indices[i] = sstGetIndex(indices, i_type, i);
+    }
+    return occluder;
+}
+
+void sstFreeOccluder( sstOccluder *occluder ) {
+    free(occluder->positions);
+    free(occluder->indices);
+    free(occluder);
+}
+
+/*
+ * Occlusion functions
+ */
+
+/*
+ * Generates an occlusion culler with a depth buffer of the given size, which
+ * is rounded up to whole tiles, rasterizing with the given number of threads.
+ * The threads past the first are started here and wait for each frame.
+ */
+sstOcclusion * sstNewOcclusion( int width, int height, int threads ) {
+    sstOcclusion *occ;
+    struct sstOcclusionWork *work;
+    int i, l, w, h, tiles;
+    occ = (sstOcclusion*)malloc(sizeof(sstOcclusion));
+    occ->width = (width + TILE_W - 1) / TILE_W * TILE_W;
+    occ->height = (height + TILE_H - 1) / TILE_H * TILE_H;
+    occ->threads = threads > 0 ? threads : 1;
+    /* Step 1: Make the pyramid, down to a single pixel */
+    occ->levels = 1;
+    for( w = occ->width, h = occ->height; w > 1 || h > 1;
+         w = (w + 1) / 2, h = (h + 1) / 2 ) {
+        occ->levels++;
+    }
+    occ->depth = (GLfloat**)malloc(sizeof(GLfloat*) * occ->levels);
+    w = occ->width;
+    h = occ->height;
+    for( l = 0; l < occ->levels; l++ ) {
+        occ->depth[l] = (GLfloat*)malloc(sizeof(GLfloat) * w * h);
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    /* Step 2: Make the bins */
+    work = (struct sstOcclusionWork*)malloc(sizeof(struct sstOcclusionWork));
+    work->triangles = NULL;
+    work->count = work->capacity = 0;
+    work->tiles_x = occ->width / TILE_W;
+    work->tiles_y = occ->height / TILE_H;
+    tiles = work->tiles_x * work->tiles_y;
+    work->bins = (int**)calloc(tiles, sizeof(int*));
+    work->bin_counts = (int*)calloc(tiles, sizeof(int));
+    work->bin_capacities = (int*)calloc(tiles, sizeof(int));
+    occ->work = work;
+    /* Step 3: Start the workers. Job 0 is run by the calling thread. */
+    work->pool = (pthread_t*)malloc(sizeof(pthread_t) * occ->threads);
+    work->jobs = (sstRasterJob*)malloc(sizeof(sstRasterJob) * occ->threads);
+    pthread_mutex_init(&work->lock, NULL);
+    pthread_cond_init(&work->start, NULL);
+    pthread_cond_init(&work->done, NULL);
+    work->frame = work->running = work->quit = 0;
+    for( i = 0; i < occ->threads; i++ ) {
+        work->jobs[i].occ = occ;
+        work->jobs[i].index = i;
+    }
+    for( i = 1; i < occ->threads; i++ ) {
+        pthread_create(&work->pool[i], NULL, sstRasterWorker, &work->jobs[i]);
+    }
+    sstIdentityMatrix4x4_(occ->viewProj);
+    occ->tested = occ->occluded = occ->triangles = 0;
+    occ->raster_ms = occ->test_ms = 0.0;
+    return occ;
+}
+
+/*
+ * Starts a new frame of occlusion culling with the given projection times view
+ * matrix, clearing the depth buffer and the stats.
+ */
+void sstOcclusionBegin( sstOcclusion *occ, GLfloat *viewProj ) {
+    int i, tiles;
+    memcpy(occ->viewProj, viewProj, sizeof(GLfloat) * 16);
+    for( i = 0; i < occ->width * occ->height; i++ ) {
+        occ->depth[0][i] = 1.0f;
+    }
+    occ->work->count = 0;
+    tiles = occ->work->tiles_x * occ->work->tiles_y;
+    memset(occ->work->bin_counts, 0, sizeof(int) * tiles);
+    occ->tested = occ->occluded = occ->triangles = 0;
+    occ->raster_ms = occ->test_ms = 0.0;
+}
+
+/*
+ * Transforms an occluder drawn with the given model matrix onto the screen and
+ * bins its triangles, ready for sstOcclusionRasterize().
+ */
+void sstOcclusionAddOccluder( sstOcclusion *occ, sstOccluder *occluder,
+GLfloat *model ) {
+    GLfloat mvp[16], *clip;
+    double start;
+    int v, t;
+    start = sstSeconds();
+    sstMatMult4_(occ->viewProj, model, mvp);
+    clip = (GLfloat*)malloc(sizeof(GLfloat) * 4 * (occluder->count + 1));
+    for( v = 0; v < occluder->count; v++ ) {
+        sstToClip(mvp, &occluder->positions[v*3], &clip[v*4]);
+    }
+    for( t = 0; t < occluder->i_count; t += 3 ) {
+        sstSetupTriangle(occ, &clip[occluder->indices[t] * 4],
+                         &clip[occluder->indices[t + 1] * 4],
+                         &clip[occluder->indices[t + 2] * 4]);
+    }
+    free(clip);
+    occ->raster_ms += (sstSeconds() - start) * 1000.0;
+}
+
+/*
+ * Rasterizes every occluder added since sstOcclusionBegin(), then builds the
+ * hierarchical-Z pyramid tested against by sstOcclusionTestBox().
+ */
+void sstOcclusionRasterize( sstOcclusion *occ ) {
+    struct sstOcclusionWork *work;
+    double start;
+    start = sstSeconds();
+    work = occ->work;
+    /* Tiles don't overlap, so the threads need no locking while rasterizing */
+    pthread_mutex_lock(&work->lock);
+    work->running = occ->threads - 1;
+    work->frame++;
+    pthread_cond_broadcast(&work->start);
+    pthread_mutex_unlock(&work->lock);
+    sstRasterThread(&work->jobs[0]);
+    pthread_mutex_lock(&work->lock);
+    while( work->running > 0 ) {
+        pthread_cond_wait(&work->done, &work->lock);
+    }
+    pthread_mutex_unlock(&work->lock);
+    sstBuildHiZ(occ);
+    occ->raster_ms += (sstSeconds() - start) * 1000.0;
+}
+
+/*
+ * Tests a world space box against the hierarchical-Z levels, without timing
+ * it, so that lists of boxes can be timed as a whole.
+ */
+static int sstTestBox( sstOcclusion *occ, GLfloat *low, GLfloat *high ) {
+    GLfloat corner[3], clip[4], rect[4], nearest, *level, sx, sy;
+    int i, l, w, x, y, x0, x1, y0, y1, size, visible;
+    occ->tested++;
+    visible = 0;
+    /* Step 1: Find the screen rectangle and nearest depth of the box */
+    rect[0] = rect[1] = 1e30f;
+    rect[2] = rect[3] = -1e30f;
+    nearest = 1.0f;
+    for( i = 0; i < 8; i++ ) {
+        corner[0] = i & 1 ? high[0] : low[0];
+        corner[1] = i & 2 ? high[1] : low[1];
+        corner[2] = i & 4 ? high[2] : low[2];
+        sstToClip(occ->viewProj, corner, clip);
+        /* Crossing the near plane, so it could cover anything */
+        if( clip[2] < -clip[3] || clip[3] <= 0.0f ) {
+            return 1;
+        }
+        sx = (clip[0] / clip[3] * 0.5f + 0.5f) * occ->width;
+        sy = (clip[1] / clip[3] * 0.5f + 0.5f) * occ->height;
+        rect[0] = sx < rect[0] ? sx : rect[0];
+        rect[1] = sy < rect[1] ? sy : rect[1];
+        rect[2] = sx > rect[2] ? sx : rect[2];
+        rect[3] = sy > rect[3] ? sy : rect[3];
+        if( clip[2] / clip[3] * 0.5f + 0.5f < nearest ) {
+            nearest = clip[2] / clip[3] * 0.5f + 0.5f;
+        }
+    }
+    if( rect[2] < 0.0f || rect[3] < 0.0f || rect[0] >= occ->width
+     || rect[1] >= occ->height ) {
+        return 0;
+    }
+    x0 = rect[0] < 0.0f ? 0 : (int)rect[0];
+    y0 = rect[1] < 0.0f ? 0 : (int)rect[1];
+    x1 = rect[2] >= occ->width ? occ->width - 1 : (int)rect[2];
+    y1 = rect[3] >= occ->height ? occ->height - 1 : (int)rect[3];
+    /* Step 2: Pick the level where the rectangle covers a few texels */
+    size = (x1 - x0 > y1 - y0 ? x1 - x0 : y1 - y0) + 1;
+    w = occ->width;
+    for( l = 0; l + 1 < occ->levels && size > TEST_SIZE; l++ ) {
+        size = (size + 1) / 2;
+        w = (w + 1) / 2;
+    }
+    x0 >>= l;
+    y0 >>= l;
+    x1 >>= l;
+    y1 >>= l;
+    /* Step 3: Visible if any texel's furthest occluder is behind the box */
+    level = occ->depth[l];
+    for( y = y0; y <= y1 && !visible; y++ ) {
+        for( x = x0; x <= x1; x++ ) {
+            if( level[y * w + x] >= nearest ) {
+                visible = 1;
+                break;
+            }
+        }
+    }
+    if( !visible ) {
+        occ->occluded++;
+    }
+    return visible;
+}
+
+/*
+ * Returns 1 if any of the world space box from low to high might be visible
+ * past the occluders, or 0 if it is hidden behind them or off the screen.
+ */
+int sstOcclusionTestBox( sstOcclusion *occ, GLfloat *low, GLfloat *high ) {
+    double start;
+    int visible;
+    start = sstSeconds();
+    visible = sstTestBox(occ, low, high);
+    occ->test_ms += (sstSeconds() - start) * 1000.0;
+    return visible;
+}
+
+/*
+ * Returns 1 if the given set drawn with the given model matrix might be
+ * visible past the occluders.
+ */
+int sstOcclusionTest( sstOcclusion *occ, sstDrawableSet *set,
+GLfloat *model ) {
+    GLfloat low[3], high[3], c[3], e[3];
+    int i, j;
+    /* Fit a world space box around the transformed box of the set */
+    for( i = 0; i < 3; i++ ) {
+        c[i] = model[12 + i];
+        e[i] = 0.0f;
+        for( j = 0; j < 3; j++ ) {
+            c[i] += model[j*4 + i] * set->center[j];
+            e[i] += fabsf(model[j*4 + i])
+                  * (set->high[j] - set->low[j]) * 0.5f;
+        }
+        low[i] = c[i] - e[i];
+        high[i] = c[i] + e[i];
+    }
+    return sstOcclusionTestBox(occ, low, high);
+}
+
+/*
+ * Tests count entries of a cull list, given by their indices in visible, and
+ * removes the hidden ones. Returns the number left.
+ */
+int sstOcclusionCull( sstOcclusion *occ, sstCullList *list, int *visible,
+int count ) {
+    GLfloat low[3], high[3];
+    double start;
+    int i, e, n;
+    start = sstSeconds();
+    n = 0;
+    for( i = 0; i < count; i++ ) {
+        e = visible[i];
+        low[0] = list->cx[e] - list->ex[e];
+        low[1] = list->cy[e] - list->ey[e];
+        low[2] = list->cz[e] - list->ez[e];
+        high[0] = list->cx[e] + list->ex[e];
+        high[1] = list->cy[e] + list->ey[e];
+        high[2] = list->cz[e] + list->ez[e];
+        if( sstTestBox(occ, low, high) ) {
+            visible[n++] = e;
+        }
+    }
+    occ->test_ms += (sstSeconds() - start) * 1000.0;
+    return n;
+}
+
+/*
+ * Frees the given occlusion culler. Occluders added to it are not freed.
+ */
+void sstFreeOcclusion( sstOcclusion *occ ) {
+    int i;
+    pthread_mutex_lock(&occ->work->lock);
+    occ->work->quit = 1;
+    pthread_cond_broadcast(&occ->work->start);
+    pthread_mutex_unlock(&occ->work->lock);
+    for( i = 1; i < occ->threads; i++ ) {
+        pthread_join(occ->work->pool[i], NULL);
+    }
+    pthread_mutex_destroy(&occ->work->lock);
+    pthread_cond_destroy(&occ->work->start);
+    pthread_cond_destroy(&occ->work->done);
+    free(occ->work->pool);
+    free(occ->work->jobs);
+    for( i = 0; i < occ->work->tiles_x * occ->work->tiles_y; i++ ) {
+        free(occ->work->bins[i]);
+    }
+    free(occ->work->bins);
+    free(occ->work->bin_counts);
+    free(occ->work->bin_capacities);
+    free(occ->work->triangles);
+    free(occ->work);
+    for( i = 0; i < occ->levels; i++ ) {
+        free(occ->depth[i]);
+    }
+    free(occ->depth);
+    free(occ);
+}
@@ -0,0 +1,1035 @@
+/*
+ * sst_pack.c
+ * By Steven Smith
+ *
+ * This file contains asset packs: single files holding programs, with their
+ * shader sources, reflection tables and optionally a program binary, and
+ * drawable sets, with their buffers stored exactly as they were on the GPU.
+ * A pack is written from live objects, then mapped into memory when opened so
+ * that programs and sets are made straight from pointers into the mapping,
+ * without parsing shader sources or copying buffers on the heap first.
+ *
+ * Layout of a pack, all in the byte order of the machine that wrote it:
+ *   header          sstPackHeader
+ *   blobs           Sources, names and buffers, buffers aligned to PACK_ALIGN
+ *   records         A program or set record per entry, followed by its arrays
+ *   contents        sstPackEntry per entry, sorted by name
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sst.h"
+#include "sst_private.h"
+
+#define PACK_MAGIC "SSTPACK"
+#define PACK_VERSION 1
+/* Buffers start on the largest offset alignment GL implementations ask for */
+#define PACK_ALIGN 256
+
+typedef struct {
+    char magic[8];
+    GLuint version;
+    GLuint count; /* Number of entries */
+    GLuint64 contents; /* Offset of the table of contents */
+} sstPackHeader;
+
+typedef struct {
+    GLuint shader_count;
+    GLuint in_count;
+    GLuint un_count;
+    GLenum binary_format; /* 0 if there is no program binary */
+    GLuint64 binary; /* Offset and size of the program binary */
+    GLuint64 binary_size;
+    /* Followed by shader_count sstShaderRecord, in_count sstInputRecord and
+     * un_count sstUniformRecord */
+} sstProgramRecord;
+
+typedef struct {
+    GLenum type;
+    GLuint length; /* Of the source, which is followed by a NUL */
+    GLuint64 source;
+} sstShaderRecord;
+
+typedef struct {
+    GLuint64 name;
+    GLint location;
+    GLenum type;
+    GLuint size;
+    GLuint components;
+    GLuint slots;
+    GLuint divisor;
+} sstInputRecord;
+
+typedef struct {
+    GLuint64 name;
+    GLenum type;
+    GLuint first;
+    GLuint second;
+    GLuint count;
+    GLuint transpose;
+    GLuint instanceable;
+} sstUniformRecord;
+
+typedef struct {
+    GLenum mode;
+    GLint count;
+    GLint size; /* Number of drawables */
+    GLint i_size;
+    GLenum i_type;
+    GLint lod_count;
+    GLfloat scale[3];
+    GLfloat offset[3];
+    GLfloat low[3];
+    GLfloat high[3];
+    GLfloat center[3];
+    GLfloat radius;
+    GLuint64 indices; /* Offset and size of the index buffer, 0 if none */
+    GLuint64 i_bytes;
+    /* Followed by lod_count sstLOD, padded to 8 bytes, then size
+     * sstDrawableRecord */
+} sstSetRecord;
+
+typedef struct {
+    GLuint64 name; /* Of the input the drawable feeds */
+    GLuint64 data; /* Offset and size of the buffer */
+    GLuint64 bytes;
+    GLuint components;
+    GLuint size;
+    GLuint slots;
+    GLuint divisor;
+    GLenum type;
+    GLuint normalized;
+    GLuint transpose;
+    GLuint reserved;
+} sstDrawableRecord;
+
+struct sstPackWriter {
+    FILE *file;
+    GLuint64 offset; /* Bytes written so far */
+    sstPackEntry *entries;
+    int count;
+    int capacity;
+};
+
+/*
+ * Helper functions
+ */
+
+static size_t sstLODBytes( int lod_count ) {
+    return (sizeof(sstLOD) * lod_count + 7) & ~(size_t)7;
+}
+
+static sstDrawableRecord * sstSetDrawables( const sstSetRecord *record ) {
+    return (sstDrawableRecord*)((char*)(record + 1)
+                                + sstLODBytes(record->lod_count));
+}
+
+/*
+ * Returns a pointer to size bytes at offset in the pack, or NULL if they
+ * aren't all inside it.
+ */
+static const char * sstPackRange( sstPack *pack, GLuint64 offset,
+GLuint64 size ) {
+    if( offset > pack->size || size > pack->size - offset ) {
+        return NULL;
+    }
+    return pack->data + offset;
+}
+
+/*
+ * Returns the NUL terminated string at offset in the pack, or NULL if it
+ * runs past the end.
+ */
+static const char * sstPackString( sstPack *pack, GLuint64 offset ) {
+    const char *s;
+    if( !(s = sstPackRange(pack, offset, 1)) ) {
+        return NULL;
+    }
+    return memchr(s, '\0', pack->size - offset) ? s : NULL;
+}
+
+static int sstCompareEntries( const void *a, const void *b ) {
+    return strcmp(((const sstPackEntry*)a)->name,
+                  ((const sstPackEntry*)b)->name);
+}
+
+/*
+ * Returns the record of the entry with the given name and kind, or NULL.
+ */
+static const char * sstFindRecord( sstPack *pack, const char *name,
+GLuint kind ) {
+    sstPackEntry key;
+    const sstPackEntry *entry;
+    memset(&key, 0, sizeof(key));
+    strncpy(key.name, name, sizeof(key.name) - 1);
+    entry = (const sstPackEntry*)bsearch(&key, pack->entries, pack->count,
+                                         sizeof(sstPackEntry),
+                                         sstCompareEntries);
+    if( !entry || entry->kind != kind ) {
+        printf("ERROR: Pack has no %s named %s\n",
+               kind == SST_PACK_PROGRAM ? "program" : "set", name);
+        return NULL;
+    }
+    return sstPackRange(pack, entry->offset, entry->size);
+}
+
+/*
+ * Writes size bytes at the next multiple of align, padding with zeros.
+ * Returns the offset they were written at.
+ */
+static GLuint64 sstPackWrite( sstPackWriter *writer, const void *data,
+size_t size, size_t align ) {
+    static const char zeros[PACK_ALIGN];
+    size_t pad;
+    pad = (align - writer->offset % align) % align;
+    fwrite(zeros, 1, pad, writer->file);
+    writer->offset += pad;
+    fwrite(data, 1, size, writer->file);
+    writer->offset += size;
+    return writer->offset - size;
+}
+
+static GLuint64 sstPackWriteString( sstPackWriter *writer, const char *s ) {
+    return sstPackWrite(writer, s, strlen(s) + 1, 1);
+}
+
+static void sstAddEntry( sstPackWriter *writer, const char *name,
+GLuint kind, GLuint64 offset, GLuint64 size ) {
+    sstPackEntry *entry;
+    if( writer->count == writer->capacity ) {
+        writer->capacity = writer->capacity * 2 + 16;
+        writer->entries = (sstPackEntry*)realloc(writer->entries,
+                                                 sizeof(sstPackEntry)
+                                                 * writer->capacity);
+    }
+    entry = &writer->entries[writer->count++];
+    memset(entry, 0, sizeof(sstPackEntry));
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    entry->kind = kind;
+    entry->offset = offset;
+    entry->size = size;
+}
+
+/*
+ * Reads a whole file into a newly allocated, NUL terminated string.
+ */
+static char * sstReadFile( const char *path, size_t *length ) {
+    FILE *fp;
+    char *text;
+    long size;
+    fp = fopen(path, "rb");
+    if( !fp ) {
+        printf("ERROR: Could not open %s\n", path);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = (char*)malloc(size + 1);
+    *length = fread(text, 1, size, fp);
+    text[*length] = '\0';
+    fclose(fp);
+    return text;
+}
+
+/*
+ * Writing packs
+ */
+
+/*
+ * Starts writing a pack to the given path.
+ */
+sstPackWriter * sstNewPackWriter( const char *path ) {
+    sstPackWriter *writer;
+    sstPackHeader header;
+    FILE *file;
+    file = fopen(path, "wb");
+    if( !file ) {
+        printf("ERROR: Could not create %s\n", path);
+        return NULL;
+    }
+    writer = (sstPackWriter*)malloc(sizeof(sstPackWriter));
+    writer->file = file;
+    writer->offset = 0;
+    writer->entries = NULL;
+    writer->count = 0;
+    writer->capacity = 0;
+    /* Filled in when the writer is closed */
+    memset(&header, 0, sizeof(header));
+    sstPackWrite(writer, &header, sizeof(header), 1);
+    return writer;
+}
+
+/*
+ * Builds the program from the given shader files, then writes their sources,
+ * its reflection tables and, where GL can hand one out, its binary.
+ */
+int sstPackWriteProgram( sstPackWriter *writer, const char *name,
+const char **files, int count ) {
+    sstProgram *program;
+    sstProgramRecord *record;
+    sstShaderRecord *shaders;
+    sstInputRecord *inputs;
+    sstUniformRecord *uniforms;
+    size_t bytes, length;
+    char *text;
+    int i;
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    GLint binary_size;
+    GLenum format;
+    void *binary;
+#endif
+    /* Step 1: Build the program, for its reflection tables */
+    program = sstNewProgram(files, count);
+    if( !program ) {
+        return 0;
+    }
+    bytes = sizeof(sstProgramRecord) + sizeof(sstShaderRecord) * count
+          + sizeof(sstInputRecord) * program->in_count
+          + sizeof(sstUniformRecord) * program->un_count;
+    record = (sstProgramRecord*)calloc(1, bytes);
+    shaders = (sstShaderRecord*)(record + 1);
+    inputs = (sstInputRecord*)(shaders + count);
+    uniforms = (sstUniformRecord*)(inputs + program->in_count);
+    record->shader_count = count;
+    record->in_count = program->in_count;
+    record->un_count = program->un_count;
+    /* Step 2: Write the sources */
+    for( i = 0; i < count; i++ ) {
+        if( !(text = sstReadFile(files[i], &length)) ) {
+            free(record);
+            sstFreeProgram(program);
+            return 0;
+        }
+        shaders[i].type = sstGetShaderTypeFromFilepath(files[i]);
+        shaders[i].length = (GLuint)length;
+        shaders[i].source = sstPackWrite(writer, text, length + 1, 1);
+        free(text);
+    }
+    /* Step 3: Write the reflection tables */
+    for( i = 0; i < program->in_count; i++ ) {
+        inputs[i].name = sstPackWriteString(writer, program->inputs[i].name);
+        inputs[i].location = program->inputs[i].location;
+        inputs[i].type = program->inputs[i].type;
+        inputs[i].size = program->inputs[i].size;
+        inputs[i].components = program->inputs[i].components;
+        inputs[i].slots = program->inputs[i].slots;
+        inputs[i].divisor = program->inputs[i].divisor;
+    }
+    for( i = 0; i < program->un_count; i++ ) {
+        uniforms[i].name = sstPackWriteString(writer,
+                                              program->uniforms[i].name);
+        uniforms[i].type = program->uniforms[i].type;
+        uniforms[i].first = program->uniforms[i].first;
+        uniforms[i].second = program->uniforms[i].second;
+        uniforms[i].count = program->uniforms[i].count;
+        uniforms[i].transpose = program->uniforms[i].transpose;
+        uniforms[i].instanceable = program->uniforms[i].instanceable;
+    }
+    /* Step 4: Write the binary, which only the same driver can load */
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    binary_size = 0;
+    glGetProgramiv(program->program, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if( binary_size > 0 ) {
+        binary = malloc(binary_size);
+        glGetProgramBinary(program->program, binary_size, &binary_size,
+                           &format, binary);
+        record->binary_format = format;
+        record->binary = sstPackWrite(writer, binary, binary_size, 8);
+        record->binary_size = binary_size;
+        free(binary);
+    }
+#endif
+    sstAddEntry(writer, name, SST_PACK_PROGRAM,
+                sstPackWrite(writer, record, bytes, 8), bytes);
+    free(record);
+    sstFreeProgram(program);
+    return 1;
+}
+
+/*
+ * Reads a buffer back from GL into a newly allocated array.
+ */
+static void * sstReadBuffer( GLuint buffer, GLint *size ) {
+    void *data;
+    sstBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, size);
+    data = malloc(*size);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, *size, data);
+    return data;
+}
+
+/*
+ * Reads a buffer back from GL and writes it. Returns its offset, and its size
+ * through bytes.
+ */
+static GLuint64 sstPackWriteBuffer( sstPackWriter *writer, GLuint buffer,
+GLuint64 *bytes ) {
+    GLint size;
+    GLuint64 offset;
+    void *data;
+    data = sstReadBuffer(buffer, &size);
+    offset = sstPackWrite(writer, data, size, PACK_ALIGN);
+    free(data);
+    *bytes = size;
+    return offset;
+}
+
+/*
+ * Makes a record describing the given set, with room for lod_count levels of
+ * detail, and writes the names of the inputs its drawables feed. The caller
+ * fills in the buffers. Returns NULL if the set wasn't made with the program.
+ */
+static sstSetRecord * sstNewSetRecord( sstPackWriter *writer,
+sstProgram *program, sstDrawableSet *set, int lod_count, size_t *bytes ) {
+    sstSetRecord *record;
+    sstDrawableRecord *drawables;
+    sstDrawable *d;
+    in_var *input;
+    int i;
+    *bytes = sizeof(sstSetRecord) + sstLODBytes(lod_count)
+           + sizeof(sstDrawableRecord) * set->size;
+    record = (sstSetRecord*)calloc(1, *bytes);
+    record->mode = set->mode;
+    record->count = set->count;
+    record->size = set->size;
+    record->i_size = set->i_size;
+    record->i_type = set->i_type;
+    record->lod_count = lod_count;
+    memcpy(record->scale, set->scale, sizeof(set->scale));
+    memcpy(record->offset, set->offset, sizeof(set->offset));
+    memcpy(record->low, set->low, sizeof(set->low));
+    memcpy(record->high, set->high, sizeof(set->high));
+    memcpy(record->center, set->center, sizeof(set->center));
+    record->radius = set->radius;
+    drawables = sstSetDrawables(record);
+    for( i = 0; i < set->size; i++ ) {
+        d = &set->drawables[i];
+        for( input = program->inputs;
+             input < program->inputs + program->in_count
+             && input->location != d->location; input++ );
+        if( input == program->inputs + program->in_count ) {
+            printf("ERROR: Set wasn't made with the given program\n");
+            free(record);
+            return NULL;
+        }
+        drawables[i].name = sstPackWriteString(writer, input->name);
+        drawables[i].components = d->components;
+        drawables[i].size = d->size;
+        drawables[i].slots = d->slots;
+        drawables[i].divisor = d->divisor;
+        drawables[i].type = d->type;
+        drawables[i].normalized = d->normalized;
+        drawables[i].transpose = d->transpose;
+    }
+    return record;
+}
+
+/*
+ * Writes a set made with the given program, reading its buffers back from
+ * GL, levels of detail included.
+ */
+int sstPackWriteSet( sstPackWriter *writer, const char *name,
+sstProgram *program, sstDrawableSet *set ) {
+    sstSetRecord *record;
+    sstDrawableRecord *drawables;
+    size_t bytes;
+    int i;
+    record = sstNewSetRecord(writer, program, set, set->lod_count, &bytes);
+    if( !record ) {
+        return 0;
+    }
+    if( set->lod_count ) {
+        memcpy(record + 1, set->lods, sizeof(sstLOD) * set->lod_count);
+    }
+    /* Step 1: Write the buffers */
+    if( set->i_buffer ) {
+        record->indices = sstPackWriteBuffer(writer, set->i_buffer,
+                                             &record->i_bytes);
+    }
+    drawables = sstSetDrawables(record);
+    for( i = 0; i < set->size; i++ ) {
+        drawables[i].data = sstPackWriteBuffer(writer,
+                                               set->drawables[i].buffer,
+                                               &drawables[i].bytes);
+    }
+    sstBindBuffer(GL_COPY_READ_BUFFER, 0);
+    /* Step 2: Write the record */
+    sstAddEntry(writer, name, SST_PACK_SET,
+                sstPackWrite(writer, record, bytes, 8), bytes);
+    free(record);
+    return 1;
+}
+
+/*
+ * Writes the coarsest level of detail of a set as a set of its own, keeping
+ * only the vertices it uses.
+ */
+int sstPackWriteProxy( sstPackWriter *writer, const char *name,
+sstProgram *program, sstDrawableSet *set ) {
+    sstSetRecord *record;
+    sstDrawableRecord *drawables;
+    sstLOD *lod;
+    GLint *remap;
+    GLint size;
+    GLuint v;
+    GLsizei stride;
+    char *indices, *compact, *data, *gathered;
+    size_t bytes, i_bytes;
+    int i, used;
+    if( set->lod_count == 0 ) {
+        printf("ERROR: Set has no levels of detail to make a proxy from\n");
+        return 0;
+    }
+    record = sstNewSetRecord(writer, program, set, 0, &bytes);
+    if( !record ) {
+        return 0;
+    }
+    lod = &set->lods[set->lod_count - 1];
+    /* Step 1: Number the vertices of the coarsest level in the order they are
+     * first used */
+    indices = (char*)sstReadBuffer(set->i_buffer, &size);
+    remap = (GLint*)malloc(sizeof(GLint) * set->count);
+    memset(remap, 0xff, sizeof(GLint) * set->count);
+    i_bytes = (sstSizeFromEnum(set->i_type) * lod->size + 3) & ~(size_t)3;
+    compact = (char*)calloc(1, i_bytes);
+    used = 0;
+    for( i = 0; i < lod->size; i++ ) {
+        v = sstGetIndex(indices, set->i_type, lod->first + i);
+        if( remap[v] < 0 ) {
+            remap[v] = used++;
+        }
+        sstPutIndex(compact, set->i_type, i, remap[v]);
+    }
+    record->count = used;
+    record->i_size = lod->size;
+    record->indices = sstPackWrite(writer, compact, i_bytes, PACK_ALIGN);
+    record->i_bytes = i_bytes;
+    free(indices);
+    free(compact);
+    /* Step 2: Gather those vertices from each buffer */
+    drawables = sstSetDrawables(record);
+    for( i = 0; i < set->size; i++ ) {
+        data = (char*)sstReadBuffer(set->drawables[i].buffer, &size);
+        stride = sstVertexSize(&set->drawables[i]);
+        bytes = ((size_t)stride * used + 3) & ~(size_t)3;
+        gathered = (char*)calloc(1, bytes);
+        for( v = 0; v < (GLuint)set->count; v++ ) {
+            if( remap[v] >= 0 ) {
+                memcpy(gathered + (size_t)remap[v] * stride,
+                       data + (size_t)v * stride, stride);
+            }
+        }
+        drawables[i].data = sstPackWrite(writer, gathered, bytes, PACK_ALIGN);
+        drawables[i].bytes = bytes;
+        free(data);
+        free(gathered);
+    }
+    sstBindBuffer(GL_COPY_READ_BUFFER, 0);
+    free(remap);
+    /* Step 3: Write the record */
+    bytes = (char*)(drawables + set->size) - (char*)record;
+    sstAddEntry(writer, name, SST_PACK_SET,
+                sstPackWrite(writer, record, bytes, 8), bytes);
+    free(record);
+    return 1;
+}
+
+/*
+ * Writes the table of contents and the header, then closes the file.
+ * Returns 1 on success.
+ */
+int sstClosePackWriter( sstPackWriter *writer ) {
+    sstPackHeader header;
+    int i, ok;
+    /* Step 1: Sort the contents so they can be searched */
+    qsort(writer->entries, writer->count, sizeof(sstPackEntry),
+          sstCompareEntries);
+    for( i = 1; i < writer->count; i++ ) {
+        if( strcmp(writer->entries[i - 1].name, writer->entries[i].name)
+            == 0 ) {
+            printf("WARN: Pack has two entries named %s\n",
+                   writer->entries[i].name);
+        }
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.version = PACK_VERSION;
+    header.count = writer->count;
+    header.contents = sstPackWrite(writer, writer->entries,
+                                   sizeof(sstPackEntry) * writer->count, 8);
+    /* Step 2: Go back for the header */
+    fseek(writer->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, writer->file);
+    ok = !ferror(writer->file);
+    ok = fclose(writer->file) == 0 && ok;
+    if( !ok ) {
+        printf("ERROR: Could not write pack\n");
+    }
+    free(writer->entries);
+    free(writer);
+    return ok;
+}
+
+/*
+ * Reading packs
+ */
+
+/*
+ * Maps the pack at the given path into memory.
+ */
+sstPack * sstOpenPack( const char *path ) {
+    const sstPackHeader *header;
+    struct stat info;
+    sstPack *pack;
+    void *data;
+    int fd;
+    /* Step 1: Map the file */
+    if( (fd = open(path, O_RDONLY)) < 0 ) {
+        printf("ERROR: Could not open %s\n", path);
+        return NULL;
+    }
+    if( fstat(fd, &info) != 0
+        || (size_t)info.st_size < sizeof(sstPackHeader) ) {
+        printf("ERROR: %s is not a pack\n", path);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( data == MAP_FAILED ) {
+        printf("ERROR: Could not map %s\n", path);
+        return NULL;
+    }
+    pack = (sstPack*)malloc(sizeof(sstPack));
+    pack->data = (const char*)data;
+    pack->size = info.st_size;
+    /* Step 2: Check the header and find the contents */
+    header = (const sstPackHeader*)data;
+    pack->count = header->count;
+    pack->entries = (const sstPackEntry*)sstPackRange(
+        pack, header->contents, sizeof(sstPackEntry) * (GLuint64)header->count);
+    if( memcmp(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0
+        || header->version != PACK_VERSION || !pack->entries ) {
+        printf("ERROR: %s is not a version %d pack\n", path, PACK_VERSION);
+        sstClosePack(pack);
+        return NULL;
+    }
+    return pack;
+}
+
+/*
+ * Compiles and links a program from the sources in its record, binding the
+ * inputs to the locations they had when it was written. Returns the program,
+ * or 0 on failure.
+ */
+static GLuint sstLinkPackSources( sstPack *pack,
+const sstProgramRecord *record, sstProgram *p ) {
+    const sstShaderRecord *shaders;
+    const sstInputRecord *inputs;
+    const char *source;
+    GLuint program;
+    GLuint i;
+    shaders = (const sstShaderRecord*)(record + 1);
+    inputs = (const sstInputRecord*)(shaders + record->shader_count);
+    program = glCreateProgram();
+    for( i = 0; i < record->shader_count; i++ ) {
+        source = sstPackRange(pack, shaders[i].source,
+                              (GLuint64)shaders[i].length + 1);
+        if( !source || source[shaders[i].length] != '\0'
+            || !(p->shaders[i] = sstCompileShader(shaders[i].type, &source,
+                                                  1)) ) {
+            glDeleteProgram(program);
+            return 0;
+        }
+        glAttachShader(program, p->shaders[i]);
+    }
+    for( i = 0; i < record->in_count; i++ ) {
+        if( inputs[i].location >= 0 ) {
+            glBindAttribLocation(program, inputs[i].location,
+                                 p->inputs[i].name);
+        }
+    }
+    if( !sstLinkProgram(program) ) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/*
+ * Creates the program with the given name from the pack. The shader sources
+ * aren't parsed, as the pack holds the variables they declare. The program's
+ * binary is loaded if the pack has one that the driver takes, else the
+ * sources are compiled straight from the mapping. Input and uniform names
+ * point into the pack, so it must stay open while the program is in use.
+ */
+sstProgram * sstPackProgram( sstPack *pack, const char *name ) {
+    const sstProgramRecord *record;
+    const sstShaderRecord *shaders;
+    const sstInputRecord *inputs;
+    const sstUniformRecord *uniforms;
+    const char *source;
+    sstProgram *result;
+    in_var *in;
+    uniform *un;
+    GLuint i;
+    GLboolean loaded;
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    const char *binary;
+    GLint status;
+#endif
+    /* Step 1: Find the record and check that its arrays are in the pack */
+    record = (const sstProgramRecord*)sstFindRecord(pack, name,
+                                                    SST_PACK_PROGRAM);
+    if( !record ) {
+        return NULL;
+    }
+    shaders = (const sstShaderRecord*)(record + 1);
+    inputs = (const sstInputRecord*)(shaders + record->shader_count);
+    uniforms = (const sstUniformRecord*)(inputs + record->in_count);
+    if( !sstPackRange(pack, (const char*)record - pack->data,
+                      (const char*)(uniforms + record->un_count)
+                      - (const char*)record) ) {
+        printf("ERROR: Program %s runs past the end of the pack\n", name);
+        return NULL;
+    }
+    /* Step 2: Fill in the variables from the reflection tables */
+    result = (sstProgram*)malloc(sizeof(sstProgram));
+    result->program = 0;
+    result->variant = NULL;
+    result->mesh_passes = 0;
+    result->weld_epsilon = 0.0f;
+    result->lod_levels = 4;
+    result->lod_ratio = 0.5f;
+    result->build_bvh = GL_FALSE;
+    result->pulling = NULL;
+    result->shader_count = record->shader_count;
+    result->shaders = (GLuint*)calloc(record->shader_count, sizeof(GLuint));
+    result->sources = (char**)calloc(record->shader_count, sizeof(char*));
+    result->in_count = record->in_count;
+    result->inst_count = 0;
+    result->inputs = (in_var*)malloc(sizeof(in_var) * (record->in_count + 1));
+    for( i = 0, in = result->inputs; i < record->in_count; i++, in++ ) {
+        in->name = (char*)sstPackString(pack, inputs[i].name);
+        in->location = inputs[i].location;
+        in->type = inputs[i].type;
+        in->size = inputs[i].size;
+        in->components = inputs[i].components;
+        in->data_components = inputs[i].components;
+        in->slots = inputs[i].slots;
+        in->divisor = inputs[i].divisor;
+        in->compress = SST_UNCOMPRESSED;
+        in->max_error = 0.0f;
+        if( in->divisor ) {
+            result->inst_count++;
+        }
+    }
+    result->un_count = record->un_count;
+    result->uniforms = (uniform*)malloc(sizeof(uniform)
+                                        * (record->un_count + 1));
+    for( i = 0, un = result->uniforms; i < record->un_count; i++, un++ ) {
+        un->name = (char*)sstPackString(pack, uniforms[i].name);
+        un->type = uniforms[i].type;
+        un->first = uniforms[i].first;
+        un->second = uniforms[i].second;
+        un->count = uniforms[i].count;
+        un->transpose = (GLboolean)uniforms[i].transpose;
+        un->instanceable = (GLboolean)uniforms[i].instanceable;
+        un->value = NULL;
+        un->replayed = 0;
+    }
+    /* Vertex sources are kept for building variants of the program */
+    for( i = 0; i < record->shader_count; i++ ) {
+        source = sstPackRange(pack, shaders[i].source,
+                              (GLuint64)shaders[i].length + 1);
+        if( source && shaders[i].type == GL_VERTEX_SHADER ) {
+            result->sources[i] = (char*)malloc(shaders[i].length + 1);
+            memcpy(result->sources[i], source, shaders[i].length + 1);
+        }
+    }
+    for( i = 0; i < record->in_count + record->un_count; i++ ) {
+        if( i < record->in_count ? !result->inputs[i].name
+            : !result->uniforms[i - record->in_count].name ) {
+            printf("ERROR: Program %s has a bad variable name\n", name);
+            sstFreeProgram(result);
+            return NULL;
+        }
+    }
+    /* Step 3: Load the binary, or compile the sources if there is none or the
+     * driver turns it down */
+    loaded = GL_FALSE;
+#ifdef GL_PROGRAM_BINARY_LENGTH
+    if( record->binary_format
+        && (binary = sstPackRange(pack, record->binary,
+                                  record->binary_size)) ) {
+        result->program = glCreateProgram();
+        glProgramBinary(result->program, record->binary_format, binary,
+                        (GLsizei)record->binary_size);
+        glGetProgramiv(result->program, GL_LINK_STATUS, &status);
+        loaded = status == GL_TRUE;
+        if( !loaded ) {
+            glDeleteProgram(result->program);
+            result->program = 0;
+        }
+    }
+#endif
+    if( !loaded ) {
+        result->program = sstLinkPackSources(pack, record, result);
+        if( !result->program ) {
+            printf("ERROR: Could not build program %s\n", name);
+            sstFreeProgram(result);
+            return NULL;
+        }
+    }
+    /* Step 4: Uniform locations are the driver's to choose */
+    for( un = result->uniforms; un < result->uniforms + result->un_count; un++ )
+    {
+        un->location = glGetUniformLocation(result->program, un->name);
+        un->value = calloc(1, sstUniformSize(un));
+    }
+    return result;
+}
+
+/*
+ * Returns the record of the set with the given name, once everything it
+ * points to has been checked to be inside the pack, or NULL.
+ */
+static const sstSetRecord * sstFindSet( sstPack *pack, const char *name ) {
+    const sstSetRecord *record;
+    const sstDrawableRecord *drawables;
+    int i;
+    record = (const sstSetRecord*)sstFindRecord(pack, name, SST_PACK_SET);
+    if( !record ) {
+        return NULL;
+    }
+    drawables = sstSetDrawables(record);
+    if( record->lod_count < 0 || record->size < 0
+        || !sstPackRange(pack, (const char*)record - pack->data,
+                         (const char*)(drawables + record->size)
+                         - (const char*)record)
+        || !sstPackRange(pack, record->indices, record->i_bytes) ) {
+        printf("ERROR: Set %s runs past the end of the pack\n", name);
+        return NULL;
+    }
+    for( i = 0; i < record->size; i++ ) {
+        if( !sstPackRange(pack, drawables[i].data, drawables[i].bytes) ) {
+            printf("ERROR: Set %s runs past the end of the pack\n", name);
+            return NULL;
+        }
+    }
+    return record;
+}
+
+/*
+ * Where the buffers of a set created from a pack are uploaded from.
+ */
+typedef struct {
+    sstDrawableSet *set;
+    const char *indices; /* NULL if the set isn't indexed */
+    GLsizeiptr i_bytes;
+    const char **data; /* For each drawable */
+    GLsizeiptr *bytes;
+    int copied; /* Non-zero if the data is a copy to be freed */
+} sstPackUpload;
+
+/*
+ * Makes the vertex array and buffers of a set created from a pack, then frees
+ * the upload. Called through sstRenderCall(), so that it happens on the render
+ * thread when that is running.
+ */
+static void sstUploadPackSet( void *arg ) {
+    sstPackUpload *upload;
+    sstDrawableSet *set;
+    sstDrawable *d;
+    int i;
+    upload = (sstPackUpload*)arg;
+    set = upload->set;
+    glGenVertexArrays(1, &set->vao);
+    sstBindVertexArray(set->vao);
+    set->i_buffer = 0;
+    if( upload->indices ) {
+        glGenBuffers(1, &set->i_buffer);
+        sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, set->i_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, upload->i_bytes,
+                     upload->indices, GL_STATIC_DRAW);
+    }
+    for( i = 0; i < set->size; i++ ) {
+        d = &set->drawables[i];
+        glGenBuffers(1, &d->buffer);
+        sstBindBuffer(GL_ARRAY_BUFFER, d->buffer);
+        glBufferData(GL_ARRAY_BUFFER, upload->bytes[i], upload->data[i],
+                     GL_STATIC_DRAW);
+        sstAttribPointers(d);
+    }
+    if( upload->copied ) {
+        free((char*)upload->indices);
+        for( i = 0; i < set->size; i++ ) {
+            free((char*)upload->data[i]);
+        }
+    }
+    free(upload->data);
+    free(upload->bytes);
+    free(upload);
+}
+
+/*
+ * Returns a copy of size bytes of data.
+ */
+static const char * sstCopyBytes( const char *data, size_t size ) {
+    char *copy;
+    copy = (char*)malloc(size + 1);
+    memcpy(copy, data, size);
+    return copy;
+}
+
+/*
+ * Creates the set with the given name from the pack for the given program,
+ * uploading its buffers straight from the mapping, or from a copy of it on the
+ * render thread when that is running.
+ */
+sstDrawableSet * sstPackDrawableSet( sstPack *pack, const char *name,
+sstProgram *program ) {
+    const sstSetRecord *record;
+    const sstDrawableRecord *drawables;
+    const char *data, *indices, *input_name;
+    sstPackUpload *upload;
+    sstDrawableSet *set;
+    sstDrawable *d;
+    in_var *input;
+    int i;
+    /* Step 1: Find the record and check that it fits the program */
+    if( !(record = sstFindSet(pack, name)) ) {
+        return NULL;
+    }
+    drawables = sstSetDrawables(record);
+    for( i = 0; i < record->size; i++ ) {
+        input_name = sstPackString(pack, drawables[i].name);
+        if( !input_name || !sstFindInput(program, (char*)input_name) ) {
+            printf("ERROR: Set %s doesn't fit the program\n", name);
+            return NULL;
+        }
+    }
+    indices = record->i_bytes ? pack->data + record->indices : NULL;
+    /* Step 2: Copy over the description */
+    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
+    set->count = record->count;
+    set->size = record->size;
+    set->mode = record->mode;
+    set->i_size = record->i_size;
+    set->i_type = record->i_type;
+    set->inst_id = 0;
+    memcpy(set->scale, record->scale, sizeof(set->scale));
+    memcpy(set->offset, record->offset, sizeof(set->offset));
+    memcpy(set->low, record->low, sizeof(set->low));
+    memcpy(set->high, record->high, sizeof(set->high));
+    memcpy(set->center, record->center, sizeof(set->center));
+    set->radius = record->radius;
+    set->lod_count = record->lod_count;
+    set->lods = NULL;
+    if( record->lod_count ) {
+        set->lods = (sstLOD*)malloc(sizeof(sstLOD) * record->lod_count);
+        memcpy(set->lods, record + 1, sizeof(sstLOD) * record->lod_count);
+    }
+    set->bvh = NULL;
+    /* Step 3: Describe the drawables and where their data is. The pack may
+     * be closed before the render thread gets to it, so it gets copies. */
+    upload = (sstPackUpload*)malloc(sizeof(sstPackUpload));
+    upload->set = set;
+    upload->copied = sstRenderRemote();
+    upload->i_bytes = (GLsizeiptr)record->i_bytes;
+    upload->indices = indices && upload->copied
+                    ? sstCopyBytes(indices, record->i_bytes) : indices;
+    upload->data = (const char**)malloc(sizeof(char*) * (set->size + 1));
+    upload->bytes = (GLsizeiptr*)malloc(sizeof(GLsizeiptr) * (set->size + 1));
+    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * set->size);
+    for( i = 0; i < set->size; i++ ) {
+        d = &set->drawables[i];
+        input = sstFindInput(program, (char*)sstPackString(pack,
+                                                           drawables[i].name));
+        data = sstPackRange(pack, drawables[i].data, drawables[i].bytes);
+        d->location = input->location;
+        d->components = drawables[i].components;
+        d->size = drawables[i].size;
+        d->slots = drawables[i].slots;
+        d->divisor = drawables[i].divisor;
+        d->type = drawables[i].type;
+        d->normalized = (GLboolean)drawables[i].normalized;
+        d->transpose = (GLboolean)drawables[i].transpose;
+        upload->bytes[i] = (GLsizeiptr)drawables[i].bytes;
+        upload->data[i] = upload->copied
+                        ? sstCopyBytes(data, drawables[i].bytes) : data;
+    }
+    /* Step 4: Upload the buffers */
+    sstRenderCall(sstUploadPackSet, upload);
+    return set;
+}
+
+/*
+ * Returns the number of bytes the buffers of the set with the given name take
+ * up on the GPU, or 0 if the pack has no such set.
+ */
+GLuint64 sstPackSetBytes( sstPack *pack, const char *name ) {
+    const sstSetRecord *record;
+    const sstDrawableRecord *drawables;
+    GLuint64 bytes;
+    int i;
+    if( !(record = sstFindSet(pack, name)) ) {
+        return 0;
+    }
+    drawables = sstSetDrawables(record);
+    bytes = record->i_bytes;
+    for( i = 0; i < record->size; i++ ) {
+        bytes += drawables[i].bytes;
+    }
+    return bytes;
+}
+
+/*
+ * Asks for a range of the pack to be read in, then touches each of its pages
+ * so that it is in memory on return.
+ */
+static void sstPackTouch( sstPack *pack, GLuint64 offset, GLuint64 size ) {
+    GLuint64 page, start;
+    if( size == 0 ) {
+        return;
+    }
+    page = (GLuint64)sysconf(_SC_PAGESIZE);
+    start = offset - offset % page;
+    madvise((void*)(pack->data + start), offset + size - start,
+            MADV_WILLNEED);
+    for( ; start < offset + size; start += page ) {
+        (void)*(volatile const char*)(pack->data + start);
+    }
+}
+
+/*
+ * Reads the buffers of the set with the given name into memory, so that
+ * uploading them won't wait on the disk.
+ */
+void sstPackFetchSet( sstPack *pack, const char *name ) {
+    const sstSetRecord *record;
+    const sstDrawableRecord *drawables;
+    int i;
+    if( !(record = sstFindSet(pack, name)) ) {
+        return;
+    }
+    drawables = sstSetDrawables(record);
+    sstPackTouch(pack, record->indices, record->i_bytes);
+    for( i = 0; i < record->size; i++ ) {
+        sstPackTouch(pack, drawables[i].data, drawables[i].bytes);
+    }
+}
+
+/*
+ * Unmaps the given pack.
+ */
+void sstClosePack( sstPack *pack ) {
+    munmap((void*)pack->data, pack->size);
+    free(pack);
+}
@@ -0,0 +1,346 @@
+/*
+ * sst_pipeline.c
+ * By Steven Smith
+ *
+ * This file contains pipelines, which bundle a program with the fixed-function
+ * state it's drawn with. Pipelines can't be changed once made, so when one is
+ * made, what differs between it and every other pipeline is worked out ahead
+ * of time and kept as a bitmask. Switching pipelines then only looks at the
+ * state the mask says differs.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Pieces of state that can differ between pipelines, each set with one call */
+#define DIFF_DEPTH_TEST     0x1
+#define DIFF_DEPTH_FUNC     0x2
+#define DIFF_DEPTH_WRITE    0x4
+#define DIFF_BLEND          0x8
+#define DIFF_BLEND_FUNC     0x10
+#define DIFF_BLEND_EQUATION 0x20
+#define DIFF_CULL           0x40
+#define DIFF_CULL_FACE      0x80
+#define DIFF_FRONT_FACE     0x100
+#define DIFF_STENCIL        0x200
+#define DIFF_STENCIL_FUNC   0x400
+#define DIFF_STENCIL_OP     0x800
+#define DIFF_STENCIL_WRITE  0x1000
+#define DIFF_COLOR_WRITE    0x2000
+#define DIFF_VIEWPORT       0x4000
+#define DIFF_ALL            0x7FFF
+
+/* Longest the list of pipelines can grow to by doubling with ids that fit an
+ * int */
+#define MAX_PIPELINES ((size_t)INT_MAX / 2 + 1)
+
+struct sstPipeline {
+    sstPipelineState state;
+    int id; /* Index into the list of pipelines, and into each one's diffs */
+    unsigned int *diffs; /* State to set when switching to each pipeline */
+};
+
+/* Every pipeline, by id, with NULL for ids free to be given out again. The
+ * lock is held while the list or the diffs are changed or read, since
+ * pipelines can be made on one thread while another binds them. */
+static sstPipeline **pipelines = NULL;
+static int pipeline_count = 0;
+static size_t pipeline_size = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns the state that has to be set when switching from one pipeline to
+ * another. Pipelines that leave the viewport alone don't know what it is, so
+ * switching from one always sets the viewport of the other, if it has one.
+ */
+static unsigned int sstPipelineDiff( sstPipelineState *from,
+sstPipelineState *to ) {
+    unsigned int mask;
+    mask = 0;
+    if( from->depth_test != to->depth_test ) {
+        mask |= DIFF_DEPTH_TEST;
+    }
+    if( from->depth_func != to->depth_func ) {
+        mask |= DIFF_DEPTH_FUNC;
+    }
+    if( from->depth_write != to->depth_write ) {
+        mask |= DIFF_DEPTH_WRITE;
+    }
+    if( from->blend != to->blend ) {
+        mask |= DIFF_BLEND;
+    }
+    if( from->blend_src != to->blend_src || from->blend_dst != to->blend_dst ) {
+        mask |= DIFF_BLEND_FUNC;
+    }
+    if( from->blend_equation != to->blend_equation ) {
+        mask |= DIFF_BLEND_EQUATION;
+    }
+    if( from->cull != to->cull ) {
+        mask |= DIFF_CULL;
+    }
+    if( from->cull_face != to->cull_face ) {
+        mask |= DIFF_CULL_FACE;
+    }
+    if( from->front_face != to->front_face ) {
+        mask |= DIFF_FRONT_FACE;
+    }
+    if( from->stencil_test != to->stencil_test ) {
+        mask |= DIFF_STENCIL;
+    }
+    if( from->stencil_func != to->stencil_func
+     || from->stencil_ref != to->stencil_ref
+     || from->stencil_mask != to->stencil_mask ) {
+        mask |= DIFF_STENCIL_FUNC;
+    }
+    if( from->stencil_fail != to->stencil_fail
+     || from->stencil_depth_fail != to->stencil_depth_fail
+     || from->stencil_pass != to->stencil_pass ) {
+        mask |= DIFF_STENCIL_OP;
+    }
+    if( from->stencil_write != to->stencil_write ) {
+        mask |= DIFF_STENCIL_WRITE;
+    }
+    if( memcmp(from->color_write, to->color_write,
+               sizeof(from->color_write)) ) {
+        mask |= DIFF_COLOR_WRITE;
+    }
+    if( to->viewport[2] > 0
+     && (from->viewport[2] <= 0 || memcmp(from->viewport, to->viewport,
+                                          sizeof(from->viewport))) ) {
+        mask |= DIFF_VIEWPORT;
+    }
+    return mask;
+}
+
+/*
+ * Enables or disables a capability.
+ */
+static void sstSetCapability( GLenum cap, GLboolean enable ) {
+    if( enable ) {
+        sstEnable(cap);
+    }
+    else {
+        sstDisable(cap);
+    }
+}
+
+/*
+ * Private functions
+ */
+
+int sstPipelineId( sstPipeline *pipeline ) {
+    return pipeline->id;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Fills in the state a context starts out with, and no program.
+ */
+void sstDefaultPipelineState( sstPipelineState *state ) {
+    state->program = NULL;
+    state->depth_test = GL_FALSE;
+    state->depth_func = GL_LESS;
+    state->depth_write = GL_TRUE;
+    state->blend = GL_FALSE;
+    state->blend_src = GL_ONE;
+    state->blend_dst = GL_ZERO;
+    state->blend_equation = GL_FUNC_ADD;
+    state->cull = GL_FALSE;
+    state->cull_face = GL_BACK;
+    state->front_face = GL_CCW;
+    state->stencil_test = GL_FALSE;
+    state->stencil_func = GL_ALWAYS;
+    state->stencil_ref = 0;
+    state->stencil_mask = 0xFFFFFFFF;
+    state->stencil_fail = GL_KEEP;
+    state->stencil_depth_fail = GL_KEEP;
+    state->stencil_pass = GL_KEEP;
+    state->stencil_write = 0xFFFFFFFF;
+    state->color_write[0] = GL_TRUE;
+    state->color_write[1] = GL_TRUE;
+    state->color_write[2] = GL_TRUE;
+    state->color_write[3] = GL_TRUE;
+    state->viewport[0] = 0;
+    state->viewport[1] = 0;
+    state->viewport[2] = 0;
+    state->viewport[3] = 0;
+}
+
+/*
+ * Makes a pipeline from a copy of the given state, working out how it differs
+ * from every other pipeline. Returns NULL if the state has no program, or if
+ * there are too many pipelines.
+ */
+sstPipeline * sstNewPipeline( sstPipelineState *state ) {
+    sstPipeline *pipeline, *other;
+    size_t i, id;
+    int seen;
+    if( !state->program ) {
+        printf("ERROR: A pipeline needs a program\n");
+        return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    /* Step 1: Find it an id, making room for more if there are none free */
+    for( id = 0; id < pipeline_size && pipelines[id]; id++ );
+    if( id == pipeline_size ) {
+        if( pipeline_size >= MAX_PIPELINES ) {
+            pthread_mutex_unlock(&lock);
+            printf("ERROR: Too many pipelines\n");
+            return NULL;
+        }
+        pipeline_size = pipeline_size ? pipeline_size * 2 : 16;
+        pipelines = (sstPipeline**)realloc(pipelines, sizeof(sstPipeline*)
+                                                      * pipeline_size);
+        for( i = id; i < pipeline_size; i++ ) {
+            pipelines[i] = NULL;
+        }
+        for( i = 0; i < id; i++ ) {
+            pipelines[i]->diffs = (unsigned int*)realloc(pipelines[i]->diffs,
+                                                         sizeof(unsigned int)
+                                                         * pipeline_size);
+        }
+    }
+    pipeline = (sstPipeline*)malloc(sizeof(sstPipeline));
+    pipeline->state = *state;
+    pipeline->id = (int)id;
+    pipeline->diffs = (unsigned int*)malloc(sizeof(unsigned int)
+                                            * pipeline_size);
+    pipelines[id] = pipeline;
+    pipeline_count++;
+    /* Step 2: Work out the differences both ways, with the pipelines there
+     * are, stopping after the last of them */
+    for( i = 0, seen = 0; seen < pipeline_count; i++ ) {
+        other = pipelines[i];
+        if( other ) {
+            pipeline->diffs[i] = sstPipelineDiff(&pipeline->state,
+                                                 &other->state);
+            other->diffs[id] = sstPipelineDiff(&other->state,
+                                               &pipeline->state);
+            seen++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return pipeline;
+}
+
+/*
+ * Returns the state a pipeline was made with.
+ */
+const sstPipelineState * sstGetPipelineState( sstPipeline *pipeline ) {
+    return &pipeline->state;
+}
+
+/*
+ * Binds a pipeline, setting only the state that differs from the pipeline
+ * bound before it in the current context, and activating its program. While
+ * deferring or queueing, the bind is recorded instead.
+ */
+void sstBindPipeline( sstPipeline *pipeline ) {
+    sstPipeline **bound;
+    sstPipelineState *s;
+    unsigned int mask;
+    if( sst_threaded && sstRenderPipeline(pipeline) ) {
+        return;
+    }
+    if( sst_deferred ) {
+        sstDeferPipeline(pipeline);
+        return;
+    }
+    if( sst_queued ) {
+        sstQueuePipeline(pipeline);
+        return;
+    }
+    bound = sstBoundPipeline();
+    if( !pipeline ) {
+        *bound = NULL;
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    mask = *bound ? (*bound)->diffs[pipeline->id] : DIFF_ALL;
+    pthread_mutex_unlock(&lock);
+    *bound = pipeline;
+    s = &pipeline->state;
+    if( sst_active != s->program ) {
+        sstActivateProgram(s->program);
+    }
+    if( !mask ) {
+        return;
+    }
+    if( mask & DIFF_DEPTH_TEST ) {
+        sstSetCapability(GL_DEPTH_TEST, s->depth_test);
+    }
+    if( mask & DIFF_DEPTH_FUNC ) {
+        sstDepthFunc(s->depth_func);
+    }
+    if( mask & DIFF_DEPTH_WRITE ) {
+        sstDepthMask(s->depth_write);
+    }
+    if( mask & DIFF_BLEND ) {
+        sstSetCapability(GL_BLEND, s->blend);
+    }
+    if( mask & DIFF_BLEND_FUNC ) {
+        sstBlendFunc(s->blend_src, s->blend_dst);
+    }
+    if( mask & DIFF_BLEND_EQUATION ) {
+        sstBlendEquation(s->blend_equation);
+    }
+    if( mask & DIFF_CULL ) {
+        sstSetCapability(GL_CULL_FACE, s->cull);
+    }
+    if( mask & DIFF_CULL_FACE ) {
+        sstCullFace(s->cull_face);
+    }
+    if( mask & DIFF_FRONT_FACE ) {
+        sstFrontFace(s->front_face);
+    }
+    if( mask & DIFF_STENCIL ) {
+        sstSetCapability(GL_STENCIL_TEST, s->stencil_test);
+    }
+    if( mask & DIFF_STENCIL_FUNC ) {
+        sstStencilFunc(s->stencil_func, s->stencil_ref, s->stencil_mask);
+    }
+    if( mask & DIFF_STENCIL_OP ) {
+        sstStencilOp(s->stencil_fail, s->stencil_depth_fail, s->stencil_pass);
+    }
+    if( mask & DIFF_STENCIL_WRITE ) {
+        sstStencilMask(s->stencil_write);
+    }
+    if( mask & DIFF_COLOR_WRITE ) {
+        sstColorMask(s->color_write[0], s->color_write[1], s->color_write[2],
+                     s->color_write[3]);
+    }
+    if( (mask & DIFF_VIEWPORT) && s->viewport[2] > 0 ) {
+        sstViewport(s->viewport[0], s->viewport[1], s->viewport[2],
+                    s->viewport[3]);
+    }
+}
+
+/*
+ * Frees a pipeline, unbinding it wherever it's bound and giving its id out
+ * again.
+ */
+void sstFreePipeline( sstPipeline *pipeline ) {
+    sstForgetPipeline(pipeline);
+    pthread_mutex_lock(&lock);
+    pipelines[pipeline->id] = NULL;
+    free(pipeline->diffs);
+    free(pipeline);
+    if( --pipeline_count == 0 ) {
+        free(pipelines);
+        pipelines = NULL;
+        pipeline_size = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,433 @@
+/*
+ * sst_private.h
+ * By Steven Smith
+ *
+ * Functions and state shared between the SST source files that are not part of
+ * the public interface in sst.h.
+ */
+
+#ifndef SST_PRIVATE_H_
+#define SST_PRIVATE_H_
+
+#include "sst.h"
+
+/*
+ * Stuff from sst.c
+ */
+
+/* The program most recently made active with sstActivateProgram() */
+extern sstProgram *sst_active;
+
+/*
+ * Returns the size of the component corresponding to the enum value given.
+ */
+GLuint sstSizeFromEnum( GLenum type );
+
+/*
+ * Returns the largest index representable by the given index type.
+ */
+GLuint sstMaxIndex( GLenum type );
+
+/*
+ * Reads index i from an array of indices of the given type.
+ */
+GLuint sstGetIndex( void *indices, GLenum type, int i );
+
+/*
+ * Writes index i to an array of indices of the given type.
+ */
+void sstPutIndex( void *indices, GLenum type, int i, GLuint value );
+
+/*
+ * Returns the input variable in the program with the given name, or NULL if
+ * there is no such input.
+ */
+in_var * sstFindInput( sstProgram *program, char *name );
+
+/*
+ * Copies the layout of an input variable into a drawable.
+ */
+void sstInitDrawable( sstDrawable *drawable, in_var *input );
+
+/*
+ * Returns the number of bytes one entry takes up in the data passed in for an
+ * input, before any compression.
+ */
+GLsizei sstInputSize( in_var *input );
+
+/*
+ * Returns the number of bytes one entry takes up in a drawable's buffer.
+ */
+GLsizei sstVertexSize( sstDrawable *drawable );
+
+/*
+ * Points the attribute locations of a drawable at its buffer in the currently
+ * bound vertex array.
+ */
+void sstAttribPointers( sstDrawable *drawable );
+
+/*
+ * Creates the storage of the buffer bound to target, rounded up to whole 32-bit
+ * words so that pulling programs can read it as an array of uints, and fills
+ * in the first size bytes with data, unless data is NULL.
+ */
+void sstBufferWords( GLenum target, GLsizeiptr size, const GLvoid *data );
+
+/*
+ * Builds a drawable set from the data for each per-vertex input, indexed if
+ * indices are given, as sstDrawableSetArrays() and sstDrawableSetElements()
+ * do.
+ */
+sstDrawableSet * sstBuildDrawableSet( sstProgram *program, GLenum mode,
+                                      int count, void *indices, GLenum i_type,
+                                      int i_count, in_var **inputs,
+                                      void **data );
+
+/*
+ * The contents of the buffers of a set that has been prepared but not uploaded
+ * yet. Each array either belongs to the caller of sstPrepareDrawableSet() or
+ * is owned, and owned arrays are freed once they have been uploaded.
+ */
+typedef struct {
+    int size; /* Number of drawables */
+    void *indices; /* NULL for an unindexed set */
+    size_t i_bytes;
+    char i_owned;
+    void **data; /* Vertex data of each drawable, as its buffer holds it */
+    size_t *bytes;
+    char *owned;
+} sstSetData;
+
+/*
+ * The halves of sstBuildDrawableSet(). Preparing the set does all of the work
+ * that needs no GL, such as processing its mesh and compressing its data.
+ * Uploading it makes its buffers from the staged data without touching any
+ * vertex array, so it can be done with a shared context, and keeping the data
+ * first copies whatever still belongs to the caller. Filling the set does both.
+ * Binding it makes its vertex array, in the context that will draw it.
+ * Building, preparing and filling return NULL if any input is missing.
+ * The mesh passes preparing runs (welding, cache, overdraw and fetch ordering,
+ * LODs, bounds and the BVH) keep all of their state in the mesh, so sets may
+ * be prepared on several threads at once, as long as none of them changes the
+ * program's options meanwhile. The uploads need a current context on each.
+ */
+sstDrawableSet * sstPrepareDrawableSet( sstProgram *program, GLenum mode,
+                                        int count, void *indices,
+                                        GLenum i_type, int i_count,
+                                        in_var **inputs, void **data,
+                                        sstSetData *staged );
+void sstKeepSetData( sstSetData *staged );
+void sstUploadSetData( sstDrawableSet *set, sstSetData *staged );
+sstDrawableSet * sstFillDrawableSet( sstProgram *program, GLenum mode,
+                                     int count, void *indices, GLenum i_type,
+                                     int i_count, in_var **inputs,
+                                     void **data );
+void sstBindDrawableSet( sstDrawableSet *set );
+
+/*
+ * Reads the pairs of input variable names and data given to
+ * sstDrawableSetArrays() and sstDrawableSetElements(), looking up the input
+ * variable for each. Returns 0 if any name isn't an input of the program.
+ */
+int sstReadInputs( sstProgram *program, int size, va_list ap,
+                   in_var **inputs, void **data );
+
+/*
+ * Returns the shader type given a file path, from its suffix.
+ */
+GLenum sstGetShaderTypeFromFilepath( const char *file );
+
+/*
+ * Compiles a shader of the given type from an array of source strings. Will
+ * return the ID of the shader on success, or 0 if there was an error.
+ */
+GLuint sstCompileShader( GLenum type, const char **strings, int count );
+
+/*
+ * Links the given program object. Returns GL_TRUE on success, or prints the
+ * link log and returns GL_FALSE otherwise.
+ */
+GLboolean sstLinkProgram( GLuint program );
+
+/*
+ * Returns the number of bytes taken up by the value of a uniform variable.
+ */
+GLuint sstUniformSize( uniform *un );
+
+/*
+ * Uploads a value for the given uniform variable to the given location of the
+ * active program.
+ */
+void sstUploadUniform( uniform *un, GLint location, GLvoid *data );
+
+/*
+ * Stuff from sst_quantize.c
+ */
+
+/*
+ * Resets the position decode transform of a set to the identity.
+ */
+void sstResetDecode( sstDrawableSet *set );
+
+/*
+ * Compresses count entries of data for an input variable as set up with
+ * sstCompressInput(), updating the format of the drawable to match. Returns the
+ * compressed data, to be freed by the caller, or NULL if the data is to be
+ * uploaded as is.
+ */
+void * sstCompressData( sstDrawableSet *set, sstDrawable *drawable,
+                        in_var *input, void *data, int count );
+
+/*
+ * Stuff from sst_mesh.c
+ */
+
+/*
+ * A triangle mesh on its way to the GPU. Mesh processing works on copies of the
+ * data handed to sstDrawableSetArrays() and sstDrawableSetElements(), so the
+ * caller's arrays are never touched.
+ */
+typedef struct {
+    int count; /* Number of vertices */
+    int size; /* Number of vertex inputs */
+    in_var **inputs;
+    void **data; /* count entries for each input, laid out as the input */
+    GLuint *indices;
+    int i_count;
+    int lod_count; /* Number of levels of detail after the full mesh */
+    GLuint **lod_indices;
+    int *lod_sizes;
+    GLfloat *lod_errors;
+} sstMesh;
+
+/*
+ * Copies the given vertex and index data into a mesh. NULL indices stand for
+ * the vertices in order. Returns 0, leaving the mesh empty, if any of the
+ * inputs are missing or an index is out of range.
+ */
+int sstInitMesh( sstMesh *mesh, int count, void *indices, GLenum i_type,
+                 int i_count, int size, in_var **inputs, void **data );
+
+/*
+ * Runs the mesh processing passes turned on for the program over the mesh.
+ */
+void sstProcessMesh( sstProgram *program, sstMesh *mesh );
+
+/*
+ * Returns the indices of the mesh converted to the narrowest index type that
+ * can hold them, to be freed by the caller. The indices of each level of
+ * detail follow the full mesh. Fills in the type used and the total number of
+ * indices.
+ */
+void * sstMeshIndices( sstMesh *mesh, GLenum *i_type, int *total );
+
+/*
+ * Returns the index of the input holding positions, or -1 if there isn't one.
+ */
+int sstFindPositions( in_var **inputs, int size );
+
+/*
+ * Fills in the bounding box and bounding sphere of the set from the positions
+ * in the given input data.
+ */
+void sstComputeBounds( in_var **inputs, void **data, int size, int count,
+                       sstDrawableSet *set );
+
+void sstFreeMesh( sstMesh *mesh );
+
+/*
+ * Stuff from sst_lod.c
+ */
+
+/*
+ * Builds the chain of levels of detail asked for by the program from the full
+ * mesh, all sharing its vertices.
+ */
+void sstBuildLODs( sstProgram *program, sstMesh *mesh );
+
+/*
+ * Draws size indices of a set starting at first, straight to GL.
+ */
+void sstDrawSetRange( sstDrawableSet *set, GLuint first, int size );
+
+/*
+ * Stuff from sst_bvh.c
+ */
+
+/*
+ * Builds the hierarchy over the triangles of a set from the positions in the
+ * given input data. Indices may be NULL for unindexed triangles, with i_count
+ * the number of vertices. Returns NULL if there are no positions.
+ */
+struct sstBVH * sstBuildBVH( in_var **inputs, void **data, int size,
+                             void *indices, GLenum i_type, int i_count );
+
+void sstFreeBVH( struct sstBVH *bvh );
+
+/*
+ * Stuff from sst_pull.c
+ */
+
+#ifdef GL_SHADER_STORAGE_BUFFER
+/*
+ * Binds the buffers of a set for a pulling program and passes their formats
+ * on. Indices are only pulled if indexed is set, otherwise gl_VertexID is taken
+ * to be the vertex.
+ */
+void sstBindPulled( struct sstPulling *pulling, sstDrawableSet *set,
+                    GLboolean indexed );
+
+/*
+ * Draws count vertices of a set starting at first, counted in indices if the
+ * set is indexed, with its buffers bound for pulling.
+ */
+void sstDrawPulled( struct sstPulling *pulling, sstDrawableSet *set,
+                    GLuint first, int count );
+
+void sstFreePulling( struct sstPulling *pulling );
+#endif
+
+/*
+ * Stuff from sst_deferred.c
+ */
+
+/* Non-zero while draw calls are being recorded */
+extern int sst_deferred;
+
+void sstDeferActivate( sstProgram *program );
+void sstDeferUniform( sstProgram *program, int index, GLvoid *data );
+void sstDeferDraw( sstDrawableSet *set );
+void sstDeferDrawInstanced( sstDrawableSet *set, sstInstanceBuffer *buffer,
+                            int count );
+void sstDeferDrawRange( sstDrawableSet *set, GLuint first, int size );
+void sstDeferPipeline( struct sstPipeline *pipeline );
+
+/*
+ * Frees the list of instanced variants built for a program by
+ * sstFlushDeferred(), starting from the given one.
+ */
+void sstFreeVariant( struct sstVariant *variant );
+
+/*
+ * Stuff from sst_immediate.c
+ */
+
+/*
+ * Drops the primitives staged for a program that is being freed.
+ */
+void sstForgetImmediate( sstProgram *program );
+
+/*
+ * Stuff from sst_queue.c
+ */
+
+/* Non-zero while draws are being queued */
+extern int sst_queued;
+
+void sstQueueActivate( sstProgram *program );
+void sstQueueUniform( sstProgram *program, int index, GLvoid *data );
+
+/*
+ * Queues a draw of a set, instanced if buffer isn't NULL.
+ */
+void sstQueueDraw( sstDrawableSet *set, sstInstanceBuffer *buffer,
+                   int count );
+
+/*
+ * Queues a draw of size indices of a set starting at first.
+ */
+void sstQueueDrawRange( sstDrawableSet *set, GLuint first, int size );
+
+/*
+ * Makes the draws queued after it bind the given pipeline first.
+ */
+void sstQueuePipeline( struct sstPipeline *pipeline );
+
+/*
+ * Stuff from sst_pipeline.c
+ */
+
+/*
+ * Returns the id of a pipeline, which is small and unique among the pipelines
+ * that exist.
+ */
+int sstPipelineId( struct sstPipeline *pipeline );
+
+/*
+ * Stuff from sst_state.c
+ */
+
+/*
+ * Makes the given GL program current.
+ */
+void sstUseProgram( GLuint program );
+
+/*
+ * Binds a buffer to an indexed target, which binds it to the target itself
+ * too.
+ */
+void sstBindBufferBase( GLenum target, GLuint index, GLuint buffer );
+
+/*
+ * Returns where the pipeline bound in the current context is kept.
+ */
+struct sstPipeline ** sstBoundPipeline( void );
+
+/*
+ * Forgets a pipeline that is being freed in every context it's bound in.
+ */
+void sstForgetPipeline( struct sstPipeline *pipeline );
+
+/*
+ * Stuff from sst_render.c
+ */
+
+/* Non-zero while the render thread is running */
+extern int sst_threaded;
+
+/*
+ * Send calls to the render thread. Each returns 0, doing nothing, when called
+ * on the render thread itself, which makes the calls for real.
+ */
+int sstRenderActivate( sstProgram *program );
+int sstRenderUniform( sstProgram *program, int index, GLvoid *data );
+int sstRenderPipeline( struct sstPipeline *pipeline );
+int sstRenderDraw( sstDrawableSet *set, sstInstanceBuffer *buffer,
+                   int count );
+int sstRenderDrawLOD( sstDrawableSet *set, GLfloat *model, GLfloat *projection,
+                      GLfloat height, GLfloat pixels );
+int sstRenderFreeSet( sstDrawableSet *set );
+int sstRenderFreeBuffer( sstInstanceBuffer *buffer );
+int sstRenderFreeProgram( sstProgram *program );
+
+/*
+ * Returns true iff the render thread is running and this isn't it, so calls
+ * touching GL have to be sent to it.
+ */
+int sstRenderRemote( void );
+
+/*
+ * Has the render thread upload the staged data of a prepared set and make its
+ * vertex array, keeping the data first so that the caller's arrays can be
+ * freed as soon as this returns. Returns 0 when called on the render thread.
+ */
+int sstRenderUploadSet( sstDrawableSet *set, sstSetData *staged );
+
+/*
+ * Stuff from sst_pack.c
+ */
+
+/*
+ * Returns the number of bytes the buffers of the set with the given name take
+ * up on the GPU, or 0 if the pack has no such set.
+ */
+GLuint64 sstPackSetBytes( sstPack *pack, const char *name );
+
+/*
+ * Reads the buffers of the set with the given name into memory, so that
+ * uploading them won't wait on the disk. Only reads the mapping, so it can be
+ * called from any thread.
+ */
+void sstPackFetchSet( sstPack *pack, const char *name );
+
+#endif
@@ -0,0 +1,536 @@
+/*
+ * sst_pull.c
+ * By Steven Smith
+ *
+ * This file contains programmable vertex pulling. A pulling program reads its
+ * per-vertex inputs out of the buffers of a drawable set bound as shader
+ * storage buffers, indexed by gl_VertexID, instead of through attributes set
+ * up in the set's vertex array. Draws then only rebind buffers, never vertex
+ * arrays. The vertex shader of an existing program is rewritten to do this:
+ * its per-vertex inputs become plain globals, filled in by fetch code
+ * generated from the program's input list before the original main() runs.
+ * The layout of each input is passed as a uniform, so sets of the same program
+ * with different layouts (ie. compressed and uncompressed) can be drawn
+ * without changing programs.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+#ifdef GL_SHADER_STORAGE_BUFFER
+
+/* Shader storage buffers need GLSL 4.30 */
+#define PULL_VERSION 430
+
+struct sstPulling {
+    GLuint binding; /* First storage binding, one per pulled input, then one
+                     * for indices */
+    int size; /* Number of pulled inputs */
+    GLint *locations; /* Original location of each pulled input, -1 if unused */
+    GLint format; /* Location of the format uniform */
+    GLuint *formats; /* 4 values per pulled input, then 4 for the indices */
+    GLuint vao; /* Empty vertex array bound for pulled draws */
+};
+
+/*
+ * Decodes one component of a vertex from the 32-bit word holding it, given the
+ * format (type, stride, normalized, component size or 0 if packed) and the
+ * byte offset of the component. The %u are filled in with GL type enums.
+ */
+static const char *decode_glsl =
+    "float sstPullDecode(uvec4 f, uint w, uint b, uint c) {\n"
+    "    int s = int(b & 3u) * 8;\n"
+    "    float x;\n"
+    "    switch( f.x ) {\n"
+    "    case %uu:\n"
+    "        return uintBitsToFloat(w);\n"
+    "    case %uu:\n"
+    "        return unpackHalf2x16(w >> uint(s)).x;\n"
+    "    case %uu:\n"
+    "        x = float(bitfieldExtract(int(w), s, 8));\n"
+    "        return f.z != 0u ? max(x / 127.0, -1.0) : x;\n"
+    "    case %uu:\n"
+    "        x = float(bitfieldExtract(w, s, 8));\n"
+    "        return f.z != 0u ? x / 255.0 : x;\n"
+    "    case %uu:\n"
+    "        x = float(bitfieldExtract(int(w), s, 16));\n"
+    "        return f.z != 0u ? max(x / 32767.0, -1.0) : x;\n"
+    "    case %uu:\n"
+    "        x = float(bitfieldExtract(w, s, 16));\n"
+    "        return f.z != 0u ? x / 65535.0 : x;\n"
+    "    case %uu:\n"
+    "        x = float(int(w));\n"
+    "        return f.z != 0u ? max(x / 2147483647.0, -1.0) : x;\n"
+    "    case %uu:\n"
+    "        x = float(w);\n"
+    "        return f.z != 0u ? x / 4294967295.0 : x;\n"
+    "    case %uu:\n"
+    "        s = int(c & 3u) * 10;\n"
+    "        x = float(bitfieldExtract(int(w), s, s == 30 ? 2 : 10));\n"
+    "        return f.z != 0u ? max(x / (s == 30 ? 1.0 : 511.0), -1.0) : x;\n"
+    "    case %uu:\n"
+    "        s = int(c & 3u) * 10;\n"
+    "        x = float(bitfieldExtract(w, s, s == 30 ? 2 : 10));\n"
+    "        return f.z != 0u ? x / (s == 30 ? 3.0 : 1023.0) : x;\n"
+    "    }\n"
+    "    return 0.0;\n"
+    "}\n";
+
+/*
+ * Helper functions for generating fetch code
+ */
+
+/*
+ * Appends text to a growing string.
+ */
+static void sstEmit( char **code, size_t *length, const char *text ) {
+    size_t size;
+    size = strlen(text);
+    *code = (char*)realloc(*code, *length + size + 1);
+    memcpy(*code + *length, text, size + 1);
+    *length += size;
+}
+
+/*
+ * Returns the GLSL type of an input variable, or NULL if it can't be pulled.
+ * Inputs spanning several locations are taken to be matrices.
+ */
+static const char * sstPullType( in_var *in, char *name ) {
+    static const char *vectors[][5] = {
+        { "", "float", "vec2", "vec3", "vec4" },
+        { "", "int", "ivec2", "ivec3", "ivec4" },
+        { "", "uint", "uvec2", "uvec3", "uvec4" },
+        { "", "bool", "bvec2", "bvec3", "bvec4" }
+    };
+    int kind;
+    switch( in->type ) {
+    case GL_FLOAT:
+        kind = 0;
+        break;
+    case GL_INT:
+        kind = 1;
+        break;
+    case GL_UNSIGNED_INT:
+        kind = 2;
+        break;
+    case GL_BYTE:
+        kind = 3;
+        break;
+    default:
+        return NULL;
+    }
+    if( in->slots == 1 && in->components >= 1 && in->components <= 4 ) {
+        return vectors[kind][in->components];
+    }
+    if( kind == 0 && in->slots >= 2 && in->slots <= 4
+     && in->components % in->slots == 0 && in->components / in->slots >= 2
+     && in->components / in->slots <= 4 ) {
+        sprintf(name, "mat%ux%u", in->slots, in->components / in->slots);
+        return name;
+    }
+    return NULL;
+}
+
+/*
+ * Returns the fetch code that goes after the original source of a pulling
+ * vertex shader: one storage buffer per pulled input and one for the indices,
+ * the format uniform, a fetch function per input, a function filling in every
+ * used per-vertex input, and the real main() calling it before the original
+ * one. Nothing is declared ahead of the original source, so its #extension
+ * lines stay valid.
+ */
+static char * sstFetchCode( sstProgram *program, GLuint binding, int size ) {
+    char line[4096], type[16];
+    const char *glsl;
+    char *code;
+    size_t length;
+    in_var *in;
+    GLuint c;
+    int k;
+    code = NULL;
+    length = 0;
+    sstEmit(&code, &length, "\n#undef main\n");
+    /* Step 1: Buffers and formats */
+    for( k = 0; k < size; k++ ) {
+        sprintf(line, "layout(std430, binding = %u) readonly buffer "
+                "sstPullBuffer%d { uint sst_PullData%d[]; };\n",
+                binding + k, k, k);
+        sstEmit(&code, &length, line);
+    }
+    sprintf(line, "layout(std430, binding = %u) readonly buffer "
+            "sstPullIndexBuffer { uint sst_PullIndices[]; };\n"
+            "uniform uvec4 sst_PullFormat[%d];\n", binding + size, size + 1);
+    sstEmit(&code, &length, line);
+    /* Step 2: Shared decoding */
+    sprintf(line, decode_glsl, GL_FLOAT, GL_HALF_FLOAT, GL_BYTE,
+            GL_UNSIGNED_BYTE, GL_SHORT, GL_UNSIGNED_SHORT, GL_INT,
+            GL_UNSIGNED_INT, GL_INT_2_10_10_10_REV,
+            GL_UNSIGNED_INT_2_10_10_10_REV);
+    sstEmit(&code, &length, line);
+    /* Step 3: Vertex index, read from the indices if the draw has them */
+    sprintf(line,
+            "uint sstPullVertex() {\n"
+            "    uint i = uint(gl_VertexID);\n"
+            "    switch( sst_PullFormat[%d].x ) {\n"
+            "    case 1u:\n"
+            "        return bitfieldExtract(sst_PullIndices[i >> 2u],"
+            " int(i & 3u) * 8, 8);\n"
+            "    case 2u:\n"
+            "        return bitfieldExtract(sst_PullIndices[i >> 1u],"
+            " int(i & 1u) * 16, 16);\n"
+            "    case 4u:\n"
+            "        return sst_PullIndices[i];\n"
+            "    }\n"
+            "    return i;\n"
+            "}\n", size);
+    sstEmit(&code, &length, line);
+    /* Step 4: One fetch function per input, since buffer blocks can't be
+     * passed around */
+    k = 0;
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( in->divisor ) {
+            continue;
+        }
+        if( in->type == GL_INT || in->type == GL_UNSIGNED_INT ) {
+            sprintf(line,
+                    "uint sstPull%d(uint v, uint c) {\n"
+                    "    return sst_PullData%d[(v * sst_PullFormat[%d].y >> 2u)"
+                    " + c];\n"
+                    "}\n", k, k, k);
+        }
+        else {
+            sprintf(line,
+                    "float sstPull%d(uint v, uint c) {\n"
+                    "    uvec4 f = sst_PullFormat[%d];\n"
+                    "    uint b = v * f.y + (f.w != 0u ? c * f.w"
+                    " : (c >> 2u) * 4u);\n"
+                    "    return sstPullDecode(f, sst_PullData%d[b >> 2u], b,"
+                    " c);\n"
+                    "}\n", k, k, k);
+        }
+        sstEmit(&code, &length, line);
+        k++;
+    }
+    /* Step 5: Fill in the inputs. Ones the original program doesn't use are
+     * left alone. */
+    sstEmit(&code, &length, "void sstPullInputs() {\n"
+            "    uint v = sstPullVertex();\n");
+    k = 0;
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( in->divisor ) {
+            continue;
+        }
+        if( in->location >= 0 ) {
+            glsl = sstPullType(in, type);
+            sstEmit(&code, &length, "    ");
+            sstEmit(&code, &length, in->name);
+            sstEmit(&code, &length, " = ");
+            sstEmit(&code, &length, glsl);
+            sstEmit(&code, &length, "(");
+            for( c = 0; c < in->components; c++ ) {
+                if( in->type == GL_INT ) {
+                    sprintf(line, "%sint(sstPull%d(v, %uu))", c ? ", " : "",
+                            k, c);
+                }
+                else {
+                    sprintf(line, "%ssstPull%d(v, %uu)", c ? ", " : "", k, c);
+                }
+                sstEmit(&code, &length, line);
+            }
+            sstEmit(&code, &length, ");\n");
+        }
+        k++;
+    }
+    sstEmit(&code, &length, "}\nvoid main() {\n    sstPullInputs();\n"
+            "    sstPulledMain();\n}\n");
+    return code;
+}
+
+/*
+ * Returns the part of a vertex shader source after its #version line, with the
+ * per-vertex inputs turned into globals. Declarations are rewritten in place,
+ * so the line numbers are kept. The text before the #version line, the number
+ * of lines up to the end of it and the version asked for (0 if none) are
+ * handed back. Returns NULL if an input is an array, which can't be told apart
+ * from a matrix.
+ */
+static char * sstRewriteInputs( sstProgram *program, char *source,
+char **prefix, int *skipped, int *version ) {
+    char *result, *line, *s, *t, *body;
+    size_t length;
+    in_var *in;
+    /* Step 1: Split off everything up to the #version line */
+    *prefix = NULL;
+    *skipped = 0;
+    *version = 0;
+    body = source;
+    for( line = source; line; line = strchr(line, '\n') ) {
+        if( *line == '\n' ) {
+            line++;
+        }
+        if( strncmp(line, "#version", 8) == 0 ) {
+            *prefix = (char*)malloc(sizeof(char) * (line - source + 1));
+            memcpy(*prefix, source, line - source);
+            (*prefix)[line - source] = '\0';
+            *version = atoi(line + 8);
+            body = strchr(line, '\n');
+            body = body ? body + 1 : line + strlen(line);
+            for( s = source; s < body; s++ ) {
+                *skipped += *s == '\n';
+            }
+            break;
+        }
+    }
+    result = (char*)malloc(sizeof(char) * (strlen(body) + 1));
+    strcpy(result, body);
+    /* Step 2: Blank out "in" on the per-vertex declarations */
+    for( line = result; line; line = strchr(line, '\n') ) {
+        if( *line == '\n' ) {
+            line++;
+        }
+        /* Same rule as the parser: declarations start at the start of a line */
+        if( strncmp(line, "in ", 3) != 0 ) {
+            continue;
+        }
+        /* Skip over the type to get to the name */
+        for( s = line + 3; *s == ' ' || *s == '\t'; s++ );
+        for( ; *s && *s != ' ' && *s != '\t' && *s != '\n'; s++ );
+        for( ; *s == ' ' || *s == '\t'; s++ );
+        for( in = program->inputs; in < program->inputs + program->in_count;
+             in++ ) {
+            length = strlen(in->name);
+            if( in->divisor || strncmp(s, in->name, length) != 0
+             || (s[length] >= 'a' && s[length] <= 'z')
+             || (s[length] >= 'A' && s[length] <= 'Z')
+             || (s[length] >= '0' && s[length] <= '9') || s[length] == '_' ) {
+                continue;
+            }
+            for( t = s + length; *t && *t != ';' && *t != '\n'; t++ ) {
+                if( *t == '[' ) {
+                    printf("WARN: Can't pull array input [%s]!\n", in->name);
+                    free(result);
+                    free(*prefix);
+                    return NULL;
+                }
+            }
+            /* "in vec3 x;" -> "   vec3 x;" */
+            memcpy(line, "  ", 2);
+            break;
+        }
+    }
+    return result;
+}
+
+/*
+ * Compiles the pulling version of a vertex shader source. Returns the ID of the
+ * shader, or 0 if it couldn't be built.
+ */
+static GLuint sstCompilePulled( sstProgram *program, char *source,
+GLuint binding, int size ) {
+    const char *strings[4];
+    char *prefix, *body, *fetch;
+    char header[96];
+    GLuint shader;
+    int skipped, version;
+    body = sstRewriteInputs(program, source, &prefix, &skipped, &version);
+    if( !body ) {
+        return 0;
+    }
+    fetch = sstFetchCode(program, binding, size);
+    /* Newer versions are kept. The #line keeps the line numbers of the
+     * original in error messages. */
+    sprintf(header, "#version %d core\n#define main sstPulledMain\n#line %d\n",
+            version > PULL_VERSION ? version : PULL_VERSION, skipped + 1);
+    strings[0] = prefix ? prefix : "";
+    strings[1] = header;
+    strings[2] = body;
+    strings[3] = fetch;
+    shader = sstCompileShader(GL_VERTEX_SHADER, strings, 4);
+    free(prefix);
+    free(body);
+    free(fetch);
+    return shader;
+}
+
+/*
+ * Pulling functions
+ */
+
+/*
+ * Rebuilds a program so that it pulls its per-vertex inputs out of shader
+ * storage buffers. Returns GL_TRUE on success, leaving the program unchanged
+ * otherwise.
+ */
+GLboolean sstPullProgram( sstProgram *program, GLuint binding ) {
+    struct sstPulling *pulling;
+    GLuint prog, shader;
+    GLint max_blocks;
+    char type[16];
+    in_var *in;
+    uniform *un;
+    int i, size, vertex;
+    if( program->pulling ) {
+        return GL_TRUE;
+    }
+    /* Step 1: Check that every per-vertex input can be pulled */
+    size = program->in_count - program->inst_count;
+    if( size == 0 ) {
+        printf("WARN: Program has no per-vertex inputs to pull!\n");
+        return GL_FALSE;
+    }
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( !in->divisor && !sstPullType(in, type) ) {
+            printf("WARN: Can't pull input [%s]!\n", in->name);
+            return GL_FALSE;
+        }
+    }
+    vertex = -1;
+    for( i = 0; i < program->shader_count; i++ ) {
+        if( program->sources[i] ) {
+            if( vertex >= 0 ) {
+                printf("WARN: Vertex pulling needs a single vertex shader!\n");
+                return GL_FALSE;
+            }
+            vertex = i;
+        }
+    }
+    glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &max_blocks);
+    if( size + 1 > max_blocks ) {
+        printf("WARN: Not enough storage buffers to pull every input!\n");
+        return GL_FALSE;
+    }
+    /* Step 2: Create program and attach shaders, rewriting the vertex shader */
+    prog = glCreateProgram();
+    for( i = 0; i < program->shader_count; i++ ) {
+        if( i == vertex ) {
+            shader = sstCompilePulled(program, program->sources[i], binding,
+                                      size);
+            if( !shader ) {
+                printf("WARN: Failed to compile pulling vertex shader!\n");
+                glDeleteProgram(prog);
+                return GL_FALSE;
+            }
+            glAttachShader(prog, shader);
+            /* Flagged for deletion, goes away along with the program */
+            glDeleteShader(shader);
+        }
+        else {
+            glAttachShader(prog, program->shaders[i]);
+        }
+    }
+    /* Step 3: Per-instance inputs stay attributes, at the same locations */
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( in->divisor && in->location >= 0 ) {
+            glBindAttribLocation(prog, in->location, in->name);
+        }
+    }
+    if( !sstLinkProgram(prog) ) {
+        printf("WARN: Failed to link pulling program!\n");
+        glDeleteProgram(prog);
+        return GL_FALSE;
+    }
+    /* Step 4: Swap it in, carrying the uniform values over */
+    glDeleteProgram(program->program);
+    program->program = prog;
+    sstUseProgram(prog);
+    for( un = program->uniforms; un < program->uniforms + program->un_count;
+         un++ ) {
+        un->location = glGetUniformLocation(prog, un->name);
+        sstUploadUniform(un, un->location, un->value);
+    }
+    sstUseProgram(sst_active ? sst_active->program : 0);
+    /* Step 5: Remember what to bind at draw time */
+    pulling = (struct sstPulling*)malloc(sizeof(struct sstPulling));
+    pulling->binding = binding;
+    pulling->size = size;
+    pulling->locations = (GLint*)malloc(sizeof(GLint) * size);
+    i = 0;
+    for( in = program->inputs; in < program->inputs + program->in_count;
+         in++ ) {
+        if( !in->divisor ) {
+            pulling->locations[i++] = in->location;
+        }
+    }
+    pulling->format = glGetUniformLocation(prog, "sst_PullFormat");
+    pulling->formats = (GLuint*)calloc(4 * (size + 1), sizeof(GLuint));
+    glGenVertexArrays(1, &pulling->vao);
+    program->pulling = pulling;
+    return GL_TRUE;
+}
+
+/*
+ * Binds the buffers of a set where the pulling program of the active program
+ * will look for them, and passes their formats on. Indices are only pulled
+ * if indexed is set, otherwise gl_VertexID is taken to be the vertex.
+ */
+void sstBindPulled( struct sstPulling *pulling, sstDrawableSet *set,
+GLboolean indexed ) {
+    sstDrawable *d;
+    GLuint *format;
+    int k;
+    /* Step 1: Find the drawable of each input by its location */
+    for( k = 0; k < pulling->size; k++ ) {
+        format = &pulling->formats[4 * k];
+        format[0] = 0;
+        if( pulling->locations[k] < 0 ) {
+            continue;
+        }
+        for( d = set->drawables; d < set->drawables + set->size; d++ ) {
+            if( d->location == pulling->locations[k] ) {
+                break;
+            }
+        }
+        if( d >= set->drawables + set->size ) {
+            continue;
+        }
+        sstBindBufferBase(GL_SHADER_STORAGE_BUFFER, pulling->binding + k,
+                         d->buffer);
+        format[0] = d->type;
+        format[1] = sstVertexSize(d);
+        format[2] = d->normalized;
+        /* Packed types keep every component of a location in one word */
+        format[3] = d->type == GL_INT_2_10_10_10_REV
+                 || d->type == GL_UNSIGNED_INT_2_10_10_10_REV ? 0 : d->size;
+    }
+    /* Step 2: Then the indices */
+    format = &pulling->formats[4 * pulling->size];
+    format[0] = 0;
+    if( indexed && set->i_buffer ) {
+        sstBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                         pulling->binding + pulling->size, set->i_buffer);
+        format[0] = sstSizeFromEnum(set->i_type);
+    }
+    glUniform4uiv(pulling->format, pulling->size + 1, pulling->formats);
+}
+
+/*
+ * Draws count vertices of a set starting at first, counted in indices if the
+ * set is indexed, with its buffers bound for pulling.
+ */
+void sstDrawPulled( struct sstPulling *pulling, sstDrawableSet *set,
+GLuint first, int count ) {
+    /* Step 1: Bind the shared empty vertex array and the set's buffers */
+    sstBindVertexArray(pulling->vao);
+    sstBindPulled(pulling, set, GL_TRUE);
+    /* Step 2: Draw, with gl_VertexID running over the indices */
+    glDrawArrays(set->mode, first, count);
+}
+
+/*
+ * Frees the pulling state of a program.
+ */
+void sstFreePulling( struct sstPulling *pulling ) {
+    sstDeleteVertexArrays(1, &pulling->vao);
+    free(pulling->locations);
+    free(pulling->formats);
+    free(pulling);
+}
+
+#endif
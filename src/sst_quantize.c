@@ -0,0 +1,384 @@
+/*
+ * sst_quantize.c
+ * By Steven Smith
+ *
+ * This file contains the compression of vertex data into smaller formats on its
+ * way to the GPU. Each kind of data has a format to try, and it is used if it
+ * reproduces every component within the allowed error. Otherwise the data is
+ * uploaded as floats, just like it would be without compression.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Converts a float to a half float, rounding to nearest. Values too large for
+ * a half float become infinity.
+ */
+static GLhalf sstFloatToHalf( GLfloat f ) {
+    union { GLfloat f; GLuint u; } v;
+    GLuint sign, mantissa, half;
+    GLint exponent;
+    v.f = f;
+    sign = (v.u >> 16) & 0x8000;
+    exponent = (GLint)((v.u >> 23) & 0xFF) - 127 + 15;
+    mantissa = v.u & 0x7FFFFF;
+    /* Infinity and NaN */
+    if( ((v.u >> 23) & 0xFF) == 0xFF ) {
+        return (GLhalf)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    }
+    /* Too large */
+    if( exponent >= 31 ) {
+        return (GLhalf)(sign | 0x7C00);
+    }
+    /* Denormal or too small */
+    if( exponent <= 0 ) {
+        if( exponent < -10 ) {
+            return (GLhalf)sign;
+        }
+        mantissa |= 0x800000;
+        half = mantissa >> (14 - exponent);
+        if( (mantissa >> (13 - exponent)) & 1 ) {
+            half++;
+        }
+        return (GLhalf)(sign | half);
+    }
+    /* Rounding may carry into the exponent, which is what we want */
+    half = sign | ((GLuint)exponent << 10) | (mantissa >> 13);
+    if( mantissa & 0x1000 ) {
+        half++;
+    }
+    return (GLhalf)half;
+}
+
+/*
+ * Converts a half float back to a float.
+ */
+static GLfloat sstHalfToFloat( GLhalf h ) {
+    GLuint exponent, mantissa;
+    GLfloat result;
+    exponent = (h >> 10) & 0x1F;
+    mantissa = h & 0x3FF;
+    if( exponent == 0 ) {
+        result = (GLfloat)ldexp((double)mantissa, -24);
+    }
+    else if( exponent == 31 ) {
+        result = mantissa ? (GLfloat)NAN : (GLfloat)INFINITY;
+    }
+    else {
+        result = (GLfloat)ldexp((double)(mantissa | 0x400),
+                                (int)exponent - 25);
+    }
+    return (h & 0x8000) ? -result : result;
+}
+
+/*
+ * Converts a value in [-1,1] to a normalized signed integer with the given
+ * largest value, ie. 32767 for shorts.
+ */
+static GLint sstToSnorm( GLfloat v, GLint max ) {
+    if( v > 1.0f ) {
+        v = 1.0f;
+    }
+    else if( v < -1.0f ) {
+        v = -1.0f;
+    }
+    return (GLint)lrintf(v * max);
+}
+
+/*
+ * Converts a normalized signed integer back, the way OpenGL does.
+ */
+static GLfloat sstFromSnorm( GLint q, GLint max ) {
+    GLfloat v;
+    v = (GLfloat)q / (GLfloat)max;
+    return v < -1.0f ? -1.0f : v;
+}
+
+/*
+ * Compressors. Each one returns the compressed data and sets the format of the
+ * drawable, or returns NULL if the data can't be compressed within max_error.
+ */
+
+/*
+ * Half floats. Odd numbers of components are padded out to keep every vertex
+ * four byte aligned, with w = 1 for vec3s.
+ */
+static void * sstCompressHalf( GLfloat *src, int count, GLuint components,
+GLfloat max_error, sstDrawable *drawable ) {
+    GLhalf *result;
+    GLuint padded, c;
+    int i;
+    padded = components + (components & 1);
+    result = (GLhalf*)malloc(sizeof(GLhalf) * padded * count);
+    for( i = 0; i < count; i++ ) {
+        for( c = 0; c < components; c++ ) {
+            result[i*padded + c] = sstFloatToHalf(src[i*components + c]);
+            if( fabsf(sstHalfToFloat(result[i*padded + c])
+                    - src[i*components + c]) > max_error ) {
+                free(result);
+                return NULL;
+            }
+        }
+        if( padded != components ) {
+            result[i*padded + c] = sstFloatToHalf(c == 3 ? 1.0f : 0.0f);
+        }
+    }
+    drawable->type = GL_HALF_FLOAT;
+    drawable->size = sizeof(GLhalf);
+    drawable->components = padded;
+    return result;
+}
+
+/*
+ * Shorts normalized against the bounds of the data, padded out to four
+ * components with w = 1. The transform back to the original positions is kept
+ * in the set.
+ */
+static void * sstCompressBounded( sstDrawableSet *set, GLfloat *src, int count,
+GLfloat max_error, sstDrawable *drawable ) {
+    GLshort *result;
+    GLfloat low[3], high[3], center[3], extent[3];
+    GLint q;
+    int i, c;
+    /* Step 1: Find the bounds */
+    for( c = 0; c < 3; c++ ) {
+        low[c] = high[c] = count > 0 ? src[c] : 0.0f;
+    }
+    for( i = 1; i < count; i++ ) {
+        for( c = 0; c < 3; c++ ) {
+            if( src[i*3 + c] < low[c] ) {
+                low[c] = src[i*3 + c];
+            }
+            if( src[i*3 + c] > high[c] ) {
+                high[c] = src[i*3 + c];
+            }
+        }
+    }
+    for( c = 0; c < 3; c++ ) {
+        center[c] = (low[c] + high[c]) * 0.5f;
+        extent[c] = (high[c] - low[c]) * 0.5f;
+        if( extent[c] <= 0.0f ) {
+            extent[c] = 1.0f;
+        }
+    }
+    /* Step 2: Quantize against them */
+    result = (GLshort*)malloc(sizeof(GLshort) * 4 * count);
+    for( i = 0; i < count; i++ ) {
+        for( c = 0; c < 3; c++ ) {
+            q = sstToSnorm((src[i*3 + c] - center[c]) / extent[c], 32767);
+            if( fabsf(sstFromSnorm(q, 32767) * extent[c] + center[c]
+                    - src[i*3 + c]) > max_error ) {
+                free(result);
+                return NULL;
+            }
+            result[i*4 + c] = (GLshort)q;
+        }
+        result[i*4 + 3] = 32767;
+    }
+    /* Step 3: Remember how to get back */
+    for( c = 0; c < 3; c++ ) {
+        set->scale[c] = extent[c];
+        set->offset[c] = center[c];
+    }
+    drawable->type = GL_SHORT;
+    drawable->size = sizeof(GLshort);
+    drawable->components = 4;
+    drawable->normalized = GL_TRUE;
+    return result;
+}
+
+#ifdef GL_INT_2_10_10_10_REV
+/*
+ * Packed 10 bit normalized ints. The 2 bit w keeps the sign of the w component
+ * of vec4s, which is where tangents keep their handedness.
+ */
+static void * sstCompressPacked( GLfloat *src, int count, GLuint components,
+GLfloat max_error, sstDrawable *drawable ) {
+    GLuint *result;
+    GLint q[4];
+    GLuint c;
+    int i;
+    result = (GLuint*)malloc(sizeof(GLuint) * count);
+    for( i = 0; i < count; i++ ) {
+        for( c = 0; c < 3; c++ ) {
+            q[c] = sstToSnorm(src[i*components + c], 511);
+            if( fabsf(sstFromSnorm(q[c], 511) - src[i*components + c])
+                > max_error ) {
+                free(result);
+                return NULL;
+            }
+        }
+        q[3] = (components == 4 && src[i*4 + 3] < 0.0f) ? -1 : 1;
+        result[i] = ((GLuint)q[0] & 0x3FF)
+                  | (((GLuint)q[1] & 0x3FF) << 10)
+                  | (((GLuint)q[2] & 0x3FF) << 20)
+                  | (((GLuint)q[3] & 0x3) << 30);
+    }
+    drawable->type = GL_INT_2_10_10_10_REV;
+    drawable->size = sizeof(GLuint);
+    drawable->components = 4;
+    drawable->normalized = GL_TRUE;
+    return result;
+}
+#endif
+
+/*
+ * Octahedral encoding of unit vec3s into two normalized shorts. Since the
+ * input is a vec2, falling back to floats still has to encode the vectors, so
+ * this never returns NULL.
+ */
+static void * sstCompressOctahedral( GLfloat *src, int count,
+GLfloat max_error, sstDrawable *drawable ) {
+    GLshort *result;
+    GLfloat *fallback;
+    GLfloat n[3], p[2], d[3], t, length, sum;
+    GLint q[2];
+    int i, c, fits;
+    result = (GLshort*)malloc(sizeof(GLshort) * 2 * count);
+    fallback = (GLfloat*)malloc(sizeof(GLfloat) * 2 * count);
+    fits = 1;
+    for( i = 0; i < count; i++ ) {
+        /* Step 1: Project onto the octahedron and fold the bottom half up */
+        length = sqrtf(src[i*3] * src[i*3] + src[i*3 + 1] * src[i*3 + 1]
+                     + src[i*3 + 2] * src[i*3 + 2]);
+        for( c = 0; c < 3; c++ ) {
+            n[c] = length > 0.0f ? src[i*3 + c] / length : 0.0f;
+        }
+        sum = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+        if( sum <= 0.0f ) {
+            sum = 1.0f;
+        }
+        p[0] = n[0] / sum;
+        p[1] = n[1] / sum;
+        if( n[2] < 0.0f ) {
+            t = p[0];
+            p[0] = (1.0f - fabsf(p[1])) * (t >= 0.0f ? 1.0f : -1.0f);
+            p[1] = (1.0f - fabsf(t)) * (p[1] >= 0.0f ? 1.0f : -1.0f);
+        }
+        fallback[i*2] = p[0];
+        fallback[i*2 + 1] = p[1];
+        if( !fits ) {
+            continue;
+        }
+        /* Step 2: Quantize, then decode like SST_OCTAHEDRAL_GLSL to check */
+        for( c = 0; c < 2; c++ ) {
+            q[c] = sstToSnorm(p[c], 32767);
+            result[i*2 + c] = (GLshort)q[c];
+        }
+        d[0] = sstFromSnorm(q[0], 32767);
+        d[1] = sstFromSnorm(q[1], 32767);
+        d[2] = 1.0f - fabsf(d[0]) - fabsf(d[1]);
+        t = d[2] < 0.0f ? -d[2] : 0.0f;
+        d[0] += d[0] >= 0.0f ? -t : t;
+        d[1] += d[1] >= 0.0f ? -t : t;
+        length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        for( c = 0; c < 3; c++ ) {
+            if( fabsf(d[c] / length - n[c]) > max_error ) {
+                fits = 0;
+            }
+        }
+    }
+    if( !fits ) {
+        free(result);
+        drawable->type = GL_FLOAT;
+        drawable->size = sizeof(GLfloat);
+        drawable->components = 2;
+        return fallback;
+    }
+    free(fallback);
+    drawable->type = GL_SHORT;
+    drawable->size = sizeof(GLshort);
+    drawable->components = 2;
+    drawable->normalized = GL_TRUE;
+    return result;
+}
+
+/*
+ * Compression functions
+ */
+
+/*
+ * Turns on compression of the data for the given input variable.
+ */
+void sstCompressInput( sstProgram *program, char *name, int kind,
+GLfloat max_error ) {
+    in_var *input;
+    input = sstFindInput(program, name);
+    if( input == NULL ) {
+        printf("WARN: Input variable [%s] does not exist!\n", name);
+        return;
+    }
+    if( input->type != GL_FLOAT || input->slots != 1 || input->divisor ) {
+        printf("WARN: Input variable [%s] can't be compressed!\n", name);
+        return;
+    }
+    if( (kind == SST_POSITION_BOUNDED && input->components != 3)
+     || (kind == SST_NORMAL && input->components < 3)
+     || (kind == SST_OCTAHEDRAL && input->components != 2) ) {
+        printf("WARN: Input variable [%s] has the wrong type for its kind!\n",
+               name);
+        return;
+    }
+    input->compress = kind;
+    input->max_error = max_error;
+    /* Octahedral vec2s are encoded from vec3 data */
+    input->data_components = kind == SST_OCTAHEDRAL ? 3 : input->components;
+}
+
+/*
+ * Compresses count entries of data for an input variable as set up with
+ * sstCompressInput(), updating the format of the drawable to match. Returns the
+ * compressed data, or NULL if the data is to be uploaded as is.
+ */
+void * sstCompressData( sstDrawableSet *set, sstDrawable *drawable,
+in_var *input, void *data, int count ) {
+    GLfloat *src;
+    src = (GLfloat*)data;
+    switch( input->compress ) {
+    case SST_POSITION:
+    case SST_TEXCOORD:
+        return sstCompressHalf(src, count, input->components,
+                               input->max_error, drawable);
+    case SST_POSITION_BOUNDED:
+        return sstCompressBounded(set, src, count, input->max_error, drawable);
+    case SST_NORMAL:
+#ifdef GL_INT_2_10_10_10_REV
+        return sstCompressPacked(src, count, input->components,
+                                 input->max_error, drawable);
+#else
+        return NULL;
+#endif
+    case SST_OCTAHEDRAL:
+        return sstCompressOctahedral(src, count, input->max_error, drawable);
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Resets the position decode transform of a set to the identity.
+ */
+void sstResetDecode( sstDrawableSet *set ) {
+    int c;
+    for( c = 0; c < 3; c++ ) {
+        set->scale[c] = 1.0f;
+        set->offset[c] = 0.0f;
+    }
+}
+
+/*
+ * Fills in the matrix that turns the positions of a set compressed with
+ * SST_POSITION_BOUNDED back into the original positions.
+ */
+void sstDrawableSetDecodeMatrix( sstDrawableSet *set, GLfloat *mat ) {
+    sstTranslateMatrix_(set->offset[0], set->offset[1], set->offset[2], mat);
+    sstScaleMatrixInto(set->scale[0], set->scale[1], set->scale[2], mat);
+}
@@ -0,0 +1,445 @@
+/*
+ * sst_queue.c
+ * By Steven Smith
+ *
+ * This file contains the render queue. While queueing, draws are recorded
+ * along with where to find the uniform values of their program, and given a
+ * 64-bit key made from their pipeline, program, material, set and depth. Each
+ * uniform value set is stored once, however many draws use it. When flushed,
+ * the draws are radix sorted by key and executed in order, so that draws
+ * sharing state end up next to each other, and only the uniforms that differ
+ * from the previous draw of the same program are uploaded.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Layout of the sort key, from the most significant bit down. Transparent
+ * draws come after opaque ones, and are sorted by depth first. Pipelines are
+ * numbered from 1, so that draws without one come first. */
+#define TRANSPARENT_BIT ((GLuint64)1 << 63)
+#define PIPELINE_BITS 8
+#define PROGRAM_BITS 10
+#define MATERIAL_BITS 10
+#define SET_BITS 12
+#define DEPTH_BITS 23
+
+typedef struct {
+    sstProgram *program;
+    long *values; /* Payload offset of each uniform's value as recorded */
+    long *applied; /* Payload offset of each uniform's value last uploaded */
+    long snapshot; /* Payload offset of a copy of values, or -1 if changed */
+    long drawn; /* Snapshot of the last draw executed, or -1 */
+} queued_program;
+
+typedef struct {
+    int program; /* Index into the queued programs */
+    sstPipeline *pipeline; /* Bound when it was queued, or NULL */
+    sstDrawableSet *set;
+    sstInstanceBuffer *buffer; /* NULL unless instanced */
+    int count; /* Instance count */
+    GLuint first; /* Range of indices drawn, for levels of detail */
+    int size; /* Number of indices in the range, or 0 for the whole set */
+    long values; /* Payload offset of its program's snapshot */
+} queued_draw;
+
+typedef struct {
+    GLuint64 key;
+    int draw;
+} sort_entry;
+
+/* Non-zero while draws are being queued */
+int sst_queued = 0;
+
+/* The programs used since sstBeginQueue(), with the program last activated */
+static queued_program *programs = NULL;
+static int program_count = 0;
+static int program_size = 0;
+static int recorded = -1;
+
+/* The queued draws, their sort keys, and the uniform values they use */
+static queued_draw *draws = NULL;
+static sort_entry *entries = NULL;
+static sort_entry *scratch = NULL;
+static int draw_count = 0;
+static int draw_size = 0;
+static char *payload = NULL;
+static size_t payload_count = 0;
+static size_t payload_size = 0;
+
+/* Set with sstQueueMaterial(), sstQueueDepth() and sstBindPipeline() */
+static GLuint material = 0;
+static GLboolean transparent = GL_FALSE;
+static GLfloat depth = 0.0f;
+static sstPipeline *pipeline = NULL;
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Copies data to the end of the payload buffer, returning its offset. Offsets
+ * are kept aligned for the arrays of offsets stored there.
+ */
+static long sstPushPayload( GLvoid *data, size_t size ) {
+    size_t offset;
+    payload_count = (payload_count + sizeof(long) - 1) & ~(sizeof(long) - 1);
+    if( payload_count + size > payload_size ) {
+        for( payload_size = payload_size ? payload_size : 1024;
+             payload_count + size > payload_size; payload_size *= 2 );
+        payload = (char*)realloc(payload, payload_size);
+    }
+    offset = payload_count;
+    memcpy(payload + offset, data, size);
+    payload_count += size;
+    return (long)offset;
+}
+
+/*
+ * Returns the index of the given program among the queued programs, adding it
+ * with its current uniform values if needed.
+ */
+static int sstQueuedProgram( sstProgram *program ) {
+    queued_program *qp;
+    int i;
+    if( recorded >= 0 && programs[recorded].program == program ) {
+        return recorded;
+    }
+    for( i = 0; i < program_count; i++ ) {
+        if( programs[i].program == program ) {
+            return i;
+        }
+    }
+    if( program_count == program_size ) {
+        program_size = program_size ? program_size * 2 : 8;
+        programs = (queued_program*)realloc(programs, sizeof(queued_program)
+                                                      * program_size);
+    }
+    qp = &programs[program_count];
+    qp->program = program;
+    qp->values = (long*)malloc(sizeof(long) * (program->un_count + 1));
+    qp->applied = (long*)malloc(sizeof(long) * (program->un_count + 1));
+    for( i = 0; i < program->un_count; i++ ) {
+        qp->values[i] = sstPushPayload(program->uniforms[i].value,
+                                       sstUniformSize(&program->uniforms[i]));
+        qp->applied[i] = -1;
+    }
+    qp->snapshot = -1;
+    qp->drawn = -1;
+    return program_count++;
+}
+
+/*
+ * Returns the sort key of a draw. Depths are non-negative floats, whose bits
+ * sort in the same order they do.
+ */
+static GLuint64 sstSortKey( int program, GLuint set ) {
+    GLuint64 key, d;
+    union { GLfloat f; GLuint u; } bits;
+    bits.f = depth > 0.0f ? depth : 0.0f;
+    d = bits.u >> (31 - DEPTH_BITS);
+    key = pipeline ? (GLuint64)((sstPipelineId(pipeline) + 1)
+                                & ((1 << PIPELINE_BITS) - 1)) : 0;
+    key = (key << PROGRAM_BITS) | (program & ((1 << PROGRAM_BITS) - 1));
+    key = (key << MATERIAL_BITS) | (material & ((1 << MATERIAL_BITS) - 1));
+    key = (key << SET_BITS) | (set & ((1 << SET_BITS) - 1));
+    if( !transparent ) {
+        /* Front to back, with draws sharing state together */
+        return (key << DEPTH_BITS) | d;
+    }
+    /* Back to front first, so that blending comes out right */
+    d = ((GLuint64)1 << DEPTH_BITS) - 1 - d;
+    return TRANSPARENT_BIT | (d << (PIPELINE_BITS + PROGRAM_BITS
+                                    + MATERIAL_BITS + SET_BITS)) | key;
+}
+
+/*
+ * Sorts the entries by key, a byte at a time from the least significant,
+ * skipping bytes that are the same in every key. Keeps draws with equal keys
+ * in the order they were queued. Returns whichever of the two arrays holds the
+ * result.
+ */
+static sort_entry * sstRadixSort( sort_entry *in, sort_entry *out, int n ) {
+    static int counts[8][256];
+    sort_entry *swap;
+    int pass, i, sum, c;
+    /* Step 1: Count every byte of every key in one go */
+    memset(counts, 0, sizeof(counts));
+    for( i = 0; i < n; i++ ) {
+        for( pass = 0; pass < 8; pass++ ) {
+            counts[pass][(in[i].key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+    /* Step 2: Scatter on each byte that varies */
+    for( pass = 0; pass < 8; pass++ ) {
+        if( counts[pass][(in[0].key >> (pass * 8)) & 0xFF] == n ) {
+            continue;
+        }
+        for( i = 0, sum = 0; i < 256; i++ ) {
+            c = counts[pass][i];
+            counts[pass][i] = sum;
+            sum += c;
+        }
+        for( i = 0; i < n; i++ ) {
+            out[counts[pass][(in[i].key >> (pass * 8)) & 0xFF]++] = in[i];
+        }
+        swap = in;
+        in = out;
+        out = swap;
+    }
+    return in;
+}
+
+/*
+ * Returns true iff any of the program's uniforms has a value, found at the
+ * given payload offsets, that differs from the one last uploaded.
+ */
+static int sstValuesDiffer( queued_program *qp, long *values ) {
+    uniform *un;
+    int i;
+    for( i = 0; i < qp->program->un_count; i++ ) {
+        un = &qp->program->uniforms[i];
+        if( values[i] != qp->applied[i]
+         && memcmp(un->value, payload + values[i], sstUniformSize(un)) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Uploads the uniforms of the active program whose values, found at the given
+ * payload offsets, differ from the ones last uploaded.
+ */
+static void sstApplyValues( queued_program *qp, long *values ) {
+    uniform *un;
+    int i;
+    for( i = 0; i < qp->program->un_count; i++ ) {
+        if( values[i] == qp->applied[i] ) {
+            continue;
+        }
+        qp->applied[i] = values[i];
+        un = &qp->program->uniforms[i];
+        if( memcmp(un->value, payload + values[i], sstUniformSize(un)) ) {
+            memcpy(un->value, payload + values[i], sstUniformSize(un));
+            sstUploadUniform(un, un->location, un->value);
+        }
+    }
+}
+
+/*
+ * Queues a draw, returning it to be filled in, or NULL if there is no active
+ * program to draw with.
+ */
+static queued_draw * sstNewDraw( sstDrawableSet *set ) {
+    queued_program *qp;
+    queued_draw *draw;
+    if( recorded < 0 ) {
+        printf("ERROR: Queued a draw with no active program\n");
+        return NULL;
+    }
+    if( draw_count == draw_size ) {
+        draw_size = draw_size ? draw_size * 2 : 256;
+        draws = (queued_draw*)realloc(draws, sizeof(queued_draw) * draw_size);
+        entries = (sort_entry*)realloc(entries, sizeof(sort_entry)
+                                                * draw_size);
+        scratch = (sort_entry*)realloc(scratch, sizeof(sort_entry)
+                                                * draw_size);
+    }
+    /* Draws between uniform changes share a snapshot */
+    qp = &programs[recorded];
+    if( qp->snapshot < 0 ) {
+        qp->snapshot = sstPushPayload(qp->values, sizeof(long)
+                                                  * qp->program->un_count);
+    }
+    draw = &draws[draw_count];
+    draw->program = recorded;
+    draw->pipeline = pipeline;
+    draw->set = set;
+    draw->buffer = NULL;
+    draw->count = 0;
+    draw->first = 0;
+    draw->size = 0;
+    draw->values = qp->snapshot;
+    entries[draw_count].key = sstSortKey(recorded, set->vao);
+    entries[draw_count].draw = draw_count;
+    draw_count++;
+    return draw;
+}
+
+/*
+ * Private functions
+ */
+
+void sstQueueActivate( sstProgram *program ) {
+    recorded = sstQueuedProgram(program);
+}
+
+void sstQueueUniform( sstProgram *program, int index, GLvoid *data ) {
+    queued_program *qp;
+    uniform *un;
+    qp = &programs[sstQueuedProgram(program)];
+    un = &program->uniforms[index];
+    qp->values[index] = sstPushPayload(data, sstUniformSize(un));
+    qp->snapshot = -1;
+}
+
+void sstQueueDraw( sstDrawableSet *set, sstInstanceBuffer *buffer,
+int count ) {
+    queued_draw *draw;
+    draw = sstNewDraw(set);
+    if( draw ) {
+        draw->buffer = buffer;
+        draw->count = count;
+    }
+}
+
+void sstQueueDrawRange( sstDrawableSet *set, GLuint first, int size ) {
+    queued_draw *draw;
+    draw = sstNewDraw(set);
+    if( draw ) {
+        draw->first = first;
+        draw->size = size;
+    }
+}
+
+void sstQueuePipeline( sstPipeline *bound ) {
+    pipeline = bound;
+    /* Binding a pipeline activates its program */
+    if( bound ) {
+        recorded = sstQueuedProgram(sstGetPipelineState(bound)->program);
+    }
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Starts queueing draws.
+ */
+void sstBeginQueue( void ) {
+    if( sst_deferred ) {
+        printf("ERROR: Can't queue draws while deferring\n");
+        return;
+    }
+    sst_queued = 1;
+    draw_count = 0;
+    payload_count = 0;
+    material = 0;
+    transparent = GL_FALSE;
+    depth = 0.0f;
+    pipeline = *sstBoundPipeline();
+    recorded = sst_active ? sstQueuedProgram(sst_active) : -1;
+}
+
+/*
+ * Sets the material of the draws that follow, and whether they are blended.
+ */
+void sstQueueMaterial( GLuint mat, GLboolean blended ) {
+    material = mat;
+    transparent = blended;
+}
+
+/*
+ * Sets the distance from the camera of the draws that follow.
+ */
+void sstQueueDepth( GLfloat distance ) {
+    depth = distance;
+}
+
+/*
+ * Sorts the queued draws and executes them, stopping queueing. Returns the
+ * number of draws executed.
+ */
+int sstFlushQueue( void ) {
+    queued_program *qp;
+    queued_draw *draw;
+    sort_entry *sorted;
+    sstPipeline *bound;
+    int i, program, last;
+    sst_queued = 0;
+    /* Step 1: Sort */
+    sorted = entries;
+    if( draw_count > 1 ) {
+        sorted = sstRadixSort(entries, scratch, draw_count);
+    }
+    /* Step 2: Draw, switching pipelines and programs and uploading uniforms
+     * only when they change */
+    program = -1;
+    bound = *sstBoundPipeline();
+    for( i = 0; i < draw_count; i++ ) {
+        draw = &draws[sorted[i].draw];
+        qp = &programs[draw->program];
+        if( draw->pipeline && draw->pipeline != bound ) {
+            sstBindPipeline(draw->pipeline);
+            bound = draw->pipeline;
+            program = -1;
+        }
+        if( draw->program != program ) {
+            sstActivateProgram(qp->program);
+            program = draw->program;
+        }
+        if( qp->drawn != draw->values ) {
+            sstApplyValues(qp, (long*)(payload + draw->values));
+            qp->drawn = draw->values;
+        }
+        if( draw->buffer ) {
+            sstDrawSetInstanced(draw->set, draw->buffer, draw->count);
+        }
+        else if( draw->size ) {
+            sstDrawSetRange(draw->set, draw->first, draw->size);
+        }
+        else {
+            sstDrawSet(draw->set);
+        }
+    }
+    /* Step 3: Leave every program's uniforms, the bound pipeline and the
+     * active program as they would be had each call been executed in order */
+    if( pipeline != bound ) {
+        sstBindPipeline(pipeline);
+        program = -1;
+    }
+    last = recorded;
+    for( i = 0; i < program_count; i++ ) {
+        qp = &programs[i];
+        if( sstValuesDiffer(qp, qp->values) ) {
+            sstActivateProgram(qp->program);
+            program = i;
+            sstApplyValues(qp, qp->values);
+        }
+        free(qp->values);
+        free(qp->applied);
+    }
+    if( last >= 0 && last != program ) {
+        sstActivateProgram(programs[last].program);
+    }
+    program_count = 0;
+    recorded = -1;
+    i = draw_count;
+    draw_count = 0;
+    payload_count = 0;
+    return i;
+}
+
+/*
+ * Frees the memory used by the render queue.
+ */
+void sstFreeQueue( void ) {
+    free(programs);
+    free(draws);
+    free(entries);
+    free(scratch);
+    free(payload);
+    programs = NULL;
+    draws = NULL;
+    entries = NULL;
+    scratch = NULL;
+    payload = NULL;
+    program_size = 0;
+    draw_size = 0;
+    payload_size = 0;
+}
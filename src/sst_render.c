@@ -0,0 +1,505 @@
+/*
+ * sst_render.c
+ * By Steven Smith
+ *
+ * This file contains the render thread. Once started, it holds the context,
+ * and the calls that draw, set uniforms, build sets and free objects are
+ * written into a ring buffer instead of going to GL, with uniform values
+ * copied in after them. The render thread reads them out and makes the calls,
+ * so stalls in the driver hold up only the render thread. There is one writer
+ * and one reader, so each only moves its own end of the ring, and neither ever
+ * takes a lock unless the ring is full or empty and it has to sleep.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Smallest ring, and how its records are aligned */
+#define MIN_RING 4096
+
+/* The render thread is woken once this fraction of the ring is in use */
+#define WAKE_FRACTION 8
+#define ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef enum {
+    CMD_WRAP, /* Rest of the ring is unused, carry on from the start */
+    CMD_QUIT,
+    CMD_ACTIVATE,
+    CMD_UNIFORM,
+    CMD_PIPELINE,
+    CMD_DRAW,
+    CMD_DRAW_INSTANCED,
+    CMD_DRAW_LOD,
+    CMD_UPLOAD_SET,
+    CMD_FREE_SET,
+    CMD_FREE_BUFFER,
+    CMD_FREE_PROGRAM,
+    CMD_CALL,
+    CMD_SWAP
+} command_type;
+
+typedef struct {
+    command_type type; /* First, so a wrap needs no more room than this */
+    int index; /* Uniform index, or instance count for instanced draws */
+    size_t size; /* Bytes to the next command, including the uniform value */
+    void *object; /* Program, pipeline, set, or argument of a call */
+    void *extra; /* Instance buffer, staged set data, or function to call */
+} command; /* Uniform and level of detail commands are followed by data */
+
+/* Non-zero while the render thread is running */
+int sst_threaded = 0;
+
+static GLFWwindow window;
+static pthread_t thread;
+
+/* The ring. Head and tail count bytes written and read since it was made, and
+ * are only moved by the writer and the reader respectively. */
+static char *ring = NULL;
+static size_t ring_size = 0;
+static size_t head = 0;
+static size_t tail = 0;
+
+/* For sleeping when the ring is full or empty */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space = PTHREAD_COND_INITIALIZER;
+static int reader_asleep = 0;
+static int writer_asleep = 0;
+
+/* Stats for sstRenderStats(), only touched by the writer */
+static size_t peak = 0;
+static unsigned long stalls = 0;
+
+/*
+ * Helper functions for writing
+ */
+
+/*
+ * Wakes the render thread if it is asleep. Only the first wake after it fell
+ * asleep does anything.
+ */
+static void sstWakeReader( void ) {
+    if( __atomic_exchange_n(&reader_asleep, 0, __ATOMIC_SEQ_CST) ) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/*
+ * Sleeps until no more than the given number of bytes of the ring are in use.
+ * Returns true iff it had to sleep.
+ */
+static int sstRingWait( size_t used ) {
+    if( head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) <= used ) {
+        return 0;
+    }
+    sstWakeReader();
+    pthread_mutex_lock(&lock);
+    for( ;; ) {
+        /* The reader clears this when it wakes us, so set it every time */
+        __atomic_store_n(&writer_asleep, 1, __ATOMIC_SEQ_CST);
+        if( head - __atomic_load_n(&tail, __ATOMIC_SEQ_CST) <= used ) {
+            break;
+        }
+        pthread_cond_wait(&space, &lock);
+    }
+    __atomic_store_n(&writer_asleep, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lock);
+    return 1;
+}
+
+/*
+ * Returns room in the ring for a command of the given size, waiting for the
+ * render thread to make room if needed. The command isn't seen by the render
+ * thread until it is sent.
+ */
+static command * sstRingReserve( command_type type, size_t size ) {
+    command *cmd;
+    size_t offset;
+    offset = head & (ring_size - 1);
+    /* Step 1: Skip the end of the ring if the command doesn't fit there */
+    if( offset + size > ring_size ) {
+        /* Room for both the skipped bytes and the command */
+        stalls += sstRingWait(offset - size);
+        ((command*)(ring + offset))->type = CMD_WRAP;
+        __atomic_store_n(&head, head + ring_size - offset, __ATOMIC_SEQ_CST);
+        offset = 0;
+    }
+    else {
+        stalls += sstRingWait(ring_size - size);
+    }
+    /* Step 2: Fill in what every command has */
+    cmd = (command*)(ring + offset);
+    cmd->type = type;
+    cmd->size = size;
+    return cmd;
+}
+
+/*
+ * Hands the last reserved command to the render thread. A render thread that
+ * has fallen asleep is left to sleep until there is a batch of commands worth
+ * waking it for, or a call or the end of a frame, since waking it for each
+ * command costs more than the command.
+ */
+static void sstRingSend( command *cmd ) {
+    size_t used;
+    __atomic_store_n(&head, head + cmd->size, __ATOMIC_SEQ_CST);
+    used = head - __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    if( used > peak ) {
+        peak = used;
+    }
+    if( used >= ring_size / WAKE_FRACTION || cmd->type == CMD_CALL
+     || cmd->type == CMD_SWAP || cmd->type == CMD_QUIT ) {
+        sstWakeReader();
+    }
+}
+
+/*
+ * Sends a command holding up to two pointers.
+ */
+static void sstRingSendObject( command_type type, void *object, void *extra,
+int index ) {
+    command *cmd;
+    cmd = sstRingReserve(type, ALIGN(sizeof(command)));
+    cmd->object = object;
+    cmd->extra = extra;
+    cmd->index = index;
+    sstRingSend(cmd);
+}
+
+/*
+ * Returns true iff calls should be sent to the render thread, which is when
+ * they aren't being made by the render thread itself.
+ */
+static int sstSending( void ) {
+    return !pthread_equal(pthread_self(), thread);
+}
+
+/*
+ * Helper functions for reading
+ */
+
+/*
+ * Uploads a set that has already been prepared and given out, and frees its
+ * staged data.
+ */
+static void sstRunUpload( sstDrawableSet *set, sstSetData *staged ) {
+    sstUploadSetData(set, staged);
+    sstBindDrawableSet(set);
+    free(staged);
+}
+
+/*
+ * Makes the calls written into the ring until told to quit, sleeping while
+ * there are none.
+ */
+static void * sstRenderThread( void *arg ) {
+    command *cmd;
+    uniform *un;
+    GLfloat *lod;
+    size_t at, size;
+    int quit;
+    (void)arg;
+    glfwMakeContextCurrent(window);
+    quit = 0;
+    at = tail;
+    while( !quit ) {
+        /* Step 1: Sleep until there is something to read */
+        if( __atomic_load_n(&head, __ATOMIC_ACQUIRE) == at ) {
+            pthread_mutex_lock(&lock);
+            for( ;; ) {
+                __atomic_store_n(&reader_asleep, 1, __ATOMIC_SEQ_CST);
+                if( __atomic_load_n(&head, __ATOMIC_SEQ_CST) != at ) {
+                    break;
+                }
+                pthread_cond_wait(&wake, &lock);
+            }
+            __atomic_store_n(&reader_asleep, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&lock);
+        }
+        /* Step 2: Make the call */
+        cmd = (command*)(ring + (at & (ring_size - 1)));
+        if( cmd->type == CMD_WRAP ) {
+            size = ring_size - (at & (ring_size - 1));
+        }
+        else {
+            size = cmd->size;
+        }
+        switch( cmd->type ) {
+        case CMD_WRAP:
+            break;
+        case CMD_QUIT:
+            quit = 1;
+            break;
+        case CMD_ACTIVATE:
+            sstActivateProgram((sstProgram*)cmd->object);
+            break;
+        case CMD_UNIFORM:
+            un = &((sstProgram*)cmd->object)->uniforms[cmd->index];
+            memcpy(un->value, (char*)cmd + ALIGN(sizeof(command)),
+                   sstUniformSize(un));
+            sstUploadUniform(un, un->location, un->value);
+            break;
+        case CMD_PIPELINE:
+            sstBindPipeline((sstPipeline*)cmd->object);
+            break;
+        case CMD_DRAW:
+            sstDrawSet((sstDrawableSet*)cmd->object);
+            break;
+        case CMD_DRAW_INSTANCED:
+            sstDrawSetInstanced((sstDrawableSet*)cmd->object,
+                                (sstInstanceBuffer*)cmd->extra, cmd->index);
+            break;
+        case CMD_DRAW_LOD:
+            lod = (GLfloat*)((char*)cmd + ALIGN(sizeof(command)));
+            sstDrawSetLOD((sstDrawableSet*)cmd->object, lod, lod + 16,
+                          lod[32], lod[33]);
+            break;
+        case CMD_UPLOAD_SET:
+            sstRunUpload((sstDrawableSet*)cmd->object, (sstSetData*)cmd->extra);
+            break;
+        case CMD_FREE_SET:
+            sstFreeDrawableSet((sstDrawableSet*)cmd->object);
+            break;
+        case CMD_FREE_BUFFER:
+            sstFreeInstanceBuffer((sstInstanceBuffer*)cmd->object);
+            break;
+        case CMD_FREE_PROGRAM:
+            sstFreeProgram((sstProgram*)cmd->object);
+            break;
+        case CMD_CALL:
+            ((void (*)( void* ))cmd->extra)(cmd->object);
+            break;
+        case CMD_SWAP:
+            glfwSwapBuffers(window);
+            break;
+        }
+        /* Step 3: Give the room back, waking the writer if it is waiting */
+        at += size;
+        __atomic_store_n(&tail, at, __ATOMIC_SEQ_CST);
+        if( __atomic_exchange_n(&writer_asleep, 0, __ATOMIC_SEQ_CST) ) {
+            pthread_mutex_lock(&lock);
+            pthread_cond_signal(&space);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    sstForgetContext(window);
+    glfwMakeContextCurrent(NULL);
+    return NULL;
+}
+
+/*
+ * Private functions
+ */
+
+int sstRenderActivate( sstProgram *program ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    sstRingSendObject(CMD_ACTIVATE, program, NULL, 0);
+    return 1;
+}
+
+int sstRenderUniform( sstProgram *program, int index, GLvoid *data ) {
+    command *cmd;
+    GLuint size;
+    if( !sstSending() ) {
+        return 0;
+    }
+    size = sstUniformSize(&program->uniforms[index]);
+    if( ALIGN(sizeof(command)) + ALIGN(size) > ring_size / 2 ) {
+        printf("ERROR: Uniform [%s] is too big for the render ring\n",
+               program->uniforms[index].name);
+        return 1;
+    }
+    cmd = sstRingReserve(CMD_UNIFORM, ALIGN(sizeof(command)) + ALIGN(size));
+    cmd->object = program;
+    cmd->index = index;
+    memcpy((char*)cmd + ALIGN(sizeof(command)), data, size);
+    sstRingSend(cmd);
+    return 1;
+}
+
+int sstRenderPipeline( struct sstPipeline *pipeline ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    sstRingSendObject(CMD_PIPELINE, pipeline, NULL, 0);
+    return 1;
+}
+
+int sstRenderDraw( sstDrawableSet *set, sstInstanceBuffer *buffer,
+int count ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    if( buffer ) {
+        sstRingSendObject(CMD_DRAW_INSTANCED, set, buffer, count);
+    }
+    else {
+        sstRingSendObject(CMD_DRAW, set, NULL, 0);
+    }
+    return 1;
+}
+
+int sstRenderDrawLOD( sstDrawableSet *set, GLfloat *model, GLfloat *projection,
+GLfloat height, GLfloat pixels ) {
+    command *cmd;
+    GLfloat *lod;
+    if( !sstSending() ) {
+        return 0;
+    }
+    cmd = sstRingReserve(CMD_DRAW_LOD, ALIGN(sizeof(command))
+                                       + ALIGN(sizeof(GLfloat) * 34));
+    cmd->object = set;
+    lod = (GLfloat*)((char*)cmd + ALIGN(sizeof(command)));
+    memcpy(lod, model, sizeof(GLfloat) * 16);
+    memcpy(lod + 16, projection, sizeof(GLfloat) * 16);
+    lod[32] = height;
+    lod[33] = pixels;
+    sstRingSend(cmd);
+    return 1;
+}
+
+int sstRenderRemote( void ) {
+    return sst_threaded && sstSending();
+}
+
+int sstRenderUploadSet( sstDrawableSet *set, sstSetData *staged ) {
+    sstSetData *kept;
+    if( !sstSending() ) {
+        return 0;
+    }
+    /* The mesh work is done, so only copy what the caller may free */
+    kept = (sstSetData*)malloc(sizeof(sstSetData));
+    *kept = *staged;
+    sstKeepSetData(kept);
+    sstRingSendObject(CMD_UPLOAD_SET, set, kept, 0);
+    return 1;
+}
+
+int sstRenderFreeSet( sstDrawableSet *set ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    sstRingSendObject(CMD_FREE_SET, set, NULL, 0);
+    return 1;
+}
+
+int sstRenderFreeBuffer( sstInstanceBuffer *buffer ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    sstRingSendObject(CMD_FREE_BUFFER, buffer, NULL, 0);
+    return 1;
+}
+
+int sstRenderFreeProgram( sstProgram *program ) {
+    if( !sstSending() ) {
+        return 0;
+    }
+    sstRingSendObject(CMD_FREE_PROGRAM, program, NULL, 0);
+    return 1;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Starts the render thread, handing it the window's context, which must be
+ * current. The ring holds at least the given number of bytes.
+ */
+void sstStartRenderThread( GLFWwindow win, size_t bytes ) {
+    if( sst_threaded ) {
+        printf("ERROR: The render thread is already running\n");
+        return;
+    }
+    for( ring_size = MIN_RING; ring_size < bytes; ring_size *= 2 );
+    ring = (char*)malloc(ring_size);
+    head = 0;
+    tail = 0;
+    peak = 0;
+    stalls = 0;
+    window = win;
+    sst_threaded = 1;
+    glfwMakeContextCurrent(NULL);
+    pthread_create(&thread, NULL, sstRenderThread, NULL);
+}
+
+/*
+ * Has the render thread make every call sent to it, then stops it and makes
+ * the window's context current again.
+ */
+void sstStopRenderThread( void ) {
+    if( !sst_threaded ) {
+        return;
+    }
+    sstRingSendObject(CMD_QUIT, NULL, NULL, 0);
+    pthread_join(thread, NULL);
+    sst_threaded = 0;
+    free(ring);
+    ring = NULL;
+    glfwMakeContextCurrent(window);
+}
+
+/*
+ * Has the render thread call a function with the given argument.
+ */
+void sstRenderCall( void (*func)( void *arg ), void *arg ) {
+    if( !sst_threaded || !sstSending() ) {
+        func(arg);
+        return;
+    }
+    sstRingSendObject(CMD_CALL, arg, (void*)func, 0);
+}
+
+/*
+ * Has the render thread swap the window's buffers.
+ */
+void sstRenderSwap( void ) {
+    if( !sst_threaded ) {
+        return;
+    }
+    sstRingSendObject(CMD_SWAP, NULL, NULL, 0);
+}
+
+/*
+ * Waits for the render thread to make every call sent to it.
+ */
+void sstRenderFinish( void ) {
+    if( sst_threaded && sstSending() ) {
+        sstRingWait(0);
+    }
+}
+
+/*
+ * Gets the size of the ring, the bytes of it in use, the most in use at once,
+ * and the number of times the ring was too full to write to, since the stats
+ * were last reset. Resets them if reset is set.
+ */
+void sstRenderStats( size_t *size, size_t *used, size_t *most,
+unsigned long *waits, GLboolean reset ) {
+    if( size ) {
+        *size = ring_size;
+    }
+    if( used ) {
+        *used = sst_threaded ? head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)
+                             : 0;
+    }
+    if( most ) {
+        *most = peak;
+    }
+    if( waits ) {
+        *waits = stalls;
+    }
+    if( reset ) {
+        peak = 0;
+        stalls = 0;
+    }
+}
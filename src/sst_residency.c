@@ -0,0 +1,371 @@
+/*
+ * sst_residency.c
+ * By Steven Smith
+ *
+ * This file streams drawable sets in from an asset pack as they are asked
+ * for, keeping the bytes they take up on the GPU under a budget. A loader
+ * thread reads asked for sets from the disk into memory, since that can take
+ * any amount of time, and the main thread uploads them a few at a time each
+ * frame, freeing the sets that were drawn the longest time ago to make room.
+ * A set's proxy, a coarse version of it that is always kept, stands in for it
+ * until it's uploaded.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Default number of bytes uploaded by each sstUpdateResidency() */
+#define UPLOAD_BUDGET (8 << 20)
+
+/* States of a streamed set */
+#define SST_EVICTED 0 /* Not on the GPU */
+#define SST_LOADING 1 /* Waiting on the loader or for room */
+#define SST_RESIDENT 2 /* On the GPU */
+#define SST_FAILED 3 /* Could not be made from the pack */
+
+struct sstResident {
+    char *name; /* Of the set in the pack */
+    sstDrawableSet *set; /* NULL unless resident */
+    sstDrawableSet *proxy; /* Drawn in its place while it isn't, or NULL */
+    size_t bytes; /* Taken up by the set's buffers */
+    int state;
+    unsigned int frame; /* Frame the set was last asked for in */
+    int newer; /* Neighbours in the list of resident sets */
+    int older;
+    int next; /* Next set in the loader's lists, guarded by its lock */
+};
+
+struct sstLoader {
+    pthread_t thread;
+    pthread_mutex_t lock; /* Guards the lists and the array of sets */
+    pthread_cond_t wake;
+    int queued; /* Sets waiting to be read, first to last */
+    int queued_last;
+    int fetched; /* Sets read and waiting to be uploaded, first to last */
+    int fetched_last;
+    int quit;
+};
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Appends a set to one of the loader's lists. The lock must be held.
+ */
+static void sstAppend( sstResidency *res, int *first, int *last, int index ) {
+    res->sets[index].next = -1;
+    if( *last >= 0 ) {
+        res->sets[*last].next = index;
+    }
+    else {
+        *first = index;
+    }
+    *last = index;
+}
+
+/*
+ * Reads the sets queued by sstResidencyUse() into memory, one at a time,
+ * handing each back to the main thread once it's read.
+ */
+static void * sstLoaderThread( void *arg ) {
+    sstResidency *res;
+    struct sstLoader *loader;
+    const char *name;
+    int index;
+    res = (sstResidency*)arg;
+    loader = res->loader;
+    pthread_mutex_lock(&loader->lock);
+    while( !loader->quit ) {
+        if( loader->queued < 0 ) {
+            pthread_cond_wait(&loader->wake, &loader->lock);
+            continue;
+        }
+        index = loader->queued;
+        loader->queued = res->sets[index].next;
+        if( loader->queued < 0 ) {
+            loader->queued_last = -1;
+        }
+        /* Names never move, unlike the array holding them */
+        name = res->sets[index].name;
+        pthread_mutex_unlock(&loader->lock);
+        sstPackFetchSet(res->pack, name);
+        pthread_mutex_lock(&loader->lock);
+        sstAppend(res, &loader->fetched, &loader->fetched_last, index);
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+/*
+ * Takes a set out of the list of resident sets.
+ */
+static void sstUnlink( sstResidency *res, int index ) {
+    struct sstResident *r;
+    r = &res->sets[index];
+    if( r->newer >= 0 ) {
+        res->sets[r->newer].older = r->older;
+    }
+    else {
+        res->newest = r->older;
+    }
+    if( r->older >= 0 ) {
+        res->sets[r->older].newer = r->newer;
+    }
+    else {
+        res->oldest = r->newer;
+    }
+}
+
+/*
+ * Puts a set at the front of the list of resident sets.
+ */
+static void sstLinkNewest( sstResidency *res, int index ) {
+    struct sstResident *r;
+    r = &res->sets[index];
+    r->newer = -1;
+    r->older = res->newest;
+    if( res->newest >= 0 ) {
+        res->sets[res->newest].newer = index;
+    }
+    else {
+        res->oldest = index;
+    }
+    res->newest = index;
+}
+
+/*
+ * Frees the resident set that was drawn the longest time ago, unless it was
+ * asked for this frame. Returns 1 if a set was freed.
+ */
+static int sstEvictOldest( sstResidency *res ) {
+    struct sstResident *r;
+    if( res->oldest < 0 || res->sets[res->oldest].frame == res->frame ) {
+        return 0;
+    }
+    r = &res->sets[res->oldest];
+    sstUnlink(res, res->oldest);
+    sstFreeDrawableSet(r->set);
+    r->set = NULL;
+    r->state = SST_EVICTED;
+    res->resident -= r->bytes;
+    res->evictions++;
+    return 1;
+}
+
+/*
+ * Uploads a set the loader has read, making room for it first. Returns 0 if
+ * there's no room to be made, leaving the set to be asked for again.
+ */
+static int sstUpload( sstResidency *res, int index ) {
+    struct sstResident *r;
+    r = &res->sets[index];
+    while( res->resident + r->bytes > res->budget && sstEvictOldest(res) );
+    if( res->resident + r->bytes > res->budget ) {
+        return 0;
+    }
+    r->set = sstPackDrawableSet(res->pack, r->name, res->program);
+    if( !r->set ) {
+        r->state = SST_FAILED;
+        return 1;
+    }
+    r->state = SST_RESIDENT;
+    sstLinkNewest(res, index);
+    res->resident += r->bytes;
+    res->uploaded += r->bytes;
+    res->loads++;
+    return 1;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Creates a residency manager streaming sets from the given pack, made for
+ * the given program, and starts its loader thread.
+ */
+sstResidency * sstNewResidency( sstPack *pack, sstProgram *program,
+size_t budget ) {
+    sstResidency *res;
+    struct sstLoader *loader;
+    res = (sstResidency*)malloc(sizeof(sstResidency));
+    res->pack = pack;
+    res->program = program;
+    res->budget = budget;
+    res->upload_budget = UPLOAD_BUDGET;
+    res->resident = 0;
+    res->proxy_bytes = 0;
+    res->count = 0;
+    res->capacity = 0;
+    res->sets = NULL;
+    res->newest = -1;
+    res->oldest = -1;
+    res->frame = 0;
+    res->loads = 0;
+    res->evictions = 0;
+    res->pending = 0;
+    res->uploaded = 0;
+    loader = (struct sstLoader*)malloc(sizeof(struct sstLoader));
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->wake, NULL);
+    loader->queued = -1;
+    loader->queued_last = -1;
+    loader->fetched = -1;
+    loader->fetched_last = -1;
+    loader->quit = 0;
+    res->loader = loader;
+    pthread_create(&loader->thread, NULL, sstLoaderThread, res);
+    return res;
+}
+
+/*
+ * Adds the set with the given name in the pack, and uploads its proxy if it
+ * has one. Returns the index of the set, or -1 if the pack has no such set.
+ */
+int sstResidencyAdd( sstResidency *res, const char *name,
+const char *proxy ) {
+    struct sstResident *r;
+    size_t bytes;
+    /* Step 1: Look the set up in the pack */
+    bytes = (size_t)sstPackSetBytes(res->pack, name);
+    if( bytes == 0 ) {
+        return -1;
+    }
+    if( bytes > res->budget ) {
+        printf("WARN: Set %s is larger than the residency budget\n", name);
+    }
+    /* Step 2: Make room for it, out of the loader's way */
+    if( res->count == res->capacity ) {
+        pthread_mutex_lock(&res->loader->lock);
+        res->capacity = res->capacity * 2 + 16;
+        res->sets = (struct sstResident*)realloc(res->sets,
+                                                 sizeof(struct sstResident)
+                                                 * res->capacity);
+        pthread_mutex_unlock(&res->loader->lock);
+    }
+    r = &res->sets[res->count];
+    r->name = (char*)malloc(strlen(name) + 1);
+    strcpy(r->name, name);
+    r->set = NULL;
+    r->proxy = NULL;
+    r->bytes = bytes;
+    r->state = SST_EVICTED;
+    r->frame = 0;
+    r->newer = -1;
+    r->older = -1;
+    r->next = -1;
+    /* Step 3: Upload the proxy, which stays for as long as the set does */
+    if( proxy ) {
+        r->proxy = sstPackDrawableSet(res->pack, proxy, res->program);
+        if( r->proxy ) {
+            res->proxy_bytes += (size_t)sstPackSetBytes(res->pack, proxy);
+        }
+    }
+    return res->count++;
+}
+
+/*
+ * Marks the set with the given index as needed this frame. Returns the set if
+ * it's resident, else asks for it to be loaded and returns its proxy.
+ */
+sstDrawableSet * sstResidencyUse( sstResidency *res, int index ) {
+    struct sstResident *r;
+    r = &res->sets[index];
+    r->frame = res->frame;
+    if( r->state == SST_RESIDENT ) {
+        sstUnlink(res, index);
+        sstLinkNewest(res, index);
+        return r->set;
+    }
+    if( r->state == SST_EVICTED ) {
+        r->state = SST_LOADING;
+        res->pending++;
+        pthread_mutex_lock(&res->loader->lock);
+        sstAppend(res, &res->loader->queued, &res->loader->queued_last,
+                  index);
+        pthread_cond_signal(&res->loader->wake);
+        pthread_mutex_unlock(&res->loader->lock);
+    }
+    return r->proxy;
+}
+
+/*
+ * Uploads the sets the loader has read, in the order they were asked for,
+ * until the upload budget is used up, then ends the frame.
+ */
+void sstUpdateResidency( sstResidency *res ) {
+    struct sstLoader *loader;
+    struct sstResident *r;
+    int index, first, last;
+    loader = res->loader;
+    res->loads = 0;
+    res->evictions = 0;
+    res->uploaded = 0;
+    /* Step 1: Keep to the budget, which may have been lowered */
+    while( res->resident > res->budget && sstEvictOldest(res) );
+    /* Step 2: Take the sets the loader has read */
+    pthread_mutex_lock(&loader->lock);
+    first = loader->fetched;
+    last = loader->fetched_last;
+    loader->fetched = -1;
+    loader->fetched_last = -1;
+    pthread_mutex_unlock(&loader->lock);
+    /* Step 3: Upload them. Sets not asked for since the last frame are
+     * dropped, and at least one set is uploaded each frame so that sets
+     * larger than the upload budget still make it. */
+    for( index = first; index >= 0; index = first ) {
+        r = &res->sets[index];
+        if( r->frame + 1 >= res->frame && res->uploaded > 0
+            && res->uploaded + r->bytes > res->upload_budget ) {
+            break;
+        }
+        first = r->next;
+        if( r->frame + 1 < res->frame || !sstUpload(res, index) ) {
+            r->state = SST_EVICTED;
+        }
+        res->pending--;
+    }
+    /* Step 4: Hand back the sets there was no time for, ahead of any the
+     * loader read in the meantime */
+    if( first >= 0 ) {
+        pthread_mutex_lock(&loader->lock);
+        res->sets[last].next = loader->fetched;
+        if( loader->fetched < 0 ) {
+            loader->fetched_last = last;
+        }
+        loader->fetched = first;
+        pthread_mutex_unlock(&loader->lock);
+    }
+    res->frame++;
+}
+
+/*
+ * Stops the loader thread, then frees every set and proxy and the manager.
+ */
+void sstFreeResidency( sstResidency *res ) {
+    struct sstResident *r;
+    pthread_mutex_lock(&res->loader->lock);
+    res->loader->quit = 1;
+    pthread_cond_signal(&res->loader->wake);
+    pthread_mutex_unlock(&res->loader->lock);
+    pthread_join(res->loader->thread, NULL);
+    pthread_mutex_destroy(&res->loader->lock);
+    pthread_cond_destroy(&res->loader->wake);
+    for( r = res->sets; r < res->sets + res->count; r++ ) {
+        if( r->set ) {
+            sstFreeDrawableSet(r->set);
+        }
+        if( r->proxy ) {
+            sstFreeDrawableSet(r->proxy);
+        }
+        free(r->name);
+    }
+    free(res->sets);
+    free(res->loader);
+    free(res);
+}
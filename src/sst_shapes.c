@@ -0,0 +1,384 @@
+/*
+ * sst_shapes.c
+ * By Steven Smith
+ *
+ * This file contains generators for common shapes: spheres, grids, tori and
+ * capsules. Each is a grid of vertices laid out over two parameters, so they
+ * share the code that writes the triangles, which walks the grid in narrow
+ * bands so that each row of a band is still in the vertex cache when the next
+ * row uses it. Shapes can be written to any memory, including mapped buffers,
+ * and sets can be made from them without any copy in between.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Width of the bands of quads triangles are written in. Two rows of a band,
+ * BAND + 1 vertices each, fit in a 16 entry vertex cache. */
+#define BAND 7
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Returns the number of rows of vertices in a shape, or 0 if the tessellation
+ * is too coarse for it.
+ */
+static int sstShapeRows( int shape, int rings, int segments ) {
+    switch( shape ) {
+    case SST_SPHERE:
+        return rings >= 2 && segments >= 3 ? rings + 1 : 0;
+    case SST_GRID:
+        return rings >= 1 && segments >= 1 ? rings + 1 : 0;
+    case SST_TORUS:
+        return rings >= 3 && segments >= 3 ? rings + 1 : 0;
+    case SST_CAPSULE:
+        /* A hemisphere above and below, meeting the cylinder at two rows */
+        return rings >= 1 && segments >= 3 ? rings * 2 + 2 : 0;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Returns whether the first and last rows of a shape all sit on one point.
+ * Triangles touching those rows along an edge are left out.
+ */
+static int sstShapePoles( int shape ) {
+    return shape == SST_SPHERE || shape == SST_CAPSULE;
+}
+
+/*
+ * Fills in the position, normal and texture coordinates of the vertex in the
+ * given row and column of a shape. Rows run from the top of the shape to the
+ * bottom (or the far edge of a grid to the near one), and columns run counter-
+ * clockwise around it seen from above, so that triangles face out.
+ */
+static void sstShapeVertex( int shape, int row, int column, int rings,
+int segments, GLfloat a, GLfloat b, GLfloat *position, GLfloat *normal,
+GLfloat *texcoord ) {
+    GLfloat n[3], p[3], u, v, theta, phi, y, length;
+    u = (GLfloat)column / segments;
+    v = (GLfloat)row / rings;
+    theta = 2.0f * (GLfloat)M_PI * u;
+    switch( shape ) {
+    case SST_SPHERE:
+        phi = (GLfloat)M_PI * v;
+        n[0] = sinf(phi) * cosf(theta);
+        n[1] = cosf(phi);
+        n[2] = sinf(phi) * sinf(theta);
+        p[0] = n[0] * a;
+        p[1] = n[1] * a;
+        p[2] = n[2] * a;
+        break;
+    case SST_GRID:
+        n[0] = n[2] = 0.0f;
+        n[1] = 1.0f;
+        p[0] = (u - 0.5f) * a;
+        p[1] = 0.0f;
+        p[2] = (0.5f - v) * b;
+        break;
+    case SST_TORUS:
+        /* a is the radius of the ring, b of the tube around it */
+        phi = 2.0f * (GLfloat)M_PI * v;
+        n[0] = cosf(phi) * cosf(theta);
+        n[1] = -sinf(phi);
+        n[2] = cosf(phi) * sinf(theta);
+        p[0] = a * cosf(theta) + n[0] * b;
+        p[1] = n[1] * b;
+        p[2] = a * sinf(theta) + n[2] * b;
+        break;
+    default:
+        /* Capsules: a is the radius, b the length of the cylinder. The upper
+         * rows are the top hemisphere, lifted by half the cylinder. */
+        if( row <= rings ) {
+            phi = 0.5f * (GLfloat)M_PI * row / rings;
+            y = 0.5f * b;
+        }
+        else {
+            phi = 0.5f * (GLfloat)M_PI * (1.0f + (GLfloat)(row - rings - 1)
+                                                 / rings);
+            y = -0.5f * b;
+        }
+        n[0] = sinf(phi) * cosf(theta);
+        n[1] = cosf(phi);
+        n[2] = sinf(phi) * sinf(theta);
+        p[0] = n[0] * a;
+        p[1] = n[1] * a + y;
+        p[2] = n[2] * a;
+        /* Texture coordinates follow the length of the outline */
+        length = (GLfloat)M_PI * a + b;
+        v = (phi * a + (row > rings ? b : 0.0f)) / length;
+        break;
+    }
+    if( position ) {
+        memcpy(position, p, sizeof(GLfloat) * 3);
+    }
+    if( normal ) {
+        memcpy(normal, n, sizeof(GLfloat) * 3);
+    }
+    if( texcoord ) {
+        texcoord[0] = u;
+        texcoord[1] = v;
+    }
+}
+
+/*
+ * Fills in the bounding box and sphere of a shape.
+ */
+static void sstShapeBounds( int shape, GLfloat a, GLfloat b,
+sstDrawableSet *set ) {
+    GLfloat extent[3];
+    int c;
+    switch( shape ) {
+    case SST_SPHERE:
+        extent[0] = extent[1] = extent[2] = a;
+        set->radius = a;
+        break;
+    case SST_GRID:
+        extent[0] = 0.5f * a;
+        extent[1] = 0.0f;
+        extent[2] = 0.5f * b;
+        set->radius = sqrtf(extent[0] * extent[0] + extent[2] * extent[2]);
+        break;
+    case SST_TORUS:
+        extent[0] = extent[2] = a + b;
+        extent[1] = b;
+        set->radius = a + b;
+        break;
+    default:
+        extent[0] = extent[2] = a;
+        extent[1] = a + 0.5f * b;
+        set->radius = a + 0.5f * b;
+        break;
+    }
+    for( c = 0; c < 3; c++ ) {
+        set->low[c] = -extent[c];
+        set->high[c] = extent[c];
+        set->center[c] = 0.0f;
+    }
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Fills in the number of vertices and indices a shape is made of. Returns 0
+ * if the tessellation is too coarse for the shape.
+ */
+int sstShapeCounts( int shape, int rings, int segments, int *count,
+int *i_count ) {
+    int rows, tris;
+    rows = sstShapeRows(shape, rings, segments);
+    if( rows == 0 ) {
+        printf("WARN: Invalid shape or tessellation!\n");
+        *count = *i_count = 0;
+        return 0;
+    }
+    tris = 2 * (rows - 1) * segments;
+    if( sstShapePoles(shape) ) {
+        tris -= 2 * segments;
+    }
+    *count = rows * (segments + 1);
+    *i_count = tris * 3;
+    return 1;
+}
+
+/*
+ * Writes the vertices and indices of a shape. Any of the outputs may be NULL.
+ */
+void sstGenerateShape( int shape, int rings, int segments, GLfloat a,
+GLfloat b, GLfloat *positions, GLfloat *normals, GLfloat *texcoords,
+void *indices, GLenum i_type, GLuint base ) {
+    int rows, columns, row, column, band, end, n, v, poles;
+    GLuint corner[4];
+    rows = sstShapeRows(shape, rings, segments);
+    if( rows == 0 ) {
+        printf("WARN: Invalid shape or tessellation!\n");
+        return;
+    }
+    columns = segments + 1;
+    /* Step 1: Vertices, row by row */
+    for( row = 0; row < rows; row++ ) {
+        for( column = 0; column < columns; column++ ) {
+            v = row * columns + column;
+            sstShapeVertex(shape, row, column, rings, segments, a, b,
+                           positions ? &positions[v*3] : NULL,
+                           normals ? &normals[v*3] : NULL,
+                           texcoords ? &texcoords[v*2] : NULL);
+        }
+    }
+    if( !indices ) {
+        return;
+    }
+    /* Step 2: Triangles, a band of columns at a time */
+    poles = sstShapePoles(shape);
+    n = 0;
+    for( band = 0; band < segments; band += BAND ) {
+        end = band + BAND < segments ? band + BAND : segments;
+        for( row = 0; row < rows - 1; row++ ) {
+            for( column = band; column < end; column++ ) {
+                corner[0] = base + row * columns + column;
+                corner[1] = corner[0] + 1;
+                corner[2] = corner[0] + columns;
+                corner[3] = corner[2] + 1;
+                if( !poles || row > 0 ) {
+                    sstPutIndex(indices, i_type, n++, corner[0]);
+                    sstPutIndex(indices, i_type, n++, corner[1]);
+                    sstPutIndex(indices, i_type, n++, corner[2]);
+                }
+                if( !poles || row < rows - 2 ) {
+                    sstPutIndex(indices, i_type, n++, corner[1]);
+                    sstPutIndex(indices, i_type, n++, corner[3]);
+                    sstPutIndex(indices, i_type, n++, corner[2]);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Generates an indexed drawable set holding a shape, with its positions,
+ * normals and texture coordinates going to the inputs with the given names.
+ * The shape is written straight into mapped buffers.
+ */
+sstDrawableSet * sstDrawableSetShape( sstProgram *program, int shape,
+int rings, int segments, GLfloat a, GLfloat b, char *position, char *normal,
+char *texcoord ) {
+    static const GLuint components[] = { 3, 3, 2 };
+    sstDrawableSet *set;
+    sstDrawable *drawable;
+    in_var *inputs[3], *slots[3];
+    void *data[3], *mapped[3], *indices;
+    char *names[3];
+    GLenum i_type;
+    int i, size, count, i_count, direct;
+    if( !sstShapeCounts(shape, rings, segments, &count, &i_count) ) {
+        return NULL;
+    }
+    /* Step 1: Match the names to inputs, which need to cover every per-vertex
+     * input of the program */
+    names[0] = position;
+    names[1] = normal;
+    names[2] = texcoord;
+    size = 0;
+    direct = !program->mesh_passes && !program->build_bvh
+          && !sstRenderRemote();
+    for( i = 0; i < 3; i++ ) {
+        slots[i] = names[i] ? sstFindInput(program, names[i]) : NULL;
+        if( names[i] && !slots[i] ) {
+            printf("ERROR: Input variable [%s] does not exist!\n", names[i]);
+            return NULL;
+        }
+        if( !slots[i] ) {
+            continue;
+        }
+        if( slots[i]->type != GL_FLOAT || slots[i]->components != components[i]
+         || slots[i]->divisor ) {
+            printf("ERROR: Input variable [%s] can't hold shape data!\n",
+                   names[i]);
+            return NULL;
+        }
+        direct = direct && slots[i]->compress == SST_UNCOMPRESSED;
+        inputs[size++] = slots[i];
+    }
+    if( size != program->in_count - program->inst_count ) {
+        printf("ERROR: Shapes only fill positions, normals and texcoords!\n");
+        return NULL;
+    }
+    /* Step 2: Sets that are processed or compressed need the data on the
+     * CPU, so they go the usual way, as do sets for the render thread to
+     * build */
+    if( !direct ) {
+        for( i = 0, size = 0; i < 3; i++ ) {
+            mapped[i] = slots[i] ? malloc(sizeof(GLfloat) * components[i]
+                                          * count) : NULL;
+            if( slots[i] ) {
+                data[size++] = mapped[i];
+            }
+        }
+        indices = malloc(sizeof(GLuint) * i_count);
+        sstGenerateShape(shape, rings, segments, a, b, (GLfloat*)mapped[0],
+                         (GLfloat*)mapped[1], (GLfloat*)mapped[2], indices,
+                         GL_UNSIGNED_INT, 0);
+        set = sstBuildDrawableSet(program, GL_TRIANGLES, count, indices,
+                                  GL_UNSIGNED_INT, i_count, inputs, data);
+        for( i = 0; i < 3; i++ ) {
+            free(mapped[i]);
+        }
+        free(indices);
+        return set;
+    }
+    /* Step 3: Set up the set, with the narrowest index type that fits */
+    set = (sstDrawableSet*)malloc(sizeof(sstDrawableSet));
+    set->size = size;
+    set->mode = GL_TRIANGLES;
+    set->count = count;
+    set->inst_id = 0;
+    set->lod_count = 0;
+    set->lods = NULL;
+    set->bvh = NULL;
+    sstResetDecode(set);
+    sstShapeBounds(shape, a, b, set);
+    if( (GLuint)count - 1 <= sstMaxIndex(GL_UNSIGNED_BYTE) ) {
+        i_type = GL_UNSIGNED_BYTE;
+    }
+    else if( (GLuint)count - 1 <= sstMaxIndex(GL_UNSIGNED_SHORT) ) {
+        i_type = GL_UNSIGNED_SHORT;
+    }
+    else {
+        i_type = GL_UNSIGNED_INT;
+    }
+    set->i_size = i_count;
+    set->i_type = i_type;
+    glGenVertexArrays(1, &set->vao);
+    sstBindVertexArray(set->vao);
+    /* Step 4: Make room in each buffer and map it */
+    glGenBuffers(1, &set->i_buffer);
+    sstBindBuffer(GL_ELEMENT_ARRAY_BUFFER, set->i_buffer);
+    sstBufferWords(GL_ELEMENT_ARRAY_BUFFER, sstSizeFromEnum(i_type) * i_count,
+                   NULL);
+    indices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0,
+                               sstSizeFromEnum(i_type) * i_count,
+                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    set->drawables = (sstDrawable*)malloc(sizeof(sstDrawable) * set->size);
+    drawable = set->drawables;
+    for( i = 0; i < 3; i++ ) {
+        mapped[i] = NULL;
+        if( !slots[i] ) {
+            continue;
+        }
+        sstInitDrawable(drawable, slots[i]);
+        glGenBuffers(1, &drawable->buffer);
+        sstBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
+        glBufferData(GL_ARRAY_BUFFER, sstVertexSize(drawable) * count, NULL,
+                     GL_STATIC_DRAW);
+        mapped[i] = glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                     sstVertexSize(drawable) * count,
+                                     GL_MAP_WRITE_BIT
+                                     | GL_MAP_INVALIDATE_BUFFER_BIT);
+        drawable++;
+    }
+    /* Step 5: Write the shape, then unmap everything */
+    sstGenerateShape(shape, rings, segments, a, b, (GLfloat*)mapped[0],
+                     (GLfloat*)mapped[1], (GLfloat*)mapped[2], indices, i_type,
+                     0);
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    for( drawable = set->drawables; drawable < set->drawables + set->size;
+         drawable++ ) {
+        sstBindBuffer(GL_ARRAY_BUFFER, drawable->buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        sstAttribPointers(drawable);
+    }
+    return set;
+}
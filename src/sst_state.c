@@ -0,0 +1,590 @@
+/*
+ * sst_state.c
+ * By Steven Smith
+ *
+ * This file keeps a copy of the GL state the toolkit sets, one per context, so
+ * that binds and enables which wouldn't change anything never reach the
+ * driver. Each thread remembers the copy for the context it last drew with,
+ * and only looks it up again when a different context is current.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+/* Stands in for a binding or setting the copy doesn't know */
+#define UNKNOWN 0xFFFFFFFF
+
+/* Number of texture units whose bindings are kept */
+#define TEXTURE_UNITS 16
+
+/* Buffer targets whose bindings are kept */
+#define ARRAY_SLOT 0
+#define ELEMENT_SLOT 1
+#define COPY_READ_SLOT 2
+#define COPY_WRITE_SLOT 3
+#define UNIFORM_SLOT 4
+#define INDIRECT_SLOT 5
+#define STORAGE_SLOT 6
+#define BUFFER_SLOTS 7
+
+typedef struct cache {
+    GLFWwindow context; /* NULL once forgotten, to be used again */
+    GLuint program;
+    GLuint vao;
+    GLuint buffers[BUFFER_SLOTS];
+    GLuint unit; /* Active texture unit */
+    GLenum targets[TEXTURE_UNITS]; /* Of the last texture bound to each unit */
+    GLuint textures[TEXTURE_UNITS];
+    GLuint depth_test;
+    GLuint blend;
+    GLuint cull;
+    GLuint stencil_test;
+    GLuint depth_mask;
+    GLuint depth_func;
+    GLuint blend_func[2]; /* Source and destination factors */
+    GLuint blend_equation;
+    GLuint cull_face;
+    GLuint front_face;
+    GLuint stencil_func[3]; /* Function, reference and mask */
+    GLuint stencil_op[3]; /* Stencil fail, depth fail and pass */
+    GLuint stencil_write;
+    int stencil_write_known; /* Every mask is valid, so UNKNOWN won't do */
+    GLuint color_mask;
+    GLuint viewport[4];
+    struct sstPipeline *pipeline; /* Last bound with sstBindPipeline() */
+    unsigned long hits;
+    unsigned long misses;
+    struct cache *next;
+} cache;
+
+/* Every copy made so far, guarded by the lock */
+static cache *caches = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The copy each thread last used */
+static pthread_key_t key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Helper functions
+ */
+
+static void sstMakeKey( void ) {
+    pthread_key_create(&key, NULL);
+}
+
+/*
+ * Forgets everything in a copy, so the next call for each piece of state goes
+ * to GL.
+ */
+static void sstClearCache( cache *c ) {
+    int i;
+    c->program = UNKNOWN;
+    c->vao = UNKNOWN;
+    for( i = 0; i < BUFFER_SLOTS; i++ ) {
+        c->buffers[i] = UNKNOWN;
+    }
+    c->unit = UNKNOWN;
+    for( i = 0; i < TEXTURE_UNITS; i++ ) {
+        c->targets[i] = 0;
+        c->textures[i] = UNKNOWN;
+    }
+    c->depth_test = UNKNOWN;
+    c->blend = UNKNOWN;
+    c->cull = UNKNOWN;
+    c->stencil_test = UNKNOWN;
+    c->depth_mask = UNKNOWN;
+    c->depth_func = UNKNOWN;
+    c->blend_func[0] = c->blend_func[1] = UNKNOWN;
+    c->blend_equation = UNKNOWN;
+    c->cull_face = UNKNOWN;
+    c->front_face = UNKNOWN;
+    for( i = 0; i < 3; i++ ) {
+        c->stencil_func[i] = UNKNOWN;
+        c->stencil_op[i] = UNKNOWN;
+    }
+    c->stencil_write_known = 0;
+    c->color_mask = UNKNOWN;
+    for( i = 0; i < 4; i++ ) {
+        c->viewport[i] = UNKNOWN;
+    }
+    c->pipeline = NULL;
+}
+
+/*
+ * Returns the copy for the current context, making it if needed.
+ */
+static cache * sstCurrentCache( void ) {
+    GLFWwindow context;
+    cache *c, *unused;
+    context = glfwGetCurrentContext();
+    pthread_once(&key_once, sstMakeKey);
+    c = (cache*)pthread_getspecific(key);
+    if( c && c->context == context ) {
+        return c;
+    }
+    /* Step 1: Find it among the other threads' copies */
+    pthread_mutex_lock(&lock);
+    unused = NULL;
+    for( c = caches; c; c = c->next ) {
+        if( c->context == context ) {
+            break;
+        }
+        if( !c->context ) {
+            unused = c;
+        }
+    }
+    /* Step 2: Make one, starting out knowing nothing, since the context may
+     * have been drawn with before the toolkit got to it */
+    if( !c ) {
+        c = unused;
+        if( !c ) {
+            c = (cache*)malloc(sizeof(cache));
+            c->next = caches;
+            caches = c;
+        }
+        c->context = context;
+        c->hits = 0;
+        c->misses = 0;
+        sstClearCache(c);
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(key, c);
+    return c;
+}
+
+/*
+ * Returns the slot a buffer target's binding is kept in, or -1 if it isn't
+ * kept.
+ */
+static int sstBufferSlot( GLenum target ) {
+    switch( target ) {
+        case GL_ARRAY_BUFFER:
+            return ARRAY_SLOT;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            return ELEMENT_SLOT;
+        case GL_COPY_READ_BUFFER:
+            return COPY_READ_SLOT;
+        case GL_COPY_WRITE_BUFFER:
+            return COPY_WRITE_SLOT;
+        case GL_UNIFORM_BUFFER:
+            return UNIFORM_SLOT;
+#ifdef GL_DRAW_INDIRECT_BUFFER
+        case GL_DRAW_INDIRECT_BUFFER:
+            return INDIRECT_SLOT;
+#endif
+#ifdef GL_SHADER_STORAGE_BUFFER
+        case GL_SHADER_STORAGE_BUFFER:
+            return STORAGE_SLOT;
+#endif
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Sets a piece of state in the copy, returning 1 if it changed and so has to
+ * be set in GL too.
+ */
+static int sstChange( cache *c, GLuint *state, GLuint value ) {
+    if( *state == value ) {
+        c->hits++;
+        return 0;
+    }
+    *state = value;
+    c->misses++;
+    return 1;
+}
+
+/*
+ * Sets n pieces of state set with one call, returning 1 if any changed.
+ */
+static int sstChangeAll( cache *c, GLuint *state, GLuint *values, int n ) {
+    if( memcmp(state, values, sizeof(GLuint) * n) == 0 ) {
+        c->hits++;
+        return 0;
+    }
+    memcpy(state, values, sizeof(GLuint) * n);
+    c->misses++;
+    return 1;
+}
+
+/*
+ * Returns where a capability's setting is kept, or NULL if it isn't kept.
+ */
+static GLuint * sstCapability( cache *c, GLenum cap ) {
+    switch( cap ) {
+        case GL_DEPTH_TEST:
+            return &c->depth_test;
+        case GL_BLEND:
+            return &c->blend;
+        case GL_CULL_FACE:
+            return &c->cull;
+        case GL_STENCIL_TEST:
+            return &c->stencil_test;
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Private functions
+ */
+
+/*
+ * Makes the given GL program current.
+ */
+void sstUseProgram( GLuint program ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->program, program) ) {
+        glUseProgram(program);
+    }
+}
+
+/*
+ * Returns where the pipeline bound in the current context is kept.
+ */
+struct sstPipeline ** sstBoundPipeline( void ) {
+    return &sstCurrentCache()->pipeline;
+}
+
+/*
+ * Forgets a pipeline that is being freed in every context it's bound in.
+ */
+void sstForgetPipeline( struct sstPipeline *pipeline ) {
+    cache *c;
+    pthread_mutex_lock(&lock);
+    for( c = caches; c; c = c->next ) {
+        if( c->pipeline == pipeline ) {
+            c->pipeline = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Binds a buffer to an indexed target, which binds it to the target itself
+ * too. Indexed bindings aren't kept, so this always goes to GL.
+ */
+void sstBindBufferBase( GLenum target, GLuint index, GLuint buffer ) {
+    cache *c;
+    int slot;
+    c = sstCurrentCache();
+    slot = sstBufferSlot(target);
+    if( slot >= 0 ) {
+        c->buffers[slot] = buffer;
+    }
+    c->misses++;
+    glBindBufferBase(target, index, buffer);
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Binds a vertex array. The element array binding belongs to the vertex
+ * array, so it is forgotten whenever another one is bound.
+ */
+void sstBindVertexArray( GLuint vao ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->vao, vao) ) {
+        c->buffers[ELEMENT_SLOT] = UNKNOWN;
+        glBindVertexArray(vao);
+    }
+}
+
+/*
+ * Binds a buffer to a target.
+ */
+void sstBindBuffer( GLenum target, GLuint buffer ) {
+    cache *c;
+    int slot;
+    c = sstCurrentCache();
+    slot = sstBufferSlot(target);
+    if( slot < 0 ) {
+        c->misses++;
+        glBindBuffer(target, buffer);
+    }
+    else if( sstChange(c, &c->buffers[slot], buffer) ) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+/*
+ * Binds a texture to a target of the given texture unit, counting from 0.
+ */
+void sstBindTexture( GLuint unit, GLenum target, GLuint texture ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( unit >= TEXTURE_UNITS ) {
+        c->misses += 2;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        c->unit = unit;
+        glBindTexture(target, texture);
+        return;
+    }
+    if( c->targets[unit] == target && c->textures[unit] == texture ) {
+        c->hits++;
+        return;
+    }
+    if( sstChange(c, &c->unit, unit) ) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    c->targets[unit] = target;
+    c->textures[unit] = texture;
+    c->misses++;
+    glBindTexture(target, texture);
+}
+
+/*
+ * Enable or disable a capability. Only depth testing, blending, face culling
+ * and stencil testing are kept; anything else always goes to GL.
+ */
+void sstEnable( GLenum cap ) {
+    cache *c;
+    GLuint *state;
+    c = sstCurrentCache();
+    if( (state = sstCapability(c, cap)) && !sstChange(c, state, GL_TRUE) ) {
+        return;
+    }
+    if( !state ) {
+        c->misses++;
+    }
+    glEnable(cap);
+}
+
+void sstDisable( GLenum cap ) {
+    cache *c;
+    GLuint *state;
+    c = sstCurrentCache();
+    if( (state = sstCapability(c, cap)) && !sstChange(c, state, GL_FALSE) ) {
+        return;
+    }
+    if( !state ) {
+        c->misses++;
+    }
+    glDisable(cap);
+}
+
+void sstDepthFunc( GLenum func ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->depth_func, func) ) {
+        glDepthFunc(func);
+    }
+}
+
+void sstDepthMask( GLboolean flag ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->depth_mask, flag ? GL_TRUE : GL_FALSE) ) {
+        glDepthMask(flag);
+    }
+}
+
+void sstBlendFunc( GLenum src, GLenum dst ) {
+    cache *c;
+    GLuint values[2];
+    c = sstCurrentCache();
+    values[0] = src;
+    values[1] = dst;
+    if( sstChangeAll(c, c->blend_func, values, 2) ) {
+        glBlendFunc(src, dst);
+    }
+}
+
+void sstBlendEquation( GLenum mode ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->blend_equation, mode) ) {
+        glBlendEquation(mode);
+    }
+}
+
+void sstCullFace( GLenum mode ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->cull_face, mode) ) {
+        glCullFace(mode);
+    }
+}
+
+void sstFrontFace( GLenum mode ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( sstChange(c, &c->front_face, mode) ) {
+        glFrontFace(mode);
+    }
+}
+
+void sstStencilFunc( GLenum func, GLint ref, GLuint mask ) {
+    cache *c;
+    GLuint values[3];
+    c = sstCurrentCache();
+    values[0] = func;
+    values[1] = (GLuint)ref;
+    values[2] = mask;
+    if( sstChangeAll(c, c->stencil_func, values, 3) ) {
+        glStencilFunc(func, ref, mask);
+    }
+}
+
+void sstStencilOp( GLenum sfail, GLenum dpfail, GLenum dppass ) {
+    cache *c;
+    GLuint values[3];
+    c = sstCurrentCache();
+    values[0] = sfail;
+    values[1] = dpfail;
+    values[2] = dppass;
+    if( sstChangeAll(c, c->stencil_op, values, 3) ) {
+        glStencilOp(sfail, dpfail, dppass);
+    }
+}
+
+void sstStencilMask( GLuint mask ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( c->stencil_write_known && c->stencil_write == mask ) {
+        c->hits++;
+        return;
+    }
+    c->stencil_write = mask;
+    c->stencil_write_known = 1;
+    c->misses++;
+    glStencilMask(mask);
+}
+
+void sstColorMask( GLboolean r, GLboolean g, GLboolean b, GLboolean a ) {
+    cache *c;
+    GLuint mask;
+    c = sstCurrentCache();
+    mask = (r ? 1 : 0) | (g ? 2 : 0) | (b ? 4 : 0) | (a ? 8 : 0);
+    if( sstChange(c, &c->color_mask, mask) ) {
+        glColorMask(r, g, b, a);
+    }
+}
+
+void sstViewport( GLint x, GLint y, GLsizei width, GLsizei height ) {
+    cache *c;
+    GLuint values[4];
+    c = sstCurrentCache();
+    values[0] = (GLuint)x;
+    values[1] = (GLuint)y;
+    values[2] = (GLuint)width;
+    values[3] = (GLuint)height;
+    if( sstChangeAll(c, c->viewport, values, 4) ) {
+        glViewport(x, y, width, height);
+    }
+}
+
+/*
+ * Delete GL objects, unbinding them in the copy as GL does in the context, so
+ * that an object given the same name later still gets bound.
+ */
+void sstDeleteBuffers( GLsizei n, GLuint *buffers ) {
+    cache *c;
+    int i, j;
+    c = sstCurrentCache();
+    for( i = 0; i < n; i++ ) {
+        for( j = 0; j < BUFFER_SLOTS; j++ ) {
+            if( buffers[i] && c->buffers[j] == buffers[i] ) {
+                c->buffers[j] = 0;
+            }
+        }
+    }
+    glDeleteBuffers(n, buffers);
+}
+
+void sstDeleteVertexArrays( GLsizei n, GLuint *vaos ) {
+    cache *c;
+    int i;
+    c = sstCurrentCache();
+    for( i = 0; i < n; i++ ) {
+        if( vaos[i] && c->vao == vaos[i] ) {
+            c->vao = 0;
+            c->buffers[ELEMENT_SLOT] = UNKNOWN;
+        }
+    }
+    glDeleteVertexArrays(n, vaos);
+}
+
+void sstDeleteTextures( GLsizei n, GLuint *textures ) {
+    cache *c;
+    int i, j;
+    c = sstCurrentCache();
+    for( i = 0; i < n; i++ ) {
+        for( j = 0; j < TEXTURE_UNITS; j++ ) {
+            if( textures[i] && c->textures[j] == textures[i] ) {
+                c->textures[j] = 0;
+            }
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+/*
+ * Forgets the state kept for the current context, for when it has been
+ * changed with GL directly.
+ */
+void sstInvalidateState( void ) {
+    sstClearCache(sstCurrentCache());
+}
+
+/*
+ * Gets the number of calls for the current context that were skipped and that
+ * went to GL, then starts counting again from 0 if reset is set.
+ */
+void sstStateStats( unsigned long *hits, unsigned long *misses,
+GLboolean reset ) {
+    cache *c;
+    c = sstCurrentCache();
+    if( hits ) {
+        *hits = c->hits;
+    }
+    if( misses ) {
+        *misses = c->misses;
+    }
+    if( reset ) {
+        c->hits = 0;
+        c->misses = 0;
+    }
+}
+
+/*
+ * Forgets the state kept for a context that is about to be destroyed. Its
+ * memory is kept for the next context drawn with, since other threads may
+ * still be holding on to it.
+ */
+void sstForgetContext( GLFWwindow context ) {
+    cache *c;
+    pthread_mutex_lock(&lock);
+    for( c = caches; c; c = c->next ) {
+        if( c->context == context ) {
+            c->context = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Frees the state kept for every context. No other thread may be drawing.
+ */
+void sstFreeStateCaches( void ) {
+    cache *c;
+    pthread_mutex_lock(&lock);
+    while( caches ) {
+        c = caches;
+        caches = c->next;
+        free(c);
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_once(&key_once, sstMakeKey);
+    pthread_setspecific(key, NULL);
+}
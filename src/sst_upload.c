@@ -0,0 +1,250 @@
+/*
+ * sst_upload.c
+ * By Steven Smith
+ *
+ * This file creates drawable sets without holding up the render thread. A
+ * worker thread, with a context of its own sharing objects with the render
+ * thread's, processes each set's meshes and fills its buffers, then puts a
+ * fence in behind the uploads. The render thread checks the fence without
+ * waiting on it, and once the GPU has the data, makes the set's vertex array,
+ * which is the only part that can't be shared between contexts.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "sst.h"
+#include "sst_private.h"
+
+struct sstAsyncSet {
+    /* Arguments to sstFillDrawableSet() */
+    sstProgram *program;
+    GLenum mode;
+    int count;
+    void *indices;
+    GLenum i_type;
+    int i_count;
+    in_var **inputs;
+    void **data;
+    /* Filled in by the worker */
+    sstDrawableSet *set;
+    GLsync fence; /* Signaled once the GPU has the set's buffers */
+    int done; /* Guarded by the uploader's lock */
+    struct sstAsyncSet *next; /* Next set waiting to be uploaded */
+};
+
+struct sstUploader {
+    GLFWwindow context; /* Hidden window whose context the worker uses */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct sstAsyncSet *first; /* Sets waiting to be uploaded */
+    struct sstAsyncSet *last;
+    int quit;
+    int outstanding; /* Sets queued and not yet collected */
+};
+
+/*
+ * Helper functions
+ */
+
+/*
+ * Uploads queued sets one at a time, in the order they were queued, until
+ * told to quit with none left.
+ */
+static void * sstUploadThread( void *arg ) {
+    sstUploader *up;
+    sstAsyncSet *async;
+    up = (sstUploader*)arg;
+    glfwMakeContextCurrent(up->context);
+    pthread_mutex_lock(&up->lock);
+    while( up->first || !up->quit ) {
+        if( !up->first ) {
+            pthread_cond_wait(&up->wake, &up->lock);
+            continue;
+        }
+        async = up->first;
+        up->first = async->next;
+        if( !up->first ) {
+            up->last = NULL;
+        }
+        pthread_mutex_unlock(&up->lock);
+        /* Step 1: Fill the buffers, and fence them off. The flush sends the
+         * fence on, so the render thread sees it signal. */
+        async->set = sstFillDrawableSet(async->program, async->mode,
+                                        async->count, async->indices,
+                                        async->i_type, async->i_count,
+                                        async->inputs, async->data);
+        async->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        free(async->inputs);
+        free(async->data);
+        /* The set's buffers may be deleted in another context, and their
+         * names given out again, while still bound in this one */
+        sstInvalidateState();
+        /* Step 2: Hand it back */
+        pthread_mutex_lock(&up->lock);
+        async->done = 1;
+    }
+    pthread_mutex_unlock(&up->lock);
+    sstForgetContext(up->context);
+    glfwMakeContextCurrent(NULL);
+    return NULL;
+}
+
+/*
+ * Queues a set for the worker to upload.
+ */
+static sstAsyncSet * sstQueueSet( sstUploader *up, sstProgram *program,
+GLenum mode, int count, void *indices, GLenum i_type, int i_count,
+va_list ap ) {
+    sstAsyncSet *async;
+    int size;
+    async = (sstAsyncSet*)malloc(sizeof(sstAsyncSet));
+    async->program = program;
+    async->mode = mode;
+    async->count = count;
+    async->indices = indices;
+    async->i_type = i_type;
+    async->i_count = i_count;
+    size = program->in_count - program->inst_count;
+    async->inputs = (in_var**)malloc(sizeof(in_var*) * size);
+    async->data = (void**)malloc(sizeof(void*) * size);
+    if( !sstReadInputs(program, size, ap, async->inputs, async->data) ) {
+        free(async->inputs);
+        free(async->data);
+        free(async);
+        return NULL;
+    }
+    async->set = NULL;
+    async->fence = 0;
+    async->done = 0;
+    async->next = NULL;
+    up->outstanding++;
+    pthread_mutex_lock(&up->lock);
+    if( up->last ) {
+        up->last->next = async;
+    }
+    else {
+        up->first = async;
+    }
+    up->last = async;
+    pthread_cond_signal(&up->wake);
+    pthread_mutex_unlock(&up->lock);
+    return async;
+}
+
+/*
+ * Public functions
+ */
+
+/*
+ * Creates an uploader, with a hidden window sharing the current context, and
+ * starts its worker.
+ */
+sstUploader * sstNewUploader( void ) {
+    sstUploader *up;
+    GLFWwindow current;
+    /* Step 1: Make the worker's context. Windows have to be made on the main
+     * thread, and making one may change the current context. */
+    current = glfwGetCurrentContext();
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    up = (sstUploader*)malloc(sizeof(sstUploader));
+    up->context = glfwCreateWindow(1, 1, GLFW_WINDOWED, "SST Uploader",
+                                   current);
+    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+    glfwMakeContextCurrent(current);
+    if( up->context == NULL ) {
+        printf("ERROR: Could not create a shared context for uploads\n");
+        free(up);
+        return NULL;
+    }
+    /* Step 2: Start the worker */
+    pthread_mutex_init(&up->lock, NULL);
+    pthread_cond_init(&up->wake, NULL);
+    up->first = NULL;
+    up->last = NULL;
+    up->quit = 0;
+    up->outstanding = 0;
+    pthread_create(&up->thread, NULL, sstUploadThread, up);
+    return up;
+}
+
+/*
+ * Queues a drawable set to be made from arrays, as sstDrawableSetArrays()
+ * does.
+ */
+sstAsyncSet * sstDrawableSetArraysAsync( sstUploader *up,
+sstProgram *program, GLenum mode, int count, ... ) {
+    sstAsyncSet *async;
+    va_list ap;
+    va_start(ap, count);
+    async = sstQueueSet(up, program, mode, count, NULL, 0, 0, ap);
+    va_end(ap);
+    return async;
+}
+
+/*
+ * Queues an indexed drawable set to be made, as sstDrawableSetElements()
+ * does.
+ */
+sstAsyncSet * sstDrawableSetElementsAsync( sstUploader *up,
+sstProgram *program, GLenum mode, int count, void *indices, GLenum i_type,
+int i_count, ... ) {
+    sstAsyncSet *async;
+    va_list ap;
+    va_start(ap, i_count);
+    async = sstQueueSet(up, program, mode, count, indices, i_type, i_count,
+                        ap);
+    va_end(ap);
+    return async;
+}
+
+/*
+ * Returns the set once the worker has uploaded it and the GPU has the data,
+ * freeing the handle, or NULL if it isn't ready yet. Never waits.
+ */
+sstDrawableSet * sstAsyncSetReady( sstUploader *up, sstAsyncSet *async ) {
+    sstDrawableSet *set;
+    GLint status;
+    int done;
+    /* Step 1: Has the worker got to it? */
+    pthread_mutex_lock(&up->lock);
+    done = async->done;
+    pthread_mutex_unlock(&up->lock);
+    if( !done ) {
+        return NULL;
+    }
+    /* Step 2: Has the GPU? */
+    glGetSynciv(async->fence, GL_SYNC_STATUS, 1, NULL, &status);
+    if( status != GL_SIGNALED ) {
+        return NULL;
+    }
+    /* Step 3: Make the vertex array here, where it will be drawn */
+    glDeleteSync(async->fence);
+    set = async->set;
+    sstBindDrawableSet(set);
+    free(async);
+    up->outstanding--;
+    return set;
+}
+
+/*
+ * Lets the worker upload every queued set, then stops it and destroys its
+ * context.
+ */
+void sstFreeUploader( sstUploader *up ) {
+    if( up->outstanding ) {
+        printf("WARN: Freeing an uploader with %d sets not collected\n",
+               up->outstanding);
+    }
+    pthread_mutex_lock(&up->lock);
+    up->quit = 1;
+    pthread_cond_signal(&up->wake);
+    pthread_mutex_unlock(&up->lock);
+    pthread_join(up->thread, NULL);
+    pthread_mutex_destroy(&up->lock);
+    pthread_cond_destroy(&up->wake);
+    glfwDestroyWindow(up->context);
+    free(up);
+}